@@ -522,6 +522,7 @@ public:
     CToolTipCtrl tooltips;
 
     double maxRate = 0;
+    Array<StatsHistory::Bucket> history;
     int stat = -1;
     int lastStat = -1;
 
@@ -674,6 +675,12 @@ public:
 
             dc.GradientFillRect(*CRect(l, t, r, b), CRef(ca), CRef(cb), TRUE);
 
+            // RMS as a darker bar in the middle
+            float vr = VUToScreen(Clamp(stats.VURms[ch], 0.0f, 1.0f));
+            int rr = area.left + int(vr * area.Width() + 1);
+            int h3 = (b - t) / 3;
+            dc.GradientFillRect(*CRect(l, t + h3, rr, b - h3), CRef(ca * 0.6f), CRef(Lerp(vr, ca, Vec3(1, 0.5, 0)) * 0.6f), TRUE);
+
             int px = area.left + int(VUToScreen(stats.VUPeak[ch]) * area.Width() + 1);
             dc.Rectangle(px - 1, t, px + 1, b);
         }
@@ -791,11 +798,15 @@ public:
             CaptureStats stats = Capture->GetStats();
             stat = stats.Recording ? 1 : 0;
 
-            // FPS graph    
+            // only fetch as many frames as the graphs can show
             CRect graph(area.left, area.top, area.right, area.top + 62);
-            PaintGraph(dc, WithDpi(graph), Vec3(0, 0.5, 0), "FPS", "%.2f", stats.Frames.Len(), stats.FPS, -1, [&](int i)
+            history.SetSize(WithDpi(graph).Width());
+            uint points = Capture->GetHistory(StatsHistory::Level::Frame, history);
+
+            // FPS graph    
+            PaintGraph(dc, WithDpi(graph), Vec3(0, 0.5, 0), "FPS", "%.2f", points, stats.FPS, -1, [&](int i)
                 {
-                    return stats.Frames[i].FPS;
+                    return history[i].Avg.FPS;
                 });
 
             while (stats.MaxBitrate < (maxRate - 5000))
@@ -805,9 +816,9 @@ public:
 
             // Bitrate graph
             graph.OffsetRect(0, 70);
-            PaintGraph(dc, WithDpi(graph), Vec3(0.0, 0, 0.5), "Bit rate", "%.0f kbits/s", stats.Frames.Len(), maxRate, stats.AvgBitrate, [&](int i)
+            PaintGraph(dc, WithDpi(graph), Vec3(0.0, 0, 0.5), "Bit rate", "%.0f kbits/s", points, maxRate, stats.AvgBitrate, [&](int i)
                 {
-                    return stats.Frames[i].Bitrate;
+                    return history[i].Avg.Bitrate;
                 });
 
             // VU meter
@@ -815,19 +826,61 @@ public:
             if (Config.CaptureAudio)
                 PaintVU(dc, WithDpi(vumeter), stats);
 
-            // info
+            // info. Formatted on the stack, this runs on every stats update
             CRect line(area.left, vumeter.bottom + 20 + 40, area.right, area.bottom);
             int lw = 80;
-            PaintText(dc, "Current file", stats.Filename, line, lw);
+            char text[512];
+            if (Config.ReplayMode)
+            {
+                FormatTo(text, "%.1f s, %.0f MB, %d saved (Win+F10)", stats.ReplaySeconds, stats.ReplayBytes / 1048576., stats.ReplaysSaved);
+                PaintText(dc, "Replay buffer", text, line, lw);
+            }
+            else if (Config.SegmentMinutes || Config.SegmentMB)
+            {
+                FormatTo(text, "%s, part %d", (const char*)stats.Filename, stats.Segment + 1);
+                PaintText(dc, "Current file", text, line, lw);
+            }
+            else
+                PaintText(dc, "Current file", stats.Filename, line, lw);
 
-            PaintText(dc, "Resolution", String::PrintF("%dx%d @ %.4g fps, %s%s", stats.SizeX, stats.SizeY, stats.FPS, stats.HDR ? " HDR " : "", formats[(int)stats.Fmt]), line, lw);
+            FormatTo(text, "%dx%d @ %.4g fps, %s%s", stats.SizeX, stats.SizeY, stats.FPS, stats.HDR ? " HDR " : "", formats[(int)stats.Fmt]);
+            PaintText(dc, "Resolution", text, line, lw);
 
             int s = (int)stats.Time;
             int m = s / 60; s = s % 60;
             int h = m / 60; m = m % 60;
-            PaintText(dc, "Length", String::PrintF("%d:%02d:%02d", h, m, s), line, lw);
+            FormatTo(text, "%d:%02d:%02d", h, m, s);
+            PaintText(dc, "Length", text, line, lw);
+
+            FormatTo(text, "avg %d, max %d kbits/s", (int)stats.AvgBitrate, (int)stats.MaxBitrate);
+            PaintText(dc, "Bitrate", text, line, lw);
 
-            PaintText(dc, "Bitrate", String::PrintF("avg %d, max %d kbits/s", (int)stats.AvgBitrate, (int)stats.MaxBitrate), line, lw);
+            FormatTo(text, "%.1f%% of the screen per frame", 100 * stats.ConvertedTiles);
+            PaintText(dc, "Converted", text, line, lw);
+
+            FormatTo(text, "%.1f fps avg, %d repeated, %d held, %d static", stats.Time > 0 ? stats.FramesEncoded / stats.Time : 0, stats.FramesDuplicated, stats.FramesHeld, stats.FramesStatic);
+            PaintText(dc, "Encoded", text, line, lw);
+
+            FormatTo(text, "%.1f%% reused, %.1f kB copied per frame", 100 * stats.PacketPoolHitRate, stats.BytesCopiedPerFrame / 1024);
+            PaintText(dc, "Packet pool", text, line, lw);
+
+            FormatTo(text, "%.0f MB/s, queue %d (max %d), %d stalls", stats.WriteRate, stats.WriteQueue, stats.WriteQueueMax, stats.WriteStalls);
+            PaintText(dc, "Disk", text, line, lw);
+
+            if (Config.CaptureAudio)
+            {
+                FormatTo(text, "%d overruns, %d underruns", stats.AudioOverruns, stats.AudioUnderruns);
+                PaintText(dc, "Audio buffer", text, line, lw);
+            }
+
+            // per stage latency
+            static const char* const stages[] = { "Convert", "Submit", "Encode", "Mux", "Drain", "Total latency" };
+            for (int i = 0; i < (int)CaptureStats::Stage::Count; i++)
+            {
+                auto& lat = stats.Latencies[i];
+                FormatTo(text, "p50 %.2f, p99 %.2f, max %.2f ms", lat.P50, lat.P99, lat.Max);
+                PaintText(dc, stages[i], text, line, lw);
+            }
         }
 
         int d10 = WithDpi(10);
@@ -923,6 +976,10 @@ public:
         {
         case 1:
             return OnSetCapture(0, Capture ? 0 : 1, 0, bHandled);
+        case 2:
+            if (Capture)
+                Capture->SaveReplay();
+            return 0;
         }
         return 0;
     }
@@ -978,7 +1035,7 @@ static int Run(LPTSTR /*lpstrCmdLine*/ = NULL, int nCmdShow = SW_SHOWDEFAULT)
     MainFrame wndMain;
 
     DPI = GetDpiForSystem();
-    RECT winRect = { .left = CW_USEDEFAULT , .top = CW_USEDEFAULT, .right = CW_USEDEFAULT + WithDpi(420), .bottom = CW_USEDEFAULT + WithDpi(420) };
+    RECT winRect = { .left = CW_USEDEFAULT , .top = CW_USEDEFAULT, .right = CW_USEDEFAULT + WithDpi(420), .bottom = CW_USEDEFAULT + WithDpi(600) };
 
     if (wndMain.CreateEx(0, &winRect, WS_DLGFRAME | WS_SYSMENU | WS_MINIMIZEBOX) == NULL)
     {
@@ -989,6 +1046,8 @@ static int Run(LPTSTR /*lpstrCmdLine*/ = NULL, int nCmdShow = SW_SHOWDEFAULT)
     wndMain.ShowWindow(nCmdShow);
 
     auto hr = RegisterHotKey(wndMain, 1, MOD_WIN | MOD_NOREPEAT, VK_F9);
+    if (Config.ReplayMode)
+        RegisterHotKey(wndMain, 2, MOD_WIN | MOD_NOREPEAT, VK_F10);
 
     int nRet = theLoop.Run();
 
@@ -0,0 +1,117 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include "annexb.h"
+
+#include <string.h>
+
+// finds the next 00 00 01 at or after p, or returns end. memchr for the 01 does
+// the heavy lifting, encoded data rarely has one
+static const uint8* FindStartCode(const uint8* p, const uint8* end)
+{
+    const uint8* q = p + 2;
+    while (q < end)
+    {
+        q = (const uint8*)memchr(q, 1, end - q);
+        if (!q)
+            return end;
+        if (!q[-1] && !q[-2])
+            return q - 2;
+
+        // the 01 of the next start code can't be less than 3 bytes away
+        q += 3;
+    }
+    return end;
+}
+
+bool NalScanner::Next(NalUnit& nal)
+{
+    const uint headerSize = Codec == NalCodec::H264 ? 1 : 2;
+    for (;;)
+    {
+        const uint8* start = FindStartCode(Pos, End);
+        if (End - start < 3 + headerSize)
+            break;
+
+        const uint8* data = start + 3;
+        Pos = data;
+
+        // no NAL header starts with 00 00 (or 00 for H.264), so these are trailing
+        // zeros or part of a 4 byte start code
+        if (!data[0] && (Codec == NalCodec::H264 || !data[1]))
+            continue;
+
+        nal.Data = data;
+        nal.Size = 0;
+        nal.Type = Codec == NalCodec::H264 ? (data[0] & 0x1f) : ((data[0] >> 1) & 0x3f);
+        return true;
+    }
+
+    Pos = End;
+    return false;
+}
+
+void NalScanner::FindEnd(NalUnit& nal)
+{
+    Pos = FindStartCode(nal.Data, End);
+
+    // NAL units never end in a zero byte, so these are trailing zeros or
+    // part of a 4 byte start code
+    const uint8* end = Pos;
+    while (end > nal.Data + 1 && !end[-1])
+        end--;
+    nal.Size = (uint)(end - nal.Data);
+}
+
+static bool IsSlice(NalCodec codec, uint type)
+{
+    return codec == NalCodec::H264 ? (type >= 1 && type <= 5) : (type < 32);
+}
+
+static bool IsKeySlice(NalCodec codec, uint type)
+{
+    // HEVC: BLA, IDR and CRA are all random access points
+    return codec == NalCodec::H264 ? (type == 5) : (type >= 16 && type <= 23);
+}
+
+static bool IsParameterSet(NalCodec codec, uint type)
+{
+    return codec == NalCodec::H264 ? (type == 7 || type == 8) : (type >= 32 && type <= 34);
+}
+
+NalPacketInfo ParsePacket(NalCodec codec, const uint8* data, uint size)
+{
+    NalPacketInfo info = {};
+    NalScanner scan(codec, data, size);
+    NalUnit nal;
+    while (scan.Next(nal))
+    {
+        if (IsParameterSet(codec, nal.Type))
+            info.HasParameterSets = true;
+        else if (IsSlice(codec, nal.Type))
+        {
+            info.IsKeyframe = IsKeySlice(codec, nal.Type);
+            break;
+        }
+    }
+    return info;
+}
+
+void ExtractParameterSets(NalCodec codec, const uint8* data, uint size, Array<uint8>& out)
+{
+    static const uint8 startCode[] = { 0, 0, 0, 1 };
+
+    NalScanner scan(codec, data, size);
+    NalUnit nal;
+    while (scan.Next(nal) && !IsSlice(codec, nal.Type))
+    {
+        if (IsParameterSet(codec, nal.Type))
+        {
+            scan.FindEnd(nal);
+            out += ReadOnlySpan<uint8>(startCode);
+            out += ReadOnlySpan<uint8>(nal.Data, nal.Size);
+        }
+    }
+}
@@ -0,0 +1,50 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#pragma once
+
+#include "types.h"
+
+// Helpers for H.264/HEVC Annex-B byte streams, aka NAL units separated by
+// 00 00 01 start codes - what NVENC, x264 and x265 spit out
+
+enum class NalCodec { H264, HEVC };
+
+struct NalUnit
+{
+    const uint8* Data;  // NAL header onwards, without start code
+    uint Size;          // 0 until NalScanner::FindEnd()
+    uint Type;
+};
+
+class NalScanner
+{
+public:
+    NalScanner(NalCodec codec, const uint8* data, uint size) : Codec(codec), Pos(data), End(data + size) {}
+
+    // next NAL unit in the buffer, false if there are no more. Only reads the
+    // header, so stopping at a slice doesn't mean scanning through all of it
+    bool Next(NalUnit& nal);
+
+    // finds the end of the unit the last Next() returned, and sets its size
+    void FindEnd(NalUnit& nal);
+
+private:
+    NalCodec Codec;
+    const uint8* Pos;
+    const uint8* End;
+};
+
+struct NalPacketInfo
+{
+    bool IsKeyframe;        // starts with an IDR (H.264) or IRAP (HEVC) picture
+    bool HasParameterSets;
+};
+
+// looks at the NAL units up to the first picture slice
+NalPacketInfo ParsePacket(NalCodec codec, const uint8* data, uint size);
+
+// appends the VPS/SPS/PPS in front of the first slice to out, each with a 4 byte start code
+void ExtractParameterSets(NalCodec codec, const uint8* data, uint size, Array<uint8>& out);
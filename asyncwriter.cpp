@@ -0,0 +1,218 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include "asyncwriter.h"
+
+#include <new>
+#include <string.h>
+
+// buffers for unbuffered files need to be block aligned
+static uint8* AllocBlocks(size_t size) { return (uint8*)::operator new[](size, std::align_val_t(FileBlockSize)); }
+static void FreeBlocks(uint8* mem) { ::operator delete[](mem, std::align_val_t(FileBlockSize)); }
+static uint64 AlignUp(uint64 v) { return (v + FileBlockSize - 1) & ~(uint64)(FileBlockSize - 1); }
+
+AsyncFileWriter::AsyncFileWriter(const char* path, const Para& para) : Config(para), Path(path)
+{
+    Config.BufferSize = (uint)AlignUp(Max(Config.BufferSize, FileBlockSize));
+    Config.BufferCount = Clamp(Config.BufferCount, 2u, 32u);
+
+    File = OpenFile(path, Config.Unbuffered ? OpenFileMode::CreateUnbuffered : OpenFileMode::Create);
+
+    for (uint i = 0; i < Config.BufferCount; i++)
+        Buffers += AllocBlocks(Config.BufferSize);
+
+    Current = Buffers[0];
+    for (uint i = 1; i < Config.BufferCount; i++)
+        FreeBuffers.Enqueue(Buffers[i]);
+
+    WriteThread = new Thread(Bind(this, &AsyncFileWriter::WriteThreadFunc));
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+    if (Fill)
+        SubmitCurrent();
+
+    // the thread works off the queue before it exits
+    delete WriteThread;
+
+    if (!File->SetLength(Size))
+        DPrintF("could not set length of %s\n", (const char*)Path);
+    delete File;
+
+    for (uint8* mem : Buffers)
+        FreeBlocks(mem);
+}
+
+void AsyncFileWriter::Write(const void* ptr, uint64 len)
+{
+    auto src = (const uint8*)ptr;
+    while (len)
+    {
+        if (Position < CurrentOffset)
+        {
+            // already on its way to the disk, so patch it there
+            uint n = (uint)Min<uint64>(len, Min<uint64>(CurrentOffset - Position, Config.BufferSize));
+            uint8* mem = new uint8[n];
+            memcpy(mem, src, n);
+            Queue({ .Mem = mem, .Offset = Position, .Size = n, .Patch = true });
+            Position += n;
+            src += n;
+            len -= n;
+            Size = Max(Size, Position);
+            continue;
+        }
+
+        uint64 offs = Position - CurrentOffset;
+        if (offs >= Config.BufferSize)
+        {
+            // seeked past the current buffer
+            memset(Current + Fill, 0, Config.BufferSize - Fill);
+            Fill = Config.BufferSize;
+            SubmitCurrent();
+            continue;
+        }
+
+        if (offs > Fill)
+            memset(Current + Fill, 0, offs - Fill);
+
+        uint n = (uint)Min<uint64>(len, Config.BufferSize - offs);
+        memcpy(Current + offs, src, n);
+        Fill = Max(Fill, (uint)offs + n);
+        Position += n;
+        src += n;
+        len -= n;
+        Size = Max(Size, Position);
+
+        if (offs + n == Config.BufferSize)
+            SubmitCurrent();
+    }
+}
+
+uint64 AsyncFileWriter::Seek(uint64 pos)
+{
+    Position = pos;
+    return Position;
+}
+
+AsyncFileWriter::Stats AsyncFileWriter::GetStats() const
+{
+    return Stats
+    {
+        .QueueDepth = (uint)Jobs.Len(),
+        .MaxQueueDepth = MaxQueueDepth,
+        .Stalls = Stalls,
+        .BytesWritten = BytesWritten,
+        .WriteTime = (double)WriteTicks / GetTicksPerSecond(),
+    };
+}
+
+void AsyncFileWriter::Queue(const Job& job)
+{
+    while (!Jobs.Enqueue(job))
+        Thread::Sleep(1);
+    JobEvent.Fire();
+    MaxQueueDepth = Max(MaxQueueDepth, (uint)Jobs.Len());
+}
+
+void AsyncFileWriter::SubmitCurrent()
+{
+    Queue({ .Mem = Current, .Offset = CurrentOffset, .Size = Fill, .Patch = false });
+    CurrentOffset += Config.BufferSize;
+    Fill = 0;
+
+    // all buffers in flight: now we have to wait for the disk
+    if (!FreeBuffers.Dequeue(Current))
+    {
+        Stalls++;
+        while (!FreeBuffers.Dequeue(Current))
+            FreeEvent.Wait(10);
+    }
+}
+
+void AsyncFileWriter::WriteAt(uint64 offset, const uint8* ptr, uint64 len)
+{
+    int64 start = GetTicks();
+
+    File->Seek((int64)offset, Stream::From::Start);
+    for (uint64 done = 0; done < len; )
+    {
+        uint64 written = File->Write(ptr + done, len - done);
+        if (!written)
+            Fatal("could not write to %s\n", (const char*)Path);
+        done += written;
+    }
+
+    WriteTicks += GetTicks() - start;
+    BytesWritten += len;
+}
+
+void AsyncFileWriter::Patch(const Job& job)
+{
+    if (!Config.Unbuffered)
+    {
+        WriteAt(job.Offset, job.Mem, job.Size);
+        return;
+    }
+
+    // read-modify-write the blocks it touches. They're all completely written,
+    // as everything before CurrentOffset was queued before the patch.
+    uint64 start = job.Offset & ~(uint64)(FileBlockSize - 1);
+    uint size = (uint)(AlignUp(job.Offset + job.Size) - start);
+    uint8* mem = AllocBlocks(size);
+
+    File->Seek((int64)start, Stream::From::Start);
+    if (File->Read(mem, size) != size)
+        Fatal("could not read back %s\n", (const char*)Path);
+
+    memcpy(mem + (job.Offset - start), job.Mem, job.Size);
+    WriteAt(start, mem, size);
+    FreeBlocks(mem);
+}
+
+void AsyncFileWriter::WriteThreadFunc(Thread& thread)
+{
+    if (Config.Preallocate && !File->Reserve(Config.Preallocate))
+        DPrintF("could not preallocate %s\n", (const char*)Path);
+
+    for (;;)
+    {
+        Job job;
+        if (!Jobs.Dequeue(job))
+        {
+            // the destructor queues the last buffer before stopping us
+            if (!thread.IsRunning())
+            {
+                if (Jobs.IsEmpty())
+                    break;
+                continue;
+            }
+            JobEvent.Wait(10);
+            continue;
+        }
+
+        if (job.Patch)
+        {
+            Patch(job);
+            delete[] job.Mem;
+            continue;
+        }
+
+        // the last buffer of an unbuffered file gets padded to full blocks, the
+        // destructor cuts the file back to size
+        uint size = job.Size;
+        if (Config.Unbuffered)
+        {
+            uint aligned = (uint)AlignUp(size);
+            memset(job.Mem + size, 0, aligned - size);
+            size = aligned;
+        }
+
+        WriteAt(job.Offset, job.Mem, size);
+
+        FreeBuffers.Enqueue(job.Mem);
+        FreeEvent.Fire();
+    }
+}
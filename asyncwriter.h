@@ -0,0 +1,90 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#pragma once
+
+#include "types.h"
+#include "system.h"
+
+// Write-behind file. Write() only copies into one of a few big buffers, and a
+// background thread puts full buffers on the disk, so a slow drive only stalls
+// the caller once all buffers are waiting to be written.
+// Seeking back and overwriting (like muxers do to patch headers) works, but
+// anything that already left for the disk gets patched one by one, so keep it rare.
+// Only one thread may call Write()/Seek().
+class AsyncFileWriter
+{
+public:
+    struct Para
+    {
+        uint BufferSize = 8 << 20;  // rounded up to FileBlockSize
+        uint BufferCount = 3;
+        bool Unbuffered = false;    // bypass the OS file cache
+        uint64 Preallocate = 0;     // bytes to reserve on disk up front
+    };
+
+    struct Stats
+    {
+        uint QueueDepth;        // buffers waiting for the disk
+        uint MaxQueueDepth;
+        uint Stalls;            // times Write() had to wait for a free buffer
+        uint64 BytesWritten;    // actually on disk
+        double WriteTime;       // seconds spent in disk writes
+    };
+
+    AsyncFileWriter(const char* path, const Para& para);
+
+    // writes everything that's left, waits for it and trims the file to Length()
+    ~AsyncFileWriter();
+
+    void Write(const void* ptr, uint64 len);
+
+    // seeking past the end fills the gap with zeros on the next write
+    uint64 Seek(uint64 pos);
+
+    uint64 Pos() const { return Position; }
+    uint64 Length() const { return Size; }
+
+    Stats GetStats() const;
+
+private:
+    struct Job
+    {
+        uint8* Mem;         // one of the buffers, or patch data
+        uint64 Offset;
+        uint Size;
+        bool Patch;
+    };
+
+    Para Config;
+    String Path;
+    Stream* File = nullptr;
+
+    Array<uint8*> Buffers;
+    SpscQueue<Job, 64> Jobs;
+    SpscQueue<uint8*, 64> FreeBuffers;
+    ThreadEvent JobEvent;
+    ThreadEvent FreeEvent;
+    Thread* WriteThread = nullptr;
+
+    // writer side, only ever read from elsewhere
+    std::atomic<uint64> BytesWritten = 0;
+    std::atomic<int64> WriteTicks = 0;
+
+    // caller side
+    uint8* Current = nullptr;
+    uint64 CurrentOffset = 0;   // file position of Current, always block aligned
+    uint Fill = 0;
+    uint64 Position = 0;
+    uint64 Size = 0;
+    uint MaxQueueDepth = 0;
+    uint Stalls = 0;
+
+    void Queue(const Job& job);
+    void SubmitCurrent();
+    void WriteAt(uint64 offset, const uint8* ptr, uint64 len);
+    void Patch(const Job& job);
+    void WriteThreadFunc(Thread& thread);
+};
@@ -5,6 +5,7 @@
 
 #pragma once
 #include "types.h"
+#include "audioring.h"
 
 struct CaptureConfig;
 
@@ -34,10 +35,15 @@ public:
 
     virtual void JumpToTime(double time) = 0;
     virtual void Flush() = 0;
+
+    virtual AudioRingStats GetRingStats() const = 0;
 };
 
 void InitAudioCapture();
 
 void GetAudioDevices(Array<String> &into);
 
-IAudioCapture *CreateAudioCaptureWASAPI(const CaptureConfig &config);
\ No newline at end of file
+IAudioCapture *CreateAudioCaptureWASAPI(const CaptureConfig &config);
+
+// F32 sines in real time, see audiocapture_synthetic.cpp
+IAudioCapture *CreateAudioCaptureSynthetic(uint sampleRate, uint channels);
\ No newline at end of file
@@ -0,0 +1,78 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include "system.h"
+#include "audiocapture.h"
+
+#include <math.h>
+
+// Synthetic audio: a sine per channel in F32, written into the ring in 10ms
+// chunks at the rate a device would deliver them, with the same kind of time
+// stamps. For measuring the pipeline with audio but without a sound card
+class AudioCapture_Synthetic : public IAudioCapture
+{
+    AudioInfo Info = {};
+    AudioRing Ring;
+    Array<float> Chunk;
+    Thread* CaptureThread = nullptr;
+
+    void CaptureThreadFunc(Thread& thread)
+    {
+        const uint chunkSamples = (uint)(Chunk.Len() / Info.Channels);
+        const double tickRate = (double)GetTicksPerSecond();
+        const int64 start = GetTicks();
+        uint64 written = 0;
+
+        while (thread.Wait(5))
+        {
+            uint64 due = (uint64)((double)(GetTicks() - start) / tickRate * Info.SampleRate);
+            while (written + chunkSamples <= due)
+            {
+                double time = (double)start / tickRate + (double)written / Info.SampleRate;
+                Ring.Write((const uint8*)Chunk.Ptr(), Chunk.Len() * sizeof(float), time);
+                written += chunkSamples;
+            }
+        }
+    }
+
+public:
+    AudioCapture_Synthetic(uint sampleRate, uint channels)
+    {
+        Info = AudioInfo
+        {
+            .Format = AudioFormat::F32,
+            .Channels = channels,
+            .SampleRate = sampleRate,
+            .BytesPerSample = (uint)(channels * sizeof(float)),
+        };
+
+        // 10ms of 1kHz always ends on a full period for the usual rates, so the
+        // same chunk can just be repeated
+        uint samples = Max(sampleRate / 100, 1u);
+        Chunk.SetSize((size_t)samples * channels);
+        for (uint i = 0; i < samples; i++)
+            for (uint c = 0; c < channels; c++)
+                Chunk[(size_t)i * channels + c] = 0.25f * sinf(6.2831853f * 1000.0f * i / sampleRate);
+
+        Ring.Init((uint64)Info.BytesPerSample * sampleRate, Info.BytesPerSample * sampleRate, Info.BytesPerSample);
+        CaptureThread = new Thread(Bind(this, &AudioCapture_Synthetic::CaptureThreadFunc));
+    }
+
+    ~AudioCapture_Synthetic()
+    {
+        delete CaptureThread;
+    }
+
+    AudioInfo GetInfo() const override { return Info; }
+    uint Read(uint8* dest, uint size, double& time) override { return Ring.Read(dest, size, time); }
+    void JumpToTime(double time) override { Ring.JumpToTime(time); }
+    void Flush() override { Ring.Flush(); }
+    AudioRingStats GetRingStats() const override { return Ring.GetStats(); }
+};
+
+IAudioCapture* CreateAudioCaptureSynthetic(uint sampleRate, uint channels)
+{
+    return new AudioCapture_Synthetic(sampleRate, channels);
+}
@@ -38,13 +38,7 @@ class AudioCapture_WASAPI : public IAudioCapture
 
     Thread* CaptureThread = nullptr;
 
-    uint8* Ring = nullptr;
-    uint RingSize = 0;
-    uint RingRead = 0;
-    uint RingWrite = 0;
-    uint RingTimePos = 0;
-    double RingTimeValue = 0;
-    ThreadLock RingLock;
+    AudioRing Ring;
 
     uint BytesPerSample = 0;
     AudioInfo Info = {};
@@ -67,38 +61,7 @@ class AudioCapture_WASAPI : public IAudioCapture
                 double time = (double)qpctime / REFPERSEC;
 
                 uint bytes = samples * BytesPerSample;
-                uint pos;
-                {
-                    ScopeLock lock(RingLock);
-                    uint avail = RingSize - (RingWrite - RingRead);
-                    if (bytes > avail)
-                        RingRead += bytes-avail;
-
-                    RingTimePos = RingWrite;
-                    RingTimeValue = time;
-
-                    pos = RingWrite % RingSize;
-                    RingWrite += bytes;
-
-                    if (RingRead > RingSize)
-                    {
-                        RingWrite -= RingSize;
-                        RingRead -= RingSize;
-                        RingTimePos -= RingSize;
-                    }
-                }
-
-                uint chunk1 = Min(bytes, RingSize - pos);
-                if (flags & AUDCLNT_BUFFERFLAGS_SILENT)
-                {
-                    memset(Ring + pos, 0, chunk1);
-                    memset(Ring, 0, bytes - chunk1);
-                }
-                else
-                {
-                    memcpy(Ring + pos, data, chunk1);
-                    memcpy(Ring, data + chunk1, bytes - chunk1);
-                }
+                Ring.Write((flags & AUDCLNT_BUFFERFLAGS_SILENT) ? nullptr : data, bytes, time);
 
                 CHECK(CaptureClient->ReleaseBuffer(samples));
                 CHECK(CaptureClient->GetNextPacketSize(&packetSize));
@@ -139,8 +102,9 @@ public:
         ASSERT(Format->Format.wFormatTag == WAVE_FORMAT_EXTENSIBLE && Format->SubFormat == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT);
         
         BytesPerSample = Format->Format.nChannels * Format->Format.wBitsPerSample / 8;
-        RingSize = Format->Format.nSamplesPerSec * BytesPerSample; // 1 second for now
-        Ring = new uint8[RingSize];
+        uint bytesPerSec = Format->Format.nSamplesPerSec * BytesPerSample;
+        uint bufferMs = Clamp(cfg.AudioBufferMs, 100u, 10000u);
+        Ring.Init((uint64)bytesPerSec * bufferMs / 1000, bytesPerSec, BytesPerSample);
 
         CHECK(Client->Initialize(AUDCLNT_SHAREMODE_SHARED, AUDCLNT_STREAMFLAGS_LOOPBACK, duration, 0, (WAVEFORMATEX*)Format, NULL));
         CHECK(Client->GetBufferSize(&BufferSize));
@@ -161,8 +125,6 @@ public:
         Client.Clear();
         PlaybackClient.Clear();
 
-        delete[] Ring;
-
         CoTaskMemFree(Format);
         CoUninitialize();
     }
@@ -180,32 +142,22 @@ public:
 
     uint Read(uint8* dest, uint size, double &time) override
     {
-        ScopeLock lock(RingLock);
-        time = RingTimeValue + ((double)RingRead - RingTimePos) / (double)(BytesPerSample * Format->Format.nSamplesPerSec);
-
-        size = Min(size, RingWrite - RingRead);
-        uint pos = RingRead % RingSize;
-        uint chunk1 = Min(size, RingSize - pos);
-        memcpy(dest, Ring + pos, chunk1);
-        memcpy(dest + chunk1, Ring, size - chunk1);
-        RingRead += size;
-
-        return size;
+        return Ring.Read(dest, size, time);
     }
 
     void JumpToTime(double time) override
     {
-        ScopeLock lock(RingLock);
-        int deltasamples = (int)round((time - RingTimeValue) * Format->Format.nSamplesPerSec);
-        int destpos = RingTimePos + deltasamples * BytesPerSample;
-        //ASSERT(destpos >= (int)RingRead && destpos < (int)RingWrite);
-        RingRead = (uint)Clamp<int>(destpos, RingRead, RingWrite);
+        Ring.JumpToTime(time);
     }
 
     void Flush() override
     {
-        ScopeLock lock(RingLock);
-        RingRead = RingWrite;
+        Ring.Flush();
+    }
+
+    AudioRingStats GetRingStats() const override
+    {
+        return Ring.GetStats();
     }
 };
 
@@ -0,0 +1,153 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include "audiometer.h"
+
+#include <math.h>
+#include <string.h>
+#include <emmintrin.h>
+
+// SSE2 is always there on x64, so no dispatching needed
+
+// ITU-R BS.1770-4 Annex 2 interpolation filter, 4 phases of 12 taps
+static const float TruePeakPhases[4][12] =
+{
+    {  0.0017089843750f,  0.0109863281250f, -0.0196533203125f,  0.0332031250000f, -0.0594482421875f,  0.1373291015625f,
+       0.9721679687500f, -0.1022949218750f,  0.0476074218750f, -0.0266113281250f,  0.0148925781250f, -0.0083007812500f },
+    { -0.0291748046875f,  0.0292968750000f, -0.0517578125000f,  0.0891113281250f, -0.1665039062500f,  0.4650878906250f,
+       0.7797851562500f, -0.2003173828125f,  0.1015625000000f, -0.0582275390625f,  0.0330810546875f, -0.0189208984375f },
+    { -0.0189208984375f,  0.0330810546875f, -0.0582275390625f,  0.1015625000000f, -0.2003173828125f,  0.7797851562500f,
+       0.4650878906250f, -0.1665039062500f,  0.0891113281250f, -0.0517578125000f,  0.0292968750000f, -0.0291748046875f },
+    { -0.0083007812500f,  0.0148925781250f, -0.0266113281250f,  0.0476074218750f, -0.1022949218750f,  0.9721679687500f,
+       0.1373291015625f, -0.0594482421875f,  0.0332031250000f, -0.0196533203125f,  0.0109863281250f,  0.0017089843750f },
+};
+
+static inline float ToFloat(float v) { return v; }
+static inline float ToFloat(int16 v) { return v * (1.0f / 32768.0f); }
+
+static inline __m128 Load4(const float* p) { return _mm_loadu_ps(p); }
+
+static inline __m128 Load4(const int16* p)
+{
+    __m128i v = _mm_loadl_epi64((const __m128i*)p);
+    v = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    return _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(1.0f / 32768.0f));
+}
+
+static inline __m128 Abs(__m128 v) { return _mm_and_ps(v, _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff))); }
+
+AudioMeter::AudioMeter(const Para& para) : Config(para)
+{
+    ASSERT(Config.Channels >= 1 && Config.Channels <= MaxChannels);
+    ASSERT(Config.Format == AudioFormat::F32 || Config.Format == AudioFormat::I16);
+
+    // smallest multiple of 4 that's also a multiple of the channel count
+    uint ch = Config.Channels;
+    Lanes = !(ch % 4) ? ch : !(ch % 2) ? 2 * ch : 4 * ch;
+    StepFrames = Lanes / ch;
+    StepDecay = powf(Config.Decay, (float)StepFrames);
+
+    for (uint k = 0; k < Taps; k++)
+        for (uint p = 0; p < 4; p++)
+            TpCoefs[k][p] = TruePeakPhases[p][Taps - 1 - k];
+
+    Reset();
+}
+
+void AudioMeter::Reset()
+{
+    memset(LanePeak, 0, sizeof(LanePeak));
+    memset(LaneSum, 0, sizeof(LaneSum));
+    memset(Peak, 0, sizeof(Peak));
+    memset(MeanSquare, 0, sizeof(MeanSquare));
+    memset(History, 0, sizeof(History));
+    memset(TPeak, 0, sizeof(TPeak));
+    HistPos = 0;
+}
+
+void AudioMeter::Process(const uint8* data, uint size)
+{
+    uint frameSize = Config.Channels * (Config.Format == AudioFormat::F32 ? 4 : 2);
+    uint frames = size / frameSize;
+    if (!frames)
+        return;
+
+    if (Config.Format == AudioFormat::F32)
+        Run((const float*)data, frames);
+    else
+        Run((const int16*)data, frames);
+}
+
+template<typename T> void AudioMeter::Run(const T* src, uint frames)
+{
+    const uint ch = Config.Channels;
+    const uint vecs = Lanes / 4;
+    const __m128 decay = _mm_set1_ps(StepDecay);
+    const T* tpSrc = src;
+
+    // whole steps: each lane gets one sample per step
+    uint steps = frames / StepFrames;
+    for (uint s = 0; s < steps; s++, src += Lanes)
+    {
+        for (uint v = 0; v < vecs; v++)
+        {
+            __m128 x = Load4(src + 4 * v);
+            __m128 peak = _mm_mul_ps(_mm_load_ps(LanePeak + 4 * v), decay);
+            _mm_store_ps(LanePeak + 4 * v, _mm_max_ps(Abs(x), peak));
+            _mm_store_ps(LaneSum + 4 * v, _mm_add_ps(_mm_load_ps(LaneSum + 4 * v), _mm_mul_ps(x, x)));
+        }
+    }
+
+    // leftover frames go into the lanes they'd have landed in
+    for (uint l = 0; l < (frames - steps * StepFrames) * ch; l++)
+    {
+        float x = ToFloat(src[l]);
+        LanePeak[l] = Max(fabsf(x), LanePeak[l] * StepDecay);
+        LaneSum[l] += x * x;
+    }
+
+    // collect lanes into channels
+    float sum[MaxChannels] = {};
+    for (uint c = 0; c < ch; c++)
+        Peak[c] = 0;
+    for (uint l = 0; l < Lanes; l++)
+    {
+        Peak[l % ch] = Max(Peak[l % ch], LanePeak[l]);
+        sum[l % ch] += LaneSum[l];
+        LaneSum[l] = 0;
+    }
+
+    float a = 1.0f - expf(-(float)frames / (Config.RmsTime * Config.SampleRate));
+    for (uint c = 0; c < ch; c++)
+        MeanSquare[c] += a * (sum[c] / frames - MeanSquare[c]);
+
+    if (Config.TruePeak)
+    {
+        for (uint f = 0; f < frames; f++)
+        {
+            for (uint c = 0; c < ch; c++)
+                TruePeakSample(c, ToFloat(*tpSrc++));
+            HistPos = (HistPos + 1) % Taps;
+        }
+    }
+}
+
+void AudioMeter::TruePeakSample(uint ch, float x)
+{
+    float* hist = History[ch];
+    hist[HistPos] = hist[HistPos + Taps] = x;
+
+    // all four phases at once, newest sample last
+    const float* window = hist + HistPos + 1;
+    __m128 acc = _mm_setzero_ps();
+    for (uint k = 0; k < Taps; k++)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(window[k]), _mm_load_ps(TpCoefs[k])));
+
+    acc = Abs(acc);
+    acc = _mm_max_ps(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_max_ps(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    TPeak[ch] = Max(_mm_cvtss_f32(acc), TPeak[ch] * Config.Decay);
+}
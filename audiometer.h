@@ -0,0 +1,71 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#pragma once
+
+#include "types.h"
+#include "audiocapture.h"
+
+// Level meter for interleaved F32 or I16 audio: peak with decay, RMS and
+// optionally the true peak (4x oversampled with the BS.1770 interpolation filter).
+// Peak and RMS work on all channels at once with SSE, four samples per op no
+// matter how many channels there are, so there's no per sample branching left.
+// Not thread safe, call Process() and the getters from the same thread.
+class AudioMeter
+{
+public:
+    static constexpr uint MaxChannels = 32;
+
+    struct Para
+    {
+        AudioFormat Format = AudioFormat::F32;
+        uint Channels = 2;          // up to MaxChannels
+        uint SampleRate = 48000;
+        float Decay = 0.9999f;      // peak falloff per sample
+        float RmsTime = 0.3f;       // RMS averaging time in seconds
+        bool TruePeak = false;
+    };
+
+    explicit AudioMeter(const Para& para);
+
+    // size in bytes, whole frames only
+    void Process(const uint8* data, uint size);
+    void Reset();
+
+    // all linear, 1.0 = full scale
+    float GetPeak(uint ch) const { return Peak[ch]; }
+    float GetRms(uint ch) const { return sqrtf(MeanSquare[ch]); }
+    float GetTruePeak(uint ch) const { return TPeak[ch]; }
+
+    uint GetChannels() const { return Config.Channels; }
+
+private:
+    static constexpr uint Taps = 12; // per phase
+    static constexpr uint MaxLanes = 4 * MaxChannels;
+
+    Para Config;
+
+    // The samples go through the SIMD lanes in steps of Lanes floats, which is a
+    // whole number of frames and a multiple of 4, so lane l always sees
+    // channel l % Channels.
+    uint Lanes = 0;
+    uint StepFrames = 0;
+    float StepDecay = 0;
+
+    alignas(16) float LanePeak[MaxLanes] = {};
+    alignas(16) float LaneSum[MaxLanes] = {};
+
+    float Peak[MaxChannels] = {};
+    float MeanSquare[MaxChannels] = {};
+
+    // true peak: last Taps samples per channel, written twice so the window is always contiguous
+    alignas(16) float History[MaxChannels][2 * Taps] = {};
+    uint HistPos = 0;
+    float TPeak[MaxChannels] = {};
+    alignas(16) float TpCoefs[Taps][4]; // all four phases per tap, oldest sample first
+
+    template<typename T> void Run(const T* src, uint frames);
+    void TruePeakSample(uint ch, float x);
+};
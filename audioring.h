@@ -0,0 +1,235 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#pragma once
+
+#include "types.h"
+#include "system.h"
+
+#include <atomic>
+#include <string.h>
+
+struct AudioRingStats
+{
+    uint64 Overruns;     // writes that had to throw away unread data
+    uint64 Underruns;    // seeks to data that hadn't arrived yet
+    uint64 DroppedBytes; // unread data thrown away by overruns
+};
+
+// Single producer/single consumer byte ring for captured audio. Besides the data
+// it keeps (byte position, device time) anchors for the last few writes, so the
+// consumer can map any read position back to a capture time.
+//
+// The producer (the device thread) never waits: if the ring is full it pushes the
+// read position ahead and overwrites the oldest data. The consumer notices when
+// that happened during a read and retries with what's left.
+class AudioRing
+{
+public:
+
+    AudioRing() {}
+    ~AudioRing() { delete[] Data; }
+
+    AudioRing(const AudioRing&) = delete;
+    AudioRing& operator=(const AudioRing&) = delete;
+
+    // size gets rounded up to a power of two. blockAlign is the size of one
+    // sample frame, so seeks don't end up between channels
+    void Init(uint64 size, uint bytesPerSecond, uint blockAlign)
+    {
+        ASSERT(!Data);
+        Size = 1;
+        while (Size < size) Size <<= 1;
+        Mask = Size - 1;
+        Data = new uint8[Size];
+        BytesPerSecond = (double)bytesPerSecond;
+        Align = Max(blockAlign, 1u);
+    }
+
+    uint64 Capacity() const { return Size; }
+
+    // producer side ---------------------------------------------------------------
+
+    // data == nullptr writes silence
+    void Write(const uint8* data, uint64 bytes, double time)
+    {
+        ASSERT(bytes <= Size);
+        uint64 write = WritePos.load(std::memory_order_relaxed);
+
+        // if there's too little space, move the consumer ahead first
+        uint64 minRead = write + bytes - Size;
+        uint64 read = ReadPos.load(std::memory_order_acquire);
+        while (read + Size < write + bytes)
+        {
+            if (ReadPos.compare_exchange_weak(read, minRead, std::memory_order_acq_rel))
+            {
+                Overruns.fetch_add(1, std::memory_order_relaxed);
+                DroppedBytes.fetch_add(minRead - read, std::memory_order_relaxed);
+                break;
+            }
+        }
+
+        SetAnchor(write, time);
+
+        uint64 pos = write & Mask;
+        uint64 chunk1 = Min(bytes, Size - pos);
+        if (data)
+        {
+            memcpy(Data + pos, data, chunk1);
+            memcpy(Data, data + chunk1, bytes - chunk1);
+        }
+        else
+        {
+            memset(Data + pos, 0, chunk1);
+            memset(Data, 0, bytes - chunk1);
+        }
+
+        WritePos.store(write + bytes, std::memory_order_release);
+    }
+
+    // consumer side ---------------------------------------------------------------
+
+    // returns # of bytes read and the capture time of the first one
+    uint Read(uint8* dest, uint size, double& time)
+    {
+        for (;;)
+        {
+            uint64 read = ReadPos.load(std::memory_order_acquire);
+            uint64 write = WritePos.load(std::memory_order_acquire);
+
+            uint64 len = Min<uint64>(size, write - read);
+            if (!len)
+            {
+                time = TimeAt(read);
+                return 0;
+            }
+
+            uint64 pos = read & Mask;
+            uint64 chunk1 = Min(len, Size - pos);
+            memcpy(dest, Data + pos, chunk1);
+            memcpy(dest + chunk1, Data, len - chunk1);
+            time = TimeAt(read);
+
+            // if the producer moved us while copying, the data might be torn - try again
+            if (ReadPos.compare_exchange_strong(read, read + len, std::memory_order_acq_rel))
+                return (uint)len;
+        }
+    }
+
+    // skip to the data captured at a certain time, as far as it's in the ring
+    void JumpToTime(double time)
+    {
+        uint64 read = ReadPos.load(std::memory_order_acquire);
+        for (;;)
+        {
+            uint64 write = WritePos.load(std::memory_order_acquire);
+
+            Anchor a = {};
+            if (!FindAnchor(write, a))
+                return;
+
+            int64 delta = (int64)round((time - a.Time) * BytesPerSecond);
+            int64 dest = (int64)a.Pos + delta - delta % (int64)Align;
+            if (dest > (int64)write)
+                Underruns.fetch_add(1, std::memory_order_relaxed);
+
+            uint64 target = (uint64)Clamp<int64>(dest, (int64)read, (int64)write);
+            if (ReadPos.compare_exchange_strong(read, target, std::memory_order_acq_rel))
+                return;
+        }
+    }
+
+    void Flush()
+    {
+        uint64 read = ReadPos.load(std::memory_order_acquire);
+        while (!ReadPos.compare_exchange_weak(read, Max(read, WritePos.load(std::memory_order_acquire)), std::memory_order_acq_rel)) {}
+    }
+
+    AudioRingStats GetStats() const
+    {
+        return AudioRingStats
+        {
+            .Overruns = Overruns.load(std::memory_order_relaxed),
+            .Underruns = Underruns.load(std::memory_order_relaxed),
+            .DroppedBytes = DroppedBytes.load(std::memory_order_relaxed),
+        };
+    }
+
+private:
+
+    static constexpr uint NumAnchors = 32;
+
+    struct Anchor
+    {
+        uint64 Pos;
+        double Time;
+    };
+
+    // every anchor slot is a tiny seqlock: odd sequence = being written
+    struct AnchorSlot
+    {
+        std::atomic<uint64> Seq = 0;
+        std::atomic<uint64> Pos = 0;
+        std::atomic<double> Time = 0;
+    };
+
+    uint8* Data = nullptr;
+    uint64 Size = 0;
+    uint64 Mask = 0;
+    double BytesPerSecond = 1;
+    uint Align = 1;
+
+    alignas(CacheLineSize) std::atomic<uint64> WritePos = 0;
+    uint64 AnchorCount = 0; // producer private
+    alignas(CacheLineSize) std::atomic<uint64> PublishedAnchors = 0;
+    alignas(CacheLineSize) std::atomic<uint64> ReadPos = 0;
+    alignas(CacheLineSize) std::atomic<uint64> Overruns = 0;
+    std::atomic<uint64> Underruns = 0;
+    std::atomic<uint64> DroppedBytes = 0;
+
+    AnchorSlot Anchors[NumAnchors];
+
+    void SetAnchor(uint64 pos, double time)
+    {
+        uint64 n = AnchorCount++;
+        AnchorSlot& slot = Anchors[n % NumAnchors];
+        slot.Seq.store(2 * n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.Pos.store(pos, std::memory_order_relaxed);
+        slot.Time.store(time, std::memory_order_relaxed);
+        slot.Seq.store(2 * n + 2, std::memory_order_release);
+        PublishedAnchors.store(n + 1, std::memory_order_release);
+    }
+
+    // newest anchor at or before pos, or the oldest one still there
+    bool FindAnchor(uint64 pos, Anchor& found) const
+    {
+        uint64 count = PublishedAnchors.load(std::memory_order_acquire);
+        bool any = false;
+        for (uint64 i = count; i > 0 && i + NumAnchors > count; i--)
+        {
+            const AnchorSlot& slot = Anchors[(i - 1) % NumAnchors];
+            uint64 seq = slot.Seq.load(std::memory_order_acquire);
+            Anchor a = { slot.Pos.load(std::memory_order_relaxed), slot.Time.load(std::memory_order_relaxed) };
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq != 2 * i || slot.Seq.load(std::memory_order_relaxed) != seq)
+                break; // overwritten in the meantime, older ones will be too
+
+            found = a;
+            any = true;
+            if (a.Pos <= pos)
+                break;
+        }
+        return any;
+    }
+
+    double TimeAt(uint64 pos) const
+    {
+        Anchor a = {};
+        if (!FindAnchor(pos, a))
+            return 0;
+        return a.Time + ((double)pos - (double)a.Pos) / BytesPerSecond;
+    }
+};
@@ -0,0 +1,70 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#pragma once
+
+#include "types.h"
+#include "system.h"
+
+// Tests and benchmarks, all in one console program (Bench.vcxproj):
+//   Bench             runs all tests
+//   Bench all         runs all tests and benchmarks
+//   Bench <name> ...  runs only the tests and benchmarks with these names
+//   Bench list        shows what there is
+//   Bench --child <name> <arg>   runs CHILD(name), see ChildProcess
+// Tests CHECK() things and fail the run (exit code 1), benchmarks print numbers.
+// Every bench_*.cpp registers its own with TEST() and BENCHMARK().
+
+struct BenchEntry
+{
+    const char* Name;
+    bool IsTest;
+    void (*Run)();
+    BenchEntry* Next;
+
+    BenchEntry(const char* name, bool isTest, void (*run)());
+};
+
+#define TEST(name) static void Test_##name(); static BenchEntry TestEntry_##name(#name, true, Test_##name); static void Test_##name()
+#define BENCHMARK(name) static void Bench_##name(); static BenchEntry BenchEntry_##name(#name, false, Bench_##name); static void Bench_##name()
+
+struct ChildEntry
+{
+    const char* Name;
+    void (*Run)(const char* arg);
+    ChildEntry* Next;
+
+    ChildEntry(const char* name, void (*run)(const char*));
+};
+
+// code that runs in its own process, for tests that need to kill something
+#define CHILD(name) static void Child_##name(const char*); static ChildEntry ChildEntry_##name(#name, Child_##name); static void Child_##name(const char* arg)
+
+// this program again, running CHILD(name) with arg
+class ChildProcess
+{
+public:
+    ChildProcess(const char* name, const char* arg);
+    ~ChildProcess();    // kills it if it's still running
+
+    // the hard way, no chance to clean up
+    void Kill();
+
+private:
+    void* P = nullptr;
+};
+
+// reports and fails the run, but carries on
+#define CHECK(x) { if (!(x)) CheckFailed(__FILE__, __LINE__, #x); }
+void CheckFailed(const char* file, int line, const char* expr);
+
+// operator new calls so far, on all threads. av_malloc() and friends don't count
+uint64 GetAllocCount();
+
+// seconds per call of func: the best of a few rounds that run at least minSeconds each
+double TimePerCall(const Func<void()>& func, double minSeconds = 0.1);
+
+// where tests and benchmarks can put their files
+String GetBenchDir();
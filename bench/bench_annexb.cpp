@@ -0,0 +1,189 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "annexb.h"
+#include "encode.h"
+#include "screencapture.h"
+
+static void NalTypes(NalCodec codec, ReadOnlySpan<uint8> data, Array<uint>& types, Array<uint>* sizes = nullptr)
+{
+    NalScanner scan(codec, data.Ptr(), (uint)data.Len());
+    NalUnit nal;
+    while (scan.Next(nal))
+    {
+        types += nal.Type;
+        if (sizes)
+        {
+            scan.FindEnd(nal);
+            *sizes += nal.Size;
+        }
+    }
+}
+
+static bool Equals(const Array<uint>& a, std::initializer_list<uint> b)
+{
+    if (a.Len() != b.size())
+        return false;
+    size_t i = 0;
+    for (uint v : b)
+        if (a[i++] != v)
+            return false;
+    return true;
+}
+
+// packets the pass-through encoder makes: a real H.264 stream
+static void EncodePassthrough(uint frames, const Func<void(uint index, ReadOnlySpan<uint8> pkt)>& onPacket)
+{
+    CaptureConfig cfg;
+    cfg.CodecCfg.GopSize = 4;
+    IEncode* encoder = CreateEncodePassthrough(cfg, false);
+    encoder->Init(320, 180, 60, 1, {});
+    for (uint i = 0; i < frames; i++)
+    {
+        encoder->SubmitFrame(i / 60.0);
+        uint8* data;
+        uint size;
+        double time;
+        if (encoder->BeginGetPacket(data, size, 100, time))
+        {
+            onPacket(i, ReadOnlySpan<uint8>(data, size));
+            encoder->EndGetPacket();
+        }
+    }
+    delete encoder;
+}
+
+TEST(annexb)
+{
+    // the pass-through encoder's stream: SPS, PPS, IDR, filler, then P slices
+    {
+        uint count = 0;
+        EncodePassthrough(6, [&](uint i, ReadOnlySpan<uint8> pkt)
+        {
+            count++;
+            NalPacketInfo info = ParsePacket(NalCodec::H264, pkt.Ptr(), (uint)pkt.Len());
+            bool key = !(i % 4);
+            CHECK(info.IsKeyframe == key);
+            CHECK(info.HasParameterSets == key);
+
+            Array<uint> types, sizes;
+            NalTypes(NalCodec::H264, pkt, types, &sizes);
+            CHECK(key ? Equals(types, { 7, 8, 5, 12 }) : Equals(types, { 1, 12 }));
+
+            // all sizes plus 4 byte start codes add up to the packet
+            uint total = 0;
+            for (uint s : sizes)
+                total += s + 4;
+            CHECK(total == pkt.Len());
+
+            Array<uint8> ps;
+            ExtractParameterSets(NalCodec::H264, pkt.Ptr(), (uint)pkt.Len(), ps);
+            if (key)
+            {
+                // which is exactly the start of the packet
+                CHECK(ps.Len() == 8 + sizes[0] + sizes[1]);
+                CHECK(!memcmp(ps.Ptr(), pkt.Ptr(), ps.Len()));
+            }
+            else
+                CHECK(!ps.Len());
+        });
+        CHECK(count == 6);
+    }
+
+    // H.264 by hand: 3 and 4 byte start codes, an empty unit, trailing zeros, and
+    // an escaped start code inside a unit
+    {
+        static const uint8 stream[] =
+        {
+            0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x1e,                 // SPS
+            0, 0, 1, 0x68, 0xce, 0x38, 0x80,                    // PPS
+            0, 0, 1, 0, 0, 1, 0x06, 0x05, 0x00, 0x00, 0x03, 0x01, 0x80, 0, 0,  // empty, SEI ending in zeros
+            0, 0, 0, 1, 0x65, 0x88, 0x84, 0x00, 0x00, 0x03, 0x00, 0x21,        // IDR
+            0, 0,
+        };
+        Array<uint> types, sizes;
+        NalTypes(NalCodec::H264, stream, types, &sizes);
+        CHECK(Equals(types, { 7, 8, 6, 5 }));
+        CHECK(Equals(sizes, { 4, 4, 7, 8 }));
+
+        NalPacketInfo info = ParsePacket(NalCodec::H264, stream, sizeof(stream));
+        CHECK(info.IsKeyframe && info.HasParameterSets);
+
+        Array<uint8> ps;
+        ExtractParameterSets(NalCodec::H264, stream, sizeof(stream), ps);
+        static const uint8 expected[] = { 0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x1e, 0, 0, 0, 1, 0x68, 0xce, 0x38, 0x80 };
+        CHECK(ps.Len() == sizeof(expected) && !memcmp(ps.Ptr(), expected, sizeof(expected)));
+
+        // a truncated start code at the end is nothing
+        static const uint8 junk[] = { 0, 0, 1 };
+        CHECK(!ParsePacket(NalCodec::H264, junk, sizeof(junk)).IsKeyframe);
+        CHECK(!ParsePacket(NalCodec::H264, stream, 0).HasParameterSets);
+    }
+
+    // HEVC: VPS/SPS/PPS, a CRA is a keyframe, a TRAIL_N (header 00 01) isn't
+    {
+        static const uint8 key[] =
+        {
+            0, 0, 0, 1, 0x40, 0x01, 0x0c, 0x01,     // VPS
+            0, 0, 0, 1, 0x42, 0x01, 0x01, 0x01,     // SPS
+            0, 0, 0, 1, 0x44, 0x01, 0xc1, 0x72,     // PPS
+            0, 0, 0, 1, 0x2a, 0x01, 0xaf, 0x00,     // CRA
+        };
+        static const uint8 nonKey[] = { 0, 0, 0, 1, 0x00, 0x01, 0xd0, 0x2f, 0x00, 0x00, 0x03, 0x02 };
+
+        Array<uint> types, sizes;
+        NalTypes(NalCodec::HEVC, key, types, &sizes);
+        CHECK(Equals(types, { 32, 33, 34, 21 }));
+        CHECK(Equals(sizes, { 4, 4, 4, 3 }));
+
+        NalPacketInfo info = ParsePacket(NalCodec::HEVC, key, sizeof(key));
+        CHECK(info.IsKeyframe && info.HasParameterSets);
+        Array<uint8> ps;
+        ExtractParameterSets(NalCodec::HEVC, key, sizeof(key), ps);
+        CHECK(ps.Len() == 24 && !memcmp(ps.Ptr(), key, 24));
+
+        types.Clear();
+        NalTypes(NalCodec::HEVC, nonKey, types);
+        CHECK(Equals(types, { 0 }));
+        info = ParsePacket(NalCodec::HEVC, nonKey, sizeof(nonKey));
+        CHECK(!info.IsKeyframe && !info.HasParameterSets);
+    }
+}
+
+BENCHMARK(annexb)
+{
+    // a 4 MB keyframe, like 4K lossless makes. Parsing it should only cost the
+    // parameter sets, not the slice
+    Array<uint8> pkt;
+    static const uint8 head[] = { 0, 0, 0, 1, 0x67, 0x64, 0x00, 0x33, 0, 0, 0, 1, 0x68, 0xee, 0x3c, 0x80, 0, 0, 0, 1, 0x65 };
+    pkt += ReadOnlySpan<uint8>(head, sizeof(head));
+    uint seed = 1;
+    while (pkt.Len() < 4 << 20)
+    {
+        seed = seed * 1664525 + 1013904223;
+        pkt += (uint8)((seed >> 24) | 4);    // no zeros, so no start codes
+    }
+
+    NalPacketInfo info = {};
+    double tParse = TimePerCall([&] { info = ParsePacket(NalCodec::H264, pkt.Ptr(), (uint)pkt.Len()); });
+    Array<uint8> ps;
+    double tExtract = TimePerCall([&] { ps.Clear(); ExtractParameterSets(NalCodec::H264, pkt.Ptr(), (uint)pkt.Len(), ps); });
+    double tScan = TimePerCall([&]
+    {
+        NalScanner scan(NalCodec::H264, pkt.Ptr(), (uint)pkt.Len());
+        NalUnit nal;
+        while (scan.Next(nal))
+            scan.FindEnd(nal);
+    });
+
+    printf("4 MB IDR packet:\n");
+    printf("ParsePacket()           %8.3f us\n", tParse * 1e6);
+    printf("ExtractParameterSets()  %8.3f us\n", tExtract * 1e6);
+    printf("full scan               %8.3f us (%.2f GB/s)\n", tScan * 1e6, pkt.Len() / tScan / 1e9);
+}
@@ -0,0 +1,239 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include <stdio.h>
+#include <math.h>
+
+#include "bench.h"
+#include "audioring.h"
+
+// 7.1 float at 192kHz, the worst WASAPI will hand us
+static constexpr uint Channels = 8;
+static constexpr uint Rate = 192000;
+static constexpr uint FrameBytes = Channels * sizeof(float);
+
+// every sample of frame n holds n, so the reader can tell what it got
+static void FillFrames(uint* dest, uint64 first, uint frames)
+{
+    for (uint i = 0; i < frames; i++)
+        for (uint c = 0; c < Channels; c++)
+            *dest++ = (uint)(first + i);
+}
+
+static double FrameTime(uint64 frame) { return 10.0 + (double)frame / Rate; }
+
+struct RingRun
+{
+    uint64 Written = 0;
+    uint64 Read = 0;
+    uint64 Torn = 0;        // frames with mixed up samples
+    uint64 Backwards = 0;   // frames older than what we already had
+    uint64 BadTimes = 0;    // reads whose time doesn't match the frame
+    double Seconds = 0;
+    double MaxWrite = 0;    // longest Write() call in seconds
+};
+
+// device thread writes packets of packetFrames as fast as it can, the consumer
+// reads readFrames at a time and checks everything
+static RingRun RunRing(AudioRing& ring, uint64 totalFrames, uint packetFrames, uint readFrames)
+{
+    RingRun run;
+    std::atomic<bool> done = false;
+    std::atomic<uint> ready = 0;
+
+    Thread* producer = new Thread([&](Thread&)
+    {
+        Array<uint> packet;
+        packet.SetSize(packetFrames * Channels);
+        double ticks = (double)GetTicksPerSecond();
+        ready++;
+        while (ready < 2)
+            Thread::Sleep(0);
+        for (uint64 frame = 0; frame < totalFrames; frame += packetFrames)
+        {
+            FillFrames(packet.Ptr(), frame, packetFrames);
+            int64 t0 = GetTicks();
+            ring.Write((const uint8*)packet.Ptr(), (uint64)packetFrames * FrameBytes, FrameTime(frame));
+            run.MaxWrite = Max(run.MaxWrite, (double)(GetTicks() - t0) / ticks);
+            run.Written += packetFrames;
+        }
+        done = true;
+    });
+
+    Array<uint> buffer;
+    buffer.SetSize(readFrames * Channels);
+    int64 next = 0;
+    ready++;
+    while (ready < 2)
+        Thread::Sleep(0);
+
+    int64 start = GetTicks();
+    for (;;)
+    {
+        bool last = done;
+        double time = 0;
+        uint got = ring.Read((uint8*)buffer.Ptr(), readFrames * FrameBytes, time);
+        if (!got)
+        {
+            if (last)
+                break;
+            Thread::Sleep(0);
+            continue;
+        }
+
+        CHECK(got % FrameBytes == 0);
+        const uint* frames = buffer.Ptr();
+        if (fabs(time - FrameTime(frames[0])) > 0.5 / Rate)
+            run.BadTimes++;
+        for (uint i = 0; i < got / FrameBytes; i++, frames += Channels)
+        {
+            for (uint c = 1; c < Channels; c++)
+                if (frames[c] != frames[0])
+                {
+                    run.Torn++;
+                    break;
+                }
+            if ((int64)frames[0] < next)
+                run.Backwards++;
+            next = frames[0] + 1;
+        }
+        run.Read += got / FrameBytes;
+    }
+    run.Seconds = (double)(GetTicks() - start) / (double)GetTicksPerSecond();
+
+    delete producer;
+    return run;
+}
+
+TEST(audioring)
+{
+    // sizes round up, data and times come back out, also across the wrap
+    {
+        AudioRing ring;
+        ring.Init(1000 * FrameBytes, Rate * FrameBytes, FrameBytes);
+        CHECK(ring.Capacity() == 32768);
+
+        uint in[300 * Channels], out[300 * Channels];
+        uint64 frame = 0;
+        for (int round = 0; round < 10; round++)
+        {
+            FillFrames(in, frame, 300);
+            ring.Write((const uint8*)in, sizeof(in), FrameTime(frame));
+
+            double time = 0;
+            CHECK(ring.Read((uint8*)out, 100 * FrameBytes, time) == 100 * FrameBytes);
+            CHECK(out[0] == frame && out[99 * Channels] == frame + 99);
+            CHECK(fabs(time - FrameTime(frame)) < 1e-9);
+
+            // the rest, and one more packet's worth would be too much
+            CHECK(ring.Read((uint8*)out, 300 * FrameBytes, time) == 200 * FrameBytes);
+            CHECK(out[0] == frame + 100 && out[199 * Channels + 7] == frame + 299);
+            CHECK(fabs(time - FrameTime(frame + 100)) < 1e-9);
+            frame += 300;
+        }
+
+        double time = 0;
+        CHECK(ring.Read((uint8*)out, sizeof(out), time) == 0);
+        CHECK(fabs(time - FrameTime(frame)) < 1e-9);
+
+        AudioRingStats stats = ring.GetStats();
+        CHECK(!stats.Overruns && !stats.Underruns && !stats.DroppedBytes);
+    }
+
+    // silence, overruns and seeking
+    {
+        AudioRing ring;
+        ring.Init(1024 * FrameBytes, Rate * FrameBytes, FrameBytes);
+
+        uint in[256 * Channels], out[1024 * Channels];
+        for (uint64 frame = 0; frame < 2048; frame += 256)
+        {
+            FillFrames(in, frame, 256);
+            ring.Write((const uint8*)in, sizeof(in), FrameTime(frame));
+        }
+
+        // the oldest half is gone, the newest data is there
+        AudioRingStats stats = ring.GetStats();
+        CHECK(stats.Overruns == 4);
+        CHECK(stats.DroppedBytes == 1024 * FrameBytes);
+
+        // anchors still map the time of everything that's left
+        ring.JumpToTime(FrameTime(1500));
+        double time = 0;
+        CHECK(ring.Read((uint8*)out, 16 * FrameBytes, time) == 16 * FrameBytes);
+        CHECK(out[0] == 1500 && fabs(time - FrameTime(1500)) < 1e-9);
+
+        // can't go back to what's been overwritten
+        ring.JumpToTime(FrameTime(100));
+        CHECK(ring.Read((uint8*)out, 16 * FrameBytes, time) == 16 * FrameBytes);
+        CHECK(out[0] == 1516);
+
+        // seeking into the future is an underrun and ends up at the write position
+        ring.JumpToTime(FrameTime(5000));
+        CHECK(ring.GetStats().Underruns == 1);
+        CHECK(ring.Read((uint8*)out, sizeof(out), time) == 0);
+
+        ring.Write(nullptr, 64 * FrameBytes, FrameTime(2048));
+        CHECK(ring.Read((uint8*)out, sizeof(out), time) == 64 * FrameBytes);
+        CHECK(!out[0] && !out[64 * Channels - 1]);
+        CHECK(fabs(time - FrameTime(2048)) < 1e-9);
+
+        ring.Write((const uint8*)in, sizeof(in), FrameTime(2112));
+        ring.Flush();
+        CHECK(ring.Read((uint8*)out, sizeof(out), time) == 0);
+    }
+
+    // a consumer that can't keep up loses whole frames, but never gets torn,
+    // reordered or mistimed ones, and everything written is either read or counted
+    {
+        AudioRing ring;
+        ring.Init(Rate * FrameBytes / 50, Rate * FrameBytes, FrameBytes);  // 20ms
+        RingRun run = RunRing(ring, (uint64)Rate * 10, 480, 333);
+        AudioRingStats stats = ring.GetStats();
+        CHECK(run.Read + stats.DroppedBytes / FrameBytes == run.Written);
+        CHECK(!run.Torn);
+        CHECK(!run.Backwards);
+        CHECK(!run.BadTimes);
+    }
+}
+
+BENCHMARK(audioring)
+{
+    const double realTime = (double)Rate * FrameBytes;
+    printf("7.1 float at %ukHz: %.2f MB/s real time\n", Rate / 1000, realTime / 1e6);
+
+    // one thread, write a 10ms packet and read it back
+    {
+        AudioRing ring;
+        ring.Init((uint64)Rate * FrameBytes, Rate * FrameBytes, FrameBytes);
+        const uint frames = Rate / 100;
+        Array<uint> packet;
+        packet.SetSize(frames * Channels);
+        FillFrames(packet.Ptr(), 0, frames);
+        double time = 0;
+        double t = TimePerCall([&]
+        {
+            ring.Write((const uint8*)packet.Ptr(), (uint64)frames * FrameBytes, time);
+            ring.Read((uint8*)packet.Ptr(), frames * FrameBytes, time);
+            time += 0.01;
+        });
+        double bytes = (double)frames * FrameBytes;
+        printf("write+read, 10ms packets:  %8.2f GB/s, %6.0fx real time\n", bytes / t / 1e9, bytes / t / realTime);
+    }
+
+    // device thread against consumer thread, 1 minute of audio as fast as possible
+    static const struct { uint Ms, Packet, Read; } configs[] = { { 1000, Rate / 100, 4096 }, { 100, Rate / 1000, 1024 }, { 20, Rate / 1000, 333 } };
+    for (auto& cfg : configs)
+    {
+        AudioRing ring;
+        ring.Init((uint64)Rate * FrameBytes * cfg.Ms / 1000, Rate * FrameBytes, FrameBytes);
+        RingRun run = RunRing(ring, (uint64)Rate * 60, cfg.Packet, cfg.Read);
+        AudioRingStats stats = ring.GetStats();
+        double bytes = (double)run.Written * FrameBytes;
+        printf("%4ums ring, %4u frame packets: %7.2f GB/s, %5.0fx real time, longest write %6.1fus, %llu overruns (%.1f%% dropped)\n",
+            cfg.Ms, cfg.Packet, bytes / run.Seconds / 1e9, bytes / run.Seconds / realTime, run.MaxWrite * 1e6,
+            (unsigned long long)stats.Overruns, 100.0 * (double)stats.DroppedBytes / bytes);
+    }
+}
@@ -0,0 +1,251 @@
+//
+// Copyright (C) Tammo Hinrichs 2021-2022. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "colorconvert_cpu.h"
+
+using BufferFormat = IEncode::BufferFormat;
+using Isa = ColorConverterCPU::Isa;
+
+static const char* const FormatNames[] = { "BGRA8", "NV12", "YUV444_8", "YUV420_16", "YUV444_16" };
+static const char* const IsaNames[] = { "scalar", "SSE4.1", "AVX2" };
+static const PixelFormat SrcFormats[] = { PixelFormat::BGRA8, PixelFormat::RGBA8, PixelFormat::RGB10A2, PixelFormat::RGBA16F };
+static const char* const SrcNames[] = { "BGRA8", "RGBA8", "RGB10A2", "RGBA16F" };
+
+static uint BytesPerPixel(PixelFormat fmt) { return fmt == PixelFormat::RGBA16F ? 8 : 4; }
+
+// random pixels. For half floats, keep to 0..1 with a few out of range and
+// negative ones in, like scRGB has
+static void FillSource(Array<uint8>& src, uint pitch, uint sizeY, PixelFormat fmt, uint seed)
+{
+    src.SetSize((size_t)pitch * sizeY);
+    srand(seed);
+    if (fmt == PixelFormat::RGBA16F)
+    {
+        uint16* h = (uint16*)src.Ptr();
+        for (size_t i = 0; i < src.Len() / 2; i++)
+            h[i] = (uint16)(rand() % 16 ? rand() % 0x3c00 : rand() % 0x10000);
+    }
+    else
+        for (size_t i = 0; i < src.Len(); i++)
+            src[i] = (uint8)rand();
+}
+
+static ColorConverterCPU::Para MakePara(BufferFormat fmt, uint sizeX, uint sizeY, uint upscale, bool hdr, Isa isa, uint threads)
+{
+    return ColorConverterCPU::Para
+    {
+        .Format = fmt,
+        .SizeX = sizeX,
+        .SizeY = sizeY,
+        .Upscale = upscale,
+        .Hdr = hdr,
+        .YuvMatrix = GetConvertMatrix(fmt, hdr),
+        .ColorMatrix = GetHdrColorMatrix(),
+        .Threads = threads,
+        .MaxIsa = isa,
+    };
+}
+
+// output buffer with a fill pattern
+static void ClearOut(Array<uint8>& out, BufferFormat fmt, uint sizeX, uint sizeY)
+{
+    FormatInfo fi = GetFormatInfo(fmt, sizeX, sizeY);
+    out.SetSize((size_t)fi.pitch * fi.lines);
+    memset(out.Ptr(), 0xcd, out.Len());
+}
+
+static bool Same(const Array<uint8>& a, const Array<uint8>& b)
+{
+    return a.Len() == b.Len() && !memcmp(a.Ptr(), b.Ptr(), a.Len());
+}
+
+TEST(colorconvert)
+{
+    // known values: white and black go to the ends of the video range
+    {
+        const uint sizeX = 16, sizeY = 16;
+        Array<uint8> src, out;
+        src.SetSize(sizeX * sizeY * 4);
+        for (uint v : { 255u, 0u })
+        {
+            memset(src.Ptr(), v, src.Len());
+            ColorConverterCPU conv(MakePara(BufferFormat::NV12, sizeX, sizeY, 1, false, Isa::Scalar, 1));
+            ClearOut(out, BufferFormat::NV12, sizeX, sizeY);
+            conv.Convert(src.Ptr(), sizeX * 4, PixelFormat::BGRA8, out.Ptr());
+            CHECK(out[0] == (v ? 235 : 16) && out[sizeX * sizeY - 1] == (v ? 235 : 16));
+            CHECK(out[sizeX * sizeY] == 128 && out[out.Len() - 1] == 128);
+        }
+    }
+
+    Isa maxIsa = ColorConverterCPU::DetectIsa();
+    if (maxIsa < Isa::AVX2)
+        printf("  (only up to %s on this CPU)\n", IsaNames[(int)maxIsa]);
+
+    // all SIMD paths match the scalar one bit for bit, for every format, with odd
+    // row lengths, padded source pitches and upscaling. The Release build compiles
+    // the converter with AVX2 and FMA contraction allowed (/fp:contract, or
+    // -mavx2 -mfma with gcc), so this also checks nothing gets fused behind our back
+    const uint sizeX = 198, sizeY = 70;
+    Array<uint8> src, src2, ref, out;
+    for (int f = 0; f < 5; f++)
+        for (int s = 0; s < 4; s++)
+            for (uint up = 1; up <= 2; up++)
+            {
+                BufferFormat fmt = (BufferFormat)f;
+                PixelFormat srcFmt = SrcFormats[s];
+                bool hdr = srcFmt == PixelFormat::RGBA16F;
+                uint srcX = sizeX / up, srcY = sizeY / up;
+                uint pitch = srcX * BytesPerPixel(srcFmt) + 12;
+                FillSource(src, pitch, srcY, srcFmt, f * 8 + s * 2 + up);
+
+                ColorConverterCPU scalar(MakePara(fmt, sizeX, sizeY, up, hdr, Isa::Scalar, 1));
+                ClearOut(ref, fmt, sizeX, sizeY);
+                scalar.Convert(src.Ptr(), pitch, srcFmt, ref.Ptr());
+
+                // every byte gets written: same result on a differently filled buffer
+                out.SetSize(ref.Len());
+                memset(out.Ptr(), 0x32, out.Len());
+                scalar.Convert(src.Ptr(), pitch, srcFmt, out.Ptr());
+                bool untouched = !Same(ref, out);
+
+                bool same = true;
+                for (int isa = 1; isa <= (int)maxIsa; isa++)
+                {
+                    ColorConverterCPU simd(MakePara(fmt, sizeX, sizeY, up, hdr, (Isa)isa, 3));
+                    CHECK(simd.GetIsa() == (Isa)isa);
+                    ClearOut(out, fmt, sizeX, sizeY);
+                    simd.Convert(src.Ptr(), pitch, srcFmt, out.Ptr());
+                    same &= Same(ref, out);
+                }
+
+                // tiles: start from the old picture, change a rectangle, convert only
+                // what's dirty and end up with the same as converting everything
+                TileMask mask;
+                mask.Init(sizeX, sizeY);
+                mask.Clear();
+                src2 = src;
+                int x0 = 13 / up, y0 = 9 / up, x1 = 121 / up, y1 = 37 / up;
+                for (int y = y0; y < y1; y++)
+                    for (int x = x0 * (int)BytesPerPixel(srcFmt); x < x1 * (int)BytesPerPixel(srcFmt); x++)
+                        src2[(size_t)y * pitch + x] ^= 0x5a;
+                mask.AddRect(x0, y0, x1, y1, up);
+
+                ColorConverterCPU conv(MakePara(fmt, sizeX, sizeY, up, hdr, maxIsa, 2));
+                Array<uint8> full;
+                ClearOut(full, fmt, sizeX, sizeY);
+                conv.Convert(src2.Ptr(), pitch, srcFmt, full.Ptr());
+                out = ref;
+                conv.ConvertTiles(src2.Ptr(), pitch, srcFmt, out.Ptr(), mask);
+                bool tiles = Same(full, out) && !Same(ref, out);
+
+                // and a rectangle
+                out = ref;
+                conv.ConvertRect(src2.Ptr(), pitch, srcFmt, out.Ptr(), 12, 8, 122, 38);
+                bool rect = Same(full, out);
+
+                if (untouched || !same || !tiles || !rect)
+                    printf("  %s from %s, upscale %u:%s%s%s%s\n", FormatNames[f], SrcNames[s], up,
+                        untouched ? " untouched output" : "", same ? "" : " SIMD mismatch",
+                        tiles ? "" : " tiles mismatch", rect ? "" : " rect mismatch");
+                CHECK(!untouched);
+                CHECK(same);
+                CHECK(tiles);
+                CHECK(rect);
+            }
+}
+
+BENCHMARK(colorconvert)
+{
+    Isa maxIsa = ColorConverterCPU::DetectIsa();
+    uint cores = Thread::GetCPUCount();
+
+    static const struct { uint X, Y; } sizes[] = { { 1920, 1080 }, { 3840, 2160 } };
+    static const struct { PixelFormat Src; BufferFormat Fmt; bool Hdr; } cases[] =
+    {
+        { PixelFormat::BGRA8, BufferFormat::NV12, false },
+        { PixelFormat::BGRA8, BufferFormat::YUV444_8, false },
+        { PixelFormat::RGBA16F, BufferFormat::YUV420_16, true },
+    };
+
+    printf("GB/s source read (ms/frame)       ");
+    for (int isa = 0; isa <= (int)maxIsa; isa++)
+        printf("%-18s", IsaNames[isa]);
+    printf("%s x%u\n", IsaNames[(int)maxIsa], cores);
+
+    for (auto& size : sizes)
+        for (auto& c : cases)
+        {
+            uint pitch = size.X * BytesPerPixel(c.Src);
+            Array<uint8> src, out;
+            FillSource(src, pitch, size.Y, c.Src, 1);
+            ClearOut(out, c.Fmt, size.X, size.Y);
+            double bytes = (double)pitch * size.Y;
+
+            char label[64];
+            snprintf(label, sizeof(label), "%ux%u %s->%s", size.X, size.Y, SrcNames[c.Src == PixelFormat::RGBA16F ? 3 : 0], FormatNames[(int)c.Fmt]);
+            printf("%-34s", label);
+
+            auto run = [&](Isa isa, uint threads)
+            {
+                ColorConverterCPU conv(MakePara(c.Fmt, size.X, size.Y, 1, c.Hdr, isa, threads));
+                double t = TimePerCall([&] { conv.Convert(src.Ptr(), pitch, c.Src, out.Ptr()); }, 0.3);
+                printf("%5.2f (%6.2fms)    ", bytes / t / 1e9, t * 1000);
+            };
+            for (int isa = 0; isa <= (int)maxIsa; isa++)
+                run((Isa)isa, 1);
+            run(maxIsa, 0);
+            printf("\n");
+        }
+}
+
+BENCHMARK(colorconvert_tiles)
+{
+    // what converting only the dirty tiles costs against converting everything, by
+    // how much is dirty. Scattered tiles are the worst case, a block (like a
+    // window or a video playing) the usual one
+    const uint sizeX = 1920, sizeY = 1080;
+    Isa maxIsa = ColorConverterCPU::DetectIsa();
+    uint pitch = sizeX * 4;
+    Array<uint8> src, out;
+    FillSource(src, pitch, sizeY, PixelFormat::BGRA8, 1);
+    ClearOut(out, BufferFormat::NV12, sizeX, sizeY);
+    ColorConverterCPU conv(MakePara(BufferFormat::NV12, sizeX, sizeY, 1, false, maxIsa, 0));
+
+    double tFull = TimePerCall([&] { conv.Convert(src.Ptr(), pitch, PixelFormat::BGRA8, out.Ptr()); }, 0.3);
+    printf("%ux%u BGRA8->NV12, %s x%u: full frame %.2fms\n", sizeX, sizeY, IsaNames[(int)maxIsa], Thread::GetCPUCount(), tFull * 1000);
+    printf("dirty     scattered ms (vs full)   block ms (vs full)\n");
+
+    TileMask mask;
+    mask.Init(sizeX, sizeY);
+    const uint tilesX = mask.GetTilesX(), tilesY = mask.GetTilesY();
+    for (double fraction : { 0.01, 0.05, 0.1, 0.25, 0.5, 0.75, 1.0 })
+    {
+        auto time = [&]
+        {
+            return TimePerCall([&] { conv.ConvertTiles(src.Ptr(), pitch, PixelFormat::BGRA8, out.Ptr(), mask); }, 0.3);
+        };
+
+        mask.Clear();
+        srand(2);
+        while (mask.GetFraction() < fraction)
+            mask.Set(rand() % tilesX, rand() % tilesY);
+        double tScattered = time();
+
+        mask.Clear();
+        uint rows = Max((uint)(fraction * tilesY + 0.5), 1u);
+        for (uint ty = 0; ty < rows; ty++)
+            for (uint tx = 0; tx < tilesX; tx++)
+                mask.Set(tx, ty);
+        double tBlock = time();
+
+        printf("%4.0f%%     %6.2f (%4.2fx)            %6.2f (%4.2fx)\n", fraction * 100,
+            tScattered * 1000, tScattered / tFull, tBlock * 1000, tBlock / tFull);
+    }
+}
@@ -0,0 +1,164 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "encode.h"
+#include "screencapture.h"
+
+// libx264/libx265 through Encode_LibAV, fed from system memory like in headless mode
+
+// NV12 with a bit of everything: a gradient scrolling by, and a noisy block moving
+// over it, so the encoder has motion and detail to deal with
+static void MakeFrame(Array<uint8>& buffer, uint sizeX, uint sizeY, uint frame)
+{
+    FormatInfo fi = GetFormatInfo(IEncode::BufferFormat::NV12, sizeX, sizeY);
+    buffer.SetSize((size_t)fi.pitch * fi.lines);
+
+    uint8* y = buffer.Ptr();
+    for (uint py = 0; py < sizeY; py++, y += fi.pitch)
+        for (uint px = 0; px < sizeX; px++)
+            y[px] = (uint8)(((px + 4 * frame) ^ (py / 8)) + py / 4);
+
+    uint bx = (frame * 7) % (sizeX / 2), by = (frame * 3) % (sizeY / 2);
+    uint seed = frame * 2654435761u;
+    for (uint py = by; py < by + sizeY / 4; py++)
+        for (uint px = bx; px < bx + sizeX / 4; px++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            buffer[(size_t)py * fi.pitch + px] = (uint8)(seed >> 24);
+        }
+
+    uint8* uv = buffer.Ptr() + (size_t)fi.pitch * sizeY;
+    for (uint py = 0; py < sizeY / 2; py++, uv += fi.pitch)
+        for (uint px = 0; px < sizeX / 2; px++)
+        {
+            uv[2 * px] = (uint8)(96 + (px + frame) / 16 % 64);
+            uv[2 * px + 1] = (uint8)(160 - py / 16 % 64);
+        }
+}
+
+struct EncodeResult
+{
+    uint Packets;
+    double Seconds;         // first submit until the last packet is out
+    double FlushSeconds;
+};
+
+// encodes frames from a few prepared ones, picks up the packets on another thread
+// like the process thread does
+static EncodeResult RunEncode(const CaptureConfig& cfg, uint sizeX, uint sizeY, uint rate, uint frames)
+{
+    static constexpr uint NumSources = 8;
+    Array<uint8> sources[NumSources];
+    for (uint i = 0; i < NumSources; i++)
+        MakeFrame(sources[i], sizeX, sizeY, i);
+
+    Array<uint8> input;
+    input.SetSize(sources[0].Len());
+
+    IEncode* encoder = CreateEncodeLibAV(cfg, false);
+    encoder->Init(sizeX, sizeY, rate, 1, IEncode::Input{ .Cpu = input.Ptr() });
+
+    std::atomic<uint> packets = 0;
+    Thread* output = new Thread([&](Thread& thread)
+    {
+        uint8* data;
+        uint size;
+        double time;
+        while (thread.IsRunning())
+            while (encoder->BeginGetPacket(data, size, 10, time))
+            {
+                encoder->EndGetPacket();
+                packets++;
+            }
+    });
+
+    int64 start = GetTicks();
+    for (uint i = 0; i < frames; i++)
+    {
+        // SubmitFrame() copies the input right away
+        memcpy(input.Ptr(), sources[i % NumSources].Ptr(), input.Len());
+        encoder->SubmitFrame((double)i / rate);
+    }
+    int64 flush = GetTicks();
+    encoder->Flush();
+    int64 end = GetTicks();
+
+    delete output;
+    delete encoder;
+
+    double ticks = (double)GetTicksPerSecond();
+    return EncodeResult
+    {
+        .Packets = packets,
+        .Seconds = (double)(end - start) / ticks,
+        .FlushSeconds = (double)(end - flush) / ticks,
+    };
+}
+
+static CaptureConfig MakeConfig(CodecProfile profile, const char* preset)
+{
+    CaptureConfig cfg;
+    cfg.CodecCfg.UseEncoder = VideoEncoder::CPU;
+    cfg.CodecCfg.Profile = profile;
+    cfg.CodecCfg.CpuPreset = preset;
+    cfg.CodecCfg.UseBitrateControl = BitrateControl::CBR;
+    cfg.CodecCfg.BitrateParameter = 20000;
+    return cfg;
+}
+
+TEST(encode)
+{
+    // every frame comes out, and Flush() returns as soon as the last one is picked up
+    for (CodecProfile profile : { CodecProfile::H264_MAIN, CodecProfile::HEVC_MAIN })
+    {
+        CaptureConfig cfg = MakeConfig(profile, "ultrafast");
+        EncodeResult res = RunEncode(cfg, 320, 180, 60, 90);
+        CHECK(res.Packets == 90);
+        CHECK(res.FlushSeconds < 1);
+    }
+}
+
+BENCHMARK(encode)
+{
+    static const char* const presets[] = { "ultrafast", "superfast", "veryfast", "faster", "fast", "medium" };
+    static const struct { CodecProfile Profile; const char* Name; } profiles[] =
+    {
+        { CodecProfile::H264_MAIN, "x264" },
+        { CodecProfile::HEVC_MAIN, "x265" },
+    };
+    static const struct { uint X, Y; } sizes[] = { { 1920, 1080 }, { 3840, 2160 } };
+    const uint rate = 60;
+
+    printf("fps (x real time at %u Hz), CBR 20 Mbit/s, %u cores\n", rate, Thread::GetCPUCount());
+    printf("%-14s", "");
+    for (auto& size : sizes)
+        for (auto& p : profiles)
+        {
+            char label[32];
+            snprintf(label, sizeof(label), "%s %up", p.Name, size.Y);
+            printf("%-18s", label);
+        }
+    printf("\n");
+
+    for (const char* preset : presets)
+    {
+        printf("%-14s", preset);
+        for (auto& size : sizes)
+            for (auto& p : profiles)
+            {
+                CaptureConfig cfg = MakeConfig(p.Profile, preset);
+                uint frames = size.Y > 1080 ? 60 : 180;
+                EncodeResult res = RunEncode(cfg, size.X, size.Y, rate, frames);
+                double fps = res.Packets / res.Seconds;
+                printf("%7.1f (%5.2fx)   ", fps, fps / rate);
+                fflush(stdout);
+            }
+        printf("\n");
+    }
+}
@@ -0,0 +1,180 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <limits>
+
+#include "bench.h"
+
+// FormatTo against the C library's snprintf, and what it saves over PrintF
+
+// same text and same length as snprintf, into a buffer that's big enough and
+// into every size that isn't
+template<class ... A> static bool SameAsSnprintf(const char* format, A ... args)
+{
+    char want[512], got[512];
+    int wantLen = snprintf(want, sizeof(want), format, args...);
+    size_t gotLen = FormatTo(Span<char>(got), format, args...);
+    if (wantLen < 0 || gotLen != (size_t)wantLen || strcmp(got, want))
+    {
+        printf("  \"%s\": \"%s\" (%u), expected \"%s\" (%d)\n", format, got, (uint)gotLen, want, wantLen);
+        return false;
+    }
+
+    for (size_t size = 0; size <= gotLen + 1; size++)
+    {
+        memset(want, '#', sizeof(want));
+        memset(got, '#', sizeof(got));
+        snprintf(want, size, format, args...);
+        size_t len = FormatTo(Span<char>(got, size), format, args...);
+        if (len != gotLen || memcmp(got, want, sizeof(got)))
+        {
+            printf("  \"%s\" into %u chars: \"%.*s\" (%u), expected \"%.*s\"\n", format, (uint)size,
+                (int)size, got, (uint)len, (int)size, want);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool Is(const char* got, const char* want)
+{
+    if (strcmp(got, want))
+        printf("  \"%s\", expected \"%s\"\n", got, want);
+    return !strcmp(got, want);
+}
+
+TEST(format_ints)
+{
+    CHECK(SameAsSnprintf("plain text, %s", "and a string"));
+    CHECK(SameAsSnprintf("%d %i %u %x %X %o %c %%", -42, 42, 42u, 0xbeefu, 0xbeefu, 8u, 'c'));
+    CHECK(SameAsSnprintf("%d %d %u %x", 0, (int)0x80000000, 0xffffffffu, 0u));
+    CHECK(SameAsSnprintf("%lld %llu %llx", -9223372036854775807ll - 1, 18446744073709551615ull, 0x123456789abcdefull));
+    CHECK(SameAsSnprintf("%zu %zd %hd %hu %hhd %hhu", (size_t)12345, (ptrdiff_t)-5, (short)-300, (unsigned short)65535, (signed char)-1, (unsigned char)200));
+
+    // widths, precisions and flags
+    CHECK(SameAsSnprintf("[%5d] [%-5d] [%05d] [%+d] [% d] [%+5d] [%-+5d]", 42, 42, 42, 42, 42, 42, 42));
+    CHECK(SameAsSnprintf("[%05d] [%-05d] [%5.3d] [%.0d] [%.0d] [%5.0d]", -42, -42, 7, 0, 1, 0));
+    CHECK(SameAsSnprintf("[%#x] [%#X] [%#o] [%#o] [%#x] [%#08x] [%08.3x]", 255u, 255u, 8u, 0u, 0u, 255u, 255u));
+    CHECK(SameAsSnprintf("[%2d] [%40d] [%-40u]", 12345, 1, 2u));
+
+    // widths and precisions from the arguments, negative ones included
+    CHECK(SameAsSnprintf("[%*d] [%-*d] [%*d] [%.*d] [%*.*d] [%.*d]", 6, 42, 6, 42, -6, 42, 4, 42, 8, 4, -42, -1, 42));
+
+    // strings
+    CHECK(SameAsSnprintf("[%10s] [%-10s] [%.3s] [%10.3s] [%*.*s] [%s]", "abc", "abc", "abcdef", "abcdef", -8, 2, "xyz", ""));
+    CHECK(SameAsSnprintf("[%c] [%3c] [%-3c]", 'a', 'b', 'c'));
+    CHECK(SameAsSnprintf("[%ls] [%5ls] [%.2ls]", L"wide", L"abc", L"abc"));
+
+    // MSVC only, the same everywhere here
+    char buf[64];
+    FormatTo(buf, "%I64d %I64u %I32d %Id", -1ll, 18446744073709551615ull, -2, (ptrdiff_t)-3);
+    CHECK(Is(buf, "-1 18446744073709551615 -2 -3"));
+
+    // %p is MSVC style on every platform (glibc would say 0x1234)
+    FormatTo(buf, "%p", (void*)(uintptr_t)0x1234);
+    CHECK(Is(buf, sizeof(void*) == 8 ? "0000000000001234" : "00001234"));
+    FormatTo(buf, "[%20p] [%-20p]", (void*)(uintptr_t)0xabcdef, (void*)nullptr);
+    CHECK(Is(buf, sizeof(void*) == 8 ? "[    0000000000ABCDEF] [0000000000000000    ]" : "[            00ABCDEF] [00000000            ]"));
+
+    // wide strings are UTF-8, whatever the C library's locale would do
+    FormatTo(buf, "%ls %S", L"\u00e4\u20ac", L"\U0001F600");
+    CHECK(Is(buf, "\xc3\xa4\xe2\x82\xac \xf0\x9f\x98\x80"));
+
+    // not a format: printed as is
+    FormatTo(buf, "%y %", 1);
+    CHECK(Is(buf, "%y %"));
+}
+
+TEST(format_floats)
+{
+    CHECK(SameAsSnprintf("%f %f %f %f", 0.0, 1.5, -2.25, 1e20));
+    CHECK(SameAsSnprintf("%.0f %.1f %.2f %.3f %.10f", 2.5, 0.05, 1.005, -0.0005, 1.0 / 3));
+    CHECK(SameAsSnprintf("%.0f %.0f %.0f %.0f", 0.5, 1.5, 2.5, 3.5));
+    CHECK(SameAsSnprintf("%e %E %.0e %.3e %e", 12345.678, 0.00012, 5e300, -1e-300, 0.0));
+    CHECK(SameAsSnprintf("%g %g %g %g %g %g", 100000.0, 1000000.0, 0.0001, 0.00001, 123456789.0, 0.1));
+    CHECK(SameAsSnprintf("%G %.3g %.10g %.0g %.1g %g", 1e-10, 3.14159, 2.0 / 3, 123.0, 0.95, 0.0));
+    CHECK(SameAsSnprintf("%.4g fps, %.1f%% of the screen", 59.94005994, 12.345));
+
+    // widths, flags and * on floats
+    CHECK(SameAsSnprintf("[%10.2f] [%-10.2f] [%010.2f] [%+.2f] [% .2f] [%+010.2f]", 3.14159, 3.14159, -3.14159, 3.14159, 3.14159, 3.14159));
+    CHECK(SameAsSnprintf("[%*.*f] [%-*.*e] [%.*g] [%*g]", 12, 3, 2.5, 12, 2, 2.5, 3, 1234.5, -8, 0.5));
+    CHECK(SameAsSnprintf("[%12e] [%-12g] [%012e] [%+g]", 1.0, 1.0, -1.0, 1.0));
+
+    // the ends of the range
+    CHECK(SameAsSnprintf("%g %g %e %e", 5e-324, 1.7976931348623157e308, 2.2250738585072014e-308, 1.7976931348623157e308));
+    CHECK(SameAsSnprintf("%.0f", 1.7976931348623157e308));
+    CHECK(SameAsSnprintf("%.17g %.17g %.17g", 0.1, 1.0 / 3, 9007199254740993.0));
+
+    // not numbers. No zeros in front of these
+    CHECK(SameAsSnprintf("[%f] [%f] [%6.2f] [%-6e] [%06g] [%+f] [%F] [%E]", INFINITY, -INFINITY, INFINITY, INFINITY, INFINITY, INFINITY, INFINITY, INFINITY));
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    CHECK(SameAsSnprintf("[%f] [%6g] [%-6e] [%06f]", nan, nan, nan, nan));
+}
+
+TEST(format_sinks)
+{
+    // the StringBuilder version appends, and has no length limit
+    StringBuilder sb;
+    sb += "start ";
+    CHECK(FormatTo(sb, "%d %s", 42, "x") == 4);
+    String long1 = String::Repeat('x', 5000);
+    CHECK(FormatTo(sb, "[%s]", (const char*)long1) == 5002);
+    CHECK(FormatTo(sb, "%4000d|", 1) == 4001);
+    String s = sb.ToString();
+    CHECK(s.Length() == 6 + 4 + 5002 + 4001);
+    CHECK(!strncmp(s, "start 42 x[xxx", 14) && s[s.Length() - 2] == '1' && s[s.Length() - 1] == '|');
+
+    // PrintF too, both below and above its stack buffer
+    for (uint len : { 10u, 255u, 256u, 257u, 10000u })
+    {
+        String p = String::PrintF("%*d", (int)len, 7);
+        CHECK(p.Length() == len && p[len - 1] == '7' && p[0] == (len > 1 ? ' ' : '7'));
+    }
+
+    // a Span of one only gets the terminator, and an empty one nothing at all
+    char one[1] = { '#' };
+    CHECK(FormatTo(Span<char>(one), "%d", 12345) == 5 && one[0] == 0);
+    char none = '#';
+    CHECK(FormatTo(Span<char>(&none, (size_t)0), "%d", 12345) == 5 && none == '#');
+}
+
+// what App shows every frame, and a stats line in JSON
+#define STATS_FORMAT "%.1f fps avg, %d repeated, %d held, %d static"
+#define STATS_ARGS 59.9712, 12, 3, 1500
+#define JSON_FORMAT "{\"time\":%.3f,\"fps\":%.2f,\"bitrate\":%lld,\"skew\":%g,\"frames\":%u,\"file\":\"%s\"}"
+#define JSON_ARGS 12345.678, 59.94, 48123456ll, -3.2e-5, 740913u, "C:/Captures/capture_2021-06-01_12-34-56.mov"
+
+BENCHMARK(format)
+{
+    printf("                    ns/call  allocs/call\n");
+    auto run = [](const char* name, const auto& func)
+    {
+        double t = TimePerCall(func);
+        const uint count = 10000;
+        uint64 a0 = GetAllocCount();
+        for (uint i = 0; i < count; i++)
+            func();
+        printf("%-20s %7.0f %12.2f\n", name, t * 1e9, (double)(GetAllocCount() - a0) / count);
+    };
+
+    char buf[256];
+    StringBuilder sb;
+    String str;
+
+    printf("stats\n");
+    run("snprintf", [&] { snprintf(buf, sizeof(buf), STATS_FORMAT, STATS_ARGS); });
+    run("FormatTo(Span)", [&] { FormatTo(buf, STATS_FORMAT, STATS_ARGS); });
+    run("FormatTo(sb)", [&] { sb.Clear(); FormatTo(sb, STATS_FORMAT, STATS_ARGS); });
+    run("PrintF", [&] { str = String::PrintF(STATS_FORMAT, STATS_ARGS); });
+
+    printf("json\n");
+    run("snprintf", [&] { snprintf(buf, sizeof(buf), JSON_FORMAT, JSON_ARGS); });
+    run("FormatTo(Span)", [&] { FormatTo(buf, JSON_FORMAT, JSON_ARGS); });
+    run("FormatTo(sb)", [&] { sb.Clear(); FormatTo(sb, JSON_FORMAT, JSON_ARGS); });
+    run("PrintF", [&] { str = String::PrintF(JSON_FORMAT, JSON_ARGS); });
+}
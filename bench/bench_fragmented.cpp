@@ -0,0 +1,246 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "bench.h"
+#include "encode.h"
+#include "output.h"
+#include "screencapture.h"
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+// Fragmented writing: kill the process that's recording, and what's on disk
+// still has to play
+
+static constexpr uint SizeX = 320;
+static constexpr uint SizeY = 180;
+static constexpr uint Rate = 60;
+
+// pass-through encoder into Output_LibAV, roughly in real time
+static void WriteFrames(const char* filename, bool fragmented, uint frames, Array<KeyframeEntry>* keyframes = nullptr)
+{
+    CaptureConfig cfg;
+    const char* ext = strrchr(filename, '.');
+    cfg.UseContainer = !strcmp(ext, ".mkv") ? Container::Mkv : !strcmp(ext, ".mov") ? Container::Mov : Container::Mp4;
+    cfg.Fragmented = fragmented;
+    cfg.FragmentMs = 500;
+    cfg.CodecCfg.GopSize = Rate / 2;
+
+    IEncode* encoder = CreateEncodePassthrough(cfg, false);
+    encoder->Init(SizeX, SizeY, Rate, 1, {});
+    IOutput* output = CreateOutputLibAV(OutputPara
+    {
+        .filename = filename,
+        .SizeX = SizeX,
+        .SizeY = SizeY,
+        .RateNum = Rate,
+        .RateDen = 1,
+        .Hdr = false,
+        .Audio = {},
+        .CConfig = &cfg,
+    });
+
+    for (uint frame = 0; frame < frames; frame++)
+    {
+        encoder->SubmitFrame((double)frame / Rate);
+        uint8* data;
+        uint size;
+        double time;
+        if (encoder->BeginGetPacket(data, size, 100, time))
+        {
+            output->SubmitVideoPacket(data, size, time);
+            encoder->EndGetPacket();
+            output->WriteVideo();
+        }
+        Thread::Sleep(1000 / Rate);
+    }
+
+    if (keyframes)
+        output->GetKeyframes(*keyframes);
+    delete output;
+    delete encoder;
+}
+
+// these run until they get killed
+CHILD(fragwriter) { WriteFrames(arg, true, UINT_MAX); }
+CHILD(plainwriter) { WriteFrames(arg, false, UINT_MAX); }
+
+struct PlayResult
+{
+    bool Opened;
+    uint Packets;
+    uint Keyframes;
+    bool FirstIsKey;
+    uint Decoded;           // frames out of the decoder
+    uint Errors;            // packets that didn't demux in order or decode
+    uint LastError;         // packet number of the last error (1 based)
+};
+
+// demuxes and decodes the video, like a player would
+static PlayResult Play(const char* filename)
+{
+    PlayResult res = {};
+    AVFormatContext* fmt = nullptr;
+    if (avformat_open_input(&fmt, filename, nullptr, nullptr) < 0)
+        return res;
+
+    const AVCodec* codec = nullptr;
+    int stream = -1;
+    if (avformat_find_stream_info(fmt, nullptr) >= 0)
+        stream = av_find_best_stream(fmt, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (stream < 0)
+    {
+        avformat_close_input(&fmt);
+        return res;
+    }
+    res.Opened = true;
+
+    AVCodecContext* dec = avcodec_alloc_context3(codec);
+    avcodec_parameters_to_context(dec, fmt->streams[stream]->codecpar);
+    bool decoding = avcodec_open2(dec, codec, nullptr) >= 0;
+
+    AVPacket* pkt = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    int64 lastPts = INT64_MIN;
+    auto error = [&] { res.Errors++; res.LastError = res.Packets; };
+
+    while (av_read_frame(fmt, pkt) >= 0)
+    {
+        if (pkt->stream_index == stream)
+        {
+            res.Packets++;
+            if (pkt->flags & AV_PKT_FLAG_KEY)
+            {
+                res.Keyframes++;
+                if (res.Packets == 1)
+                    res.FirstIsKey = true;
+            }
+
+            // no B frames, so the timestamps go up one by one
+            if (pkt->pts == AV_NOPTS_VALUE || pkt->pts <= lastPts)
+                error();
+            lastPts = pkt->pts;
+
+            if (!decoding || avcodec_send_packet(dec, pkt) < 0)
+                error();
+            while (decoding && avcodec_receive_frame(dec, frame) >= 0)
+                res.Decoded++;
+        }
+        av_packet_unref(pkt);
+    }
+
+    if (decoding && avcodec_send_packet(dec, nullptr) >= 0)
+        while (avcodec_receive_frame(dec, frame) >= 0)
+            res.Decoded++;
+
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    avcodec_free_context(&dec);
+    avformat_close_input(&fmt);
+    return res;
+}
+
+static String BenchFile(const char* name)
+{
+    return String::PrintF("%s/capturinha_%s", (const char*)GetBenchDir(), name);
+}
+
+TEST(fragmented)
+{
+    static const char* const exts[] = { "mp4", "mov", "mkv" };
+
+    // closed normally, everything's there
+    for (const char* ext : exts)
+    {
+        String name = BenchFile(String::PrintF("frag_closed.%s", ext));
+        Array<KeyframeEntry> keyframes;
+        WriteFrames(name, true, 90, &keyframes);
+        PlayResult res = Play(name);
+        RemoveFile(name);
+
+        // the keyframe index has what the player saw
+        CHECK(keyframes.Len() == 3);
+        for (uint i = 0; i < keyframes.Len(); i++)
+            CHECK(keyframes[i].FrameNo == i * Rate / 2 && keyframes[i].Size > 0 && !keyframes[i].Segment);
+
+        CHECK(res.Opened);
+        CHECK(res.Packets == 90);
+        CHECK(res.FirstIsKey && res.Keyframes == 3);
+        CHECK(res.Decoded == 90);
+        CHECK(!res.Errors);
+    }
+
+    // killed mid recording: every fragment that made it to disk plays, and after
+    // a few seconds there's at least one. Only the packet the file got cut in
+    // may be broken
+    for (const char* ext : exts)
+    {
+        String name = BenchFile(String::PrintF("frag_killed.%s", ext));
+        RemoveFile(name);
+        {
+            ChildProcess writer("fragwriter", name);
+            Thread::Sleep(3000);
+            writer.Kill();
+        }
+        PlayResult res = Play(name);
+        RemoveFile(name);
+
+        const uint fragment = Rate / 2;
+        if (!res.Opened || res.Packets < fragment || res.Errors)
+            printf("  %s: %s, %u packets, %u decoded, %u errors\n", ext, res.Opened ? "opened" : "didn't open", res.Packets, res.Decoded, res.Errors);
+        CHECK(res.Opened);
+        CHECK(res.Packets >= fragment);
+        CHECK(res.FirstIsKey);
+        CHECK(res.Decoded + 1 >= res.Packets);
+        CHECK(!res.Errors || (res.Errors == 1 && res.LastError == res.Packets));
+    }
+
+    // and the same without fragments, to see the test can fail: an mp4 without
+    // its trailer has no index
+    {
+        String name = BenchFile("plain_killed.mp4");
+        RemoveFile(name);
+        {
+            ChildProcess writer("plainwriter", name);
+            Thread::Sleep(3000);
+            writer.Kill();
+        }
+        PlayResult res = Play(name);
+        RemoveFile(name);
+        CHECK(!res.Opened || !res.Packets);
+    }
+}
+
+TEST(keyframeindex)
+{
+    // keeps the newest Capacity entries, oldest first
+    KeyframeIndex index;
+    Array<KeyframeEntry> out;
+    index.Get(out);
+    CHECK(!out.Len() && !index.GetCount() && !index.GetLast().FrameNo);
+
+    const uint64 total = KeyframeIndex::Capacity + 100;
+    for (uint64 i = 0; i < total; i++)
+        index.Add(KeyframeEntry{ .FrameNo = i * 60, .Pts = (int64)i * 60, .Size = 1000, .Segment = (uint)(i / 1000) });
+
+    index.Get(out);
+    CHECK(index.GetCount() == total);
+    CHECK(out.Len() == KeyframeIndex::Capacity);
+    CHECK(out[0].FrameNo == 100 * 60);
+    CHECK(out[out.Len() - 1].FrameNo == (total - 1) * 60);
+    CHECK(index.GetLast().Segment == (uint)((total - 1) / 1000));
+
+    bool ordered = true;
+    for (uint i = 1; i < out.Len(); i++)
+        ordered &= out[i].FrameNo == out[i - 1].FrameNo + 60;
+    CHECK(ordered);
+}
@@ -0,0 +1,166 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include <stdio.h>
+#include <math.h>
+
+#include "bench.h"
+#include "framepacer.h"
+
+// FramePacer against synthetic present traces: whatever comes in, the output
+// has to stay on real time within the drift limit, and only duplicate or drop
+// what the trace actually asks for
+
+using TracePara = FramePacerSim::TracePara;
+
+struct PacerRun
+{
+    FramePacerSim::Result Res;
+    double Seconds;     // first to last present
+    double Expected;    // output frames real time asks for
+};
+
+static PacerRun RunTrace(const TracePara& trace, uint rateNum = 60, uint rateDen = 1)
+{
+    Array<double> presents;
+    FramePacerSim::Generate(presents, trace);
+
+    FramePacer::Para para;
+    para.RateNum = rateNum;
+    para.RateDen = rateDen;
+
+    PacerRun run;
+    run.Res = FramePacerSim::Run(para, presents, {});
+    run.Seconds = presents[presents.Len() - 1] - presents[0];
+    run.Expected = run.Seconds * rateNum / rateDen + 1;
+    return run;
+}
+
+// what has to hold for any trace
+static bool CheckCommon(const char* name, const PacerRun& run, uint rateNum = 60, uint rateDen = 1)
+{
+    const FramePacer::Para para;
+    const double frame = (double)rateDen / rateNum;
+    const auto& r = run.Res;
+
+    bool ok = true;
+    ok &= r.Emitted + r.Dropped == r.Presents;
+    ok &= fabs(r.Drift) <= para.DriftLimit * frame + 1e-9;
+    ok &= r.MaxDrift <= para.DriftLimit * frame + 1e-9;
+    ok &= fabs((double)(r.Emitted + r.Duplicates) - run.Expected) <= 1;
+    if (!ok)
+        printf("  %s: %llu presents, %llu emitted, %llu dups, %llu dropped, drift %.2f max %.2f frames, %.1f frames expected\n", name,
+            (unsigned long long)r.Presents, (unsigned long long)r.Emitted, (unsigned long long)r.Duplicates, (unsigned long long)r.Dropped,
+            r.Drift / frame, r.MaxDrift / frame, run.Expected);
+    return ok;
+}
+
+TEST(framepacer_jitter)
+{
+    // exactly on the refresh: nothing to do
+    {
+        auto run = RunTrace({});
+        CHECK(CheckCommon("60 on 60", run));
+        CHECK(!run.Res.Duplicates && !run.Res.Dropped);
+    }
+
+    // jitter up to a quarter frame without vsync stays within the rounding
+    for (double jitter : { 0.0005, 0.001, 0.002, 0.004 })
+    {
+        auto run = RunTrace({ .VSync = false, .Jitter = jitter });
+        CHECK(CheckCommon("jitter", run));
+        CHECK(!run.Res.Duplicates && !run.Res.Dropped);
+    }
+
+    // with vsync, jitter pushes some presents into the next refresh. Every frame
+    // that lands in the same slot as the one before had a gap in front of it
+    for (double jitter : { 0.0005, 0.002, 0.008 })
+    {
+        auto run = RunTrace({ .Jitter = jitter });
+        CHECK(CheckCommon("jitter vsync", run));
+        CHECK(run.Res.Duplicates == run.Res.Dropped);
+    }
+}
+
+TEST(framepacer_vrr)
+{
+    // 144Hz VRR display, content at anything from 30 to 143fps, into 60fps
+    for (double content : { 30.0, 48.0, 59.0, 61.0, 90.0, 120.0, 143.0 })
+    {
+        auto run = RunTrace({ .RefreshRate = 144, .ContentRate = content, .VSync = false, .Jitter = 0.0005 });
+        CHECK(CheckCommon("vrr", run));
+
+        // slower than 60 only gets duplicates, faster only drops, each as
+        // many as the rates say
+        double frames = (double)run.Res.Presents;
+        if (content < 60)
+        {
+            CHECK(!run.Res.Dropped);
+            CHECK(fabs((double)run.Res.Duplicates - frames * (60 / content - 1)) <= 2);
+        }
+        else
+        {
+            CHECK(!run.Res.Duplicates);
+            CHECK(fabs((double)run.Res.Dropped - frames * (1 - 60 / content)) <= 2);
+        }
+    }
+}
+
+TEST(framepacer_ntsc)
+{
+    // 59.94fps content on a 60Hz display: one duplicate every 1000 frames
+    {
+        auto run = RunTrace({ .ContentRate = 60000.0 / 1001, .Frames = 100000 });
+        CHECK(CheckCommon("59.94 on 60", run));
+        CHECK(!run.Res.Dropped);
+        CHECK(run.Res.Duplicates >= 99 && run.Res.Duplicates <= 101);
+    }
+
+    // and the other way around, 60fps presents into 59.94fps output
+    {
+        auto run = RunTrace({ .VSync = false, .Frames = 100000 }, 60000, 1001);
+        CHECK(CheckCommon("60 into 59.94", run, 60000, 1001));
+        CHECK(!run.Res.Duplicates);
+        CHECK(run.Res.Dropped >= 99 && run.Res.Dropped <= 101);
+    }
+}
+
+TEST(framepacer_stalls)
+{
+    // the application hangs every 3 seconds: the gaps get filled with exactly
+    // as many duplicates as they're long, and nothing gets dropped
+    for (double length : { 0.05, 0.1, 0.5, 2.0 })
+    {
+        TracePara trace = { .StallEvery = 3, .StallLength = length, .Frames = 36000 };
+        auto run = RunTrace(trace);
+        CHECK(CheckCommon("stalls", run));
+        CHECK(!run.Res.Dropped);
+
+        double stalled = run.Seconds - (trace.Frames - 1) / trace.ContentRate;
+        CHECK(fabs((double)run.Res.Duplicates - stalled * 60) <= 1);
+    }
+}
+
+BENCHMARK(framepacer)
+{
+    // the simulator itself, traces pregenerated
+    static const struct { TracePara Trace; const char* Name; } traces[] =
+    {
+        { { .Frames = 1000000 }, "60 on 60" },
+        { { .Jitter = 0.002, .Frames = 1000000 }, "jitter 2ms vsync" },
+        { { .RefreshRate = 144, .ContentRate = 90, .VSync = false, .Jitter = 0.0005, .Frames = 1000000 }, "vrr 90 on 144" },
+        { { .ContentRate = 60000.0 / 1001, .Frames = 1000000 }, "59.94 on 60" },
+        { { .StallEvery = 3, .StallLength = 0.5, .Frames = 1000000 }, "stalls 0.5s every 3s" },
+    };
+
+    printf("                          Mframes/s\n");
+    for (auto& t : traces)
+    {
+        Array<double> presents;
+        FramePacerSim::Generate(presents, t.Trace);
+        double time = TimePerCall([&] { FramePacerSim::Run({}, presents, {}); });
+        printf("%-24s %10.1f\n", t.Name, presents.Len() / time / 1e6);
+    }
+}
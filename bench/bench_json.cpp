@@ -0,0 +1,565 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <bit>
+
+#include "bench.h"
+#include "json.h"
+#include "screencapture.h"
+
+// JsonReader and Json: strings, numbers (against strtod), errors, member lookup,
+// and what reading and writing costs on a large file
+
+static ReadOnlySpan<char> Text(const char* text) { return ReadOnlySpan<char>(text, strlen(text)); }
+
+// the first error, or "" if there wasn't one
+static String FirstError(const JsonReader& reader)
+{
+    return reader.GetErrors().Len() ? reader.GetErrors()[0] : String();
+}
+
+static bool ReadString(const char* json, const char* want, size_t wantLen)
+{
+    JsonReader reader(Text(json));
+    ReadOnlySpan<char> str;
+    bool ok = reader.StringView(str) && !!reader && str.Len() == wantLen && !memcmp(str.Ptr(), want, wantLen);
+    if (!ok)
+        printf("  %s: got \"%.*s\" %s\n", json, (int)str.Len(), str.Ptr(), (const char*)FirstError(reader));
+    return ok;
+}
+
+static bool ReadString(const char* json, const char* want) { return ReadString(json, want, strlen(want)); }
+
+static bool ReadError(const char* json, const char* want)
+{
+    JsonReader reader(Text(json));
+    ReadOnlySpan<char> str;
+    reader.StringView(str);
+    String err = FirstError(reader);
+    if (err != want)
+        printf("  %s: \"%s\", expected \"%s\"\n", json, (const char*)err, want);
+    return err == want;
+}
+
+TEST(json_strings)
+{
+    CHECK(ReadString(R"("plain")", "plain"));
+    CHECK(ReadString(R"("")", ""));
+    CHECK(ReadString(R"(  "after space")", "after space"));
+
+    // all the escapes, also at the very start and end
+    CHECK(ReadString(R"("\"quoted\"")", "\"quoted\""));
+    CHECK(ReadString(R"("a\\b\/c")", "a\\b/c"));
+    CHECK(ReadString(R"("\r\n\t\b\f")", "\r\n\t\b\f"));
+    CHECK(ReadString(R"("long enough to not be all escapes\n")", "long enough to not be all escapes\n"));
+
+    // \u: 1, 2 and 3 byte UTF-8, and a surrogate pair into 4
+    CHECK(ReadString(R"("\u0041\u00e9\u20AC")", "A\xc3\xa9\xe2\x82\xac"));
+    CHECK(ReadString(R"("\u0000")", "\0", 1));
+    CHECK(ReadString(R"("\ud83d\ude00")", "\xf0\x9f\x98\x80"));
+    CHECK(ReadString(R"("\uD834\uDD1E")", "\xf0\x9d\x84\x9e"));
+    CHECK(ReadString(R"("\udbff\udfff")", "\xf4\x8f\xbf\xbf"));
+
+    // a high surrogate without its low half stays what it is (as CESU-8 style bytes),
+    // and whatever comes after it is read normally
+    CHECK(ReadString(R"("\ud83dx")", "\xed\xa0\xbdx"));
+    CHECK(ReadString(R"("\ud83d\u0041")", "\xed\xa0\xbd" "A"));
+
+    // broken ones
+    CHECK(ReadError(R"("\x")", "Error (1,2): invalid escape \\x"));
+    CHECK(ReadError(R"("\u12")", "Error (1,3): invalid \\u escape"));
+    CHECK(ReadError(R"("\u12g4")", "Error (1,3): invalid \\u escape"));
+    CHECK(ReadError("\"no end", "Error (1,7): expected \""));
+    CHECK(ReadError("\"line\nbreak\"", "Error (2,0): expected \""));   // looked for it past the line break
+    CHECK(ReadError("nope", "Error (1,0): expected \""));
+}
+
+struct JsonInts
+{
+    int8 I8 = 0;
+    uint8 U8 = 0;
+    int16 I16 = 0;
+    uint16 U16 = 0;
+    int I32 = 0;
+    uint U32 = 0;
+    int64 I64 = 0;
+
+    JSON_BEGIN();
+        JSON_VALUE(I8);
+        JSON_VALUE(U8);
+        JSON_VALUE(I16);
+        JSON_VALUE(U16);
+        JSON_VALUE(I32);
+        JSON_VALUE(U32);
+        JSON_VALUE(I64);
+    JSON_END();
+};
+
+static bool ReadInts(const char* json, const char* wantError, JsonInts* out = nullptr)
+{
+    JsonInts ints;
+    Array<String> errors;
+    Json::Deserialize(json, ints, errors);
+    String err = errors.Len() ? errors[0] : String();
+    if (err != wantError)
+        printf("  %s: \"%s\", expected \"%s\"\n", json, (const char*)err, wantError);
+    if (out)
+        *out = ints;
+    return err == wantError;
+}
+
+TEST(json_errors)
+{
+    // line and column of what went wrong, both counting from where the reader stands:
+    // line from 1, column from 0
+    {
+        JsonInts ints;
+        Array<String> errors;
+        CHECK(!Json::Deserialize("{\n  \"I8\": 1,\n  \"U8\" 2\n}", ints, errors));
+        CHECK(errors.Len() == 1 && errors[0] == "Error (3,7): expected :");
+    }
+    {
+        JsonInts ints;
+        Array<String> errors;
+        CHECK(!Json::Deserialize("{ \"I8\": 1 \"U8\": 2 }", ints, errors));
+        CHECK(errors.Len() == 1 && errors[0] == "Error (1,10): expected ,");
+    }
+    {
+        JsonInts ints;
+        Array<String> errors;
+        CHECK(!Json::Deserialize("{\r\n\"I8\": -\r\n}", ints, errors));
+        CHECK(errors.Len() && errors[0] == "Error (2,6): Number expected");    // and more after it
+    }
+
+    // every integer size at its limits, and one past them
+    JsonInts ints;
+    CHECK(ReadInts(R"({ "I8": -128, "U8": 255, "I16": -32768, "U16": 65535, "I32": -2147483648, "U32": 4294967295, "I64": -9223372036854775808 })", "", &ints));
+    CHECK(ints.I8 == -128 && ints.U8 == 255 && ints.I16 == -32768 && ints.U16 == 65535);
+    CHECK(ints.I32 == (int)0x80000000 && ints.U32 == 0xffffffff && ints.I64 == (int64)0x8000000000000000ull);
+    CHECK(ReadInts(R"({ "I64": 9223372036854775807 })", "", &ints) && ints.I64 == 0x7fffffffffffffffll);
+
+    CHECK(ReadInts(R"({ "I8": 128 })", "Error (1,11): Number too large (max: 127)", &ints) && ints.I8 == 127);
+    CHECK(ReadInts(R"({ "I8": -129 })", "Error (1,12): Number too small (min: -128)", &ints) && ints.I8 == -128);
+    CHECK(ReadInts(R"({ "U8": -1 })", "Error (1,10): Number too small (min: 0)", &ints) && ints.U8 == 0);
+    CHECK(ReadInts(R"({ "U16": 65536 })", "Error (1,14): Number too large (max: 65535)"));
+    CHECK(ReadInts(R"({ "I32": 2147483648 })", "Error (1,19): Number too large (max: 2147483647)"));
+    CHECK(ReadInts(R"({ "U32": 4294967296 })", "Error (1,19): Number too large (max: 4294967295)"));
+    CHECK(ReadInts(R"({ "I64": 9223372036854775808 })", "Error (1,28): Number too large", &ints) && ints.I64 == 0x7fffffffffffffffll);
+    CHECK(ReadInts(R"({ "I64": -9223372036854775809 })", "Error (1,29): Number too small"));
+    CHECK(ReadInts(R"({ "I64": 100000000000000000000000 })", "Error (1,33): Number too large"));
+
+    // not integers, but still numbers: these convert
+    CHECK(ReadInts(R"({ "I32": 1e3, "I16": -2.75, "I64": 1.5e300 })", "", &ints));
+    CHECK(ints.I32 == 1000 && ints.I16 == -2 && ints.I64 == 0x7ffffffffffffc00ll);
+    CHECK(ReadInts(R"({ "I32": 00042 })", "", &ints) && ints.I32 == 42);
+}
+
+static double ParseDouble(const char* text, bool* ok = nullptr)
+{
+    JsonReader reader(Text(text));
+    double v = 0;
+    bool res = reader.Number(v);
+    if (ok) *ok = res && !!reader;
+    return v;
+}
+
+// same bits as strtod
+static bool SameAsStrtod(const char* text)
+{
+    bool ok;
+    double v = ParseDouble(text, &ok);
+    double want = strtod(text, nullptr);
+    if (!ok || std::bit_cast<uint64>(v) != std::bit_cast<uint64>(want))
+    {
+        printf("  %s: %.17g, strtod says %.17g\n", text, v, want);
+        return false;
+    }
+    return true;
+}
+
+struct JsonDoubles
+{
+    Array<double> D;
+    float F = 0;
+
+    JSON_BEGIN();
+        JSON_VALUE(D);
+        JSON_VALUE(F);
+    JSON_END();
+};
+
+TEST(json_numbers)
+{
+    static const char* const cases[] =
+    {
+        // plain, and Clinger's fast path limits
+        "0", "-0", "1", "-1", "0.1", "3.141592653589793", "1e22", "1e23", "9007199254740992", "9007199254740993",
+        "123456789012345678", "0.000001", "1.7976931348623157e308", "2.2250738585072014e-308",
+
+        // halfway between two doubles: round to even, and a hair off either way
+        "9007199254740993", "9007199254740995", "9007199254740993.0000000001", "9007199254740992.9999999999",
+        "1.00000000000000011102230246251565404236316680908203125",
+        "1.00000000000000011102230246251565404236316680908203124",
+        "1.00000000000000011102230246251565404236316680908203126",
+        "7.2057594037927933e16", "1.8014398509481984e16", "9.5e-5",
+
+        // subnormals, down to the smallest and just under half of it
+        "2.2250738585072011e-308", "2.2250738585072009e-308", "4.9406564584124654e-324", "5e-324",
+        "2.4703282292062328e-324", "2.4703282292062327e-324", "1e-320", "3e-320", "1.23456789e-310",
+
+        // more than 19 digits, where the cut off part decides
+        "12345678901234567890", "123456789012345678901234567890", "0.12345678901234567890123456789",
+        "1234567890123456789.5", "1844674407370955161599999999999", "18446744073709551616",
+        "3.14159265358979323846264338327950288419716939937510582097494459",
+        "100000000000000000000000000000000000000000000000000000000000000000000",
+        "0.0000000000000000000000000000000000000000000000000000000000000000001",
+        "2.47032822920623272088284396434110686182529901307162382212792841250337753635104375932649918180817996189898282347722858865463328355177969898199387398005390939063150356595155702263922908583924491051844359318028499365361525003193704576782492193656236698636584807570015857692699037063119282795585513329278343384093519780155312465972635795746227664652728272200563740064854999770965994704540208281662262378573934507363390079677619305775067401763246736009689513405355374585166611342237666786041621596804619144672918403005300575308490487653917113865916462395249126236538818796362393732804238910186723484976682350898633885879256283027559956575244555072551893136908362547791869486679949683240497058210285131854513962138377228261454376934125320985913276672363281255e-324",
+
+        // out of range: infinity and zero, like strtod
+        "1e400", "-1e400", "1e309", "1e-400", "-1e-400", "1e-330", "1e100000",
+    };
+
+    for (const char* c : cases)
+        CHECK(SameAsStrtod(c));
+
+    // random doubles, printed shortest and with all 17 digits, read back exactly
+    uint64 seed = 0x123456789abcdefull;
+    uint mismatches = 0;
+    for (uint i = 0; i < 100000; i++)
+    {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        double v = std::bit_cast<double>(seed);
+        if (!isfinite(v))
+            continue;
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.17g", v);
+        mismatches += std::bit_cast<uint64>(ParseDouble(buf)) != seed;
+        snprintf(buf, sizeof(buf), "%.9e", v);
+        mismatches += !SameAsStrtod(buf);
+    }
+    CHECK(!mismatches);
+
+    // random digit strings around every power of ten, 1 to 25 significant digits
+    mismatches = 0;
+    for (int exp = -340; exp <= 310; exp++)
+        for (uint digits = 1; digits <= 25; digits++)
+        {
+            char buf[64];
+            int len = 0;
+            for (uint d = 0; d < digits; d++)
+            {
+                seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+                buf[len++] = (char)('0' + (seed >> 33) % 10);
+                if (!d && digits > 1)
+                    buf[len++] = '.';
+            }
+            if (buf[0] == '0') buf[0] = '1';
+            snprintf(buf + len, sizeof(buf) - len, "e%d", exp);
+            mismatches += !SameAsStrtod(buf);
+        }
+    CHECK(!mismatches);
+
+    // and through Json, which writes as few digits as it takes
+    {
+        JsonDoubles doubles, back;
+        for (uint i = 0; i < 10000; i++)
+        {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            double v = std::bit_cast<double>(seed);
+            doubles.D += isfinite(v) ? v : (double)i;
+        }
+        for (double v : { 0.0, -0.0, 1e-7, 59.94, 5e-324, 1.7976931348623157e308 })
+            doubles.D += v;
+        doubles.F = 0.1f;
+
+        String json = Json::Serialize(doubles);
+        CHECK(Json::Deserialize(json, back));
+        CHECK(back.D.Len() == doubles.D.Len() && !memcmp(back.D.Ptr(), doubles.D.Ptr(), back.D.Len() * sizeof(double)));
+        CHECK(back.F == 0.1f);
+        CHECK(strstr(json, ",59.94,"));
+    }
+
+    // not numbers
+    bool ok;
+    ParseDouble("-", &ok); CHECK(!ok);
+    ParseDouble("1.", &ok); CHECK(!ok);
+    ParseDouble("1e", &ok); CHECK(!ok);
+    ParseDouble(".5", &ok); CHECK(!ok);
+}
+
+// the member tables: any case of a name finds it, anything else is an unknown key
+
+enum class JsonColor { Red, Green, DarkBlue };
+JSON_DEFINE_ENUM(JsonColor, "red", "green", "dark_blue")
+
+struct JsonEmpty
+{
+    JSON_BEGIN();
+    JSON_END();
+};
+
+struct JsonInner
+{
+    int X = 0;
+    JsonColor Color = JsonColor::Red;
+    Array<int> List;
+
+    JSON_BEGIN();
+        JSON_VALUE(X);
+        JSON_ENUM(Color);
+        JSON_VALUE(List);
+    JSON_END();
+};
+
+struct JsonOuter
+{
+    String Name;
+    JsonInner Inner;
+    Array<JsonInner> Inners;
+    JsonEmpty Empty;
+    JsonColor Color = JsonColor::Red;
+    double Value = 0;
+
+    JSON_BEGIN();
+        JSON_VALUE(Name);
+        JSON_VALUE(Inner);
+        JSON_VALUE(Inners);
+        JSON_VALUE(Empty);
+        JSON_ENUM_NAME(Color, "colour");
+        JSON_VALUE_NAME(Value, "the_value");
+    JSON_END();
+};
+
+template<class T> static bool ReadKeys(const char* json, const char* wantError, T& into)
+{
+    Array<String> errors;
+    Json::Deserialize(json, into, errors);
+    String err = errors.Len() ? errors[0] : String();
+    if (err != wantError)
+        printf("  %s: \"%s\", expected \"%s\"\n", json, (const char*)err, wantError);
+    return err == wantError;
+}
+
+TEST(json_keys)
+{
+    // every member once, in any case
+    {
+        JsonInts ints;
+        CHECK(ReadKeys(R"({ "i8": 1, "U8": 2, "i16": 3, "u16": 4, "I32": 5, "u32": 6, "i64": 7 })", "", ints));
+        CHECK(ints.I8 == 1 && ints.U8 == 2 && ints.I16 == 3 && ints.U16 == 4 && ints.I32 == 5 && ints.U32 == 6 && ints.I64 == 7);
+    }
+
+    // key names with escapes get looked up like any other
+    {
+        JsonInts ints;
+        CHECK(ReadKeys(R"({ "I\u00316": 3 })", "", ints) && ints.I16 == 3);
+    }
+
+    // unknown keys, reported right after the colon, and the name as it was in the text
+    {
+        JsonInts ints;
+        CHECK(ReadKeys(R"({ "I8": 1, "Nope": 2 })", "Error (1,18): Unknown key: Nope", ints));
+        CHECK(ints.I8 == 1);
+        CHECK(ReadKeys("{\n  \"I8\": 1,\n  \"i_8\": 2\n}", "Error (3,8): Unknown key: i_8", ints));
+        CHECK(ReadKeys(R"({ "I": 1 })", "Error (1,6): Unknown key: I", ints));          // a prefix
+        CHECK(ReadKeys(R"({ "I80": 1 })", "Error (1,8): Unknown key: I80", ints));     // one longer
+        CHECK(ReadKeys(R"({ "": 1 })", "Error (1,5): Unknown key: ", ints));
+        CHECK(ReadKeys(R"({ "N\u006fpe": 1 })", "Error (1,14): Unknown key: Nope", ints));    // from the scratch buffer
+    }
+
+    // nothing to find in a struct without members
+    {
+        JsonEmpty empty;
+        CHECK(Json::Serialize(empty) == "{}");
+        CHECK(ReadKeys("{}", "", empty));
+        CHECK(ReadKeys(" { } ", "", empty));
+        CHECK(ReadKeys(R"({ "x": 1 })", "Error (1,6): Unknown key: x", empty));
+    }
+
+    // nested objects, enums and arrays, and the names from JSON_*_NAME
+    {
+        JsonOuter outer;
+        CHECK(ReadKeys(R"({
+            "name": "outer",
+            "INNER": { "x": 1, "color": "Green", "list": [ 1, 2, 3 ] },
+            "inners": [ { "X": 2 }, { "Color": "DARK_BLUE", "List": [] }, {} ],
+            "empty": {},
+            "Colour": "dark_blue",
+            "The_Value": 0.5
+        })", "", outer));
+        CHECK(outer.Name == "outer");
+        CHECK(outer.Inner.X == 1 && outer.Inner.Color == JsonColor::Green && outer.Inner.List.Len() == 3 && outer.Inner.List[2] == 3);
+        CHECK(outer.Inners.Len() == 3);
+        CHECK(outer.Inners[0].X == 2 && outer.Inners[1].Color == JsonColor::DarkBlue && outer.Inners[2].X == 0);
+        CHECK(outer.Color == JsonColor::DarkBlue && outer.Value == 0.5);
+
+        // and back, with the names as declared
+        String json = Json::Serialize(outer);
+        CHECK(strstr(json, "\"colour\":\"dark_blue\",\"the_value\":0.5"));
+        JsonOuter back;
+        CHECK(ReadKeys(json, "", back));
+        CHECK(Json::Serialize(back) == json);
+
+        // the member names of the outer object don't exist in the inner ones
+        CHECK(ReadKeys(R"({ "inner": { "name": "x" } })", "Error (1,20): Unknown key: name", outer));
+        CHECK(ReadKeys(R"({ "inners": [ { "x": 1 }, { "value": 2 } ] })", "Error (1,36): Unknown key: value", outer));
+        CHECK(ReadKeys(R"({ "colour": "blue" })", "Error (1,18): Unknown value blue (expected: red, green, dark_blue)", outer));
+    }
+}
+
+// structs with 1 to 64 int members, named M0..M3, M00..M33 and so on
+#define JSON_DISPATCH_4(m, p) m(p##0) m(p##1) m(p##2) m(p##3)
+#define JSON_DISPATCH_16(m, p) JSON_DISPATCH_4(m, p##0) JSON_DISPATCH_4(m, p##1) JSON_DISPATCH_4(m, p##2) JSON_DISPATCH_4(m, p##3)
+#define JSON_DISPATCH_64(m, p) JSON_DISPATCH_16(m, p##0) JSON_DISPATCH_16(m, p##1) JSON_DISPATCH_16(m, p##2) JSON_DISPATCH_16(m, p##3)
+#define JSON_DISPATCH_DECL(v) int v = 0;
+#define JSON_DISPATCH_VALUE(v) JSON_VALUE(v);
+
+struct JsonDispatch1 { int M = 0; JSON_BEGIN(); JSON_VALUE(M); JSON_END(); };
+struct JsonDispatch4 { JSON_DISPATCH_4(JSON_DISPATCH_DECL, M) JSON_BEGIN(); JSON_DISPATCH_4(JSON_DISPATCH_VALUE, M) JSON_END(); };
+struct JsonDispatch16 { JSON_DISPATCH_16(JSON_DISPATCH_DECL, M) JSON_BEGIN(); JSON_DISPATCH_16(JSON_DISPATCH_VALUE, M) JSON_END(); };
+struct JsonDispatch64 { JSON_DISPATCH_64(JSON_DISPATCH_DECL, M) JSON_BEGIN(); JSON_DISPATCH_64(JSON_DISPATCH_VALUE, M) JSON_END(); };
+
+template<class T> static void BenchDispatch(uint count)
+{
+    // every member once, as declared and in lower case
+    String json = Json::Serialize(T());
+    Array<char> lower;
+    lower.SetSize(json.Length() + 1);
+    for (uint i = 0; i <= json.Length(); i++)
+        lower[i] = json[i] == 'M' ? 'm' : json[i];
+
+    T obj;
+    double tDeclared = TimePerCall([&] { Json::Deserialize(json, obj); });
+    double tLower = TimePerCall([&] { Json::Deserialize(lower.Ptr(), obj); });
+    printf("%7u %12.1f %12.1f\n", count, tDeclared / count * 1e9, tLower / count * 1e9);
+}
+
+BENCHMARK(json_keys)
+{
+    // ns per key for a whole object, which includes reading the key string and the
+    // value. The lookup itself shouldn't grow with the number of members
+    printf("members  ns/key as is   lower case\n");
+    BenchDispatch<JsonDispatch1>(1);
+    BenchDispatch<JsonDispatch4>(4);
+    BenchDispatch<JsonDispatch16>(16);
+    BenchDispatch<JsonDispatch64>(64);
+}
+
+// a day of per-second stats, like the stats history would save it
+struct JsonStatsEntry
+{
+    double Time = 0;
+    double Fps = 0;
+    double Bitrate = 0;
+    double Skew = 0;
+    uint Frames = 0;
+    uint Duplicated = 0;
+    uint Dropped = 0;
+    int64 Bytes = 0;
+    bool Recording = false;
+    String Note;
+
+    JSON_BEGIN();
+        JSON_VALUE(Time);
+        JSON_VALUE(Fps);
+        JSON_VALUE(Bitrate);
+        JSON_VALUE(Skew);
+        JSON_VALUE(Frames);
+        JSON_VALUE(Duplicated);
+        JSON_VALUE(Dropped);
+        JSON_VALUE(Bytes);
+        JSON_VALUE(Recording);
+        JSON_VALUE(Note);
+    JSON_END();
+};
+
+struct JsonStatsFile
+{
+    String Name;
+    uint Version = 1;
+    Array<JsonStatsEntry> Entries;
+
+    JSON_BEGIN();
+        JSON_VALUE(Name);
+        JSON_VALUE(Version);
+        JSON_VALUE(Entries);
+    JSON_END();
+};
+
+BENCHMARK(json)
+{
+    JsonStatsFile file;
+    file.Name = "stats \"history\"\n";
+    file.Entries.SetSize(86400 / 4);
+    uint64 seed = 1;
+    for (uint i = 0; i < file.Entries.Len(); i++)
+    {
+        auto& e = file.Entries[i];
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        e.Time = i * 4.0;
+        e.Fps = 59.94 + (double)(seed >> 40) / (1 << 24) - 0.5;
+        e.Bitrate = 50e6 * (double)(seed >> 11) / (1ull << 53);
+        e.Skew = ((double)(seed & 0xffff) - 32768) * 1e-7;
+        e.Frames = 240 + (uint)(seed >> 60);
+        e.Duplicated = (uint)(seed >> 62);
+        e.Dropped = (uint)(seed >> 63);
+        e.Bytes = (int64)(seed >> 20);
+        e.Recording = i % 3 != 0;
+        if (i % 100 == 0)
+            e.Note = String::PrintF("segment %u started, \\o/ \"%u\"", i / 100, i);
+    }
+
+    for (bool pretty : { false, true })
+    {
+        String json;
+        double tWrite = TimePerCall([&] { json = Json::Serialize(file, pretty); });
+
+        JsonStatsFile back;
+        bool ok = true;
+        double tRead = TimePerCall([&] { back = JsonStatsFile(); ok &= Json::Deserialize(json, back); });
+
+        double mb = json.Length() / 1048576.0;
+        printf("%s, %.1f MB:  write %7.1f MB/s   read %7.1f MB/s%s\n", pretty ? "pretty" : "compact",
+            mb, mb / tWrite, mb / tRead, ok && back.Entries.Len() == file.Entries.Len() ? "" : "   (failed)");
+    }
+}
+
+// the config file, which gets read at startup and written on every change in the UI.
+// Short strings don't allocate, so what's left is the JSON text itself, and the
+// directory (which is longer than that, and has escapes to unpack)
+template<class F> static void BenchAllocs(const char* name, const F& func)
+{
+    double t = TimePerCall(func);
+    const uint count = 1000;
+    uint64 a0 = GetAllocCount();
+    for (uint i = 0; i < count; i++)
+        func();
+    printf("%-20s %10.2f %10.2f\n", name, t * 1e6, (double)(GetAllocCount() - a0) / count);
+}
+
+BENCHMARK(json_config)
+{
+    CaptureConfig cfg;
+    cfg.Directory = "C:\\Users\\Somebody\\Videos\\Captures";
+    cfg.NamePrefix = "game";
+    cfg.CodecCfg.CpuPreset = "medium";
+
+    String json = Json::Serialize(cfg);
+    String pretty = Json::Serialize(cfg, true);
+
+    CaptureConfig back;
+    bool ok = Json::Deserialize(json, back) && Json::Serialize(back) == json;
+
+    printf("CaptureConfig, %u bytes    us/call  allocs/call%s\n", (uint)json.Length(), ok ? "" : "   (failed)");
+    BenchAllocs("write", [&] { json = Json::Serialize(cfg); });
+    BenchAllocs("write pretty", [&] { pretty = Json::Serialize(cfg, true); });
+    BenchAllocs("read", [&] { Json::Deserialize(json, back); });
+    BenchAllocs("read pretty", [&] { Json::Deserialize(pretty, back); });
+    BenchAllocs("read into new", [&] { CaptureConfig c; Json::Deserialize(json, c); });
+}
@@ -0,0 +1,98 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include <stdio.h>
+#include <math.h>
+
+#include "bench.h"
+#include "audiometer.h"
+
+static constexpr uint Rate = 48000;
+
+// every channel gets its own sine, at amplitude (ch + 1) / channels
+static void FillSines(Array<float>& out, uint channels, uint frames)
+{
+    out.SetSize((size_t)channels * frames);
+    for (uint i = 0; i < frames; i++)
+        for (uint c = 0; c < channels; c++)
+            out[(size_t)i * channels + c] = (float)(c + 1) / channels * sinf(6.2831853f * (440.0f + 37.0f * c) * i / Rate);
+}
+
+static void ToI16(const Array<float>& in, Array<int16>& out)
+{
+    out.SetSize(in.Len());
+    for (size_t i = 0; i < in.Len(); i++)
+        out[i] = (int16)lrintf(in[i] * 32767.0f);
+}
+
+static AudioMeter::Para MakePara(AudioFormat fmt, uint channels, bool truePeak)
+{
+    return AudioMeter::Para
+    {
+        .Format = fmt,
+        .Channels = channels,
+        .SampleRate = Rate,
+        .TruePeak = truePeak,
+    };
+}
+
+TEST(meter)
+{
+    // all 32 channels see their own signal: peak is the amplitude, RMS amplitude/sqrt(2),
+    // the true peak is at least the sample peak, and I16 says the same as F32
+    const uint channels = AudioMeter::MaxChannels;
+    Array<float> f32;
+    Array<int16> i16;
+    FillSines(f32, channels, Rate);
+    ToI16(f32, i16);
+
+    AudioMeter mf(MakePara(AudioFormat::F32, channels, true));
+    AudioMeter mi(MakePara(AudioFormat::I16, channels, true));
+    mf.Process((const uint8*)f32.Ptr(), (uint)(f32.Len() * sizeof(float)));
+    mi.Process((const uint8*)i16.Ptr(), (uint)(i16.Len() * sizeof(int16)));
+
+    bool ok = true;
+    for (uint c = 0; c < channels; c++)
+    {
+        float amp = (float)(c + 1) / channels;
+        ok &= fabsf(mf.GetPeak(c) - amp) < 0.01f * amp + 1e-3f;
+        ok &= fabsf(mf.GetRms(c) - amp * 0.70710678f) < 0.03f * amp;
+        ok &= mf.GetTruePeak(c) >= mf.GetPeak(c) - 1e-6f && mf.GetTruePeak(c) < amp * 1.05f;
+        ok &= fabsf(mi.GetPeak(c) - mf.GetPeak(c)) < 1e-3f;
+        ok &= fabsf(mi.GetRms(c) - mf.GetRms(c)) < 1e-3f;
+        if (!ok)
+        {
+            printf("  channel %u: peak %f rms %f true peak %f\n", c, mf.GetPeak(c), mf.GetRms(c), mf.GetTruePeak(c));
+            break;
+        }
+    }
+    CHECK(ok);
+}
+
+BENCHMARK(meter)
+{
+    // 10ms chunks, like the audio thread reads them
+    const uint frames = Rate / 100;
+    printf("10ms chunks at %ukHz       us/chunk   x real time\n", Rate / 1000);
+
+    for (uint channels : { 2u, 8u, 32u })
+        for (AudioFormat fmt : { AudioFormat::F32, AudioFormat::I16 })
+            for (bool truePeak : { false, true })
+            {
+                Array<float> f32;
+                Array<int16> i16;
+                FillSines(f32, channels, frames);
+                ToI16(f32, i16);
+                const uint8* data = fmt == AudioFormat::F32 ? (const uint8*)f32.Ptr() : (const uint8*)i16.Ptr();
+                uint size = (uint)(fmt == AudioFormat::F32 ? f32.Len() * sizeof(float) : i16.Len() * sizeof(int16));
+
+                AudioMeter meter(MakePara(fmt, channels, truePeak));
+                double t = TimePerCall([&] { meter.Process(data, size); });
+
+                char label[64];
+                snprintf(label, sizeof(label), "%2u ch %s%s", channels, fmt == AudioFormat::F32 ? "F32" : "I16", truePeak ? " true peak" : "");
+                printf("%-26s %8.2f   %8.0fx\n", label, t * 1e6, 0.01 / t);
+            }
+}
@@ -0,0 +1,168 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include <stdio.h>
+
+#include "bench.h"
+#include "graphics.h"
+#include "encode.h"
+#include "audiocapture.h"
+#include "screencapture.h"
+
+// The whole capture pipeline without a desktop or a GPU: synthetic frames, CPU color
+// conversion, the pass-through encoder, and the real Output_LibAV writing the file.
+// What's left is our own overhead per frame.
+
+struct PipelineResult
+{
+    double Seconds;
+    uint Frames;            // packets written
+    uint Captured;          // new frames converted
+    double CpuCapture;      // ms per frame
+    double CpuProcess;
+    double CpuOther;
+    double Allocs;          // per frame
+    double CpuPerSecond;    // whole process, ms per second recorded
+    uint Duplicated;        // repeats encoded
+    uint Held;              // VFR: repeats that weren't
+    CaptureStats::Latency Drain;
+};
+
+// audio: 48kHz stereo from the synthetic source into that codec, on the audio
+// thread or with the video packets
+struct PipelineAudio
+{
+    bool On = false;
+    AudioCodec Codec = AudioCodec::AAC;
+    bool OwnThread = true;
+};
+
+// video: a new frame every ChangeEvery refreshes, into that encoder
+struct PipelineVideo
+{
+    uint ChangeEvery = 1;
+    bool Vfr = false;
+    EncoderFactory Encoder = CreateEncodePassthrough;
+};
+
+static PipelineResult RunPipeline(uint sizeX, uint sizeY, uint rate, double seconds, const PipelineAudio& audio = {}, const PipelineVideo& video = {})
+{
+    CaptureConfig cfg;
+    cfg.Directory = GetBenchDir();
+    cfg.NamePrefix = "bench";
+    cfg.BlinkScrollLock = false;
+    cfg.RecordOnlyFullscreen = false;
+    cfg.CaptureAudio = false;
+    cfg.UseAudioCodec = audio.Codec;
+    cfg.AudioThread = audio.OwnThread;
+    cfg.CodecCfg.UseBitrateControl = BitrateControl::CBR;
+    cfg.CodecCfg.BitrateParameter = 50000;
+    cfg.VariableFrameRate = video.Vfr;
+
+    IAudioCapture* audioCapture = audio.On ? CreateAudioCaptureSynthetic(48000, 2) : nullptr;
+    IScreenCapture* capture = CreateScreenCaptureHeadless(cfg, CreateFrameSourceSynthetic(sizeX, sizeY, rate, 1, video.ChangeEvery), video.Encoder, audioCapture);
+
+    // let it settle first (threads, pools, file creation), then compare two snapshots
+    Thread::Sleep(1000);
+    CaptureStats s0 = capture->GetStats();
+    uint64 allocs0 = GetAllocCount();
+    int64 ticks0 = GetTicks();
+
+    Thread::Sleep((int)(1000 * seconds));
+
+    uint64 allocs1 = GetAllocCount();
+    int64 ticks1 = GetTicks();
+    CaptureStats s1 = capture->GetStats();
+
+    delete capture;
+    if (s1.Filename.Length())
+        RemoveFile(s1.Filename);
+
+    PipelineResult res = {};
+    res.Seconds = (double)(ticks1 - ticks0) / (double)GetTicksPerSecond();
+    res.Frames = s1.FramesEncoded - s0.FramesEncoded;
+    res.Captured = s1.FramesCaptured - s0.FramesCaptured;
+    res.Duplicated = s1.FramesDuplicated - s0.FramesDuplicated;
+    res.Held = s1.FramesHeld - s0.FramesHeld;
+    res.CpuPerSecond = (s1.CpuTotal - s0.CpuTotal) * 1000.0 / res.Seconds;
+    if (res.Frames)
+    {
+        double toMs = 1000.0 / res.Frames;
+        res.CpuCapture = (s1.CpuCapture - s0.CpuCapture) * toMs;
+        res.CpuProcess = (s1.CpuProcess - s0.CpuProcess) * toMs;
+        res.CpuOther = (s1.CpuTotal - s0.CpuTotal) * toMs - res.CpuCapture - res.CpuProcess;
+        res.Allocs = (double)(allocs1 - allocs0) / res.Frames;
+    }
+    res.Drain = s1.Latencies[(int)CaptureStats::Stage::Drain];
+    return res;
+}
+
+TEST(pipeline)
+{
+    auto res = RunPipeline(320, 180, 60, 1);
+
+    // it's not a benchmark, so just check that everything arrived
+    CHECK(res.Frames > 30);
+    CHECK(res.Captured > 30);
+
+    // same with audio on its own thread
+    res = RunPipeline(320, 180, 60, 1, { .On = true });
+    CHECK(res.Frames > 30);
+}
+
+BENCHMARK(pipeline)
+{
+    static const struct { uint X, Y; } sizes[] = { { 1920, 1080 }, { 3840, 2160 } };
+    static const uint rates[] = { 60, 144, 240 };
+
+    printf("                 fps      CPU ms/frame: capture  process  other   allocs/frame\n");
+    for (auto& size : sizes)
+        for (uint rate : rates)
+        {
+            auto res = RunPipeline(size.X, size.Y, rate, 5);
+            printf("%4ux%-4u @%3u  %7.1f (%3.0f%%)          %7.3f  %7.3f  %7.3f  %6.2f\n",
+                size.X, size.Y, rate, res.Frames / res.Seconds, 100.0 * res.Frames / (res.Seconds * rate),
+                res.CpuCapture, res.CpuProcess, res.CpuOther, res.Allocs);
+        }
+}
+
+BENCHMARK(pipeline_audio)
+{
+    // what encoding audio with the video packets costs the process thread, next
+    // to no audio and the audio thread
+    static const struct { PipelineAudio Audio; const char* Name; } modes[] =
+    {
+        { {}, "no audio" },
+        { { .On = true, .Codec = AudioCodec::PCM_S16, .OwnThread = false }, "pcm_s16, inline" },
+        { { .On = true, .Codec = AudioCodec::PCM_S16, .OwnThread = true }, "pcm_s16, thread" },
+        { { .On = true, .Codec = AudioCodec::AAC, .OwnThread = false }, "aac, inline" },
+        { { .On = true, .Codec = AudioCodec::AAC, .OwnThread = true }, "aac, thread" },
+        { { .On = true, .Codec = AudioCodec::MP3, .OwnThread = false }, "mp3, inline" },
+        { { .On = true, .Codec = AudioCodec::MP3, .OwnThread = true }, "mp3, thread" },
+    };
+
+    printf("1920x1080 @240                 fps    drain ms: p50     p99     max\n");
+    for (auto& mode : modes)
+    {
+        auto res = RunPipeline(1920, 1080, 240, 5, mode.Audio);
+        printf("%-24s %9.1f          %7.3f %7.3f %7.3f\n",
+            mode.Name, res.Frames / res.Seconds, res.Drain.P50, res.Drain.P99, res.Drain.Max);
+    }
+}
+
+BENCHMARK(pipeline_vfr)
+{
+    // a mostly static desktop: one new frame every 30 refreshes. CFR encodes all
+    // the repeats, VFR just makes the frame before last longer
+    printf("1920x1080 @60, new frame every 30      packets  new  dups  held   CPU ms/s\n");
+    for (auto encoder : { CreateEncodePassthrough, CreateEncodeLibAV })
+        for (bool vfr : { false, true })
+        {
+            auto res = RunPipeline(1920, 1080, 60, 10, {}, { .ChangeEvery = 30, .Vfr = vfr, .Encoder = encoder });
+            char label[64];
+            snprintf(label, sizeof(label), "%s, %s", encoder == CreateEncodeLibAV ? "libx264" : "pass-through", vfr ? "VFR" : "CFR");
+            printf("%-36s %9u %4u %5u %5u %10.1f\n", label, res.Frames, res.Captured, res.Duplicated, res.Held, res.CpuPerSecond);
+        }
+}
@@ -0,0 +1,195 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include <stdio.h>
+
+#include "bench.h"
+
+// the mutex based queue from before the lock free ones, as a baseline
+template <typename T, int SIZE> class MutexQueue
+{
+public:
+
+    bool Enqueue(const T &value)
+    {
+        ScopeLock lock(Lock);
+        if (IsFull()) return false;
+        Buffer[(Write++) % SIZE] = value;
+        return true;
+    }
+
+    bool Dequeue(T &value)
+    {
+        ScopeLock lock(Lock);
+        if (IsEmpty()) return false;
+        value = Buffer[(Read++) % SIZE];
+        if (Write >= SIZE && Read >= SIZE)
+        {
+            Write -= SIZE;
+            Read -= SIZE;
+        }
+        return true;
+    }
+
+    int  Len() { ScopeLock lock(Lock);  return (int)(Write - Read); }
+    bool IsEmpty() { ScopeLock lock(Lock); return Write == Read; }
+    bool IsFull() { ScopeLock lock(Lock); return Write - Read == SIZE; }
+
+private:
+    ThreadLock Lock;
+    uint Read = 0;
+    uint Write = 0;
+    T Buffer[SIZE];
+};
+
+// producers push count values each (tagged with their index), consumers pop until
+// everything's through. Whoever has to wait yields, so this works on few cores too. Returns the seconds it took; sum gets the sum of all values popped
+template <typename Q> static double RunQueue(Q& queue, uint producers, uint consumers, uint64 count, uint64& sum)
+{
+    std::atomic<uint64> popped = 0;
+    std::atomic<uint64> total = 0;
+    std::atomic<uint> ready = 0;
+    const uint64 all = count * producers;
+
+    Array<Thread*> threads;
+    for (uint p = 0; p < producers; p++)
+        threads += new Thread([&, p](Thread&)
+        {
+            ready++;
+            while (ready < producers + consumers)
+                Thread::Sleep(0);
+            for (uint64 i = 0; i < count; i++)
+                while (!queue.Enqueue((uint64)p << 40 | i))
+                    Thread::Sleep(0);
+        });
+    for (uint c = 0; c < consumers; c++)
+        threads += new Thread([&](Thread&)
+        {
+            ready++;
+            while (ready < producers + consumers)
+                Thread::Sleep(0);
+            uint64 mySum = 0, value = 0;
+            while (popped < all)
+            {
+                if (queue.Dequeue(value))
+                {
+                    mySum += value;
+                    popped++;
+                }
+                else
+                    Thread::Sleep(0);
+            }
+            total += mySum;
+        });
+
+    // deleting a Thread joins it
+    int64 start = GetTicks();
+    for (Thread* t : threads)
+        delete t;
+    int64 end = GetTicks();
+    sum = total;
+    return (double)(end - start) / (double)GetTicksPerSecond();
+}
+
+static uint64 ExpectedSum(uint producers, uint64 count)
+{
+    uint64 sum = 0;
+    for (uint p = 0; p < producers; p++)
+        sum += ((uint64)p << 40) * count + count * (count - 1) / 2;
+    return sum;
+}
+
+TEST(queue)
+{
+    // single threaded basics
+    {
+        Queue<int, 8> q;
+        CHECK(q.IsEmpty() && q.Len() == 0);
+        for (int i = 0; i < 8; i++)
+            CHECK(q.Enqueue(i));
+        CHECK(!q.Enqueue(8));
+        CHECK(q.IsFull() && q.Len() == 8);
+
+        int values[5];
+        CHECK(q.DequeueBatch(values) == 5);
+        CHECK(values[0] == 0 && values[4] == 4);
+        CHECK(q.Len() == 3);
+
+        int more[] = { 8, 9, 10, 11, 12, 13 };
+        CHECK(q.EnqueueBatch(more) == 5);
+        int v = -1;
+        CHECK(q.Peek(v) && v == 5);
+        for (int i = 5; i < 13; i++)
+            CHECK(q.Dequeue(v) && v == i);
+        CHECK(!q.Dequeue(v) && q.IsEmpty());
+    }
+    {
+        SpscQueue<int, 4> q;
+        for (int i = 0; i < 4; i++)
+            CHECK(q.Enqueue(i));
+        CHECK(!q.Enqueue(4) && q.IsFull());
+        int v = -1;
+        for (int i = 0; i < 4; i++)
+            CHECK(q.Dequeue(v) && v == i);
+        CHECK(!q.Dequeue(v) && q.IsEmpty());
+    }
+
+    // everything arrives exactly once under contention
+    uint64 sum;
+    {
+        static Queue<uint64, 64> q;
+        RunQueue(q, 4, 4, 200000, sum);
+        CHECK(sum == ExpectedSum(4, 200000));
+        CHECK(q.IsEmpty());
+    }
+    {
+        static SpscQueue<uint64, 64> q;
+        RunQueue(q, 1, 1, 1000000, sum);
+        CHECK(sum == ExpectedSum(1, 1000000));
+        CHECK(q.IsEmpty());
+    }
+
+    // Len() from a third thread never leaves 0..SIZE, and an empty queue reads as empty
+    {
+        static Queue<uint64, 16> q;
+        std::atomic<uint> bad = 0;
+        Thread* watcher = new Thread([&](Thread& t)
+        {
+            while (t.IsRunning())
+            {
+                int len = q.Len();
+                if (len < 0 || len > 16)
+                    bad++;
+            }
+        });
+        RunQueue(q, 2, 2, 300000, sum);
+        delete watcher;
+        CHECK(!bad);
+        CHECK(q.Len() == 0 && q.IsEmpty());
+    }
+}
+
+BENCHMARK(queue)
+{
+    const uint64 count = 1000000;
+    static MutexQueue<uint64, 256> mutexQueue;
+    static Queue<uint64, 256> queue;
+    static SpscQueue<uint64, 256> spsc;
+    uint64 sum;
+
+    printf("M ops/s                  mutex    lock free\n");
+    static const uint configs[][2] = { { 1, 1 }, { 2, 2 }, { 4, 4 }, { 4, 1 }, { 1, 4 } };
+    for (auto& cfg : configs)
+    {
+        uint p = cfg[0], c = cfg[1];
+        double total = (double)count * p / 1e6;
+        double tm = RunQueue(mutexQueue, p, c, count, sum);
+        double tq = RunQueue(queue, p, c, count, sum);
+        printf("%u producers %u consumers %7.2f  %7.2f\n", p, c, total / tm, total / tq);
+    }
+
+    double ts = RunQueue(spsc, 1, 1, count, sum);
+    printf("SpscQueue, 1/1           %7.2f\n", count / ts / 1e6);
+}
@@ -0,0 +1,105 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include <stdio.h>
+
+#include "bench.h"
+#include "encode.h"
+#include "replay.h"
+#include "screencapture.h"
+
+static constexpr uint Rate = 60;
+
+// the pass-through encoder with gop frames per GOP into the replay buffer. The
+// buffer's own config can say something else, like when the GOP size isn't set
+static void Feed(ReplayBuffer& replay, uint gop, uint frames, const Func<void(uint frame)>& after)
+{
+    CaptureConfig cfg;
+    cfg.CodecCfg.GopSize = gop;
+    IEncode* encoder = CreateEncodePassthrough(cfg, false);
+    encoder->Init(320, 180, Rate, 1, {});
+    for (uint i = 0; i < frames; i++)
+    {
+        encoder->SubmitFrame((double)i / Rate);
+        uint8* data;
+        uint size;
+        double time;
+        if (encoder->BeginGetPacket(data, size, 100, time))
+        {
+            replay.AddVideo(data, size, time);
+            encoder->EndGetPacket();
+        }
+        static const uint8 audio[48 * 4] = {};
+        replay.AddAudio(audio, sizeof(audio));
+        after(i);
+    }
+    delete encoder;
+}
+
+static OutputPara MakePara(const CaptureConfig& cfg)
+{
+    return OutputPara
+    {
+        .filename = {},
+        .SizeX = 320,
+        .SizeY = 180,
+        .RateNum = Rate,
+        .RateDen = 1,
+        .Hdr = false,
+        .Audio = {},
+        .CConfig = &cfg,
+    };
+}
+
+TEST(replay)
+{
+    // GOPs twice as long as the time limit, and the config doesn't say: the ring
+    // has to grow instead of starting over, and always has the time limit in it
+    {
+        CaptureConfig cfg;
+        cfg.CodecCfg.GopSize = 0;
+        ReplayBuffer replay(MakePara(cfg), 5, 1ull << 30);
+
+        uint empty = 0, shortOnes = 0;
+        Feed(replay, 10 * Rate, 30 * Rate, [&](uint frame)
+        {
+            double expect = Min((frame + 1.0) / Rate, 5.0);
+            double have = replay.GetSeconds();
+            if (have == 0)
+                empty++;
+            else if (have < expect - 1e-6)
+                shortOnes++;
+        });
+        CHECK(!empty);
+        CHECK(!shortOnes);
+
+        // the newest keyframe at 20s has 10s after it, so that's all there is
+        CHECK(replay.GetSeconds() > 9.9 && replay.GetSeconds() < 10.1);
+    }
+
+    // over the size limit with a single GOP, it starts over at the next keyframe
+    {
+        CaptureConfig cfg;
+        cfg.CodecCfg.GopSize = Rate;
+        ReplayBuffer replay(MakePara(cfg), 60, 64 << 10);
+        uint64 maxBytes = 0;
+        Feed(replay, 10 * Rate, 30 * Rate, [&](uint) { maxBytes = Max(maxBytes, replay.GetBytes()); });
+        CHECK(maxBytes <= 64 << 10);
+    }
+
+    // saving writes one file with what's there
+    {
+        CaptureConfig cfg;
+        cfg.CodecCfg.GopSize = Rate;
+        String name = String::PrintF("%s/capturinha_replay.mp4", (const char*)GetBenchDir());
+        {
+            ReplayBuffer replay(MakePara(cfg), 2, 1ull << 30);
+            Feed(replay, Rate, 5 * Rate, [](uint) {});
+            replay.Save(name);
+        }
+        CHECK(FileExists(name));
+        RemoveFile(name);
+    }
+}
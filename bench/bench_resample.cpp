@@ -0,0 +1,116 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include <stdio.h>
+#include <math.h>
+
+#include "bench.h"
+#include "encode.h"
+#include "output.h"
+#include "screencapture.h"
+
+// Audio through Output_LibAV: swr converts and resamples straight into pooled
+// frames, so per audio second there should be one copy of the output PCM and
+// nothing else
+
+static constexpr uint Channels = 2;
+
+struct ResampleResult
+{
+    double InBytes;         // per audio second
+    double CopiedBytes;     // per audio second
+    double RealTime;        // audio seconds per CPU second
+};
+
+static ResampleResult RunAudio(uint inRate, uint outRate, AudioCodec codec, uint seconds)
+{
+    CaptureConfig cfg;
+    cfg.UseAudioCodec = codec;
+    cfg.AudioSampleRate = outRate;
+    String filename = String::PrintF("%s/resample.mkv", (const char*)GetBenchDir());
+
+    // audio only goes in after the first video packet
+    IEncode* encoder = CreateEncodePassthrough(cfg, false);
+    encoder->Init(320, 180, 60, 1, {});
+    IOutput* output = CreateOutputLibAV(OutputPara
+    {
+        .filename = filename,
+        .SizeX = 320,
+        .SizeY = 180,
+        .RateNum = 60,
+        .RateDen = 1,
+        .Hdr = false,
+        .Audio = { .Format = AudioFormat::F32, .Channels = Channels, .SampleRate = inRate, .BytesPerSample = (uint)(Channels * sizeof(float)) },
+        .CConfig = &cfg,
+    });
+
+    encoder->SubmitFrame(0);
+    uint8* data;
+    uint size;
+    double time;
+    if (encoder->BeginGetPacket(data, size, 1000, time))
+    {
+        output->SubmitVideoPacket(data, size, time);
+        encoder->EndGetPacket();
+        output->WriteVideo();
+    }
+
+    // 10ms chunks, like the audio thread reads them
+    const uint chunk = inRate / 100;
+    Array<float> samples;
+    samples.SetSize((size_t)chunk * Channels);
+    for (uint i = 0; i < chunk; i++)
+        for (uint c = 0; c < Channels; c++)
+            samples[(size_t)i * Channels + c] = 0.5f * sinf(6.2831853f * 1000.0f * i / inRate);
+
+    uint64 before = output->GetStats().AudioBytesCopied;
+    int64 t0 = GetTicks();
+    for (uint i = 0; i < 100 * seconds; i++)
+        output->SubmitAudio((const uint8*)samples.Ptr(), (uint)(samples.Len() * sizeof(float)));
+    double cpu = (double)(GetTicks() - t0) / GetTicksPerSecond();
+    uint64 copied = output->GetStats().AudioBytesCopied - before;
+
+    delete output;
+    delete encoder;
+    RemoveFile(filename);
+
+    return ResampleResult
+    {
+        .InBytes = (double)inRate * Channels * sizeof(float),
+        .CopiedBytes = (double)copied / seconds,
+        .RealTime = seconds / cpu,
+    };
+}
+
+TEST(resample)
+{
+    // 44.1 to 48kHz float: what comes out is 48000 samples per second and
+    // channel, minus what swr and the half filled frame still hold
+    auto res = RunAudio(44100, 48000, AudioCodec::PCM_F32, 2);
+    double expect = 48000.0 * Channels * sizeof(float);
+    CHECK(res.CopiedBytes <= expect);
+    CHECK(res.CopiedBytes > expect - 2048.0 * Channels * sizeof(float));
+}
+
+BENCHMARK(resample)
+{
+    static const struct { AudioCodec Codec; const char* Name; } codecs[] =
+    {
+        { AudioCodec::PCM_S16, "pcm_s16" },
+        { AudioCodec::PCM_F32, "pcm_f32" },
+        { AudioCodec::AAC, "aac" },
+    };
+
+    printf("F32 stereo in, 10ms chunks        kB/s in   kB/s copied   copied/in   x real time\n");
+    for (auto& codec : codecs)
+        for (uint rate : { 44100u, 96000u, 192000u })
+            for (uint outRate : { 0u, 48000u })
+            {
+                auto res = RunAudio(rate, outRate, codec.Codec, 10);
+                char label[64];
+                snprintf(label, sizeof(label), "%-7s %6u -> %s", codec.Name, rate, outRate ? "48000" : "same");
+                printf("%-32s %9.1f   %11.1f   %9.2f   %11.0fx\n", label, res.InBytes / 1024, res.CopiedBytes / 1024, res.CopiedBytes / res.InBytes, res.RealTime);
+            }
+}
@@ -0,0 +1,174 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <utility>
+
+#include "bench.h"
+
+// String: where the small ones end and the long ones start, and that copies,
+// moves and compares do the right thing on both sides of it
+
+static_assert(sizeof(String) == 24, "String should still fit in 24 bytes");
+
+static const char Chars22[] = "0123456789abcdefghijkl";
+static const char Chars23[] = "0123456789abcdefghijklm";
+static_assert(sizeof(Chars22) - 1 == String::SmallCap, "");
+
+// the chars live inside the object
+static bool IsSmall(const String& s)
+{
+    const char* p = s;
+    return p >= (const char*)&s && p < (const char*)(&s + 1);
+}
+
+static bool Is(const String& s, const char* want)
+{
+    bool ok = s.Length() == strlen(want) && !strcmp(s, want);
+    if (!ok)
+        printf("  \"%s\" (%u), expected \"%s\"\n", (const char*)s, (uint)s.Length(), want);
+    return ok;
+}
+
+TEST(string_small)
+{
+    // 22 chars fit, 23 don't. Only the long one allocates
+    {
+        uint64 a0 = GetAllocCount();
+        String s22(Chars22);
+        uint64 a1 = GetAllocCount();
+        String s23(Chars23);
+        uint64 a2 = GetAllocCount();
+        CHECK(Is(s22, Chars22) && IsSmall(s22) && a1 == a0);
+        CHECK(Is(s23, Chars23) && !IsSmall(s23) && a2 == a1 + 1);
+        CHECK(IsSmall(String()) && Is(String(), "") && Is(String(""), ""));
+
+        // same from all the other ways to make one
+        CHECK(IsSmall(String(ReadOnlySpan<char>(Chars23, 22))) && !IsSmall(String(ReadOnlySpan<char>(Chars23, 23))));
+        CHECK(IsSmall(String(L"0123456789abcdefghijkl")) && !IsSmall(String(L"0123456789abcdefghijklm")));
+        CHECK(IsSmall(String::PrintF("%s", Chars22)) && !IsSmall(String::PrintF("%s", Chars23)));
+        CHECK(IsSmall(String::Repeat('x', 22)) && !IsSmall(String::Repeat('x', 23)));
+
+        // the same 22 chars in UTF-8 (11 times 2 bytes) still fit
+        String umlauts(L"\u00e4\u00e4\u00e4\u00e4\u00e4\u00e4\u00e4\u00e4\u00e4\u00e4\u00e4");
+        CHECK(umlauts.Length() == 22 && IsSmall(umlauts));
+
+        // and across the boundary with Concat
+        String a("0123456789a"), b("bcdefghijkl"), c("bcdefghijklm");
+        String ab = a + b, ac = a + c;
+        CHECK(Is(ab, "0123456789abcdefghijkl") && IsSmall(ab));
+        CHECK(Is(ac, "0123456789abcdefghijklm") && !IsSmall(ac));
+    }
+
+    // copies: small ones get their own chars, long ones share the node
+    for (const char* chars : { Chars22, Chars23 })
+    {
+        String s(chars);
+        uint64 a0 = GetAllocCount();
+        String copy(s);
+        String assigned;
+        assigned = s;
+        CHECK(GetAllocCount() == a0);
+        CHECK(Is(copy, chars) && Is(assigned, chars));
+        bool shared = (const char*)copy == (const char*)s && (const char*)assigned == (const char*)s;
+        CHECK(shared == !IsSmall(s));
+
+        // and stay what they are when the original goes away
+        s = "x";
+        CHECK(Is(copy, chars) && Is(assigned, chars) && Is(s, "x"));
+    }
+
+    // moves leave an empty string behind, and don't allocate
+    for (const char* chars : { Chars22, Chars23 })
+    {
+        String s(chars);
+        String assigned("something else that's long");
+        const char* p = s;
+        uint64 a0 = GetAllocCount();
+        String moved(std::move(s));
+        CHECK(Is(moved, chars) && Is(s, ""));
+        if (!IsSmall(moved))
+            CHECK((const char*)moved == p);
+
+        assigned = std::move(moved);
+        CHECK(Is(assigned, chars) && Is(moved, ""));
+        CHECK(GetAllocCount() == a0);
+
+        // a moved from string is still a string
+        moved = chars;
+        CHECK(Is(moved, chars));
+    }
+
+    // assigning to itself changes nothing
+    for (const char* chars : { Chars22, Chars23 })
+    {
+        String s(chars);
+        String& same = s;
+        s = same;
+        CHECK(Is(s, chars));
+        s = std::move(same);
+        CHECK(Is(s, chars));
+        s = (const char*)same;      // from its own chars
+        CHECK(Is(s, chars));
+        s = ReadOnlySpan<char>(same);
+        CHECK(Is(s, chars));
+    }
+
+    // long to small and back, in place
+    {
+        String s(Chars23);
+        s = Chars22;
+        CHECK(Is(s, Chars22) && IsSmall(s));
+        s = Chars23;
+        CHECK(Is(s, Chars23) && !IsSmall(s));
+        s = String();
+        CHECK(Is(s, ""));
+    }
+}
+
+TEST(string_equals)
+{
+    // lengths first: 22 and 23 never match, even with the same start
+    String s22(Chars22), s23(Chars23);
+    CHECK(s22 != s23 && s23 != s22);
+    CHECK(s22 != Chars23 && s23 != Chars22);
+    CHECK(s22 == Chars22 && s23 == Chars23);
+    CHECK(String::Equals(s22, String(Chars22)) && String::Equals(s23, String(Chars23)));
+
+    // Hash() is the same whether the string is long or not, and remembered or not
+    CHECK(s22.Hash() == String::Hash(ReadOnlySpan<char>(Chars22, 22)));
+    CHECK(s23.Hash() == String::Hash(ReadOnlySpan<char>(Chars23, 23)));
+    CHECK(s23.Hash() == s23.Hash());
+    CHECK(String().Hash() == String::Hash(ReadOnlySpan<char>()) && String().Hash());
+
+    // long strings of the same length: with both hashes known, with one, and with none
+    const char* texts[] = { "a long string of thirty-two chars", "a long string of thirty-two Chars", "A LONG STRING OF THIRTY-TWO CHARS" };
+    for (int known = 0; known < 4; known++)
+    {
+        String a(texts[0]), b(texts[0]), c(texts[1]), d(texts[2]);
+        if (known & 1) { a.Hash(); c.Hash(); d.Hash(); }
+        if (known & 2) { b.Hash(); }
+
+        CHECK(a == b && b == a);
+        CHECK(a != c && c != a);
+
+        // different hashes don't count when case doesn't
+        CHECK(!String::Equals(a, d) && String::Equals(a, d, true) && String::Equals(d, a, true));
+        CHECK(String::Equals(a, c, true));
+    }
+
+    // and the same for small ones, which don't keep their hash
+    {
+        String a("small"), b("small"), c("smalL"), d("SMALL");
+        a.Hash(); c.Hash();
+        CHECK(a == b && a != c && a != d);
+        CHECK(String::Equals(a, d, true) && String::Equals(c, d, true));
+    }
+
+    // against char pointers, which may be longer or null
+    CHECK(String("abc") != "abcd" && String("abcd") != "abc" && String("abc").Equals("ABC", true));
+    CHECK(String::Equals(String(), (const char*)nullptr) && !String::Equals(String("x"), (const char*)nullptr));
+}
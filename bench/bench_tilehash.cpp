@@ -0,0 +1,133 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "tilehash.h"
+
+static constexpr uint TS = TileMask::TileSize;
+
+static void FillRandom(Array<uint8>& image, uint seed)
+{
+    for (size_t i = 0; i < image.Len(); i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        image[i] = (uint8)(seed >> 24);
+    }
+}
+
+struct TilePos { uint X, Y; };
+
+// exactly the tiles in want changed, nothing else
+static bool CheckChanged(const TileHasher& hasher, uint count, std::initializer_list<TilePos> want)
+{
+    const TileMask& mask = hasher.GetChanged();
+    if (count != want.size() || mask.GetCount() != want.size())
+    {
+        printf("  %u tiles changed, expected %u\n", mask.GetCount(), (uint)want.size());
+        return false;
+    }
+    for (auto& t : want)
+        if (!mask.Get(t.X, t.Y))
+        {
+            printf("  tile %u,%u should have changed\n", t.X, t.Y);
+            return false;
+        }
+    return true;
+}
+
+TEST(tilehash)
+{
+    // odd sizes for partial tiles at the edges, and a pitch with some slack
+    const uint sizeX = 100, sizeY = 37;
+    const uint tilesX = (sizeX + TS - 1) / TS, tilesY = (sizeY + TS - 1) / TS;
+
+    for (uint bpp : { 4u, 8u })
+    {
+        const uint pitch = sizeX * bpp + 64;
+        Array<uint8> image;
+        image.SetSize((size_t)pitch * sizeY);
+        FillRandom(image, bpp);
+        auto at = [&](uint x, uint y) { return &image[(size_t)y * pitch + x * bpp]; };
+
+        TileHasher hasher;
+        hasher.Init(sizeX, sizeY, bpp);
+
+        // everything the first time, nothing the second
+        CHECK(hasher.Update(image.Ptr(), pitch) == tilesX * tilesY);
+        CHECK(hasher.Update(image.Ptr(), pitch) == 0);
+
+        // the padding after each row isn't part of the image
+        image[(size_t)5 * pitch + sizeX * bpp + 3] ^= 0xff;
+        CHECK(hasher.Update(image.Ptr(), pitch) == 0);
+
+        // single bytes: first and last byte of a pixel, and in the partial tiles
+        // at the right and bottom edge
+        at(0, 0)[0] ^= 1;
+        at(17, 9)[bpp - 1] ^= 0x80;
+        at(sizeX - 1, 20)[1] ^= 1;
+        at(50, sizeY - 1)[0] ^= 1;
+        at(sizeX - 1, sizeY - 1)[2] ^= 1;
+        CHECK(CheckChanged(hasher, hasher.Update(image.Ptr(), pitch),
+            { { 0, 0 }, { 2, 1 }, { tilesX - 1, 2 }, { 6, tilesY - 1 }, { tilesX - 1, tilesY - 1 } }));
+
+        // and back: the same tiles again, because they differ from the last image
+        at(0, 0)[0] ^= 1;
+        at(17, 9)[bpp - 1] ^= 0x80;
+        at(sizeX - 1, 20)[1] ^= 1;
+        at(50, sizeY - 1)[0] ^= 1;
+        at(sizeX - 1, sizeY - 1)[2] ^= 1;
+        CHECK(CheckChanged(hasher, hasher.Update(image.Ptr(), pitch),
+            { { 0, 0 }, { 2, 1 }, { tilesX - 1, 2 }, { 6, tilesY - 1 }, { tilesX - 1, tilesY - 1 } }));
+
+        // two rows of a tile swapped, or two pixels in a row: same bytes, different image
+        Array<uint8> row;
+        row.SetSize(TS * bpp);
+        uint8* r0 = at(24, 8);
+        uint8* r1 = at(24, 11);
+        memcpy(row.Ptr(), r0, row.Len());
+        memcpy(r0, r1, row.Len());
+        memcpy(r1, row.Ptr(), row.Len());
+        for (uint i = 0; i < bpp; i++)
+        {
+            uint8 t = at(40, 30)[i];
+            at(40, 30)[i] = at(41, 30)[i];
+            at(41, 30)[i] = t;
+        }
+        CHECK(CheckChanged(hasher, hasher.Update(image.Ptr(), pitch), { { 3, 1 }, { 5, 3 } }));
+
+        // a new image with the same content is still the same
+        Array<uint8> copy(image);
+        CHECK(hasher.Update(copy.Ptr(), pitch) == 0);
+
+        // Init starts over
+        hasher.Init(sizeX, sizeY, bpp);
+        CHECK(hasher.Update(image.Ptr(), pitch) == tilesX * tilesY);
+    }
+}
+
+BENCHMARK(tilehash)
+{
+    // a whole 4K frame per call. Random data, the hash doesn't care what changed
+    const uint sizeX = 3840, sizeY = 2160;
+    printf("3840x2160         ms/frame      fps   x 4K240     GB/s\n");
+
+    for (uint bpp : { 4u, 8u })
+    {
+        const uint pitch = sizeX * bpp;
+        Array<uint8> image;
+        image.SetSize((size_t)pitch * sizeY);
+        FillRandom(image, 1);
+
+        TileHasher hasher;
+        hasher.Init(sizeX, sizeY, bpp);
+        double t = TimePerCall([&] { hasher.Update(image.Ptr(), pitch); });
+
+        printf("%-16s %9.3f %8.0f %9.2f %8.2f\n", bpp == 4 ? "BGRA8/RGB10" : "RGBA16F",
+            t * 1000, 1 / t, 1 / (t * 240), image.Len() / t / 1e9);
+    }
+}
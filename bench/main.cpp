@@ -0,0 +1,226 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+#include "bench.h"
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+static BenchEntry* Entries = nullptr;
+static ChildEntry* Children = nullptr;
+static uint Failures = 0;
+static std::atomic<uint64> Allocs = 0;
+
+BenchEntry::BenchEntry(const char* name, bool isTest, void (*run)()) : Name(name), IsTest(isTest), Run(run), Next(Entries)
+{
+    Entries = this;
+}
+
+ChildEntry::ChildEntry(const char* name, void (*run)(const char*)) : Name(name), Run(run), Next(Children)
+{
+    Children = this;
+}
+
+#ifdef _WIN32
+
+ChildProcess::ChildProcess(const char* name, const char* arg)
+{
+    char exe[MAX_PATH];
+    GetModuleFileNameA(nullptr, exe, MAX_PATH);
+    char cmdLine[3 * MAX_PATH];
+    snprintf(cmdLine, sizeof(cmdLine), "\"%s\" --child %s \"%s\"", exe, name, arg);
+
+    STARTUPINFOA si = { .cb = sizeof(si) };
+    PROCESS_INFORMATION pi = {};
+    if (!CreateProcessA(exe, cmdLine, nullptr, nullptr, FALSE, 0, nullptr, nullptr, &si, &pi))
+        Fatal("could not start %s\n", cmdLine);
+    CloseHandle(pi.hThread);
+    P = pi.hProcess;
+}
+
+ChildProcess::~ChildProcess()
+{
+    Kill();
+}
+
+void ChildProcess::Kill()
+{
+    if (!P)
+        return;
+    TerminateProcess((HANDLE)P, 1);
+    WaitForSingleObject((HANDLE)P, INFINITE);
+    CloseHandle((HANDLE)P);
+    P = nullptr;
+}
+
+#else
+
+ChildProcess::ChildProcess(const char* name, const char* arg)
+{
+    pid_t pid = fork();
+    if (!pid)
+    {
+        execl("/proc/self/exe", "Bench", "--child", name, arg, (char*)nullptr);
+        _exit(127);
+    }
+    if (pid < 0)
+        Fatal("could not start child %s\n", name);
+    P = (void*)(intptr_t)pid;
+}
+
+ChildProcess::~ChildProcess()
+{
+    Kill();
+}
+
+void ChildProcess::Kill()
+{
+    if (!P)
+        return;
+    pid_t pid = (pid_t)(intptr_t)P;
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    P = nullptr;
+}
+
+#endif
+
+void CheckFailed(const char* file, int line, const char* expr)
+{
+    printf("%s(%d): CHECK failed: %s\n", file, line, expr);
+    Failures++;
+}
+
+uint64 GetAllocCount() { return Allocs; }
+
+double TimePerCall(const Func<void()>& func, double minSeconds)
+{
+    const int64 minTicks = (int64)(minSeconds * (double)GetTicksPerSecond());
+    double best = 1e30;
+    for (int round = 0; round < 3; round++)
+    {
+        int64 start = GetTicks(), now;
+        uint64 calls = 0;
+        do
+        {
+            func();
+            calls++;
+            now = GetTicks();
+        } while (now - start < minTicks);
+        best = Min(best, (double)(now - start) / ((double)GetTicksPerSecond() * (double)calls));
+    }
+    return best;
+}
+
+String GetBenchDir()
+{
+    const char* dir = getenv("TEMP");
+    if (!dir) dir = getenv("TMPDIR");
+    return dir ? dir : "/tmp";
+}
+
+// count every allocation, to see what the hot paths do per frame
+
+void* operator new(size_t size)
+{
+    Allocs++;
+    if (void* ptr = malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+
+void* operator new(size_t size, std::align_val_t align)
+{
+    Allocs++;
+#ifdef _MSC_VER
+    void* ptr = _aligned_malloc(size ? size : 1, (size_t)align);
+#else
+    void* ptr = aligned_alloc((size_t)align, ((size ? size : 1) + (size_t)align - 1) & ~((size_t)align - 1));
+#endif
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size, std::align_val_t align) { return operator new(size, align); }
+
+#ifdef _MSC_VER
+void operator delete(void* ptr, std::align_val_t) noexcept { _aligned_free(ptr); }
+#else
+void operator delete(void* ptr, std::align_val_t) noexcept { free(ptr); }
+#endif
+void operator delete[](void* ptr, std::align_val_t align) noexcept { operator delete(ptr, align); }
+void operator delete(void* ptr, size_t, std::align_val_t align) noexcept { operator delete(ptr, align); }
+void operator delete[](void* ptr, size_t, std::align_val_t align) noexcept { operator delete(ptr, align); }
+
+int main(int argc, char** argv)
+{
+    if (argc == 4 && !strcmp(argv[1], "--child"))
+    {
+        for (ChildEntry* c = Children; c; c = c->Next)
+            if (!strcmp(c->Name, argv[2]))
+            {
+                c->Run(argv[3]);
+                return 0;
+            }
+        printf("no child %s\n", argv[2]);
+        return 1;
+    }
+
+    // the list is in reverse registration order
+    Array<BenchEntry*> entries;
+    for (BenchEntry* e = Entries; e; e = e->Next)
+        entries.PushHead(e);
+
+    bool list = argc == 2 && !strcmp(argv[1], "list");
+    bool all = argc == 2 && !strcmp(argv[1], "all");
+
+    for (BenchEntry* e : entries)
+    {
+        if (list)
+        {
+            printf("%-9s %s\n", e->IsTest ? "test" : "benchmark", e->Name);
+            continue;
+        }
+
+        bool run = all || (argc == 1 && e->IsTest);
+        for (int i = 1; i < argc; i++)
+            run |= !strcmp(argv[i], e->Name);
+        if (!run)
+            continue;
+
+        printf("--- %s %s\n", e->IsTest ? "test" : "benchmark", e->Name);
+        fflush(stdout);
+        uint failures = Failures;
+        e->Run();
+        if (e->IsTest)
+            printf("%s\n", Failures == failures ? "ok" : "FAILED");
+        fflush(stdout);
+    }
+
+    if (Failures)
+        printf("%u checks failed\n", Failures);
+    return Failures ? 1 : 0;
+}
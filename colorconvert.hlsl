@@ -16,13 +16,21 @@
 #define HDR 1
 #endif
 
+// TILES=1: only convert the 8x8 tiles listed in Tiles, one thread group each
+#ifndef TILES
+#define TILES 0
+#endif
+
 Texture2D<float4> TexIn;
+#if TILES == 1
+StructuredBuffer<uint> Tiles : register(t1); // x | (y << 16), in tiles
+#endif
 RWByteAddressBuffer Out;
 
 cbuffer cb_csc : register(b0)
 {
     float4x4 yuvmatrix;    // convert from RGB to YUV and scale to integer
-    uint4 pitch_height_scale;
+    uint4 pitch_height_scale;   // w: number of tiles with TILES=1
     float4x4 colormatrix;  // convert to ST 2020 and normalize to 10000 nits
 }
 
@@ -59,8 +67,15 @@ float3 lin2ST2084(float3 y)
 
 // color space conversion
 [numthreads(8, 8, 1)]
-void csc(uint3 dispid : SV_DispatchThreadID, uint3 threadid : SV_GroupThreadID)
+void csc(uint3 dispid : SV_DispatchThreadID, uint3 threadid : SV_GroupThreadID, uint3 groupid : SV_GroupID)
 {
+#if TILES == 1
+    // groups come in rows of 1024 to stay below the dispatch limit. The ones past
+    // the end just do the last tile again
+    uint t = Tiles[min(1024 * groupid.y + groupid.x, pitch_height_scale.w - 1)];
+    dispid.xy = 8 * uint2(t & 0xffff, t >> 16) + threadid.xy;
+#endif
+
     // convert 8x8 pixels to output color space and store in tile
 #if UPSCALE == 1
     float4 pixel = TexIn.Load(int3(dispid.x / pitch_height_scale.z, dispid.y / pitch_height_scale.z, 0));
@@ -0,0 +1,725 @@
+//
+// Copyright (C) Tammo Hinrichs 2021-2022. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include "colorconvert_cpu.h"
+#include "system.h"
+
+#include <math.h>
+#include <string.h>
+#include <atomic>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// MSVC lets us use any intrinsic anywhere, gcc/clang need to be told per function
+#if defined(_MSC_VER) && !defined(__clang__)
+#define CPU_TARGET(x)
+#else
+#define CPU_TARGET(x) __attribute__((target(x)))
+#endif
+
+// All kernels work on planar float rows. To stay bit exact between the paths,
+// each of them does the same IEEE operations in the same order as the scalar
+// code (especially: no FMA), and rounding is round-to-nearest-even like HLSL's round().
+// The compiler mustn't fuse a*b+c into FMAs on its own either, whatever the
+// target flags say
+#if defined(_MSC_VER) && !defined(__clang__)
+#pragma fp_contract(off)
+#elif defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#else
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+//---------------------------------------------------------------------------
+// scalar
+//---------------------------------------------------------------------------
+
+static float HalfToFloat(uint16 h)
+{
+    uint sign = (uint)(h & 0x8000) << 16;
+    uint exp = (h >> 10) & 0x1f;
+    uint mant = h & 0x3ff;
+    uint bits;
+
+    if (exp == 0x1f)
+        bits = sign | 0x7f800000 | (mant << 13);
+    else if (exp)
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    else if (!mant)
+        bits = sign;
+    else
+    {
+        // denormal: renormalize
+        exp = 113;
+        while (!(mant & 0x400)) { mant <<= 1; exp--; }
+        bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+
+    float f;
+    memcpy(&f, &bits, 4);
+    return f;
+}
+
+// convert linear (0..1, 1.0 = 10000 nits) to ST-2084 (0..1)
+static float Lin2ST2084(float y)
+{
+    y = y > 0 ? y : 0;
+    float p = powf(y, 0.1593017578f);
+    float v = powf((0.8359375f + 18.8515625f * p) / (1.0f + 18.6875f * p), 78.84375f);
+    return v > 0 ? (v < 1 ? v : 1) : 0;
+}
+
+static inline float Quant(float v, float max)
+{
+    v = nearbyintf(v);
+    v = v > 0 ? v : 0;
+    return v < max ? v : max;
+}
+
+static void Decode8_Scalar(const uint8* src, uint n, bool bgr, float* r, float* g, float* b)
+{
+    float* c0 = bgr ? b : r;
+    float* c2 = bgr ? r : b;
+    for (uint i = 0; i < n; i++, src += 4)
+    {
+        c0[i] = (float)src[0] / 255.0f;
+        g[i] = (float)src[1] / 255.0f;
+        c2[i] = (float)src[2] / 255.0f;
+    }
+}
+
+static void Matrix_Scalar(const float* r, const float* g, const float* b, uint n, const float* m, float* out)
+{
+    for (uint i = 0; i < n; i++)
+        out[i] = r[i] * m[0] + g[i] * m[1] + b[i] * m[2] + m[3];
+}
+
+static void Quant8_Scalar(const float* in, uint n, uint8* out)
+{
+    for (uint i = 0; i < n; i++)
+        out[i] = (uint8)Quant(in[i], 255.0f);
+}
+
+static void Quant8x2_Scalar(const float* u, const float* v, uint n, uint8* out)
+{
+    for (uint i = 0; i < n; i++)
+    {
+        out[2 * i] = (uint8)Quant(u[i], 255.0f);
+        out[2 * i + 1] = (uint8)Quant(v[i], 255.0f);
+    }
+}
+
+static void Quant16_Scalar(const float* in, uint n, uint16* out)
+{
+    for (uint i = 0; i < n; i++)
+        out[i] = (uint16)Quant(in[i], 65535.0f);
+}
+
+static void Quant16x2_Scalar(const float* u, const float* v, uint n, uint16* out)
+{
+    for (uint i = 0; i < n; i++)
+    {
+        out[2 * i] = (uint16)Quant(u[i], 65535.0f);
+        out[2 * i + 1] = (uint16)Quant(v[i], 65535.0f);
+    }
+}
+
+// average 2x2 blocks of two rows, n = # of outputs (the shader's getuv420())
+static void Average420_Scalar(const float* row0, const float* row1, uint n, float* out)
+{
+    for (uint i = 0; i < n; i++)
+        out[i] = (row0[2 * i] + row0[2 * i + 1] + row1[2 * i] + row1[2 * i + 1]) * 0.25f;
+}
+
+//---------------------------------------------------------------------------
+// SSE4.1
+//---------------------------------------------------------------------------
+
+CPU_TARGET("sse4.1") static inline __m128i QuantI_SSE(__m128 v, __m128 max)
+{
+    v = _mm_round_ps(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    v = _mm_max_ps(v, _mm_setzero_ps());
+    v = _mm_min_ps(v, max);
+    return _mm_cvttps_epi32(v);
+}
+
+CPU_TARGET("sse4.1") static void Decode8_SSE(const uint8* src, uint n, bool bgr, float* r, float* g, float* b)
+{
+    float* c0 = bgr ? b : r;
+    float* c2 = bgr ? r : b;
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    uint i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i px = _mm_loadu_si128((const __m128i*)(src + 4 * i));
+        _mm_storeu_ps(c0 + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(px, mask)), scale));
+        _mm_storeu_ps(g + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), mask)), scale));
+        _mm_storeu_ps(c2 + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), mask)), scale));
+    }
+    Decode8_Scalar(src + 4 * i, n - i, bgr, r + i, g + i, b + i);
+}
+
+CPU_TARGET("sse4.1") static void Matrix_SSE(const float* r, const float* g, const float* b, uint n, const float* m, float* out)
+{
+    const __m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]), m2 = _mm_set1_ps(m[2]), m3 = _mm_set1_ps(m[3]);
+    uint i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(r + i), m0), _mm_mul_ps(_mm_loadu_ps(g + i), m1));
+        v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(b + i), m2));
+        _mm_storeu_ps(out + i, _mm_add_ps(v, m3));
+    }
+    Matrix_Scalar(r + i, g + i, b + i, n - i, m, out + i);
+}
+
+CPU_TARGET("sse4.1") static void Quant8_SSE(const float* in, uint n, uint8* out)
+{
+    const __m128 max = _mm_set1_ps(255.0f);
+    uint i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i a = _mm_packs_epi32(QuantI_SSE(_mm_loadu_ps(in + i), max), QuantI_SSE(_mm_loadu_ps(in + i + 4), max));
+        __m128i b = _mm_packs_epi32(QuantI_SSE(_mm_loadu_ps(in + i + 8), max), QuantI_SSE(_mm_loadu_ps(in + i + 12), max));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(a, b));
+    }
+    Quant8_Scalar(in + i, n - i, out + i);
+}
+
+CPU_TARGET("sse4.1") static void Quant8x2_SSE(const float* u, const float* v, uint n, uint8* out)
+{
+    const __m128 max = _mm_set1_ps(255.0f);
+    uint i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i u0 = QuantI_SSE(_mm_loadu_ps(u + i), max), u1 = QuantI_SSE(_mm_loadu_ps(u + i + 4), max);
+        __m128i v0 = QuantI_SSE(_mm_loadu_ps(v + i), max), v1 = QuantI_SSE(_mm_loadu_ps(v + i + 4), max);
+        __m128i a = _mm_packs_epi32(_mm_unpacklo_epi32(u0, v0), _mm_unpackhi_epi32(u0, v0));
+        __m128i b = _mm_packs_epi32(_mm_unpacklo_epi32(u1, v1), _mm_unpackhi_epi32(u1, v1));
+        _mm_storeu_si128((__m128i*)(out + 2 * i), _mm_packus_epi16(a, b));
+    }
+    Quant8x2_Scalar(u + i, v + i, n - i, out + 2 * i);
+}
+
+CPU_TARGET("sse4.1") static void Quant16_SSE(const float* in, uint n, uint16* out)
+{
+    const __m128 max = _mm_set1_ps(65535.0f);
+    uint i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i a = _mm_packus_epi32(QuantI_SSE(_mm_loadu_ps(in + i), max), QuantI_SSE(_mm_loadu_ps(in + i + 4), max));
+        _mm_storeu_si128((__m128i*)(out + i), a);
+    }
+    Quant16_Scalar(in + i, n - i, out + i);
+}
+
+CPU_TARGET("sse4.1") static void Quant16x2_SSE(const float* u, const float* v, uint n, uint16* out)
+{
+    const __m128 max = _mm_set1_ps(65535.0f);
+    uint i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i u0 = QuantI_SSE(_mm_loadu_ps(u + i), max);
+        __m128i v0 = QuantI_SSE(_mm_loadu_ps(v + i), max);
+        _mm_storeu_si128((__m128i*)(out + 2 * i), _mm_packus_epi32(_mm_unpacklo_epi32(u0, v0), _mm_unpackhi_epi32(u0, v0)));
+    }
+    Quant16x2_Scalar(u + i, v + i, n - i, out + 2 * i);
+}
+
+CPU_TARGET("sse4.1") static void Average420_SSE(const float* row0, const float* row1, uint n, float* out)
+{
+    const __m128 quarter = _mm_set1_ps(0.25f);
+    uint i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 a0 = _mm_loadu_ps(row0 + 2 * i), b0 = _mm_loadu_ps(row0 + 2 * i + 4);
+        __m128 a1 = _mm_loadu_ps(row1 + 2 * i), b1 = _mm_loadu_ps(row1 + 2 * i + 4);
+        __m128 v = _mm_add_ps(_mm_shuffle_ps(a0, b0, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a0, b0, _MM_SHUFFLE(3, 1, 3, 1)));
+        v = _mm_add_ps(v, _mm_shuffle_ps(a1, b1, _MM_SHUFFLE(2, 0, 2, 0)));
+        v = _mm_add_ps(v, _mm_shuffle_ps(a1, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+        _mm_storeu_ps(out + i, _mm_mul_ps(v, quarter));
+    }
+    Average420_Scalar(row0 + 2 * i, row1 + 2 * i, n - i, out + i);
+}
+
+//---------------------------------------------------------------------------
+// AVX2
+//---------------------------------------------------------------------------
+
+CPU_TARGET("avx2") static inline __m256i QuantI_AVX(__m256 v, __m256 max)
+{
+    v = _mm256_round_ps(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    v = _mm256_max_ps(v, _mm256_setzero_ps());
+    v = _mm256_min_ps(v, max);
+    return _mm256_cvttps_epi32(v);
+}
+
+// 32 ints (in order a,b,c,d) -> 32 bytes
+CPU_TARGET("avx2") static inline void Pack8_AVX(__m256i a, __m256i b, __m256i c, __m256i d, uint8* out)
+{
+    __m256i v = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+    v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+    _mm256_storeu_si256((__m256i*)out, v);
+}
+
+// 16 ints (in order a,b) -> 16 words
+CPU_TARGET("avx2") static inline void Pack16_AVX(__m256i a, __m256i b, uint16* out)
+{
+    __m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256((__m256i*)out, v);
+}
+
+// interleave 8+8 ints into u0 v0 u1 v1 ... (lo: first 8, hi: last 8)
+CPU_TARGET("avx2") static inline void Interleave_AVX(__m256i u, __m256i v, __m256i& lo, __m256i& hi)
+{
+    __m256i l = _mm256_unpacklo_epi32(u, v);
+    __m256i h = _mm256_unpackhi_epi32(u, v);
+    lo = _mm256_permute2x128_si256(l, h, 0x20);
+    hi = _mm256_permute2x128_si256(l, h, 0x31);
+}
+
+CPU_TARGET("avx2") static void Decode8_AVX(const uint8* src, uint n, bool bgr, float* r, float* g, float* b)
+{
+    float* c0 = bgr ? b : r;
+    float* c2 = bgr ? r : b;
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    uint i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i px = _mm256_loadu_si256((const __m256i*)(src + 4 * i));
+        _mm256_storeu_ps(c0 + i, _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(px, mask)), scale));
+        _mm256_storeu_ps(g + i, _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 8), mask)), scale));
+        _mm256_storeu_ps(c2 + i, _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 16), mask)), scale));
+    }
+    Decode8_Scalar(src + 4 * i, n - i, bgr, r + i, g + i, b + i);
+}
+
+CPU_TARGET("avx2") static void Matrix_AVX(const float* r, const float* g, const float* b, uint n, const float* m, float* out)
+{
+    const __m256 m0 = _mm256_set1_ps(m[0]), m1 = _mm256_set1_ps(m[1]), m2 = _mm256_set1_ps(m[2]), m3 = _mm256_set1_ps(m[3]);
+    uint i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(r + i), m0), _mm256_mul_ps(_mm256_loadu_ps(g + i), m1));
+        v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_loadu_ps(b + i), m2));
+        _mm256_storeu_ps(out + i, _mm256_add_ps(v, m3));
+    }
+    Matrix_Scalar(r + i, g + i, b + i, n - i, m, out + i);
+}
+
+CPU_TARGET("avx2") static void Quant8_AVX(const float* in, uint n, uint8* out)
+{
+    const __m256 max = _mm256_set1_ps(255.0f);
+    uint i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        Pack8_AVX(QuantI_AVX(_mm256_loadu_ps(in + i), max), QuantI_AVX(_mm256_loadu_ps(in + i + 8), max),
+            QuantI_AVX(_mm256_loadu_ps(in + i + 16), max), QuantI_AVX(_mm256_loadu_ps(in + i + 24), max), out + i);
+    }
+    Quant8_Scalar(in + i, n - i, out + i);
+}
+
+CPU_TARGET("avx2") static void Quant8x2_AVX(const float* u, const float* v, uint n, uint8* out)
+{
+    const __m256 max = _mm256_set1_ps(255.0f);
+    uint i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i a, b, c, d;
+        Interleave_AVX(QuantI_AVX(_mm256_loadu_ps(u + i), max), QuantI_AVX(_mm256_loadu_ps(v + i), max), a, b);
+        Interleave_AVX(QuantI_AVX(_mm256_loadu_ps(u + i + 8), max), QuantI_AVX(_mm256_loadu_ps(v + i + 8), max), c, d);
+        Pack8_AVX(a, b, c, d, out + 2 * i);
+    }
+    Quant8x2_Scalar(u + i, v + i, n - i, out + 2 * i);
+}
+
+CPU_TARGET("avx2") static void Quant16_AVX(const float* in, uint n, uint16* out)
+{
+    const __m256 max = _mm256_set1_ps(65535.0f);
+    uint i = 0;
+    for (; i + 16 <= n; i += 16)
+        Pack16_AVX(QuantI_AVX(_mm256_loadu_ps(in + i), max), QuantI_AVX(_mm256_loadu_ps(in + i + 8), max), out + i);
+    Quant16_Scalar(in + i, n - i, out + i);
+}
+
+CPU_TARGET("avx2") static void Quant16x2_AVX(const float* u, const float* v, uint n, uint16* out)
+{
+    const __m256 max = _mm256_set1_ps(65535.0f);
+    uint i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i a, b;
+        Interleave_AVX(QuantI_AVX(_mm256_loadu_ps(u + i), max), QuantI_AVX(_mm256_loadu_ps(v + i), max), a, b);
+        Pack16_AVX(a, b, out + 2 * i);
+    }
+    Quant16x2_Scalar(u + i, v + i, n - i, out + 2 * i);
+}
+
+CPU_TARGET("avx2") static inline __m256 Even_AVX(__m256 a, __m256 b)
+{
+    __m256 v = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(v), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+CPU_TARGET("avx2") static inline __m256 Odd_AVX(__m256 a, __m256 b)
+{
+    __m256 v = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(v), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+CPU_TARGET("avx2") static void Average420_AVX(const float* row0, const float* row1, uint n, float* out)
+{
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+    uint i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 a0 = _mm256_loadu_ps(row0 + 2 * i), b0 = _mm256_loadu_ps(row0 + 2 * i + 8);
+        __m256 a1 = _mm256_loadu_ps(row1 + 2 * i), b1 = _mm256_loadu_ps(row1 + 2 * i + 8);
+        __m256 v = _mm256_add_ps(Even_AVX(a0, b0), Odd_AVX(a0, b0));
+        v = _mm256_add_ps(v, Even_AVX(a1, b1));
+        v = _mm256_add_ps(v, Odd_AVX(a1, b1));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(v, quarter));
+    }
+    Average420_Scalar(row0 + 2 * i, row1 + 2 * i, n - i, out + i);
+}
+
+//---------------------------------------------------------------------------
+// the converter
+//---------------------------------------------------------------------------
+
+struct Kernels
+{
+    void (*Decode8)(const uint8* src, uint n, bool bgr, float* r, float* g, float* b);
+    void (*Matrix)(const float* r, const float* g, const float* b, uint n, const float* m, float* out);
+    void (*Quant8)(const float* in, uint n, uint8* out);
+    void (*Quant8x2)(const float* u, const float* v, uint n, uint8* out);
+    void (*Quant16)(const float* in, uint n, uint16* out);
+    void (*Quant16x2)(const float* u, const float* v, uint n, uint16* out);
+    void (*Average420)(const float* row0, const float* row1, uint n, float* out);
+};
+
+static const Kernels KernelsScalar = { Decode8_Scalar, Matrix_Scalar, Quant8_Scalar, Quant8x2_Scalar, Quant16_Scalar, Quant16x2_Scalar, Average420_Scalar };
+static const Kernels KernelsSSE = { Decode8_SSE, Matrix_SSE, Quant8_SSE, Quant8x2_SSE, Quant16_SSE, Quant16x2_SSE, Average420_SSE };
+static const Kernels KernelsAVX = { Decode8_AVX, Matrix_AVX, Quant8_AVX, Quant8x2_AVX, Quant16_AVX, Quant16x2_AVX, Average420_AVX };
+
+ColorConverterCPU::Isa ColorConverterCPU::DetectIsa()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int regs[4] = {};
+    __cpuid(regs, 0);
+    int maxLeaf = regs[0];
+    __cpuid(regs, 1);
+    bool sse41 = regs[2] & (1 << 19);
+    bool osxsave = regs[2] & (1 << 27);
+    bool avx = regs[2] & (1 << 28);
+    bool avx2 = false;
+    if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6)
+    {
+        __cpuidex(regs, 7, 0);
+        avx2 = regs[1] & (1 << 5);
+    }
+#else
+    __builtin_cpu_init();
+    bool sse41 = __builtin_cpu_supports("sse4.1");
+    bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+    return avx2 ? Isa::AVX2 : sse41 ? Isa::SSE41 : Isa::Scalar;
+}
+
+struct ColorConverterCPU::Priv
+{
+    Para P;
+    Isa UsedIsa;
+    const Kernels* K;
+    FormatInfo FI;
+    bool Is420;
+    uint Channels;
+    float Coefs[4][4];  // per output channel: r, g, b, constant
+    float HdrCoefs[3][4];
+
+    // per band scratch rows
+    struct Scratch
+    {
+        float* Mem = nullptr;
+        float *R, *G, *B;
+        float* C[2][4];     // matrix output, two rows for 4:2:0
+        float *AU, *AV;     // averaged chroma
+    };
+    Array<Scratch> Scratches;
+
+    // worker threads do bands 1..n-1, Convert() itself band 0
+    struct Worker
+    {
+        Thread* Th = nullptr;
+        ThreadEvent Start;
+        std::atomic<double> CpuTime = 0;   // of the whole thread so far
+    };
+    Array<Worker*> Workers;
+    ThreadEvent Done;
+    std::atomic<int> Pending = 0;
+    bool Quit = false;
+
+    const uint8* JobSrc = nullptr;
+    uint JobPitch = 0;
+    PixelFormat JobFormat = PixelFormat::None;
+    uint8* JobOut = nullptr;
+
+    explicit Priv(const Para& para) : P(para)
+    {
+        P.Upscale = Max(P.Upscale, 1u);
+
+        UsedIsa = Min(DetectIsa(), P.MaxIsa);
+        K = UsedIsa == Isa::AVX2 ? &KernelsAVX : UsedIsa == Isa::SSE41 ? &KernelsSSE : &KernelsScalar;
+
+        FI = GetFormatInfo(P.Format, P.SizeX, P.SizeY);
+        Is420 = P.Format == IEncode::BufferFormat::NV12 || P.Format == IEncode::BufferFormat::YUV420_16;
+        Channels = P.Format == IEncode::BufferFormat::BGRA8 ? 4 : 3;
+        if (Is420)
+            ASSERT(!(P.SizeX & 1) && !(P.SizeY & 1));
+
+        const Mat44& m = P.YuvMatrix;
+        const Mat44& c = P.ColorMatrix;
+        const Vec4* rows[4] = { &m.i, &m.j, &m.k, &m.l };
+        const Vec4* crows[4] = { &c.i, &c.j, &c.k, &c.l };
+        for (int ch = 0; ch < 4; ch++)
+            for (int r = 0; r < 4; r++)
+            {
+                Coefs[ch][r] = (&rows[r]->x)[ch];
+                if (ch < 3) HdrCoefs[ch][r] = (&crows[r]->x)[ch];
+            }
+
+        uint threads = P.Threads ? P.Threads : Thread::GetCPUCount();
+        threads = Clamp(threads, 1u, Max(P.SizeY / 16, 1u));
+
+        for (uint i = 0; i < threads; i++)
+        {
+            Scratch s;
+            uint w = P.SizeX + 16;
+            s.Mem = new float[15 * (size_t)w];
+            float* ptr = s.Mem;
+            s.R = ptr; ptr += w;
+            s.G = ptr; ptr += w;
+            s.B = ptr; ptr += w;
+            for (int r = 0; r < 2; r++)
+                for (int ch = 0; ch < 4; ch++)
+                {
+                    s.C[r][ch] = ptr; ptr += w;
+                }
+            s.AU = ptr; ptr += w;
+            s.AV = ptr;
+            Scratches += s;
+        }
+
+        for (uint i = 1; i < threads; i++)
+        {
+            auto w = new Worker;
+            Workers += w;
+            w->Th = new Thread([this, i, w](Thread&)
+            {
+                for (;;)
+                {
+                    w->Start.Wait();
+                    if (Quit) break;
+                    DoBand(i);
+                    w->CpuTime = GetThreadCpuTime();
+                    if (Pending.fetch_sub(1) == 1)
+                        Done.Fire();
+                }
+            });
+        }
+    }
+
+    ~Priv()
+    {
+        Quit = true;
+        for (auto w : Workers)
+        {
+            w->Start.Fire();
+            delete w->Th;
+            delete w;
+        }
+        for (auto& s : Scratches)
+            delete[] s.Mem;
+    }
+
+    void DoBand(uint band)
+    {
+        uint n = Scratches.Len();
+        uint y0 = (uint)((uint64)P.SizeY * band / n) & ~1u;
+        uint y1 = band == n - 1 ? P.SizeY : (uint)((uint64)P.SizeY * (band + 1) / n) & ~1u;
+        if (y1 > y0)
+            ConvertRect(Scratches[band], JobSrc, JobPitch, JobFormat, JobOut, 0, y0, P.SizeX, y1);
+    }
+
+    void Convert(const uint8* src, uint srcPitch, PixelFormat srcFormat, uint8* out)
+    {
+        JobSrc = src;
+        JobPitch = srcPitch;
+        JobFormat = srcFormat;
+        JobOut = out;
+
+        Pending = (int)Workers.Len();
+        for (auto w : Workers)
+            w->Start.Fire();
+
+        DoBand(0);
+
+        if (Workers.Len())
+            Done.Wait();
+    }
+
+    // source row -> planar float RGB
+    void LoadRow(Scratch& s, const uint8* row, PixelFormat fmt, uint x0, uint n)
+    {
+        bool bgr = fmt == PixelFormat::BGRA8 || fmt == PixelFormat::BGRA8sRGB;
+        bool is8 = bgr || fmt == PixelFormat::RGBA8 || fmt == PixelFormat::RGBA8sRGB;
+        uint up = P.Upscale;
+
+        if (is8 && up == 1)
+            K->Decode8(row + 4 * x0, n, bgr, s.R, s.G, s.B);
+        else if (is8)
+        {
+            for (uint i = 0; i < n; i++)
+                Decode8_Scalar(row + 4 * ((x0 + i) / up), 1, bgr, s.R + i, s.G + i, s.B + i);
+        }
+        else if (fmt == PixelFormat::RGB10A2)
+        {
+            for (uint i = 0; i < n; i++)
+            {
+                uint v;
+                memcpy(&v, row + 4 * ((x0 + i) / up), 4);
+                s.R[i] = (float)(v & 0x3ff) / 1023.0f;
+                s.G[i] = (float)((v >> 10) & 0x3ff) / 1023.0f;
+                s.B[i] = (float)((v >> 20) & 0x3ff) / 1023.0f;
+            }
+        }
+        else if (fmt == PixelFormat::RGBA16F)
+        {
+            for (uint i = 0; i < n; i++)
+            {
+                uint16 v[4];
+                memcpy(v, row + 8 * ((x0 + i) / up), 8);
+                s.R[i] = HalfToFloat(v[0]);
+                s.G[i] = HalfToFloat(v[1]);
+                s.B[i] = HalfToFloat(v[2]);
+            }
+        }
+        else
+            Fatal("CPU color conversion: unsupported source format %d", (int)fmt);
+
+        if (P.Hdr)
+        {
+            // to ST 2020, then the ST-2084 transfer curve
+            for (uint i = 0; i < n; i++)
+            {
+                float r = s.R[i], g = s.G[i], b = s.B[i];
+                s.R[i] = Lin2ST2084(r * HdrCoefs[0][0] + g * HdrCoefs[0][1] + b * HdrCoefs[0][2] + HdrCoefs[0][3]);
+                s.G[i] = Lin2ST2084(r * HdrCoefs[1][0] + g * HdrCoefs[1][1] + b * HdrCoefs[1][2] + HdrCoefs[1][3]);
+                s.B[i] = Lin2ST2084(r * HdrCoefs[2][0] + g * HdrCoefs[2][1] + b * HdrCoefs[2][2] + HdrCoefs[2][3]);
+            }
+        }
+    }
+
+    void ConvertRect(Scratch& s, const uint8* src, uint srcPitch, PixelFormat srcFormat, uint8* out, uint x0, uint y0, uint x1, uint y1)
+    {
+        x1 = Min(x1, P.SizeX);
+        y1 = Min(y1, P.SizeY);
+        if (x1 <= x0 || y1 <= y0) return;
+        if (Is420)
+            ASSERT(!(x0 & 1) && !(y0 & 1) && !(x1 & 1) && !(y1 & 1));
+
+        const uint n = x1 - x0;
+        const uint rows = Is420 ? 2 : 1;
+        const uint pitch = FI.pitch;
+        const uint sizeY = P.SizeY;
+
+        for (uint y = y0; y < y1; y += rows)
+        {
+            for (uint r = 0; r < rows; r++)
+            {
+                LoadRow(s, src + (size_t)((y + r) / P.Upscale) * srcPitch, srcFormat, x0, n);
+                for (uint ch = 0; ch < Channels; ch++)
+                    K->Matrix(s.R, s.G, s.B, n, Coefs[ch], s.C[r][ch]);
+            }
+
+            switch (P.Format)
+            {
+            case IEncode::BufferFormat::BGRA8:
+            {
+                uint8* dest = out + (size_t)y * pitch + 4 * x0;
+                for (uint i = 0; i < n; i++, dest += 4)
+                {
+                    dest[0] = (uint8)Quant(s.C[0][2][i], 255.0f);
+                    dest[1] = (uint8)Quant(s.C[0][1][i], 255.0f);
+                    dest[2] = (uint8)Quant(s.C[0][0][i], 255.0f);
+                    dest[3] = (uint8)Quant(s.C[0][3][i], 255.0f);
+                }
+                break;
+            }
+            case IEncode::BufferFormat::NV12:
+                K->Quant8(s.C[0][0], n, out + (size_t)y * pitch + x0);
+                K->Quant8(s.C[1][0], n, out + (size_t)(y + 1) * pitch + x0);
+                K->Average420(s.C[0][1], s.C[1][1], n / 2, s.AU);
+                K->Average420(s.C[0][2], s.C[1][2], n / 2, s.AV);
+                K->Quant8x2(s.AU, s.AV, n / 2, out + (size_t)(sizeY + y / 2) * pitch + x0);
+                break;
+            case IEncode::BufferFormat::YUV444_8:
+                K->Quant8(s.C[0][0], n, out + (size_t)y * pitch + x0);
+                K->Quant8(s.C[0][1], n, out + (size_t)(sizeY + y) * pitch + x0);
+                K->Quant8(s.C[0][2], n, out + (size_t)(2 * sizeY + y) * pitch + x0);
+                break;
+            case IEncode::BufferFormat::YUV420_16:
+                K->Quant16(s.C[0][0], n, (uint16*)(out + (size_t)y * pitch) + x0);
+                K->Quant16(s.C[1][0], n, (uint16*)(out + (size_t)(y + 1) * pitch) + x0);
+                K->Average420(s.C[0][1], s.C[1][1], n / 2, s.AU);
+                K->Average420(s.C[0][2], s.C[1][2], n / 2, s.AV);
+                K->Quant16x2(s.AU, s.AV, n / 2, (uint16*)(out + (size_t)(sizeY + y / 2) * pitch) + x0);
+                break;
+            case IEncode::BufferFormat::YUV444_16:
+                K->Quant16(s.C[0][0], n, (uint16*)(out + (size_t)y * pitch) + x0);
+                K->Quant16(s.C[0][1], n, (uint16*)(out + (size_t)(sizeY + y) * pitch) + x0);
+                K->Quant16(s.C[0][2], n, (uint16*)(out + (size_t)(2 * sizeY + y) * pitch) + x0);
+                break;
+            }
+        }
+    }
+};
+
+ColorConverterCPU::ColorConverterCPU(const Para& para) : P(new Priv(para)) {}
+ColorConverterCPU::~ColorConverterCPU() { delete P; }
+
+void ColorConverterCPU::Convert(const uint8* src, uint srcPitch, PixelFormat srcFormat, uint8* out)
+{
+    P->Convert(src, srcPitch, srcFormat, out);
+}
+
+void ColorConverterCPU::ConvertRect(const uint8* src, uint srcPitch, PixelFormat srcFormat, uint8* out, uint x0, uint y0, uint x1, uint y1)
+{
+    P->ConvertRect(P->Scratches[0], src, srcPitch, srcFormat, out, x0, y0, x1, y1);
+}
+
+void ColorConverterCPU::ConvertTiles(const uint8* src, uint srcPitch, PixelFormat srcFormat, uint8* out, const TileMask& tiles)
+{
+    // whole runs at once, so the kernels still get long rows
+    const uint ts = TileMask::TileSize;
+    tiles.ForEachRun([&](uint x0, uint x1, uint y)
+    {
+        P->ConvertRect(P->Scratches[0], src, srcPitch, srcFormat, out, x0 * ts, y * ts, x1 * ts, (y + 1) * ts);
+    });
+}
+
+ColorConverterCPU::Isa ColorConverterCPU::GetIsa() const { return P->UsedIsa; }
+
+double ColorConverterCPU::GetWorkerCpuTime() const
+{
+    double time = 0;
+    for (auto w : P->Workers)
+        time += w->CpuTime;
+    return time;
+}
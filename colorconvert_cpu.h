@@ -0,0 +1,61 @@
+//
+// Copyright (C) Tammo Hinrichs 2021-2022. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#pragma once
+
+#include "types.h"
+#include "graphics.h"
+#include "encode.h"
+#include "tilemask.h"
+
+// CPU version of the csc shader in colorconvert.hlsl, for when there's no GPU to
+// do the job (or a software encoder wants the result in system memory anyway).
+// Writes exactly the layouts described by GetFormatInfo(). The SSE4.1 and AVX2
+// paths give bit identical results to the scalar one.
+class ColorConverterCPU
+{
+public:
+    enum class Isa { Scalar, SSE41, AVX2 };
+
+    struct Para
+    {
+        IEncode::BufferFormat Format = IEncode::BufferFormat::NV12;
+        uint SizeX = 0;         // output size (so source size * Upscale)
+        uint SizeY = 0;
+        uint Upscale = 1;       // integer upscaling, like UPSCALE in the shader
+        bool Hdr = false;       // scRGB source: convert to Rec.2020 and apply PQ, like HDR in the shader
+        Mat44 YuvMatrix;        // see GetConvertMatrix()
+        Mat44 ColorMatrix;      // see GetHdrColorMatrix()
+        uint Threads = 0;       // 0: one per core
+        Isa MaxIsa = Isa::AVX2; // to force the slower paths
+    };
+
+    explicit ColorConverterCPU(const Para& para);
+    ~ColorConverterCPU();
+
+    // convert a whole image, split into bands over all worker threads.
+    // Supported source formats: BGRA8, RGBA8, RGB10A2, RGBA16F
+    void Convert(const uint8* src, uint srcPitch, PixelFormat srcFormat, uint8* out);
+
+    // convert only a rectangle of the output (x1/y1 exclusive) on the calling thread.
+    // Coordinates need to be even for the 4:2:0 formats. Don't call while Convert() runs.
+    void ConvertRect(const uint8* src, uint srcPitch, PixelFormat srcFormat, uint8* out, uint x0, uint y0, uint x1, uint y1);
+
+    // convert only the dirty tiles of the output and leave the rest of out alone,
+    // on the calling thread. Reference for what the csc shader does with TILES=1
+    void ConvertTiles(const uint8* src, uint srcPitch, PixelFormat srcFormat, uint8* out, const TileMask& tiles);
+
+    Isa GetIsa() const;
+
+    // CPU time the worker threads have used so far, in seconds. Convert() does
+    // one band on the calling thread, that's not included
+    double GetWorkerCpuTime() const;
+
+    static Isa DetectIsa();
+
+private:
+    struct Priv;
+    Priv* P = nullptr;
+};
@@ -23,13 +23,23 @@ struct IEncode
 
     virtual ~IEncode() {}
 
+    // where the converted frames are, in the layout GetFormatInfo() describes: a GPU
+    // buffer the csc shader writes, or system memory when running without D3D
+    // (headless, converted by ColorConverterCPU). SubmitFrame() reads whichever is set
+    struct Input
+    {
+        RCPtr<GpuByteBuffer> Gpu = nullptr;
+        const uint8* Cpu = nullptr;
+    };
+
     virtual BufferFormat GetBufferFormat() = 0;
 
-    virtual void Init(uint sizeX, uint sizeY, uint rateNum, uint rateDen, RCPtr<GpuByteBuffer> buffer) = 0;
+    virtual void Init(uint sizeX, uint sizeY, uint rateNum, uint rateDen, const Input& input) = 0;
 
     virtual void SubmitFrame(double time) = 0;
 
-    virtual void DuplicateFrame() = 0;
+    // repeats the last frame. time is what the packet reports, for VFR output
+    virtual void DuplicateFrame(double time) = 0;
 
     virtual void Flush() = 0;
 
@@ -38,6 +48,8 @@ struct IEncode
 };
 
 IEncode* CreateEncodeNVENC(const CaptureConfig &cfg, bool isHdr);
+IEncode* CreateEncodeLibAV(const CaptureConfig &cfg, bool isHdr);
+IEncode* CreateEncodePassthrough(const CaptureConfig &cfg, bool isHdr);
 
 struct FormatInfo
 {
@@ -47,4 +59,10 @@ struct FormatInfo
     float ymin, ymax, uvmin, uvmax;
 };
 
-FormatInfo GetFormatInfo(IEncode::BufferFormat fmt, uint sizeX, uint sizeY);
\ No newline at end of file
+FormatInfo GetFormatInfo(IEncode::BufferFormat fmt, uint sizeX, uint sizeY);
+
+// RGB -> output format conversion matrix (with the amplitude baked in)
+Mat44 GetConvertMatrix(IEncode::BufferFormat fmt, bool isHdr);
+
+// HDR: converts scRGB to Rec.2020, normalized to 10000 nits
+Mat44 GetHdrColorMatrix();
\ No newline at end of file
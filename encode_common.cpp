@@ -4,6 +4,7 @@
 //
 
 #include "encode.h"
+#include "colormath.h"
 
 FormatInfo GetFormatInfo(IEncode::BufferFormat fmt, uint sizeX, uint sizeY)
 {
@@ -49,4 +50,20 @@ FormatInfo GetFormatInfo(IEncode::BufferFormat fmt, uint sizeX, uint sizeY)
         break;
     }
     return info;
-}
\ No newline at end of file
+}
+
+Mat44 GetConvertMatrix(IEncode::BufferFormat fmt, bool isHdr)
+{
+    auto fi = GetFormatInfo(fmt, 0, 0);
+
+    Mat44 yuvMatrix;
+    if (fmt != IEncode::BufferFormat::BGRA8)
+        yuvMatrix = MakeRGB2YUV44(isHdr ? Rec2020 : Rec709, fi.ymin, fi.ymax, fi.uvmin, fi.uvmax);
+
+    return yuvMatrix * Mat44::Scale(fi.amp);
+}
+
+Mat44 GetHdrColorMatrix()
+{
+    return Mat44(Rec709.GetConvertTo(Rec2020) * Mat33::Scale(80.f / 10000.0f), Vec3(0));
+}
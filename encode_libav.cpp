@@ -0,0 +1,462 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include "system.h"
+#include "graphics.h"
+#include "encode.h"
+#include "screencapture.h"
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavutil/avutil.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+#include <libavutil/error.h>
+}
+
+#define AVERR(x) { auto _ret=(x); if(_ret<0) { char _err[AV_ERROR_MAX_STRING_SIZE]; Fatal("%s(%d): libav call failed: %s\nCall: %s\n",__FILE__,__LINE__,av_make_error_string(_err, AV_ERROR_MAX_STRING_SIZE, _ret),#x); } }
+
+struct ProfileDef
+{
+    const char* encoder;
+    const char* profile;
+    AVPixelFormat pixFmt;
+};
+
+// same order as CodecProfile. x265 doesn't take NV12, so the 4:2:0 formats get split into planes for it
+static const ProfileDef Profiles[] =
+{
+    { "libx264", "main", AV_PIX_FMT_NV12 },
+    { "libx264", "high", AV_PIX_FMT_NV12 },
+    { "libx264", "high444", AV_PIX_FMT_YUV444P },
+    { "libx265", "main", AV_PIX_FMT_YUV420P },
+    { "libx265", "main10", AV_PIX_FMT_YUV420P10 },
+    { "libx265", "main444-8", AV_PIX_FMT_YUV444P },
+    { "libx265", "main444-10", AV_PIX_FMT_YUV444P10 },
+    { "libx265", "main444-10", AV_PIX_FMT_YUV444P10 },
+};
+
+// the 16 bit buffer formats are 10 bits scaled to the full 16 bit range (like P010)
+static inline uint16 To10Bit(uint v) { return (uint16)((v - (v >> 10) + 32) >> 6); }
+
+static void CopyPlane16To10(uint8* dest, int destPitch, const uint8* src, uint srcPitch, uint sizeX, uint sizeY)
+{
+    for (uint y = 0; y < sizeY; y++, dest += destPitch, src += srcPitch)
+    {
+        auto d = (uint16*)dest;
+        auto s = (const uint16*)src;
+        for (uint x = 0; x < sizeX; x++)
+            d[x] = To10Bit(s[x]);
+    }
+}
+
+static void SplitUV8(uint8* destU, int pitchU, uint8* destV, int pitchV, const uint8* src, uint srcPitch, uint sizeX, uint sizeY)
+{
+    for (uint y = 0; y < sizeY; y++, destU += pitchU, destV += pitchV, src += srcPitch)
+        for (uint x = 0; x < sizeX; x++)
+        {
+            destU[x] = src[2 * x];
+            destV[x] = src[2 * x + 1];
+        }
+}
+
+static void SplitUV16To10(uint8* destU, int pitchU, uint8* destV, int pitchV, const uint8* src, uint srcPitch, uint sizeX, uint sizeY)
+{
+    for (uint y = 0; y < sizeY; y++, destU += pitchU, destV += pitchV, src += srcPitch)
+    {
+        auto u = (uint16*)destU;
+        auto v = (uint16*)destV;
+        auto s = (const uint16*)src;
+        for (uint x = 0; x < sizeX; x++)
+        {
+            u[x] = To10Bit(s[2 * x]);
+            v[x] = To10Bit(s[2 * x + 1]);
+        }
+    }
+}
+
+// CPU encoder using libx264/libx265. The converted frames get read back from the GPU
+// one frame late (so we don't stall on the copy), or taken straight from system memory
+// when running headless. Encoding happens on an extra thread that feeds the packet
+// queue; libx264/libx265 bring their own worker threads.
+class Encode_LibAV : public IEncode
+{
+    static constexpr uint NumReadback = 2;
+    static constexpr uint NumTimes = 1024;
+    static constexpr int FrameAlign = 64;
+
+    struct Packet
+    {
+        AVPacket* Pkt;
+        double Time;
+    };
+
+    const VideoCodecConfig& Config;
+    bool IsHDR;
+
+    AVCodecContext* Context = nullptr;
+    AVBufferPool* FramePool = nullptr;
+
+    uint SizeX = 0;
+    uint SizeY = 0;
+    FormatInfo Info = {};
+
+    RCPtr<GpuByteBuffer> InBuffer;
+    const uint8* CpuInput = nullptr;
+    RCPtr<ReadbackBuffer> Readback[NumReadback];
+    double ReadbackTime[NumReadback] = {};
+    uint ReadbackWrite = 0;
+    uint ReadbackRead = 0;
+
+    AVFrame* LastFrame = nullptr;
+    int64 FrameNo = 0;
+    bool Flushed = false;
+
+    // capture time per pts, written before the frame gets queued
+    double Times[NumTimes] = {};
+
+    SpscQueue<AVFrame*, 64> Frames;
+    SpscQueue<Packet, 256> Packets;
+    ThreadEvent FrameEvent;
+    ThreadEvent PacketEvent;
+    ThreadEvent ProgressEvent;          // a packet got made or taken, or the encoder is drained
+    std::atomic<bool> Drained = false;
+    Thread* EncodeThread = nullptr;
+
+    Packet Current = {};
+
+    AVFrame* AllocFrame()
+    {
+        AVFrame* frame = av_frame_alloc();
+        frame->format = Context->pix_fmt;
+        frame->width = SizeX;
+        frame->height = SizeY;
+        frame->buf[0] = av_buffer_pool_get(FramePool);
+        ASSERT(frame->buf[0]);
+        AVERR(av_image_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data, Context->pix_fmt, SizeX, SizeY, FrameAlign));
+        return frame;
+    }
+
+    void ConvertFrame(const uint8* src, AVFrame* frame)
+    {
+        const uint pitch = Info.pitch;
+        const uint8* chroma = src + (size_t)pitch * SizeY;
+
+        switch (GetBufferFormat())
+        {
+        case BufferFormat::NV12:
+            av_image_copy_plane(frame->data[0], frame->linesize[0], src, pitch, SizeX, SizeY);
+            if (frame->format == AV_PIX_FMT_NV12)
+                av_image_copy_plane(frame->data[1], frame->linesize[1], chroma, pitch, SizeX, SizeY / 2);
+            else
+                SplitUV8(frame->data[1], frame->linesize[1], frame->data[2], frame->linesize[2], chroma, pitch, SizeX / 2, SizeY / 2);
+            break;
+        case BufferFormat::YUV444_8:
+            for (int i = 0; i < 3; i++)
+                av_image_copy_plane(frame->data[i], frame->linesize[i], src + (size_t)i * pitch * SizeY, pitch, SizeX, SizeY);
+            break;
+        case BufferFormat::YUV420_16:
+            CopyPlane16To10(frame->data[0], frame->linesize[0], src, pitch, SizeX, SizeY);
+            SplitUV16To10(frame->data[1], frame->linesize[1], frame->data[2], frame->linesize[2], chroma, pitch, SizeX / 2, SizeY / 2);
+            break;
+        case BufferFormat::YUV444_16:
+            for (int i = 0; i < 3; i++)
+                CopyPlane16To10(frame->data[i], frame->linesize[i], src + (size_t)i * pitch * SizeY, pitch, SizeX, SizeY);
+            break;
+        default:
+            ASSERT0("unsupported buffer format");
+        }
+    }
+
+    void QueueFrame(AVFrame* frame, double time)
+    {
+        frame->pts = FrameNo++;
+        Times[frame->pts % NumTimes] = time;
+
+        // if the encoder can't keep up, so can't we
+        while (!Frames.Enqueue(frame))
+            Thread::Sleep(1);
+        FrameEvent.Fire();
+    }
+
+    void SendFrame(const uint8* src, double time)
+    {
+        AVFrame* frame = AllocFrame();
+        ConvertFrame(src, frame);
+
+        av_frame_unref(LastFrame);
+        AVERR(av_frame_ref(LastFrame, frame));
+
+        QueueFrame(frame, time);
+    }
+
+    void ReadbackFrame()
+    {
+        uint index = ReadbackRead++ % NumReadback;
+        SendFrame(Readback[index]->Map(), ReadbackTime[index]);
+        Readback[index]->Unmap();
+    }
+
+    void ReceivePackets(Thread& thread)
+    {
+        for (;;)
+        {
+            AVPacket* pkt = av_packet_alloc();
+            int ret = avcodec_receive_packet(Context, pkt);
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            {
+                av_packet_free(&pkt);
+                return;
+            }
+            AVERR(ret);
+
+            Packet packet = { .Pkt = pkt, .Time = Times[pkt->pts % NumTimes] };
+            while (!Packets.Enqueue(packet))
+            {
+                if (!thread.IsRunning())
+                {
+                    av_packet_free(&pkt);
+                    break;
+                }
+                Thread::Sleep(1);
+            }
+            PacketEvent.Fire();
+            ProgressEvent.Fire();
+        }
+    }
+
+    void EncodeThreadFunc(Thread& thread)
+    {
+        while (thread.IsRunning())
+        {
+            AVFrame* frame = nullptr;
+            if (!Frames.Dequeue(frame))
+            {
+                FrameEvent.Wait(10);
+                continue;
+            }
+
+            // a null frame means end of stream and drains the encoder
+            bool eos = !frame;
+            AVERR(avcodec_send_frame(Context, frame));
+            av_frame_free(&frame);
+            ReceivePackets(thread);
+
+            if (eos)
+            {
+                Drained = true;
+                ProgressEvent.Fire();
+                break;
+            }
+        }
+    }
+
+public:
+    Encode_LibAV(const VideoCodecConfig& cfg, bool isHdr) : Config(cfg), IsHDR(isHdr) {}
+
+    // doesn't flush: whoever wants the last packets calls Flush() while
+    // something still picks them up. What's left here gets thrown away
+    ~Encode_LibAV()
+    {
+        delete EncodeThread;
+
+        AVFrame* frame = nullptr;
+        while (Frames.Dequeue(frame))
+            av_frame_free(&frame);
+
+        av_packet_free(&Current.Pkt);
+        Packet packet;
+        while (Packets.Dequeue(packet))
+            av_packet_free(&packet.Pkt);
+
+        av_frame_free(&LastFrame);
+        avcodec_free_context(&Context);
+        av_buffer_pool_uninit(&FramePool);
+    }
+
+    BufferFormat GetBufferFormat() override
+    {
+        switch (Config.Profile)
+        {
+        case CodecProfile::H264_HIGH_444: case CodecProfile::HEVC_MAIN_444:
+            return BufferFormat::YUV444_8;
+        case CodecProfile::HEVC_MAIN10:
+            return BufferFormat::YUV420_16;
+        case CodecProfile::HEVC_MAIN10_444: case CodecProfile::HEVC_LOSSLESS:
+            return BufferFormat::YUV444_16;
+        default:
+            return BufferFormat::NV12;
+        }
+    }
+
+    void Init(uint sizeX, uint sizeY, uint rateNum, uint rateDen, const Input& input) override
+    {
+        SizeX = sizeX;
+        SizeY = sizeY;
+        InBuffer = input.Gpu;
+        CpuInput = input.Cpu;
+        ASSERT(InBuffer.IsValid() || CpuInput);
+        Info = GetFormatInfo(GetBufferFormat(), SizeX, SizeY);
+
+        if (IsHDR && (Config.Profile != CodecProfile::HEVC_MAIN10 && Config.Profile != CodecProfile::HEVC_MAIN10_444))
+        {
+            ASSERT0("HDR capture is only supported when using a 10 bits per pixel profile");
+        }
+
+        const ProfileDef& profile = Profiles[(int)Config.Profile];
+        const bool x265 = Config.Profile >= CodecProfile::HEVC_MAIN;
+
+        const AVCodec* codec = avcodec_find_encoder_by_name(profile.encoder);
+        if (!codec)
+            Fatal("%s is not available, can't encode on the CPU\n", profile.encoder);
+
+        Context = avcodec_alloc_context3(codec);
+        Context->width = SizeX;
+        Context->height = SizeY;
+        Context->time_base = { .num = (int)rateDen, .den = (int)rateNum };
+        Context->framerate = { .num = (int)rateNum, .den = (int)rateDen };
+        Context->sample_aspect_ratio = { .num = 1, .den = 1 };
+        Context->pix_fmt = profile.pixFmt;
+        Context->max_b_frames = 0;
+        Context->gop_size = Config.FrameCfg == FrameConfig::I ? 1 : (Config.GopSize ? (int)Config.GopSize : -1);
+
+        // libx264 does frame threads if both are set, slice threads with SLICE only
+        Context->thread_count = Config.CpuThreads;
+        Context->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+        Context->color_range = AVCOL_RANGE_MPEG;
+        if (IsHDR)
+        {
+            Context->color_primaries = AVCOL_PRI_BT2020;
+            Context->color_trc = AVCOL_TRC_SMPTE2084;
+            Context->colorspace = AVCOL_SPC_BT2020_NCL;
+        }
+        else
+        {
+            Context->color_primaries = AVCOL_PRI_BT709;
+            Context->color_trc = AVCOL_TRC_IEC61966_2_1;
+            Context->colorspace = AVCOL_SPC_BT709;
+        }
+
+        AVDictionary* opts = nullptr;
+        Array<String> x265Params;
+        av_dict_set(&opts, "preset", Config.CpuPreset, 0);
+        av_dict_set(&opts, "profile", profile.profile, 0);
+
+        switch (Config.UseBitrateControl)
+        {
+        case BitrateControl::CONSTQP:
+            av_dict_set_int(&opts, "qp", Clamp(Config.BitrateParameter, 1u, 51u), 0);
+            break;
+        case BitrateControl::CBR:
+            Context->bit_rate = Context->rc_max_rate = Min(Config.BitrateParameter * 1000ll, 500ll * 1000 * 1000);
+            Context->rc_buffer_size = (int)Context->bit_rate;
+            if (x265)
+                x265Params += "strict-cbr=1";
+            else
+                av_dict_set(&opts, "nal-hrd", "cbr", 0);
+            break;
+        }
+
+        if (x265)
+        {
+            // x265 ignores thread_count, it has its own thread pools
+            if (Config.CpuThreads)
+                x265Params += String::PrintF("pools=%d", Config.CpuThreads);
+            if (Config.Profile == CodecProfile::HEVC_LOSSLESS)
+                x265Params += "lossless=1";
+            if (x265Params.Len())
+                av_dict_set(&opts, "x265-params", String::Join(x265Params, ":"), 0);
+        }
+
+        AVERR(avcodec_open2(Context, codec, &opts));
+        av_dict_free(&opts);
+
+        FramePool = av_buffer_pool_init(av_image_get_buffer_size(Context->pix_fmt, SizeX, SizeY, FrameAlign), nullptr);
+        LastFrame = av_frame_alloc();
+
+        if (InBuffer.IsValid())
+            for (uint i = 0; i < NumReadback; i++)
+                Readback[i] = new ReadbackBuffer(Info.pitch * Info.lines);
+
+        EncodeThread = new Thread(Bind(this, &Encode_LibAV::EncodeThreadFunc));
+    }
+
+    void SubmitFrame(double time) override
+    {
+        if (Flushed) return;
+
+        // system memory: nothing to wait for
+        if (CpuInput)
+        {
+            SendFrame(CpuInput, time);
+            return;
+        }
+
+        uint index = ReadbackWrite++ % NumReadback;
+        Readback[index]->CopyFrom(InBuffer);
+        ReadbackTime[index] = time;
+
+        // by now the copy of the previous frame should be done
+        if (ReadbackWrite - ReadbackRead > 1)
+            ReadbackFrame();
+    }
+
+    void DuplicateFrame(double time) override
+    {
+        if (Flushed) return;
+
+        while (ReadbackRead != ReadbackWrite)
+            ReadbackFrame();
+
+        if (!LastFrame->buf[0])
+            return;
+
+        QueueFrame(av_frame_clone(LastFrame), time);
+    }
+
+    void Flush() override
+    {
+        if (Flushed || !EncodeThread) return;
+
+        while (ReadbackRead != ReadbackWrite)
+            ReadbackFrame();
+
+        Flushed = true;
+        while (!Frames.Enqueue(nullptr))
+            Thread::Sleep(1);
+        FrameEvent.Fire();
+
+        // wait until the encoder is drained and the output has picked up the rest,
+        // for as long as things keep moving
+        while (!Drained || !Packets.IsEmpty())
+            if (!ProgressEvent.Wait(5000))
+                break;
+    }
+
+    bool BeginGetPacket(uint8*& data, uint& size, uint timeoutMs, double& time) override
+    {
+        ASSERT(!Current.Pkt);
+        if (Packets.IsEmpty() && !PacketEvent.Wait(timeoutMs))
+            return false;
+
+        if (!Packets.Dequeue(Current))
+            return false;
+
+        data = Current.Pkt->data;
+        size = Current.Pkt->size;
+        time = Current.Time;
+        return true;
+    }
+
+    void EndGetPacket() override
+    {
+        av_packet_free(&Current.Pkt);
+        ProgressEvent.Fire();
+    }
+};
+
+IEncode* CreateEncodeLibAV(const CaptureConfig& cfg, bool isHdr) { return new Encode_LibAV(cfg.CodecCfg, isHdr); }
@@ -52,7 +52,6 @@ class Encode_NVENC : public IEncode
     {
         uint Used = 0;
         CUdeviceptr Buffer;
-        double Time;
 
         NV_ENC_MAP_INPUT_RESOURCE Map = {};
     };
@@ -60,6 +59,7 @@ class Encode_NVENC : public IEncode
     struct OutBuffer
     {
         Frame* frame = nullptr;
+        double Time = 0;    // per buffer, duplicates share the frame
         ThreadEvent event;
         NV_ENC_OUTPUT_PTR buffer = nullptr;
     };
@@ -166,7 +166,7 @@ class Encode_NVENC : public IEncode
         buffer = nullptr;
     }
 
-    void EncodeFrame()
+    void EncodeFrame(double time)
     {
         OutBuffer* ob = nullptr;
 
@@ -174,6 +174,7 @@ class Encode_NVENC : public IEncode
 
         ob = AcquireOutBuffer();
         ob->frame = CurrentFrame;
+        ob->Time = time;
         AtomicInc(CurrentFrame->Used);
 
         auto fi = GetFormatInfo(GetBufferFormat(), SizeX, SizeY);
@@ -292,12 +293,14 @@ public:
         }
     }
 
-    void Init(uint sizeX, uint sizeY, uint rateNum, uint rateDen, RCPtr<GpuByteBuffer> buffer) override
+    void Init(uint sizeX, uint sizeY, uint rateNum, uint rateDen, const Input& input) override
     {
         SizeX = sizeX;
         SizeY = sizeY;
 
-        InBuffer = buffer;
+        // NVENC registers the D3D buffer as its input, there's no system memory path
+        ASSERT(input.Gpu.IsValid());
+        InBuffer = input.Gpu;
 
         switch (GetBufferFormat())
         {
@@ -382,6 +385,7 @@ public:
         if (profile.encodeGuid == NV_ENC_CODEC_HEVC_GUID)
         {
             enccfg.encodeCodecConfig.hevcConfig.idrPeriod = enccfg.gopLength = Config.GopSize;
+            enccfg.encodeCodecConfig.hevcConfig.repeatSPSPPS = 1; // so every IDR can start a file (replay, segments)
             auto& vuipara = enccfg.encodeCodecConfig.hevcConfig.hevcVUIParameters;
             vuipara.videoSignalTypePresentFlag = 1;
             vuipara.colourDescriptionPresentFlag = 1;
@@ -401,6 +405,7 @@ public:
         else
         {
             enccfg.encodeCodecConfig.h264Config.idrPeriod = enccfg.gopLength = Config.GopSize;        
+            enccfg.encodeCodecConfig.h264Config.repeatSPSPPS = 1;
             auto& vuipara = enccfg.encodeCodecConfig.h264Config.h264VUIParameters;
             vuipara.videoSignalTypePresentFlag = 1;
             vuipara.colourDescriptionPresentFlag = 1;
@@ -469,7 +474,6 @@ public:
 
         // get a frame        
         CurrentFrame = AcquireFrame();
-        CurrentFrame->Time = time;
        
         // copy intermediate texture -> frame
         auto fi = GetFormatInfo(GetBufferFormat(), SizeX, SizeY);
@@ -493,12 +497,12 @@ public:
         // submit frame
         NVERR(Nvenc.nvEncMapInputResource(Encoder, &CurrentFrame->Map));
 
-        EncodeFrame();
+        EncodeFrame(time);
     }
 
-    void DuplicateFrame() override
+    void DuplicateFrame(double time) override
     {
-        EncodeFrame();
+        EncodeFrame(time);
     }
 
     void Flush() override
@@ -536,7 +540,7 @@ public:
             NVERR(Nvenc.nvEncLockBitstream(Encoder, &lock));
             data = (uint8*)lock.bitstreamBufferPtr;
             size = lock.bitstreamSizeInBytes;
-            time = CurrentBuffer->frame->Time;
+            time = CurrentBuffer->Time;
             return true;
         }
 
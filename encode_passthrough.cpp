@@ -0,0 +1,304 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include "system.h"
+#include "encode.h"
+#include "screencapture.h"
+
+// Pass-through "encoder": doesn't touch the GPU or even look at the frames, and
+// returns one packet per submitted frame, so capture, conversion and muxing overhead
+// can be measured without NVENC (or any GPU encoder) in the picture.
+// The packets are a real (if boring) H.264 stream: a flat gray IDR picture every
+// GOP, all-skip P pictures in between, padded with filler data to what a CBR stream
+// would write. That way the output parses, plays and gets cut at keyframes like
+// the real thing.
+class Encode_Passthrough : public IEncode
+{
+    // RBSP writer with emulation prevention, for the handful of syntax elements we need
+    struct BitWriter
+    {
+        uint8* Ptr;
+        uint Acc = 0;
+        int Count = 0;
+        uint Zeros = 0;     // zero bytes in a row, see Byte()
+
+        explicit BitWriter(uint8* ptr) : Ptr(ptr) {}
+
+        void Byte(uint8 b)
+        {
+            // 00 00 0x would look like a start code to the parser
+            if (Zeros >= 2 && b <= 3)
+            {
+                *Ptr++ = 3;
+                Zeros = 0;
+            }
+            *Ptr++ = b;
+            Zeros = b ? 0 : Zeros + 1;
+        }
+
+        void Put(uint value, int bits)
+        {
+            for (int i = bits - 1; i >= 0; i--)
+            {
+                Acc = (Acc << 1) | ((value >> i) & 1);
+                if (++Count == 8)
+                {
+                    Byte((uint8)Acc);
+                    Acc = Count = 0;
+                }
+            }
+        }
+
+        void Ue(uint value)
+        {
+            int len = 0;
+            while (((uint64)value + 1) >> (len + 1))
+                len++;
+            Put(0, len);
+            Put(value + 1, len + 1);
+        }
+
+        void Se(int value) { Ue(value > 0 ? 2 * value - 1 : -2 * value); }
+
+        // start code and NAL header; not escaped
+        void Nal(uint refIdc, uint type)
+        {
+            static const uint8 startCode[] = { 0, 0, 0, 1 };
+            memcpy(Ptr, startCode, 4);
+            Ptr += 4;
+            *Ptr++ = (uint8)((refIdc << 5) | type);
+            Zeros = 0;
+        }
+
+        void Trailing()
+        {
+            Put(1, 1);
+            if (Count)
+                Put(0, 8 - Count);
+        }
+    };
+
+    const VideoCodecConfig& Config;
+
+    SpscQueue<double, 256> Pending;
+    ThreadEvent PacketEvent;
+
+    uint MbX = 0, MbY = 0;
+    uint SizeX = 0, SizeY = 0;
+    uint Level = 0;
+    uint Gop = 1;
+    uint64 FrameNo = 0;
+    uint IdrCount = 0;
+
+    uint8* Payload = nullptr;
+    uint PayloadSize = 0;   // target size of a packet, the pictures get padded up to this
+
+    void WriteSPS(BitWriter& bw)
+    {
+        bw.Nal(3, 7);
+        bw.Put(66, 8);              // profile_idc: baseline...
+        bw.Put(0xc0, 8);            // ... constraint_set0/1, so constrained baseline
+        bw.Put(Level, 8);
+        bw.Ue(0);                   // seq_parameter_set_id
+        bw.Ue(12);                  // log2_max_frame_num_minus4: 16 bits
+        bw.Ue(2);                   // pic_order_cnt_type: output order is decode order
+        bw.Ue(1);                   // max_num_ref_frames
+        bw.Put(0, 1);               // gaps_in_frame_num_value_allowed_flag
+        bw.Ue(MbX - 1);
+        bw.Ue(MbY - 1);
+        bw.Put(1, 1);               // frame_mbs_only_flag
+        bw.Put(1, 1);               // direct_8x8_inference_flag
+        uint cropX = (MbX * 16 - SizeX) / 2, cropY = (MbY * 16 - SizeY) / 2;
+        bw.Put(cropX || cropY, 1);  // frame_cropping_flag, in units of 2 pixels for 4:2:0
+        if (cropX || cropY)
+        {
+            bw.Ue(0);
+            bw.Ue(cropX);
+            bw.Ue(0);
+            bw.Ue(cropY);
+        }
+        bw.Put(0, 1);               // vui_parameters_present_flag
+        bw.Trailing();
+    }
+
+    void WritePPS(BitWriter& bw)
+    {
+        bw.Nal(3, 8);
+        bw.Ue(0);                   // pic_parameter_set_id
+        bw.Ue(0);                   // seq_parameter_set_id
+        bw.Put(0, 1);               // entropy_coding_mode_flag: CAVLC
+        bw.Put(0, 1);               // bottom_field_pic_order_in_frame_present_flag
+        bw.Ue(0);                   // num_slice_groups_minus1
+        bw.Ue(0);                   // num_ref_idx_l0_default_active_minus1
+        bw.Ue(0);                   // num_ref_idx_l1_default_active_minus1
+        bw.Put(0, 1);               // weighted_pred_flag
+        bw.Put(0, 2);               // weighted_bipred_idc
+        bw.Se(0);                   // pic_init_qp_minus26
+        bw.Se(0);                   // pic_init_qs_minus26
+        bw.Se(0);                   // chroma_qp_index_offset
+        bw.Put(0, 1);               // deblocking_filter_control_present_flag
+        bw.Put(0, 1);               // constrained_intra_pred_flag
+        bw.Put(0, 1);               // redundant_pic_cnt_present_flag
+        bw.Trailing();
+    }
+
+    // every macroblock I_16x16 with DC prediction and no residual, which from
+    // nothing gives mid gray
+    void WriteIDR(BitWriter& bw)
+    {
+        bw.Nal(3, 5);
+        bw.Ue(0);                   // first_mb_in_slice
+        bw.Ue(7);                   // slice_type: I, and so are all others in the picture
+        bw.Ue(0);                   // pic_parameter_set_id
+        bw.Put(0, 16);              // frame_num
+        bw.Ue(IdrCount++ & 0xffff); // idr_pic_id, must differ between consecutive IDRs
+        bw.Put(0, 1);               // no_output_of_prior_pics_flag
+        bw.Put(0, 1);               // long_term_reference_flag
+        bw.Se(0);                   // slice_qp_delta
+
+        // mb_type 3 (I_16x16_2_0_0: DC, no coded blocks) "00100", intra_chroma_pred_mode 0 (DC) "1",
+        // mb_qp_delta 0 "1", and the Intra16x16DCLevel block with coeff_token TotalCoeff=0 "1"
+        for (uint i = 0; i < MbX * MbY; i++)
+            bw.Put(0x27, 8);
+        bw.Trailing();
+    }
+
+    // a single skip run over the whole picture: same as the reference
+    void WriteP(BitWriter& bw, uint frameNum)
+    {
+        bw.Nal(2, 1);
+        bw.Ue(0);                   // first_mb_in_slice
+        bw.Ue(5);                   // slice_type: P, all of them
+        bw.Ue(0);                   // pic_parameter_set_id
+        bw.Put(frameNum & 0xffff, 16);
+        bw.Put(0, 1);               // num_ref_idx_active_override_flag
+        bw.Put(0, 1);               // ref_pic_list_modification_flag_l0
+        bw.Put(0, 1);               // adaptive_ref_pic_marking_mode_flag
+        bw.Se(0);                   // slice_qp_delta
+        bw.Ue(MbX * MbY);           // mb_skip_run
+        bw.Trailing();
+    }
+
+    // filler data NAL up to the target size, if there's room for one
+    void WriteFiller(BitWriter& bw, const uint8* start)
+    {
+        uint used = (uint)(bw.Ptr - start);
+        if (used + 6 > PayloadSize)
+            return;
+
+        bw.Nal(0, 12);
+        uint count = PayloadSize - used - 6;
+        memset(bw.Ptr, 0xff, count);
+        bw.Ptr += count;
+        *bw.Ptr++ = 0x80;
+    }
+
+public:
+    Encode_Passthrough(const VideoCodecConfig& cfg) : Config(cfg) {}
+
+    ~Encode_Passthrough()
+    {
+        delete[] Payload;
+    }
+
+    BufferFormat GetBufferFormat() override
+    {
+        switch (Config.Profile)
+        {
+        case CodecProfile::H264_HIGH_444: case CodecProfile::HEVC_MAIN_444:
+            return BufferFormat::YUV444_8;
+        case CodecProfile::HEVC_MAIN10:
+            return BufferFormat::YUV420_16;
+        case CodecProfile::HEVC_MAIN10_444: case CodecProfile::HEVC_LOSSLESS:
+            return BufferFormat::YUV444_16;
+        default:
+            return BufferFormat::NV12;
+        }
+    }
+
+    void Init(uint sizeX, uint sizeY, uint rateNum, uint rateDen, const Input&) override
+    {
+        // the output declares the codec from the profile, and HEVC is too much to fake by hand
+        if (Config.Profile >= CodecProfile::HEVC_MAIN)
+            Fatal("pass-through encoding only supports the H.264 profiles");
+
+        SizeX = sizeX;
+        SizeY = sizeY;
+        MbX = (sizeX + 15) / 16;
+        MbY = (sizeY + 15) / 16;
+
+        // smallest level that fits the picture size and macroblock rate
+        static const struct { uint Idc, MaxFS, MaxMBPS; } levels[] =
+        {
+            { 40, 8192, 245760 }, { 42, 8704, 522240 }, { 51, 36864, 983040 }, { 52, 36864, 2073600 },
+            { 60, 139264, 4177920 }, { 61, 139264, 8355840 }, { 62, 139264, 16711680 },
+        };
+        uint64 mbs = (uint64)MbX * MbY;
+        uint64 mbps = mbs * rateNum / Max(rateDen, 1u);
+        Level = 62;
+        for (auto& l : levels)
+            if (mbs <= l.MaxFS && mbps <= l.MaxMBPS)
+            {
+                Level = l.Idc;
+                break;
+            }
+
+        Gop = Config.FrameCfg == FrameConfig::I ? 1 : Config.GopSize ? Config.GopSize : Max((rateNum + rateDen / 2) / rateDen, 1u);
+
+        // size the packets like a CBR stream would be, or ~1 bit per pixel otherwise
+        uint64 bytes = (uint64)sizeX * sizeY / 8;
+        if (Config.UseBitrateControl == BitrateControl::CBR)
+            bytes = (uint64)Config.BitrateParameter * 1000 * rateDen / (8ull * rateNum);
+        PayloadSize = (uint)Clamp<uint64>(bytes, 64, 64 * 1024 * 1024);
+
+        // an IDR with parameter sets is a byte per macroblock plus a bit of change
+        Payload = new uint8[Max<uint64>(PayloadSize, mbs + 256)];
+    }
+
+    void SubmitFrame(double time) override
+    {
+        // like a real encoder that can't keep up: block instead of losing the frame
+        // (the capture side counts on exactly one packet per submit)
+        while (!Pending.Enqueue(time))
+            Thread::Sleep(1);
+        PacketEvent.Fire();
+    }
+
+    void DuplicateFrame(double time) override
+    {
+        SubmitFrame(time);
+    }
+
+    void Flush() override {}
+
+    bool BeginGetPacket(uint8*& data, uint& size, uint timeoutMs, double& time) override
+    {
+        if (Pending.IsEmpty() && !PacketEvent.Wait(timeoutMs))
+            return false;
+
+        if (!Pending.Dequeue(time))
+            return false;
+
+        BitWriter bw(Payload);
+        uint frameNum = (uint)(FrameNo++ % Gop);
+        if (!frameNum)
+        {
+            WriteSPS(bw);
+            WritePPS(bw);
+            WriteIDR(bw);
+        }
+        else
+            WriteP(bw, frameNum);
+        WriteFiller(bw, Payload);
+
+        data = Payload;
+        size = (uint)(bw.Ptr - Payload);
+        return true;
+    }
+
+    void EndGetPacket() override {}
+};
+
+IEncode* CreateEncodePassthrough(const CaptureConfig& cfg, bool) { return new Encode_Passthrough(cfg.CodecCfg); }
@@ -0,0 +1,244 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include "framepacer.h"
+#include "system.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+FramePacer::FramePacer(const Para& para) : Config(para)
+{
+    FrameDuration = (double)Config.RateDen / Config.RateNum;
+    Reset();
+}
+
+void FramePacer::Reset()
+{
+    Started = false;
+    LastPresent = LastArrival = 0;
+    TotalError = FrameCount = 0;
+    LastFrameCount = 0;
+    Duplicated = Over = 0;
+    Fps = 0;
+}
+
+void FramePacer::UpdateFps(double frames)
+{
+    double cur = 1.0 / (FrameDuration * frames);
+    if (!Fps) Fps = cur;
+    Fps += 0.03 * (cur - Fps);
+}
+
+FramePacer::Decision FramePacer::OnFrame(double presentTime, double now)
+{
+    if (!Started)
+    {
+        Started = true;
+        LastPresent = presentTime;
+        LastArrival = now;
+        return Decision{ .Duplicates = 0, .Emit = true };
+    }
+
+    double delta = presentTime - LastPresent;
+    LastPresent = presentTime;
+    if (delta < 0)
+    {
+        DPrintF("Negative delta!\n");
+        return Decision{ .Duplicates = 0, .Emit = false };
+    }
+    LastArrival = now;
+
+    // whole frames, and keep track of what the rounding left over
+    double fdelta = delta / FrameDuration;
+    double fdi = round(fdelta);
+    TotalError += fdelta - fdi;
+    int comp = 0;
+    if (TotalError >= Config.DriftLimit)
+    {
+        comp = 1;
+        TotalError -= 1;
+    }
+    if (TotalError <= -Config.DriftLimit)
+    {
+        comp = -1;
+        TotalError += 1;
+    }
+    FrameCount += fdi + comp;
+
+    uint64 frameCount = (uint64)round(FrameCount);
+    int deltaFrames = (int)(frameCount - LastFrameCount);
+    LastFrameCount = frameCount;
+
+    // everything between this and the last frame needs duplicates, minus the
+    // ones OnIdle() already inserted. Any extra ones get made up for later.
+    int dup = Max(1, deltaFrames) - 1 - Duplicated;
+    if (dup < 0)
+    {
+        Over -= dup;
+        dup = 0;
+    }
+    else
+    {
+        int doover = Min(dup, Over);
+        dup -= doover;
+        Over -= doover;
+    }
+    Duplicated = 0;
+
+    if (deltaFrames)
+        UpdateFps(deltaFrames);
+
+    return Decision{ .Duplicates = (uint)dup, .Emit = deltaFrames > 0 };
+}
+
+uint FramePacer::OnIdle(double now)
+{
+    if (!Started)
+        return 0;
+
+    // if more than a certain time has passed without a new image, assume a skipped frame
+    uint dups = 0;
+    while (now - LastArrival > Config.StallFrames * FrameDuration)
+    {
+        if (Over)
+            Over--;
+        else
+        {
+            dups++;
+            Duplicated++;
+        }
+
+        LastArrival += FrameDuration;
+        UpdateFps(Duplicated + 1.0);
+    }
+    return dups;
+}
+
+//---------------------------------------------------------------------------
+
+void FramePacerSim::Generate(Array<double>& out, const TracePara& para)
+{
+    out.Clear();
+    out.SetSize(para.Frames);
+
+    uint rnd = para.Seed ? para.Seed : 1;
+    auto random = [&]() // xorshift, -1..1
+    {
+        rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+        return (double)rnd / 2147483648.0 - 1.0;
+    };
+
+    double stall = 0;
+    double last = 0;
+    for (uint64 i = 0; i < para.Frames; i++)
+    {
+        double t = (double)i / para.ContentRate + stall + para.Jitter * random();
+
+        // the application hangs for a bit, everything after it comes later
+        if (para.StallEvery > 0 && floor(t / para.StallEvery) > floor(last / para.StallEvery))
+        {
+            stall += para.StallLength;
+            t += para.StallLength;
+        }
+
+        if (para.VSync)
+            t = ceil(t * para.RefreshRate - 1e-9) / para.RefreshRate;
+
+        t = Max(t, last);
+        out[i] = last = t;
+    }
+}
+
+bool FramePacerSim::Load(Array<double>& out, const char* path)
+{
+    out.Clear();
+    RCPtr<Buffer> buf = LoadFile(path);
+    if (!buf.IsValid())
+        return false;
+
+    // one number per line, copied so strtod has its terminator
+    String text(ReadOnlySpan<char>((const char*)buf->Ptr(), buf->Len()));
+    const char* ptr = text;
+    for (;;)
+    {
+        char* end;
+        double t = strtod(ptr, &end);
+        if (end == ptr)
+            break;
+        out += t;
+        ptr = end;
+    }
+    return true;
+}
+
+bool FramePacerSim::Save(const char* path, ReadOnlySpan<double> trace)
+{
+    Stream* s = OpenFile(path, OpenFileMode::Create);
+    if (!s)
+        return false;
+
+    StringBuilder sb;
+    for (double t : trace)
+        FormatTo(sb, "%.9f\n", t);
+
+    String text = sb.ToString();
+    bool ok = s->Write(text, text.Length()) == text.Length();
+    delete s;
+    return ok;
+}
+
+FramePacerSim::Result FramePacerSim::Run(const FramePacer::Para& para, ReadOnlySpan<double> trace, const SimPara& sim)
+{
+    Result res = {};
+    if (!trace.Len())
+        return res;
+
+    FramePacer pacer(para);
+    const double frameDuration = (double)para.RateDen / para.RateNum;
+    const double start = trace[0];
+    uint64 out = 0;
+
+    auto drift = [&](double t)
+    {
+        // output so far vs. real time, counting the frame on screen right now
+        double d = (double)out * frameDuration - (t - start + frameDuration);
+        res.Drift = d;
+        res.MaxDrift = Max(res.MaxDrift, fabs(d));
+    };
+
+    for (size_t i = 0; i < trace.Len(); i++)
+    {
+        double arrival = trace[i] + sim.Latency;
+        auto dec = pacer.OnFrame(trace[i], arrival);
+        res.Presents++;
+        res.Duplicates += dec.Duplicates;
+        out += dec.Duplicates;
+        if (dec.Emit)
+        {
+            res.Emitted++;
+            out++;
+        }
+        else
+            res.Dropped++;
+        drift(trace[i]);
+
+        // the capture loop polls every PollInterval until the next frame is in.
+        // Nothing happens before the stall threshold, so start right there.
+        if (i + 1 < trace.Len())
+        {
+            double next = trace[i + 1] + sim.Latency;
+            double first = arrival + ceil(para.StallFrames * frameDuration / sim.PollInterval) * sim.PollInterval;
+            for (double t = first; t < next; t += sim.PollInterval)
+            {
+                uint dups = pacer.OnIdle(t);
+                res.Duplicates += dups;
+                out += dups;
+            }
+        }
+    }
+
+    return res;
+}
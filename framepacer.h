@@ -0,0 +1,108 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#pragma once
+
+#include "types.h"
+
+// Decides what the capture loop does with incoming frames, so the output stays
+// on a constant frame rate grid: encode a frame, drop it (two presents in the
+// same frame slot), or repeat the previous one (presents further apart than one
+// frame, or nothing new at all for a while).
+// Present times get rounded to whole frames; once the rounding errors add up to
+// DriftLimit frames, the frame count gets corrected by one.
+// No D3D in here, so it can be fed from FramePacerSim as well.
+class FramePacer
+{
+public:
+    struct Para
+    {
+        uint RateNum = 60;          // output frame rate, which is the display's refresh rate
+        uint RateDen = 1;
+        double StallFrames = 2.5;   // nothing new for this long: duplicate
+        double DriftLimit = 0.75;   // in frames
+    };
+
+    struct Decision
+    {
+        uint Duplicates;    // repeat the last frame this often first
+        bool Emit;          // encode the new frame, otherwise drop it
+    };
+
+    FramePacer() : FramePacer(Para{}) {}
+    explicit FramePacer(const Para& para);
+
+    void Reset();
+
+    // a new frame. presentTime is when it went to the screen, now is when we got it
+    // (same clock as OnIdle(), both in seconds). The very first frame is always emitted.
+    Decision OnFrame(double presentTime, double now);
+
+    // call while waiting for frames. Returns how many duplicates to insert for a stall.
+    uint OnIdle(double now);
+
+    double GetFps() const { return Fps; }           // smoothed, what actually comes in
+    double GetDrift() const { return TotalError; }  // in frames, always within +-DriftLimit
+
+private:
+    Para Config;
+    double FrameDuration;
+
+    bool Started = false;
+    double LastPresent = 0;
+    double LastArrival = 0;
+    double TotalError = 0;
+    double FrameCount = 0;
+    uint64 LastFrameCount = 0;
+
+    int Duplicated = 0;     // stall duplicates since the last frame
+    int Over = 0;           // duplicates the following frames turned out not to need
+    double Fps = 0;
+
+    void UpdateFps(double frames);
+};
+
+// Replays present time traces through a FramePacer, for sweeping the pacing
+// logic without a screen. Runs at a few ten million frames per second.
+class FramePacerSim
+{
+public:
+    struct TracePara
+    {
+        double RefreshRate = 60;    // display
+        double ContentRate = 60;    // what the application presents at
+        bool VSync = true;          // presents land on refresh boundaries (off: VRR)
+        double Jitter = 0;          // max present time error in seconds, uniform
+        double StallEvery = 0;      // seconds between stalls, 0: none
+        double StallLength = 0;     // seconds
+        uint64 Frames = 10000;
+        uint Seed = 1;
+    };
+
+    struct SimPara
+    {
+        double PollInterval = 0.002;    // the capture loop's AcquireFrame() timeout
+        double Latency = 0.001;         // present -> frame arrives
+    };
+
+    struct Result
+    {
+        uint64 Presents;
+        uint64 Emitted;
+        uint64 Duplicates;
+        uint64 Dropped;
+        double Drift;       // output length minus real time at the end, in seconds
+        double MaxDrift;    // largest absolute drift along the way
+    };
+
+    // synthetic trace, present times in seconds
+    static void Generate(Array<double>& out, const TracePara& para);
+
+    // recorded trace: text file with one present time per line, see Save()
+    static bool Load(Array<double>& out, const char* path);
+    static bool Save(const char* path, ReadOnlySpan<double> trace);
+
+    static Result Run(const FramePacer::Para& pacer, ReadOnlySpan<double> trace, const SimPara& sim);
+};
@@ -0,0 +1,100 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include "types.h"
+#include "system.h"
+#include "graphics.h"
+
+// Synthetic frame source: cycles through a few pregenerated test patterns at an
+// exact frame rate, so the rest of the pipeline can be measured without a desktop
+// to duplicate. The patterns live in system memory, so this works without D3D.
+// With changeEvery > 1 it only presents every so many refreshes, like a mostly
+// static desktop
+class FrameSource_Synthetic : public IFrameSource
+{
+    static constexpr int NumPatterns = 4;
+
+    Array<uint> Patterns[NumPatterns];
+
+    uint SizeX, SizeY, RateNum, RateDen, ChangeEvery;
+    double TickRate;
+    int64 StartTicks = 0;
+    uint64 FrameCount = 0;
+
+    static uint MakePixel(uint x, uint y, uint sizeX, uint sizeY, uint pattern)
+    {
+        // color gradient with a moving vertical bar on top
+        uint barX = (pattern * sizeX / NumPatterns + x) % sizeX;
+        if (barX < sizeX / 32)
+            return 0xffffffff;
+
+        uint r = 255 * x / sizeX;
+        uint g = 255 * y / sizeY;
+        uint b = ((x ^ y) >> 3) & 0xff;
+        return 0xff000000 | (r << 16) | (g << 8) | b; // BGRA
+    }
+
+public:
+
+    FrameSource_Synthetic(uint sizeX, uint sizeY, uint rateNum, uint rateDen, uint changeEvery)
+        : SizeX(sizeX), SizeY(sizeY), RateNum(rateNum), RateDen(rateDen), ChangeEvery(Max(changeEvery, 1u))
+    {
+        TickRate = (double)GetTicksPerSecond() * rateDen / rateNum;
+
+        for (uint p = 0; p < NumPatterns; p++)
+        {
+            Patterns[p].SetSize((size_t)sizeX * sizeY);
+            for (uint y = 0; y < sizeY; y++)
+                for (uint x = 0; x < sizeX; x++)
+                    Patterns[p][(size_t)y * sizeX + x] = MakePixel(x, y, sizeX, sizeY, p);
+        }
+    }
+
+    bool AcquireFrame(int timeoutMs, CaptureInfo& info) override
+    {
+        int64 now = GetTicks();
+        if (!StartTicks)
+            StartTicks = now;
+
+        // wait for the next "vsync" that has something new
+        uint64 nextFrame = (FrameCount / ChangeEvery + 1) * ChangeEvery;
+        int64 next = StartTicks + (int64)(TickRate * (double)nextFrame);
+        if (next > now)
+        {
+            int waitMs = (int)(1000 * (next - now) / GetTicksPerSecond());
+            if (waitMs > timeoutMs)
+            {
+                Thread::Sleep(timeoutMs);
+                return false;
+            }
+            if (waitMs > 0)
+                Thread::Sleep(waitMs);
+        }
+
+        // if we've been too slow, skip frames just like a real screen would
+        now = GetTicks();
+        uint64 late = (uint64)((double)(now - StartTicks) / TickRate);
+        FrameCount = Max(nextFrame, late - late % ChangeEvery);
+
+        info.pixels = (const uint8*)Patterns[FrameCount / ChangeEvery % NumPatterns].Ptr();
+        info.pitch = 4 * SizeX;
+        info.format = PixelFormat::BGRA8;
+        info.sizeX = SizeX;
+        info.sizeY = SizeY;
+        info.isHdr = false;
+        info.rateNum = RateNum;
+        info.rateDen = RateDen;
+        info.time = (double)(StartTicks + (int64)(TickRate * (double)FrameCount)) / (double)GetTicksPerSecond();
+        info.allDirty = true;   // a whole new pattern every frame
+        return true;
+    }
+
+    void ReleaseFrame() override {}
+};
+
+IFrameSource* CreateFrameSourceSynthetic(uint sizeX, uint sizeY, uint rateNum, uint rateDen, uint changeEvery)
+{
+    return new FrameSource_Synthetic(sizeX, sizeY, rateNum, rateDen, changeEvery);
+}
@@ -66,9 +66,6 @@ D3D_FEATURE_LEVEL FeatureLevel;
 
 RCPtr<ID3D11SamplerState> SmplWrap;
 
-static double captureFrameCount = 0;
-static int64 lastFrameTime = 0;
-
 static DXGI_FORMAT GetDXGIFormat(PixelFormat fmt)
 {
     switch (fmt)
@@ -322,7 +319,7 @@ RCPtr<Shader> CompileShader(Shader::Type type, ReadOnlySpan<char> source, const
     HRESULT hr = D3DCompile(source.Ptr(), source.Len(), name, &d3dmacros[0], NULL, entryPoint, target, flags, 0, code, errors);
 
     if (errors.IsValid())
-        DPrintF("\n%s\n", errors->GetBufferPointer());
+        DPrintF("\n%s\n", (const char*)errors->GetBufferPointer());
 
     if (FAILED(hr))
         Fatal("Shader compilation of %s failed", name);
@@ -336,10 +333,7 @@ RCPtr<Shader> CompileShader(Shader::Type type, ReadOnlySpan<char> source, const
 
 struct GpuBuffer::Priv
 {
-    Priv(GpuBuffer* b, Type k, Usage m) : gb(b), type(k), usage(m)
-    {
-        ASSERT(usage != Usage::Dynamic); // guess what you'll have to implement now, LOL
-    }
+    Priv(GpuBuffer* b, Type k, Usage m) : gb(b), type(k), usage(m) {}
 
     Type type;
     Usage usage;
@@ -358,13 +352,13 @@ struct GpuBuffer::Priv
         case Type::Index: bind = D3D11_BIND_INDEX_BUFFER; misc = 0; return;
         case Type::Structured:
             bind = D3D11_BIND_SHADER_RESOURCE;
-            if (usage != Usage::Immutable) bind |= D3D11_BIND_UNORDERED_ACCESS;
+            if (usage == Usage::GpuOnly) bind |= D3D11_BIND_UNORDERED_ACCESS;
             misc = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
             return;
 
         case Type::ByteBuffer:
             bind = D3D11_BIND_SHADER_RESOURCE;
-            if (usage != Usage::Immutable) bind |= D3D11_BIND_UNORDERED_ACCESS;
+            if (usage == Usage::GpuOnly) bind |= D3D11_BIND_UNORDERED_ACCESS;
             misc = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
             return;
         }
@@ -392,7 +386,8 @@ void GpuBuffer::Upload(const void* data, uint size, uint stride, uint totalsize)
         .StructureByteStride = stride,
     };
 
-    if (P->type == Type::ByteBuffer)
+    // dynamic ones get filled later, so they need their full size up front
+    if (P->type == Type::ByteBuffer || P->usage == Usage::Dynamic)
         desc.ByteWidth = totalsize;
 
     switch (P->usage)
@@ -439,6 +434,119 @@ ShaderResource::SR& GpuBuffer::GetSR(bool write, uint count)
 
 RCPtr<ID3D11Buffer> GpuBuffer::GetBuffer() const { return P->buf; }
 
+void* GpuBuffer::MapDiscard()
+{
+    ASSERT(P->usage == Usage::Dynamic);
+    D3D11_MAPPED_SUBRESOURCE map;
+    DXERR(Ctx->Map(*P, 0, D3D11_MAP_WRITE_DISCARD, 0, &map));
+    return map.pData;
+}
+
+void GpuBuffer::Unmap()
+{
+    Ctx->Unmap(*P, 0);
+}
+
+struct ReadbackBuffer::Priv
+{
+    RCPtr<ID3D11Buffer> buf;
+    bool mapped = false;
+};
+
+ReadbackBuffer::ReadbackBuffer(uint sz) : size(sz)
+{
+    P = new Priv;
+
+    D3D11_BUFFER_DESC desc =
+    {
+        .ByteWidth = size,
+        .Usage = D3D11_USAGE_STAGING,
+        .CPUAccessFlags = D3D11_CPU_ACCESS_READ,
+    };
+    DXERR(Dev->CreateBuffer(&desc, nullptr, P->buf));
+}
+
+ReadbackBuffer::~ReadbackBuffer()
+{
+    Unmap();
+    delete P;
+}
+
+void ReadbackBuffer::CopyFrom(GpuBuffer* buffer)
+{
+    ASSERT(!P->mapped);
+    D3D11_BOX box = { 0, 0, 0, size, 1, 1 };
+    Ctx->CopySubresourceRegion(P->buf, 0, 0, 0, 0, *buffer->P, 0, &box);
+}
+
+const uint8* ReadbackBuffer::Map()
+{
+    ASSERT(!P->mapped);
+    D3D11_MAPPED_SUBRESOURCE map = {};
+    DXERR(Ctx->Map(P->buf, 0, D3D11_MAP_READ, 0, &map));
+    P->mapped = true;
+    return (const uint8*)map.pData;
+}
+
+void ReadbackBuffer::Unmap()
+{
+    if (!P->mapped) return;
+    Ctx->Unmap(P->buf, 0);
+    P->mapped = false;
+}
+
+struct ReadbackTexture::Priv
+{
+    RCPtr<ID3D11Texture2D> tex;
+    D3D11_TEXTURE2D_DESC desc = {};
+    bool mapped = false;
+};
+
+ReadbackTexture::ReadbackTexture() { P = new Priv; }
+
+ReadbackTexture::~ReadbackTexture()
+{
+    Unmap();
+    delete P;
+}
+
+void ReadbackTexture::CopyFrom(Texture* tex)
+{
+    ASSERT(!P->mapped);
+    D3D11_TEXTURE2D_DESC desc;
+    tex->P->tex->GetDesc(&desc);
+    if (!P->tex.IsValid() || desc.Width != P->desc.Width || desc.Height != P->desc.Height || desc.Format != P->desc.Format)
+    {
+        P->desc = desc;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Usage = D3D11_USAGE_STAGING;
+        desc.BindFlags = 0;
+        desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+        desc.MiscFlags = 0;
+        P->tex.Clear();
+        DXERR(Dev->CreateTexture2D(&desc, nullptr, P->tex));
+    }
+    Ctx->CopySubresourceRegion(P->tex, 0, 0, 0, 0, tex->P->tex, 0, nullptr);
+}
+
+const uint8* ReadbackTexture::Map(uint& pitch)
+{
+    ASSERT(!P->mapped && P->tex.IsValid());
+    D3D11_MAPPED_SUBRESOURCE map = {};
+    DXERR(Ctx->Map(P->tex, 0, D3D11_MAP_READ, 0, &map));
+    P->mapped = true;
+    pitch = map.RowPitch;
+    return (const uint8*)map.pData;
+}
+
+void ReadbackTexture::Unmap()
+{
+    if (!P->mapped) return;
+    Ctx->Unmap(P->tex, 0);
+    P->mapped = false;
+}
+
 template<typename T> uint MakeLayout(D3D11_INPUT_ELEMENT_DESC* desc);
 
 static constexpr D3D11_INPUT_ELEMENT_DESC MakeVBDesc(const char* semantic, uint index, DXGI_FORMAT format, uint offset, uint slot = 0)
@@ -762,7 +870,7 @@ RCPtr<Texture> CreateTexture(const TexturePara& para, const void* data)
         .ArraySize = 1,
         .Format = GetDXGIFormat(para.format),
         .SampleDesc = { .Count = 1 },
-        .Usage = D3D11_USAGE_IMMUTABLE,
+        .Usage = data ? D3D11_USAGE_IMMUTABLE : D3D11_USAGE_DEFAULT,
         .BindFlags = D3D11_BIND_SHADER_RESOURCE,
     };
 
@@ -771,7 +879,7 @@ RCPtr<Texture> CreateTexture(const TexturePara& para, const void* data)
         .pSysMem = data,
         .SysMemPitch = para.sizeX * GetBitsPerPixel(para.format) / 8,
     };
-    DXERR(Dev->CreateTexture2D(&tdesc, &id, tex->P->tex));
+    DXERR(Dev->CreateTexture2D(&tdesc, data ? &id : nullptr, tex->P->tex));
     return tex;
 }
 
@@ -897,9 +1005,6 @@ void InitD3D(int outputIndex)
     Dev = dev0;
     Ctx = ctx0;
 
-    captureFrameCount = 0;
-    lastFrameTime = 0;
-    
     /*
     // window description
     DXGI_SWAP_CHAIN_DESC1 sd = 
@@ -956,7 +1061,6 @@ RCPtr<IDXGIAdapter> GetAdapter() { return Output.Adapter; }
 static RCPtr<Texture> capTex;
 static DXGI_OUTPUT_DESC1 outdesc;
 static DXGI_OUTDUPL_DESC odd;
-static double totalError = 0;
 
 static const DXGI_FORMAT scanoutFormats[] = {
     DXGI_FORMAT_R16G16B16A16_UINT,
@@ -966,7 +1070,41 @@ static const DXGI_FORMAT scanoutFormats[] = {
     DXGI_FORMAT_B8G8R8A8_UNORM,
 };
 
-bool CaptureFrame(int timeoutMs, CaptureInfo& ci)
+static void ReleaseFrame();
+
+static Array<uint8> metaBuffer;
+static Array<CaptureRect> dirtyRects;
+
+// dirty rects plus where the move rects went. Returns false if there's nothing
+// to go by, then everything counts as changed
+static bool GetDirtyRects(uint metaSize)
+{
+    dirtyRects.Clear();
+    if (!metaSize)
+        return false;
+    if (metaBuffer.Len() < metaSize)
+        metaBuffer.SetSize(metaSize);
+
+    UINT size = 0;
+    if (FAILED(Dupl->GetFrameMoveRects(metaSize, (DXGI_OUTDUPL_MOVE_RECT*)metaBuffer.Ptr(), &size)))
+        return false;
+    auto moves = (const DXGI_OUTDUPL_MOVE_RECT*)metaBuffer.Ptr();
+    for (uint i = 0; i < size / sizeof(DXGI_OUTDUPL_MOVE_RECT); i++)
+    {
+        const RECT& r = moves[i].DestinationRect;
+        dirtyRects += CaptureRect{ r.left, r.top, r.right, r.bottom };
+    }
+
+    if (FAILED(Dupl->GetFrameDirtyRects(metaSize, (RECT*)metaBuffer.Ptr(), &size)))
+        return false;
+    auto rects = (const RECT*)metaBuffer.Ptr();
+    for (uint i = 0; i < size / sizeof(RECT); i++)
+        dirtyRects += CaptureRect{ rects[i].left, rects[i].top, rects[i].right, rects[i].bottom };
+
+    return true;
+}
+
+static bool CaptureFrame(int timeoutMs, CaptureInfo& ci)
 {
     HRESULT hr;
 
@@ -987,7 +1125,6 @@ bool CaptureFrame(int timeoutMs, CaptureInfo& ci)
 
         Dupl->GetDesc(&odd);
         Output.Output->GetDesc1(&outdesc);
-        totalError = 0;
         //printf("new dupl %dx%d @ %d:%d\n", odd.ModeDesc.Width, odd.ModeDesc.Height, odd.ModeDesc.RefreshRate.Numerator, odd.ModeDesc.RefreshRate.Denominator);
     }
 
@@ -1022,52 +1159,23 @@ bool CaptureFrame(int timeoutMs, CaptureInfo& ci)
         ReleaseFrame();
     }
 
-    LARGE_INTEGER t2;
-    QueryPerformanceCounter(&t2);
-
     LARGE_INTEGER qpf;
     QueryPerformanceFrequency(&qpf);
-    if (!lastFrameTime)
-        lastFrameTime = info.LastPresentTime.QuadPart;
-    double delta = (double)(info.LastPresentTime.QuadPart - lastFrameTime) / (double)qpf.QuadPart;
-    lastFrameTime = info.LastPresentTime.QuadPart;
 
 #ifdef _DEBUG    
+    LARGE_INTEGER t2;
+    QueryPerformanceCounter(&t2);
     static int frc = 0;
     static double lastt1 = 0, lastt2 = 0;
     double t1d = ((double)t1.QuadPart / (double)qpf.QuadPart);
     double t2d = ((double)t2.QuadPart / (double)qpf.QuadPart);
-    DPrintF("%5d: t1 %.3f (%.3f), t2 %.3f (%.3f), delta %.3f ", frc++, t1d, t1d-lastt1, t2d, t2d-lastt2, delta);
+    DPrintF("%5d: t1 %.3f (%.3f), t2 %.3f (%.3f)\n", frc++, t1d, t1d-lastt1, t2d, t2d-lastt2);
     lastt1 = t1d;
     lastt2 = t2d;
 #endif
     t1.QuadPart = 0;
 
-    if (delta < 0)
-    {
-        DPrintF("Negative delta!\n");
-        ReleaseFrame();
-        return false;
-    }
-
-    double fdelta = delta * odd.ModeDesc.RefreshRate.Numerator / odd.ModeDesc.RefreshRate.Denominator;
-    double fdi = round(fdelta);
-    double error = fdelta - fdi;
-    totalError += error;
-    int comp = 0;
-    if (totalError >= 0.75)
-    {
-        comp = 1;
-        totalError -= 1;
-    }
-    if (totalError <= -0.75)
-    {
-        comp = -1;
-        totalError += 1;
-    }
-    captureFrameCount += fdi + comp;
-
-    DPrintF("fd %.3f (%.3f, total %.3f) comp %d\n", fdi, error, totalError, comp);
+    // (frame pacing happens in FramePacer, from the present time)
 
     // create/invalidate texture object
     RCPtr<ID3D11Texture2D> tex = frame;
@@ -1079,19 +1187,30 @@ bool CaptureFrame(int timeoutMs, CaptureInfo& ci)
     ci.tex = capTex;
     ci.sizeX = ci.tex->para.sizeX;
     ci.sizeY = ci.tex->para.sizeY;
+    ci.format = ci.tex->para.format;
     ci.isHdr = (outdesc.ColorSpace == DXGI_COLOR_SPACE_RGB_FULL_G2084_NONE_P2020);
     ci.rateNum = odd.ModeDesc.RefreshRate.Numerator;
     ci.rateDen = odd.ModeDesc.RefreshRate.Denominator;
-    ci.frameCount = (uint64)round(captureFrameCount);
     ci.time = (double)info.LastPresentTime.QuadPart / (double)qpf.QuadPart;
+    ci.allDirty = !GetDirtyRects(info.TotalMetadataBufferSize);
+    ci.dirty = dirtyRects;
     return true;
 }
 
-void ReleaseFrame()
+static void ReleaseFrame()
 {
     Dupl->ReleaseFrame();
 }
 
+class FrameSource_DXGI : public IFrameSource
+{
+public:
+    bool AcquireFrame(int timeoutMs, CaptureInfo& info) override { return CaptureFrame(timeoutMs, info); }
+    void ReleaseFrame() override { ::ReleaseFrame(); }
+};
+
+IFrameSource* CreateFrameSourceDXGI() { return new FrameSource_DXGI(); }
+
 void Clear(RenderTarget* rt, Vec4 color)
 {
     Ctx->ClearRenderTargetView(rt->P->GetRTV(), color);
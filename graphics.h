@@ -52,6 +52,8 @@ public:
 
     RCPtr<ID3D11Buffer> GetBuffer() const;
 
+    void Unmap();
+
     struct Priv;
     Priv* P = nullptr;
 
@@ -62,6 +64,7 @@ protected:
     virtual void Commit() = 0;
 
     void Upload(const void* data, uint size, uint stride=0, uint totalsize=0);
+    void* MapDiscard();
     void Reset();
     SR& GetSR(bool write, uint count);
 };
@@ -103,6 +106,9 @@ public:
         return cur - n;
     }
 
+    // Dynamic only: new contents for the whole buffer, until Unmap()
+    Span<T> Map() { return { (T*)MapDiscard(), num }; }
+
     uint Stride() const { return sizeof(T); }
     uint Len() const { return cur; }
 
@@ -154,6 +160,30 @@ public:
     TCB* operator -> () { return &data; }
 };
 
+// CPU readable copy of a GPU buffer. Uses the immediate context, so only use it
+// on the thread that renders/dispatches
+class ReadbackBuffer : public RCObj
+{
+public:
+    explicit ReadbackBuffer(uint size);
+    ~ReadbackBuffer();
+
+    // queues a copy of the buffer contents, doesn't wait
+    void CopyFrom(GpuBuffer* buffer);
+
+    // waits for the last copy to finish, pointer is valid until Unmap()
+    const uint8* Map();
+    void Unmap();
+
+    uint Size() const { return size; }
+
+    struct Priv;
+    Priv* P = nullptr;
+
+private:
+    uint size;
+};
+
 //---------------------------------------------------------------------------
 // textures
 //---------------------------------------------------------------------------
@@ -184,6 +214,27 @@ struct TexturePara
     bool operator !=(const TexturePara& p) const { return !Equals(p); }
 };
 
+class Texture;
+
+// CPU readable copy of a texture's first mip. Same rules as ReadbackBuffer,
+// the staging texture gets (re)made to fit whatever CopyFrom() sees
+class ReadbackTexture : public RCObj
+{
+public:
+    ReadbackTexture();
+    ~ReadbackTexture();
+
+    // queues a copy of the texture contents, doesn't wait
+    void CopyFrom(Texture* tex);
+
+    // waits for the last copy to finish, pointer is valid until Unmap()
+    const uint8* Map(uint& pitch);
+    void Unmap();
+
+    struct Priv;
+    Priv* P = nullptr;
+};
+
 class Texture : public ShaderResource
 {
 public:
@@ -289,20 +340,51 @@ public:
 // screen capturing
 //---------------------------------------------------------------------------
 
+struct CaptureRect
+{
+    int x0, y0, x1, y1; // in pixels, x1/y1 exclusive
+};
+
 struct CaptureInfo
 {
     RCPtr<Texture> tex;
     uint sizeX;
     uint sizeY;
+    PixelFormat format;
     bool isHdr;
     uint rateNum;
     uint rateDen;
-    uint64 frameCount;
-    double time;
+    double time;        // when the frame was presented, in seconds
+
+    // sources that run without D3D (headless benchmarking) leave tex empty and
+    // deliver the frame in system memory instead. Valid until ReleaseFrame()
+    const uint8* pixels = nullptr;
+    uint pitch = 0;
+
+    // what changed since the previous frame (only if the source knows, otherwise
+    // allDirty). Valid until ReleaseFrame(), like tex
+    bool allDirty = true;
+    ReadOnlySpan<CaptureRect> dirty;
+};
+
+// Something that delivers frames to the capture thread - usually the desktop
+// duplication, but it can also be synthetic (for benchmarking without a desktop)
+class IFrameSource
+{
+public:
+    virtual ~IFrameSource() {}
+
+    // the frame in info stays valid until ReleaseFrame() is called
+    virtual bool AcquireFrame(int timeoutMs, CaptureInfo &info) = 0;
+    virtual void ReleaseFrame() = 0;
 };
 
-bool CaptureFrame(int timeoutMs, CaptureInfo &info);
-void ReleaseFrame();
+// captures the output selected in InitD3D()
+IFrameSource* CreateFrameSourceDXGI();
+
+// generates a moving test pattern at a fixed frame rate, in system memory (no D3D needed).
+// changeEvery: only a new frame every so many refreshes, nothing in between
+IFrameSource* CreateFrameSourceSynthetic(uint sizeX, uint sizeY, uint rateNum, uint rateDen, uint changeEvery = 1);
 
 //---------------------------------------------------------------------------
 // functions
@@ -317,7 +399,7 @@ void ExitD3D();
 RCPtr<IDXGIAdapter> GetAdapter();
 
 RCPtr<Texture> LoadImg(const char *filename);
-RCPtr<Texture> CreateTexture(const TexturePara& para, const void* data);
+RCPtr<Texture> CreateTexture(const TexturePara& para, const void* data); // no data: GPU only, to copy into
 
 struct ShaderDefine
 {
@@ -0,0 +1,88 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#pragma once
+
+#include "types.h"
+#include "system.h"
+
+#include <atomic>
+#include <bit>
+#include <math.h>
+
+// Lock free histogram with logarithmic buckets, HdrHistogram style: every power of
+// two gets 8 linear sub buckets, so reported values are at most 12.5% too high.
+// Any number of threads can record and read at the same time.
+class LogHistogram
+{
+public:
+
+    void Record(uint64 value)
+    {
+        Buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        Count.fetch_add(1, std::memory_order_relaxed);
+
+        uint64 max = MaxValue.load(std::memory_order_relaxed);
+        while (value > max && !MaxValue.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+    }
+
+    uint64 GetCount() const { return Count.load(std::memory_order_relaxed); }
+    uint64 GetMax() const { return MaxValue.load(std::memory_order_relaxed); }
+
+    // p in percent. Returns the upper end of the bucket the percentile falls into
+    uint64 GetPercentile(double p) const
+    {
+        uint64 count = GetCount();
+        if (!count)
+            return 0;
+
+        uint64 target = Clamp<uint64>((uint64)ceil(p * count / 100.0), 1, count);
+        uint64 sum = 0;
+        for (uint i = 0; i < NumBuckets; i++)
+        {
+            sum += Buckets[i].load(std::memory_order_relaxed);
+            if (sum >= target)
+                return Min(BucketTop(i), GetMax());
+        }
+        return GetMax();
+    }
+
+    // don't call while others are still recording, or they might get lost
+    void Reset()
+    {
+        for (auto& b : Buckets)
+            b.store(0, std::memory_order_relaxed);
+        Count.store(0, std::memory_order_relaxed);
+        MaxValue.store(0, std::memory_order_relaxed);
+    }
+
+private:
+
+    static constexpr uint SubBits = 3;
+    static constexpr uint SubCount = 1 << SubBits;
+    static constexpr uint NumBuckets = (64 - SubBits + 1) * SubCount;
+
+    std::atomic<uint64> Buckets[NumBuckets] = {};
+    std::atomic<uint64> Count = 0;
+    std::atomic<uint64> MaxValue = 0;
+
+    static uint BucketIndex(uint64 v)
+    {
+        if (v < SubCount)
+            return (uint)v;
+        uint exp = (uint)std::bit_width(v) - 1;
+        uint sub = (uint)(v >> (exp - SubBits)) & (SubCount - 1);
+        return ((exp - SubBits + 1) << SubBits) + sub;
+    }
+
+    static uint64 BucketTop(uint index)
+    {
+        if (index < SubCount)
+            return index;
+        uint exp = (index >> SubBits) + SubBits - 1;
+        uint64 sub = (index & (SubCount - 1)) + SubCount;
+        return ((sub + 1) << (exp - SubBits)) - 1;
+    }
+};
@@ -14,16 +14,68 @@
     const type & ref; \
 };
 
-#define JSON_BEGIN() template<class TV> void _VisitJson(TV &visitor) const { bool comma = false;
-#define JSON_VALUE(v) visitor.Member(#v, v, comma); comma = true; 
-#define JSON_VALUE_NAME(v, name) visitor.Member(name, v, comma); comma = true;
-#define JSON_ENUM(v)visitor.Member(#v, GetEnumDef(v), comma); comma = true; 
-#define JSON_ENUM_NAME(v, name) visitor.Member(name, GetEnumDef(v), comma); comma = true;
+// The members go in as pointers to member, so Json can build a table of them
+// at compile time (see JsonMembers below)
+#define JSON_BEGIN() template<class TV> static constexpr void _VisitJson(TV &visitor) { using TS = typename TV::Self;
+#define JSON_VALUE(v) visitor.template Member<&TS::v>(#v);
+#define JSON_VALUE_NAME(v, name) visitor.template Member<&TS::v>(name);
+#define JSON_ENUM(v) visitor.template Enum<&TS::v>(#v);
+#define JSON_ENUM_NAME(v, name) visitor.template Enum<&TS::v>(name);
 #define JSON_END() }
 
 template<typename T> struct JsonEnumDef;
 template<typename T> JsonEnumDef<T> GetEnumDef(const T& value) { return JsonEnumDef<T>(value); }
 
+// Pull style JSON tokenizer over a span of text (doesn't need a terminator).
+// Strings come out as views into the text, or into a scratch buffer if they had
+// escapes, so nothing gets allocated unless somebody keeps the string. Numbers
+// are correctly rounded. Errors get collected with line and column.
+class JsonReader
+{
+public:
+    JsonReader(ReadOnlySpan<char> text) : Ptr(text.Ptr()), End(text.Ptr() + text.Len()), Line(text.Ptr()) {}
+
+    // all of these skip whitespace first
+    bool IfChar(char c);
+    bool Char(char c);                  // error if it's not there
+    bool IfWord(const char* word);      // true, false, null. Ignores case
+
+    // the view stays valid until the next call
+    bool StringView(ReadOnlySpan<char>& str);
+    bool Number(double& value);
+    bool Number(int64& value);
+
+    // exact length, ignoring case
+    static bool Match(ReadOnlySpan<char> str, const char* name);
+
+    bool operator!() const { return Errors.Len() > 0; }
+    CHECK_FORMAT(2, 3) void Error(FORMAT_STRING const char* format, ...);
+    const Array<String>& GetErrors() const { return Errors; }
+
+private:
+    const char* Ptr;
+    const char* End;
+    const char* Line;
+    int LineNo = 0;
+    Array<String> Errors;
+    Array<char> Scratch;
+
+    struct NumberInfo
+    {
+        const char* Start = nullptr;
+        uint64 Mantissa = 0;    // first 19 significant digits
+        int Exp10 = 0;          // value = Mantissa * 10^Exp10, if !Truncated
+        bool Negative = false;
+        bool Truncated = false; // had more than 19 digits, and not just zeros
+        bool Integer = false;   // no fraction, no exponent
+    };
+
+    void Skip();
+    bool ScanNumber(NumberInfo& num);
+    double ToDouble(const NumberInfo& num);
+    bool EscapedString(const char* start, ReadOnlySpan<char>& str);
+};
+
 class Json
 {
 public:
@@ -37,17 +89,17 @@ public:
 
     template<typename T> static bool Deserialize(const char *json, T &into)
     {
-        Scanner scan(json);
-        Read(scan, into);       
-        return !!scan;
+        JsonReader reader(ReadOnlySpan<char>(json, json ? strlen(json) : 0));
+        Read(reader, into);
+        return !!reader;
     }
 
     template<typename T> static bool Deserialize(const char* json, T &into, Array<String> &errors)
     {      
-        Scanner scan(json);
-        Read(scan, into);
-        errors = scan.Errors();
-        return !!scan;
+        JsonReader reader(ReadOnlySpan<char>(json, json ? strlen(json) : 0));
+        Read(reader, into);
+        errors = reader.GetErrors();
+        return !!reader;
     }
 
 
@@ -56,148 +108,251 @@ private:
     //------------------------------------------------------------------
     // reading
   
-    static void ReadJsonNumber(Scanner& scan, int64& major, int64& minor, int& minorDigits, int& exp, bool &sign)
-    {
-        major = 0; minor = 0; minorDigits = 0; exp = 0;
-        sign = scan.IfChar('-');
-        major = scan.Decimal();
-        if (scan.IfChar('.'))
-            minor = scan.Decimal(&minorDigits);
-        if (scan.IfChar('e') || scan.IfChar('E'))
-        {
-            bool sign2 = false;
-            scan.IfChar('+');
-            if (scan.IfChar('-'))
-                sign2 = true;
-            exp = (int)scan.Decimal();
-            if (sign2)
-                exp = -exp;
-        }
-    }
+    static void Read(JsonReader& reader, double& value) { reader.Number(value); }
+    static void Read(JsonReader& reader, int64& value) { reader.Number(value); }
 
-    static void Read(Scanner& scan, double& value)
-    {
-        int64 major, minor;
-        int mdigits, exp;
-        bool sign;
-        ReadJsonNumber(scan, major, minor, mdigits, exp, sign);
-        value = ((double)major + (double)minor * pow(10, -mdigits)) * pow(10, exp) * (sign ? -1 : 1);
-    }
-
-    static void Read(Scanner& scan, int64& value)
-    {
-        int64 major, minor;
-        int mdigits, exp;
-        bool sign;
-        ReadJsonNumber(scan, major, minor, mdigits, exp, sign);
-        if (exp)
-            value = (int64)(((double)major + (double)minor * pow(10, -mdigits)) * pow(10, exp) * (sign ? -1 : 1));
-        else
-            value = major * (sign ? -1 : 1);
-    }
-
-    static void CheckRange(Scanner &scan, int64& v, int64 min, int64 max)
+    static void CheckRange(JsonReader& reader, int64& v, int64 min, int64 max)
     {
         if (v < min) 
         {
             v = min;
-            scan.Error(String::PrintF("Number too small (min: %lld)", min));
+            reader.Error("Number too small (min: %lld)", min);
         }
         else if (v > max)
         {
             v = max;
-            scan.Error(String::PrintF("Number too large (mas: %lld)", max));
+            reader.Error("Number too large (max: %lld)", max);
         }
     }
 
-    static void Read(Scanner& scan, float& value) { double v; Read(scan, v); value = (float)v; }
-    static void Read(Scanner& scan, int8& value) { int64 v; Read(scan, v); CheckRange(scan, v, -0x80, 0x7f); value = (int8)v; }
-    static void Read(Scanner& scan, uint8& value) { int64 v; Read(scan, v); CheckRange(scan, v, 0, 0xff); value = (uint8)v; }
-    static void Read(Scanner& scan, int16& value) { int64 v; Read(scan, v); CheckRange(scan, v, -0x8000, 0x7fff); value = (int16)v; }
-    static void Read(Scanner& scan, uint16& value) { int64 v; Read(scan, v); CheckRange(scan, v, 0, 0xffff); value = (uint16)v; }
-    static void Read(Scanner& scan, int& value) { int64 v; Read(scan, v); CheckRange(scan, v, -0x80000000ll, 0x7fffffffll); value = (int)v; }
-    static void Read(Scanner& scan, uint& value) { int64 v; Read(scan, v); CheckRange(scan, v, 0, 0xffffffffll); value = (uint)v; }
+    static void Read(JsonReader& reader, float& value) { double v = 0; Read(reader, v); value = (float)v; }
+    static void Read(JsonReader& reader, int8& value) { int64 v = 0; Read(reader, v); CheckRange(reader, v, -0x80, 0x7f); value = (int8)v; }
+    static void Read(JsonReader& reader, uint8& value) { int64 v = 0; Read(reader, v); CheckRange(reader, v, 0, 0xff); value = (uint8)v; }
+    static void Read(JsonReader& reader, int16& value) { int64 v = 0; Read(reader, v); CheckRange(reader, v, -0x8000, 0x7fff); value = (int16)v; }
+    static void Read(JsonReader& reader, uint16& value) { int64 v = 0; Read(reader, v); CheckRange(reader, v, 0, 0xffff); value = (uint16)v; }
+    static void Read(JsonReader& reader, int& value) { int64 v = 0; Read(reader, v); CheckRange(reader, v, -0x80000000ll, 0x7fffffffll); value = (int)v; }
+    static void Read(JsonReader& reader, uint& value) { int64 v = 0; Read(reader, v); CheckRange(reader, v, 0, 0xffffffffll); value = (uint)v; }
 
-    template<class T> static void Read(Scanner& scan, JsonEnumDef<T>& def)
+    template<class T> static void Read(JsonReader& reader, JsonEnumDef<T>& def)
     {
-        String value = scan.QuotedString();
+        ReadOnlySpan<char> value;
+        if (!reader.StringView(value)) return;
         ReadOnlySpan<String> strs(def.Values);
         for (int i = 0; i < strs.Len(); i++)
-            if (!value.Compare(strs[i], true))
+            if (JsonReader::Match(value, strs[i]))
             {
                 const_cast<T&>(def.ref) = (T)i;
                 return;
             }
-        scan.Error(String::PrintF("Unknown value %s (expected: %s)", (const char*)value, (const char*)String::Join(strs, ", ")));
+        reader.Error("Unknown value %.*s (expected: %s)", (int)value.Len(), value.Ptr(), (const char*)String::Join(strs, ", "));
     }
 
-    template<class T> static void Read(Scanner& scan, Array<T>& array)
+    template<class T> static void Read(JsonReader& reader, Array<T>& array)
     {
-        if (!scan.Char('[')) return;
+        if (!reader.Char('[')) return;
 
         array.Clear();
-        while (!scan.IfChar(']'))
+        while (!reader.IfChar(']'))
         {
             T value;
-            Read(scan, value);
+            Read(reader, value);
             array += value;
-            scan.IfChar(',');
+
+            if (reader.IfChar(']')) return;
+            if (!reader.Char(',')) return;
         }
     }
 
-    template<class T> struct ReadVisitor
+    template<auto P, class T> static void ReadMember(JsonReader& reader, T& object) { Read(reader, object.*P); }
+    template<auto P, class T> static void ReadEnum(JsonReader& reader, T& object) { auto def = GetEnumDef(object.*P); Read(reader, def); }
+
+    // ASCII case folded FNV-1a, same idea of case as JsonReader::Match()
+    static constexpr uint HashName(const char* str, size_t len)
+    {
+        uint h = 0x811c9dc5;
+        for (size_t i = 0; i < len; i++)
+        {
+            uint8 c = (uint8)str[i];
+            if ((uint)(c - 'A') < 26) c += 'a' - 'A';
+            h = (h ^ c) * 0x01000193;
+        }
+        return h;
+    }
+
+    // Member table of an object, built at compile time from _VisitJson(). Names
+    // get a perfect hash, "hash and displace" style: the hash picks a bucket, and
+    // every bucket has a displacement that was searched for so that all of its
+    // names land on slots nobody else uses. Finding a key is one hash, one lookup
+    // and one compare, however many members there are.
+    template<class T> class JsonMembers
     {
-        ReadVisitor(Scanner &s, String n) : name(n), scan(s) {}
+    public:
+        using ReadFunc = void(*)(JsonReader&, T&);
 
-        template<typename T> void Member(String mn, const T& value, bool)
+        static ReadFunc Find(ReadOnlySpan<char> key)
         {
-            if (!found && !name.Compare(mn, true))
+            uint h = HashName(key.Ptr(), key.Len());
+            uint i = Table.Slots[Slot(h, Table.Disp[h & (NumBuckets - 1)])];
+            if (!i || !JsonReader::Match(key, Table.Names[i - 1])) return nullptr;
+            return Table.Readers[i - 1];
+        }
+
+    private:
+        struct Counter
+        {
+            using Self = T;
+            uint Count = 0;
+            template<auto P> constexpr void Member(const char*) { Count++; }
+            template<auto P> constexpr void Enum(const char*) { Count++; }
+        };
+
+        static constexpr uint Count = [] { Counter c; T::_VisitJson(c); return c.Count; }();
+        static constexpr uint Size = Max(Count, 1u);
+
+        // at least two slots per member and four per bucket, which makes finding
+        // the displacements quick
+        static constexpr uint SlotBits = [] { uint b = 1; while ((1u << b) < 2 * Count) b++; return b; }();
+        static constexpr uint NumSlots = 1u << SlotBits;
+        static constexpr uint NumBuckets = Max(NumSlots / 4, 1u);
+
+        static constexpr uint Slot(uint h, uint disp)
+        {
+            h ^= disp * 0x85ebca6b;
+            h ^= h >> 15;
+            h *= 0x9e3779b1;
+            return h >> (32 - SlotBits);
+        }
+
+        struct MemberTable
+        {
+            const char* Names[Size];
+            uint Hashes[Size];
+            ReadFunc Readers[Size];
+            uint16 Disp[NumBuckets];
+            uint16 Slots[NumSlots];    // member index + 1, 0 if free
+            bool Ok;
+        };
+
+        struct Collector
+        {
+            using Self = T;
+            MemberTable& t;
+            uint n = 0;
+
+            constexpr void Add(const char* name, ReadFunc read)
+            {
+                size_t len = 0;
+                while (name[len]) len++;
+                t.Names[n] = name;
+                t.Hashes[n] = HashName(name, len);
+                t.Readers[n] = read;
+                n++;
+            }
+
+            template<auto P> constexpr void Member(const char* name) { Add(name, &ReadMember<P, T>); }
+            template<auto P> constexpr void Enum(const char* name) { Add(name, &ReadEnum<P, T>); }
+        };
+
+        static constexpr MemberTable Build()
+        {
+            MemberTable t = {};
+            Collector c { t };
+            T::_VisitJson(c);
+
+            // biggest buckets first, while there's the most room
+            uint size[NumBuckets] = {};
+            for (uint i = 0; i < Count; i++)
+                size[t.Hashes[i] & (NumBuckets - 1)]++;
+
+            bool done[NumBuckets] = {};
+            for (uint pass = 0; pass < NumBuckets; pass++)
             {
-                Read(scan, const_cast<T&>(value));
-                found = true;
+                uint b = 0;
+                for (uint i = 0; i < NumBuckets; i++)
+                    if (!done[i] && (done[b] || size[i] > size[b]))
+                        b = i;
+                done[b] = true;
+                if (!size[b]) continue;
+
+                bool found = false;
+                for (uint d = 0; d < 0x10000; d++)
+                {
+                    // try it, and take it back if two names end up on one slot
+                    found = true;
+                    for (uint i = 0; i < Count; i++)
+                        if ((t.Hashes[i] & (NumBuckets - 1)) == b)
+                        {
+                            uint16& slot = t.Slots[Slot(t.Hashes[i], d)];
+                            if (slot) { found = false; break; }
+                            slot = (uint16)(i + 1);
+                        }
+                    if (found)
+                    {
+                        t.Disp[b] = (uint16)d;
+                        break;
+                    }
+                    for (uint16& slot : t.Slots)
+                        if (slot && (t.Hashes[slot - 1] & (NumBuckets - 1)) == b)
+                            slot = 0;
+                }
+                if (!found) return t;
             }
+
+            t.Ok = true;
+            return t;
         }
 
-        String name;
-        Scanner& scan;
-        bool found = false;
+        static constexpr MemberTable Table = Build();
+        static_assert(Table.Ok, "JSON member names have to be unique, ignoring case");
     };
 
-    template<class T> static void Read(Scanner& scan, T& object)
+    template<class T> static void Read(JsonReader& reader, T& object)
     {
-        if (!scan.Char('{')) return;
+        if (!reader.Char('{')) return;
 
-        while (!scan.IfChar('}'))
+        while (!reader.IfChar('}'))
         {
-            String name = scan.QuotedString();
-            if (!scan.Char(':')) return;
+            ReadOnlySpan<char> name;
+            if (!reader.StringView(name)) return;
+            if (!reader.Char(':')) return;
 
-            ReadVisitor<T> visitor(scan, name);
-            object._VisitJson(visitor);
-            if (!visitor.found)
+            // the name can point into the reader's scratch buffer, so report before reading on
+            auto read = JsonMembers<T>::Find(name);
+            if (!read)
             {
-                scan.Error(String::PrintF("Unknown key: %s", (const char*)name));
+                reader.Error("Unknown key: %.*s", (int)name.Len(), name.Ptr());
                 return;
             }
-            scan.IfChar(',');
+            read(reader, object);
+
+            // stop at anything unexpected, there might be no way forward
+            if (reader.IfChar('}')) return;
+            if (!reader.Char(',')) return;
         }
     }
 
-    static void Read(Scanner& scan, bool& str) 
-    { 
-        if (scan.If("true")) str = true;
-        else if (scan.If("false")) str = false;
-        else scan.Error("Expected true or false");
+    static void Read(JsonReader& reader, bool& value)
+    {
+        if (reader.IfWord("true")) value = true;
+        else if (reader.IfWord("false")) value = false;
+        else reader.Error("Expected true or false");
     }
 
-    static void Read(Scanner& scan, String& str) { str = scan.If("null") ? String() : scan.QuotedString(); }
+    static void Read(JsonReader& reader, String& str)
+    {
+        ReadOnlySpan<char> view;
+        if (reader.IfWord("null") || !reader.StringView(view))
+            str = String();
+        else
+            str = view;
+    }
 
     //------------------------------------------------------------------
     // writing
   
-    static void Write(StringBuilder& sb, const double& value) { sb += String::PrintF("%f", value); }
-    static void Write(StringBuilder& sb, const int64& value) { sb += String::PrintF("%lld", value); }
-    static void Write(StringBuilder& sb, const uint64& value) { sb += String::PrintF("%llu", value); }
+    static void Write(StringBuilder& sb, const double& value) { sb.AppendDouble(value, -1); }
+    static void Write(StringBuilder& sb, const int64& value) { sb.AppendInt(value); }
+    static void Write(StringBuilder& sb, const uint64& value) { sb.AppendUInt(value); }
     static void Write(StringBuilder& sb, const bool& value) { sb += value ? "true" : "false"; }
 
     static void Write(StringBuilder& sb, const int8& value) { Write(sb, (int64)value); }
@@ -212,37 +367,27 @@ private:
     { 
         if (value)
         {
-            char buffer[1024];
-            int bfill = 0;
-
-            auto addChar = [&](char c)
-            {
-                buffer[bfill++] = c;
-                if (bfill == 1023)
-                {
-                    buffer[bfill] = 0;
-                    sb += buffer;
-                    bfill = 0;
-                }
-            };
-
-            sb += "\"";
+            sb.AppendChar('\"');
             while (*value)
             {
+                // copy everything up to the next char that needs escaping in one go
+                const char* run = value;
+                while ((uint8)*value >= ' ' && *value != '\\' && *value != '\"')
+                    value++;
+                sb.AppendChars(run, value - run);
+
                 switch (*value)
                 {
-                case '\\': case '\"': addChar('\\'); addChar(*value); break;
-                case '\r': addChar('\\'); addChar('r'); break;
-                case '\n': addChar('\\'); addChar('n'); break;
-                case '\t': addChar('\\'); addChar('t'); break;
-                default: if ((uint)*value >= ' ') addChar(*value); break;
+                case 0: continue;
+                case '\\': case '\"': sb.AppendChar('\\'); sb.AppendChar(*value); break;
+                case '\r': sb.Append("\\r"); break;
+                case '\n': sb.Append("\\n"); break;
+                case '\t': sb.Append("\\t"); break;
+                default: break;
                 }
                 value++;
             }
-
-            buffer[bfill] = 0;
-            sb += buffer;
-            sb += "\"";
+            sb.AppendChar('\"');
         }
         else
             sb += "null";
@@ -274,12 +419,15 @@ private:
         sb += "]";
     }
 
-    struct WriteVisitor
+    template<class T> struct WriteVisitor
     {
-        WriteVisitor(StringBuilder& into) : sb(into) {}
+        using Self = T;
+        WriteVisitor(StringBuilder& into, const T& obj) : sb(into), object(obj) {}
         StringBuilder& sb;
+        const T& object;
+        bool comma = false;
 
-        template<typename T> void Member(String name, const T& value, bool comma)
+        void Name(const char* name)
         {
             if (comma) {
                 sb += ","; 
@@ -287,16 +435,19 @@ private:
             }
             sb.Append("\"", name, "\":");
             sb.PrettySpace();
-            Write(sb, value);
+            comma = true;
         }
+
+        template<auto P> void Member(const char* name) { Name(name); Write(sb, object.*P); }
+        template<auto P> void Enum(const char* name) { Name(name); Write(sb, GetEnumDef(object.*P)); }
     };
 
     template<typename T> static void Write(StringBuilder& sb, const T& object)
     {
         sb += "{"; 
         sb.PrettyNewline(2);
-        WriteVisitor visitor(sb);
-        object._VisitJson(visitor);
+        WriteVisitor<T> visitor(sb, object);
+        T::_VisitJson(visitor);
         sb.PrettyNewline(-2);
         sb += "}";
     }
@@ -31,7 +31,7 @@ struct Vec2
 
     inline Vec2 Rotate(float a) const { float s = sinf(a); float c = cosf(a); return Vec2(c * x + s * y, c * y - s * x); }
 
-    constexpr inline float operator[](int i) const { return ((const float*)this)[i]; }
+    inline float operator[](int i) const { return ((const float*)this)[i]; }
     inline operator const float* () const { return (const float*)this; }
 };
 
@@ -58,7 +58,7 @@ struct Vec3
     constexpr inline float LengthSq() const { return x * x + y * y + z * z; }
     inline float Length() const { return sqrtf(LengthSq()); }
 
-    constexpr inline float operator[](int i) const { return ((const float*)this)[i]; }
+    inline float operator[](int i) const { return ((const float*)this)[i]; }
     inline operator const float* () const { return (const float*)this; }
 };
 
@@ -104,7 +104,7 @@ struct Vec4
     constexpr inline float LengthSq() const { return x * x + y * y + z * z + w * w; }
     inline float Length() const { return sqrtf(LengthSq()); }
 
-    constexpr inline float operator[](int i) const { return ((const float*)this)[i]; }
+    inline float operator[](int i) const { return ((const float*)this)[i]; }
     inline operator const float* () const { return (const float*)this; }
 
     constexpr uint Color() const {
@@ -459,14 +459,14 @@ struct Mat44
  };
 
 constexpr inline float Dot(const Vec2& a, const Vec2& b) { return a.x * b.x + a.y * b.y; }
-constexpr inline Vec2 Normalize(const Vec2& v) { return v / v.Length(); }
+inline Vec2 Normalize(const Vec2& v) { return v / v.Length(); }
 constexpr inline Vec2 Min(const Vec2& a, const Vec2& b) { return Vec2(Min(a.x, b.x), Min(a.y, b.y)); }
 constexpr inline Vec2 Max(const Vec2& a, const Vec2& b) { return Vec2(Max(a.x, b.x), Max(a.y, b.y)); }
 constexpr inline float MinC(const Vec2& v) { return Min(v.x, v.y); }
 constexpr inline float MaxC(const Vec2& v) { return Max(v.x, v.y); }
 
 constexpr inline float Dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
-constexpr inline Vec3 Normalize(const Vec3& v) { return v / v.Length(); }
+inline Vec3 Normalize(const Vec3& v) { return v / v.Length(); }
 constexpr inline Vec3 Cross(const Vec3 a, const Vec3 b) { return a % b; }
 constexpr inline Vec3 Min(const Vec3& a, const Vec3& b) { return Vec3(Min(a.x, b.x), Min(a.y, b.y), Min(a.z, b.z)); }
 constexpr inline Vec3 Max(const Vec3& a, const Vec3& b) { return Vec3(Max(a.x, b.x), Max(a.y, b.y), Max(a.z, b.z)); }
@@ -474,7 +474,7 @@ constexpr inline float MinC(const Vec3& v) { return Min(v.x, Min(v.y, v.z)); }
 constexpr inline float MaxC(const Vec3& v) { return Max(v.x, Max(v.y, v.z)); }
 
 constexpr inline float Dot(const Vec4& a, const Vec4& b) { return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w; }
-constexpr inline Vec4 Normalize(const Vec4& v) { return v / v.Length(); }
+inline Vec4 Normalize(const Vec4& v) { return v / v.Length(); }
 constexpr inline Vec4 Min(const Vec4& a, const Vec4& b) { return Vec4(Min(a.x, b.x), Min(a.y, b.y), Min(a.z, b.z), Min(a.w, b.w)); }
 constexpr inline Vec4 Max(const Vec4& a, const Vec4& b) { return Vec4(Max(a.x, b.x), Max(a.y, b.y), Max(a.z, b.z), Max(a.w, b.w)); }
 constexpr inline float MinC(const Vec4& v) { return Min(v.x, Min(v.y, Min(v.z, v.w))); }
@@ -6,18 +6,95 @@
 #pragma once
 
 #include "types.h"
+#include "system.h"
 #include "audiocapture.h"
+#include "asyncwriter.h"
 
 struct CaptureConfig;
 
+struct KeyframeEntry
+{
+    uint64 FrameNo;     // video frame number
+    int64 Pts;          // in video stream time base
+    uint Size;          // packet size in bytes
+    uint Segment;       // file the keyframe went into (Pts is relative to its start)
+};
+
+// The newest keyframes written, built at mux time for seeking and cutting.
+// Bounded: past Capacity the oldest ones fall out. Add() on the muxing thread,
+// Get() from anywhere
+class KeyframeIndex
+{
+public:
+    static constexpr uint Capacity = 4096;  // over two hours with 2 second GOPs
+
+    void Add(const KeyframeEntry& e)
+    {
+        ScopeLock lock(Lock);
+        if (!Entries.Len())
+            Entries.SetSize(Capacity);
+        Entries[Count++ % Capacity] = e;
+    }
+
+    // all that were ever added
+    uint64 GetCount() const { return Count; }
+
+    // the ones still there, oldest first
+    void Get(Array<KeyframeEntry>& out) const
+    {
+        ScopeLock lock(Lock);
+        out.Clear();
+        for (uint64 i = Count > Capacity ? Count - Capacity : 0; i < Count; i++)
+            out += Entries[i % Capacity];
+    }
+
+    KeyframeEntry GetLast() const
+    {
+        ScopeLock lock(Lock);
+        return Count ? Entries[(Count - 1) % Capacity] : KeyframeEntry{};
+    }
+
+private:
+    mutable ThreadLock Lock;
+    Array<KeyframeEntry> Entries;
+    std::atomic<uint64> Count = 0;
+};
+
+struct OutputStats
+{
+    uint64 VideoPackets;
+    uint64 PoolRequests;
+    uint64 PoolHits;        // packet buffers that could be reused
+    uint64 BytesCopied;     // video packet data copied into pool memory
+    uint64 AudioBytesCopied;    // converted audio written into pooled frames
+    AsyncFileWriter::Stats Write;   // of the current segment
+    uint Segment;                   // current segment, starting at 0
+    uint64 Keyframes;               // written so far
+    KeyframeEntry LastKeyframe;     // if there was one
+};
+
 class IOutput
 {
 public:
     virtual ~IOutput() {}
 
-    virtual void SubmitVideoPacket(const uint8* data, uint size) = 0;
+    // copies the packet into pooled memory, so the encoder's buffer can be
+    // released right after. Call WriteVideo() to actually mux it.
+    // time is the frame's capture time in seconds; it only sets the timestamps
+    // with VariableFrameRate, where a packet lasts until the next one comes in
+    // (so it gets muxed one WriteVideo() later)
+    virtual void SubmitVideoPacket(const uint8* data, uint size, double time) = 0;
+    virtual void WriteVideo() = 0;
 
+    // converts and encodes right away, the packets get muxed with the next
+    // WriteVideo(). May be called from its own thread once the first video
+    // packet is in. On the same thread, keep it to a few seconds per call.
     virtual void SubmitAudio(const uint8* data, uint size) = 0;
+
+    virtual OutputStats GetStats() const = 0;
+
+    // the keyframe index, see KeyframeIndex
+    virtual void GetKeyframes(Array<KeyframeEntry>& out) const = 0;
 };
 
 struct OutputPara
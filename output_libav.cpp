@@ -6,6 +6,9 @@
 #include "system.h"
 #include "screencapture.h"
 #include "output.h"
+#include "annexb.h"
+#include "asyncwriter.h"
+#include "packetpool.h"
 
 extern "C"
 {
@@ -19,6 +22,7 @@ extern "C"
 }
 
 #include <math.h>
+#include <stdlib.h>
 #include <stdio.h>
 
 static Array<String> Errors;
@@ -30,41 +34,88 @@ static char averrbuf[1024];
 #define AVERR(x) { auto _ret=(x); if(_ret<0) { Fatal("%s(%d): libav call failed: %s\n%s\n",__FILE__,__LINE__,av_make_error_string(averrbuf, 1024, _ret),(const char*)String::Join(Errors,"")); } }
 #endif
 
+// One output file. With segmenting on, the next one gets opened and the last one
+// finished on a background thread, so switching files costs the process thread nothing.
+struct Segment
+{
+    String Filename;
+    AVFormatContext* Context = nullptr;
+    AsyncFileWriter* File = nullptr;
+    AVStream* VideoStream = nullptr;
+    AVStream* AudioStream = nullptr;
+
+    int64 Start = 0;        // video time the segment starts at
+    int64 AudioStart = 0;   // in audio codec time base
+    uint64 AudioPackets = 0;
+};
+
 class Output_LibAV : public IOutput
 {
 private:
 
     OutputPara Para;
 
-    AVFormatContext* Context = nullptr;
-
-    AVStream* VideoStream = nullptr;
-    AVStream* AudioStream = nullptr;
+    AVCodecParameters* VideoPar = nullptr;
+    AVCodecParameters* AudioPar = nullptr;
 
     const AVCodec* AudioCodec = nullptr;
     AVCodecContext* AudioContext = nullptr;
     AVPacket* Packet = nullptr;
-    AVFrame* Frame = nullptr;
 
+    // swr holds on to whatever doesn't fit into the current frame yet, so it's
+    // all the fifo we need: it converts straight into pooled frames
     SwrContext* Resample = nullptr;
-    uint ResampleBufferSize = 0;
-    uint8* ResampleBuffer = nullptr;
-    uint ResampleBytesPerSample = 0;
-    uint ResampleFill = 0;
+    AVBufferPool* AudioPool = nullptr;
+    AVFrame* AudioFrame = nullptr;  // being filled
+    int AudioFrameSize = 0;
+    int AudioFill = 0;
+    int AudioRate = 0;              // output sample rate
+    uint64 AudioBytesCopied = 0;
 
     int FrameNo = 0;
+
+    // video time: frame numbers, or with VFR ticks since the first frame's capture time
+    static constexpr int VfrRate = 90000;
+    bool Vfr = false;
+    AVRational VideoTb = {};
+    int64 VideoTime = 0;
+    double FirstTime = 0;
     int64 AudioWritten = 0;
 
+    // encoded audio on its way to the muxer. SubmitAudio() may run on another
+    // thread, av_interleaved_write_frame() sorts out the interleaving
+    SpscQueue<AVPacket*, 512> AudioPackets;
+    bool InlineAudio = false;   // SubmitAudio() runs on the muxing thread
+
+    PacketPool VideoPool;
+    AVPacket* VideoPacket = nullptr;
+    bool VideoPending = false;
+    uint64 VideoPackets = 0;
+    uint64 VideoBytesCopied = 0;
+
+    NalCodec NalType = NalCodec::H264;
+    KeyframeIndex Keyframes;
+
+    // segmenting
+    int64 SegmentLength = 0;    // in video time, 0: no limit
+    uint64 SegmentBytes = 0;    // 0: no limit
+    uint SegmentNo = 0;
+    Segment* Current = nullptr;
+    Segment* Closing = nullptr; // previous segment, still waiting for its last audio packets
+    bool NextRequested = false;
+
+    std::atomic<Segment*> Next = nullptr;
+    std::atomic<uint> NextIndex = 0;
+    SpscQueue<Segment*, 16> Finished;
+    ThreadEvent SegmentEvent;
+    ThreadEvent NextEvent;
+    Thread* SegmentThread = nullptr;
+
     void InitVideo(const uint8 *firstFrame, int firstFrameSize)
     {
-        VideoStream = avformat_new_stream(Context, 0);
-        VideoStream->id = 0;
-        VideoStream->time_base.den = VideoStream->avg_frame_rate.num = Para.RateNum;
-        VideoStream->time_base.num = VideoStream->avg_frame_rate.den = Para.RateDen;
-
-        auto codecpar = VideoStream->codecpar;
+        auto codecpar = VideoPar = avcodec_parameters_alloc();
         codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-        codecpar->codec_id = Para.CConfig->CodecCfg.Profile >= CodecProfile::HEVC_MAIN ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+        codecpar->codec_id = NalType == NalCodec::HEVC ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
         codecpar->bit_rate = Para.CConfig->CodecCfg.UseBitrateControl == BitrateControl::CBR ? Para.CConfig->CodecCfg.BitrateParameter * 1000ull : 0;
         codecpar->width = Para.SizeX;
         codecpar->height = Para.SizeY;
@@ -89,11 +140,16 @@ private:
         codecpar->sample_aspect_ratio.num = codecpar->sample_aspect_ratio.den = 1;
         codecpar->field_order = AV_FIELD_PROGRESSIVE;
 
-        // For h.264 and HEVC, some of the muxers need the first frame
-        // in the extradata during encode, so make a copy        
-        codecpar->extradata = (uint8*)av_malloc(firstFrameSize);
-        codecpar->extradata_size = firstFrameSize;
-        memcpy(codecpar->extradata, firstFrame, firstFrameSize);
+        // For h.264 and HEVC, some of the muxers need the parameter sets
+        // in the extradata during encode, so extract them from the first frame.
+        // If there are none (not Annex-B), copy the whole frame and hope for the best
+        Array<uint8> paramSets;
+        ExtractParameterSets(NalType, firstFrame, firstFrameSize, paramSets);
+        ReadOnlySpan<uint8> extradata = paramSets.Len() ? ReadOnlySpan<uint8>(paramSets) : ReadOnlySpan<uint8>(firstFrame, firstFrameSize);
+
+        codecpar->extradata = (uint8*)av_mallocz(extradata.Len() + AV_INPUT_BUFFER_PADDING_SIZE);
+        codecpar->extradata_size = (int)extradata.Len();
+        memcpy(codecpar->extradata, extradata.Ptr(), extradata.Len());
     }
 
     void InitAudio()
@@ -112,12 +168,23 @@ private:
         if (sampleFmt == AV_SAMPLE_FMT_NONE)
             return;
 
-        // init audio stream and codec
+        // not every codec does every rate (MP3 stops at 48kHz), so take the closest one it can do
+        AudioRate = Para.CConfig->AudioSampleRate ? Para.CConfig->AudioSampleRate : Para.Audio.SampleRate;
+        if (AudioCodec->supported_samplerates)
+        {
+            int best = AudioCodec->supported_samplerates[0];
+            for (const int* rate = AudioCodec->supported_samplerates; *rate; rate++)
+                if (abs(*rate - AudioRate) < abs(best - AudioRate))
+                    best = *rate;
+            AudioRate = best;
+        }
+
+        // init audio codec
         if (sampleFmt != AV_SAMPLE_FMT_NONE)
         {
             AudioContext = avcodec_alloc_context3(AudioCodec);
             AudioContext->sample_fmt = sampleFmt;
-            AudioContext->sample_rate = Para.Audio.SampleRate;
+            AudioContext->sample_rate = AudioRate;
             AudioContext->ch_layout.order = AV_CHANNEL_ORDER_NATIVE;
             AudioContext->ch_layout.nb_channels = Para.Audio.Channels;
             AudioContext->ch_layout.u.mask = (1ull << Para.Audio.Channels) - 1;
@@ -125,14 +192,13 @@ private:
             if (Para.CConfig->UseAudioCodec >= AudioCodec::MP3)
                 AudioContext->bit_rate = Clamp(Para.CConfig->AudioBitrate, 32u, 320u) * 1000ull;
             else
-                AudioContext->bit_rate = 8ull * Para.Audio.SampleRate * Para.Audio.Channels * av_get_bytes_per_sample(sampleFmt);
+                AudioContext->bit_rate = 8ull * AudioRate * Para.Audio.Channels * av_get_bytes_per_sample(sampleFmt);
 
             AVERR(avcodec_open2(AudioContext, AudioCodec, 0));
 
-            AudioStream = avformat_new_stream(Context, AudioCodec);
-            AudioStream->id = 1;
-            AVERR(avcodec_parameters_from_context(AudioStream->codecpar, AudioContext));
-          
+            AudioPar = avcodec_parameters_alloc();
+            AVERR(avcodec_parameters_from_context(AudioPar, AudioContext));
+
             AVSampleFormat sourceFmt = AV_SAMPLE_FMT_NONE;
             switch (Para.Audio.Format)
             {
@@ -140,31 +206,159 @@ private:
             case AudioFormat::F32: sourceFmt = AV_SAMPLE_FMT_FLT; break;
             }
 
-            AVERR(swr_alloc_set_opts2(&Resample, &AudioContext->ch_layout, sampleFmt, Para.Audio.SampleRate, &AudioContext->ch_layout, sourceFmt, Para.Audio.SampleRate, 0, nullptr));
-            ResampleBufferSize = Para.Audio.SampleRate;
-            ResampleBytesPerSample = av_get_bytes_per_sample(sampleFmt);
-            ResampleBuffer = new uint8[ResampleBufferSize * ResampleBytesPerSample * Para.Audio.Channels];
+            AVERR(swr_alloc_set_opts2(&Resample, &AudioContext->ch_layout, sampleFmt, AudioRate, &AudioContext->ch_layout, sourceFmt, Para.Audio.SampleRate, 0, nullptr));
             AVERR(swr_init(Resample));
+
+            // PCM takes any frame size
+            AudioFrameSize = AudioContext->frame_size ? AudioContext->frame_size : 1024;
+            ASSERT(!av_sample_fmt_is_planar(sampleFmt) || Para.Audio.Channels <= AV_NUM_DATA_POINTERS);
+            AudioPool = av_buffer_pool_init(av_samples_get_buffer_size(nullptr, Para.Audio.Channels, AudioFrameSize, sampleFmt, 0), nullptr);
         }
     }
 
-    void WriteAudio()
+    // converts into the current frame, and sends it off once it's full. Without
+    // input, flushes the resampler and sends the rest as a short last frame.
+    void ConvertAudio(const uint8* data, int samples)
+    {
+        const AVSampleFormat fmt = AudioContext->sample_fmt;
+        const int channels = AudioContext->ch_layout.nb_channels;
+        const bool planar = av_sample_fmt_is_planar(fmt);
+        const int sampleBytes = av_get_bytes_per_sample(fmt) * (planar ? 1 : channels);
+
+        for (;;)
+        {
+            if (!AudioFrame)
+            {
+                AudioFrame = av_frame_alloc();
+                AudioFrame->format = fmt;
+                AudioFrame->nb_samples = AudioFrameSize;
+                AVERR(av_channel_layout_copy(&AudioFrame->ch_layout, &AudioContext->ch_layout));
+                AudioFrame->buf[0] = av_buffer_pool_get(AudioPool);
+                ASSERT(AudioFrame->buf[0]);
+                AVERR(av_samples_fill_arrays(AudioFrame->data, AudioFrame->linesize, AudioFrame->buf[0]->data, channels, AudioFrameSize, fmt, 0));
+                AudioFill = 0;
+            }
+
+            uint8* out[AV_NUM_DATA_POINTERS] = {};
+            for (int i = 0; i < (planar ? channels : 1); i++)
+                out[i] = AudioFrame->data[i] + AudioFill * sampleBytes;
+
+            // input that doesn't fit stays in swr; later rounds just drain it
+            int n = swr_convert(Resample, out, AudioFrameSize - AudioFill, data ? &data : nullptr, samples);
+            AVERR(n);
+            samples = 0;
+            AudioFill += n;
+            AudioBytesCopied += (uint64)n * sampleBytes * (planar ? channels : 1);
+
+            if (AudioFill == AudioFrameSize)
+                SendAudioFrame();
+            else if (!n)
+                break;
+        }
+
+        if (!data && AudioFill)
+            SendAudioFrame();
+    }
+
+    void SendAudioFrame()
+    {
+        AVRational tb = { .num = 1, .den = AudioRate };
+        AudioFrame->nb_samples = AudioFill;
+        AudioFrame->pts = av_rescale_q(AudioWritten, tb, AudioContext->time_base);
+
+        // the encoder takes its own reference
+        AVERR(avcodec_send_frame(AudioContext, AudioFrame));
+        av_frame_free(&AudioFrame);
+        AudioWritten += AudioFill;
+        AudioFill = 0;
+
+        ReceiveAudio();
+    }
+
+    void ReceiveAudio()
     {
         while (!avcodec_receive_packet(AudioContext, Packet))
         {
-            Packet->pts = av_rescale_q(Packet->pts, AudioContext->time_base, AudioStream->time_base);
-            Packet->dts = av_rescale_q(Packet->dts, AudioContext->time_base, AudioStream->time_base);
-            Packet->duration = (int)av_rescale_q(Packet->duration, AudioContext->time_base, AudioStream->time_base);
-            Packet->stream_index = AudioStream->index;
+            AVPacket* pkt = av_packet_alloc();
+            av_packet_move_ref(pkt, Packet);
+
+            // only fills up if the muxing side is stuck. On the same thread nobody
+            // else is going to empty it
+            while (!AudioPackets.Enqueue(pkt))
+            {
+                if (InlineAudio)
+                    WriteAudio();
+                else
+                    Thread::Sleep(1);
+            }
+        }
+    }
+
+    // muxing side
+    void WriteAudio()
+    {
+        AVPacket* pkt;
+        while (AudioPackets.Dequeue(pkt))
+        {
+            // audio from before the last cut still goes into the previous segment. The
+            // first packet after it means that one is complete
+            Segment* seg = Current;
+            if (Closing)
+            {
+                if (pkt->pts < Current->AudioStart)
+                    seg = Closing;
+                else
+                    FinishClosing();
+            }
+            else if (SegmentNo && pkt->pts < Current->AudioStart)
+            {
+                // too late even for that. The first segment starts at 0 and keeps
+                // the encoder's priming packets, which come before it
+                av_packet_free(&pkt);
+                continue;
+            }
+
+            pkt->pts = av_rescale_q(pkt->pts - seg->AudioStart, AudioContext->time_base, seg->AudioStream->time_base);
+            pkt->dts = av_rescale_q(pkt->dts - seg->AudioStart, AudioContext->time_base, seg->AudioStream->time_base);
+            pkt->duration = (int)av_rescale_q(pkt->duration, AudioContext->time_base, seg->AudioStream->time_base);
+            pkt->stream_index = seg->AudioStream->index;
 
             // Write the compressed frame to the media file.
-            AVERR(av_interleaved_write_frame(Context, Packet));
-            av_packet_unref(Packet);
+            AVERR(av_interleaved_write_frame(seg->Context, pkt));
+            av_packet_free(&pkt);
+            seg->AudioPackets++;
         }
     }
 
+    // the muxer writes through a custom AVIOContext into the write-behind file,
+    // so disk latency doesn't hold up the process thread
+    static constexpr int IOBufferSize = 64 * 1024;
+
+    static int OnWrite(void* opaque, const uint8* buf, int size)
+    {
+        ((AsyncFileWriter*)opaque)->Write(buf, size);
+        return size;
+    }
+
+    static int64 OnSeek(void* opaque, int64 offset, int whence)
+    {
+        auto file = (AsyncFileWriter*)opaque;
+        switch (whence & ~AVSEEK_FORCE)
+        {
+        case SEEK_SET: return file->Seek(offset);
+        case SEEK_CUR: return file->Seek(file->Pos() + offset);
+        case SEEK_END: return file->Seek(file->Length() + offset);
+        case AVSEEK_SIZE: return file->Length();
+        }
+        return AVERROR(EINVAL);
+    }
+
     static void OnLog(void*, int level, const char* format, va_list args)
     {
+        // segments get opened and closed on another thread
+        static ThreadLock lock;
+        ScopeLock scope(lock);
+
         static char buffer[4096];
         int len = vsnprintf_s(buffer, 4096, format, args);
         if (len < 0) len = 0;
@@ -173,160 +367,341 @@ private:
             Errors += buffer;
         buffer[len] = '\n';
         buffer[len+1] = 0;
-        DPrintF(buffer);
+        DPrintF("%s", buffer);
     }
 
+    // segment files are numbered name_part001.ext, name_part002.ext, ...
+    String SegmentName(uint index) const
+    {
+        if (!SegmentLength && !SegmentBytes)
+            return Para.filename;
+
+        const char* name = Para.filename;
+        const char* ext = strrchr(name, '.');
+        if (!ext) ext = name + strlen(name);
+        return String::PrintF("%.*s_part%03d%s", (int)(ext - name), name, index + 1, ext);
+    }
+
+    Segment* OpenSegment(uint index)
+    {
+        auto cfg = Para.CConfig;
+        auto seg = new Segment;
+        seg->Filename = SegmentName(index);
+
+        static const char* const formats[] = { "mp4", "mov", "matroska" };
+        AVERR(avformat_alloc_output_context2(&seg->Context, nullptr, formats[(int)cfg->UseContainer], seg->Filename));
+
+        AsyncFileWriter::Para fpara =
+        {
+            .BufferSize = Clamp(cfg->WriteBufferMB, 1u, 256u) << 20,
+            .BufferCount = 3,
+            .Unbuffered = cfg->UnbufferedWrites,
+            .Preallocate = (uint64)cfg->PreallocateMB << 20,
+        };
+        seg->File = new AsyncFileWriter(seg->Filename, fpara);
+
+        uint8* iobuf = (uint8*)av_malloc(IOBufferSize);
+        seg->Context->pb = avio_alloc_context(iobuf, IOBufferSize, 1, seg->File, nullptr, OnWrite, OnSeek);
+        ASSERT(seg->Context->pb);
+
+        seg->VideoStream = avformat_new_stream(seg->Context, nullptr);
+        seg->VideoStream->id = 0;
+        seg->VideoStream->time_base = VideoTb;
+        if (!Vfr)
+            seg->VideoStream->avg_frame_rate = { .num = (int)Para.RateNum, .den = (int)Para.RateDen };
+        AVERR(avcodec_parameters_copy(seg->VideoStream->codecpar, VideoPar));
+
+        if (AudioPar)
+        {
+            seg->AudioStream = avformat_new_stream(seg->Context, nullptr);
+            seg->AudioStream->id = 1;
+            AVERR(avcodec_parameters_copy(seg->AudioStream->codecpar, AudioPar));
+        }
+
+        AVDictionary* opts = nullptr;
+        if (cfg->Fragmented)
+        {
+            // a new fragment/cluster at the first keyframe after FragmentMs. Only the
+            // current one is kept in memory, and everything written up to it stays playable.
+            uint fragMs = Max(cfg->FragmentMs, 100u);
+            if (cfg->UseContainer == Container::Mkv)
+            {
+                av_dict_set_int(&opts, "cluster_time_limit", fragMs, 0);
+            }
+            else
+            {
+                av_dict_set(&opts, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+                av_dict_set_int(&opts, "min_frag_duration", fragMs * 1000ll, 0);
+            }
+        }
+        AVERR(avformat_write_header(seg->Context, &opts));
+        av_dict_free(&opts);
+
+        return seg;
+    }
+
+    // writes the trailer and closes the file. Discarded segments (opened but never
+    // used) get deleted again
+    void CloseSegment(Segment* seg, bool discard = false)
+    {
+        AVERR(av_interleaved_write_frame(seg->Context, 0));
+        if (!discard && (!seg->AudioStream || seg->AudioPackets > 0)) // mkv muxer crashes otherwise...
+            AVERR(av_write_trailer(seg->Context));
+
+        avio_flush(seg->Context->pb);
+        av_freep(&seg->Context->pb->buffer);
+        avio_context_free(&seg->Context->pb);
+        delete seg->File;
+        avformat_free_context(seg->Context);
+
+        if (discard)
+            RemoveFile(seg->Filename);
+        delete seg;
+    }
+
+    void SegmentThreadFunc(Thread& thread)
+    {
+        for (;;)
+        {
+            Segment* seg;
+            while (Finished.Dequeue(seg))
+                CloseSegment(seg);
+
+            if (!thread.IsRunning())
+            {
+                if (Finished.IsEmpty())
+                    break;
+                continue;
+            }
+
+            if (uint index = NextIndex.exchange(0))
+            {
+                Next = OpenSegment(index);
+                NextEvent.Fire();
+            }
+
+            SegmentEvent.Wait(100);
+        }
+    }
+
+    // start opening the next file in the background
+    void RequestNext()
+    {
+        if (NextRequested) return;
+        NextRequested = true;
+        NextIndex = SegmentNo + 1;
+        SegmentEvent.Fire();
+    }
+
+    void FinishClosing()
+    {
+        while (!Finished.Enqueue(Closing))
+            Thread::Sleep(1);
+        SegmentEvent.Fire();
+        Closing = nullptr;
+    }
+
+    // called with every video packet before it gets its timestamps. Cuts only
+    // happen on keyframes, so every segment starts with one.
+    void UpdateSegments(bool keyframe)
+    {
+        int64 length = VideoTime - Current->Start;
+        uint64 bytes = Current->File->Length();
+
+        // late audio for the previous segment should have arrived long ago
+        if (Closing && length >= 2ll * VideoTb.den / VideoTb.num)
+            FinishClosing();
+
+        if ((SegmentLength && length >= SegmentLength * 9 / 10) || (SegmentBytes && bytes >= SegmentBytes / 10 * 9))
+            RequestNext();
+
+        if (!keyframe || !((SegmentLength && length >= SegmentLength) || (SegmentBytes && bytes >= SegmentBytes)))
+            return;
+
+        if (Closing)
+            FinishClosing();
+
+        RequestNext();
+        Segment* next;
+        while (!(next = Next.exchange(nullptr)))
+            NextEvent.Wait(10);
+
+        next->Start = VideoTime;
+        next->AudioStart = AudioContext ? av_rescale_q(VideoTime, VideoTb, AudioContext->time_base) : 0;
+
+        Closing = Current;
+        Current = next;
+        SegmentNo++;
+        NextRequested = false;
+
+        if (!AudioContext)
+            FinishClosing();
+    }
 
 public:
 
     Output_LibAV(const OutputPara& para) : Para(para)
-    {       
+    {
         Errors.Clear();
         av_log_set_callback(OnLog);
 
-        static const char* const formats[] = { "mp4", "mov", "matroska" };
+        NalType = para.CConfig->CodecCfg.Profile >= CodecProfile::HEVC_MAIN ? NalCodec::HEVC : NalCodec::H264;
+
+        Vfr = para.CConfig->VariableFrameRate;
+        InlineAudio = !para.CConfig->AudioThread;
+        VideoTb = Vfr ? AVRational{ .num = 1, .den = VfrRate } : AVRational{ .num = (int)para.RateDen, .den = (int)para.RateNum };
 
-        AVERR(avformat_alloc_output_context2(&Context, nullptr, formats[(int)para.CConfig->UseContainer] , para.filename));
-        AVERR(avio_open(&Context->pb, para.filename, AVIO_FLAG_WRITE));
+        SegmentLength = (int64)para.CConfig->SegmentMinutes * 60 * VideoTb.den / VideoTb.num;
+        SegmentBytes = (uint64)para.CConfig->SegmentMB << 20;
+        if (SegmentLength || SegmentBytes)
+            SegmentThread = new Thread(Bind(this, &Output_LibAV::SegmentThreadFunc));
 
         Packet = av_packet_alloc();
-        Frame = av_frame_alloc();     
+        VideoPacket = av_packet_alloc();
     }
 
     ~Output_LibAV()
     {
         if (AudioContext)
         {
+            ConvertAudio(nullptr, 0);
             AVERR(avcodec_send_frame(AudioContext, nullptr));
+            ReceiveAudio();
             WriteAudio();
-            delete[] ResampleBuffer;
+            av_frame_free(&AudioFrame);
             swr_free(&Resample);
+            av_buffer_pool_uninit(&AudioPool);
         }
 
-        AVERR(av_interleaved_write_frame(Context, 0));
-        if (!AudioContext || AudioWritten>0) // mkv muxer crashes otherwise...
-            AVERR(av_write_trailer(Context));
+        // a held VFR packet just keeps its nominal one frame duration
+        FlushVideo();
 
-        avio_close(Context->pb);
+        if (SegmentThread)
+        {
+            if (Closing)
+                FinishClosing();
+            if (Current)
+            {
+                Closing = Current;
+                FinishClosing();
+            }
+            delete SegmentThread;
+
+            if (Segment* next = Next.exchange(nullptr))
+                CloseSegment(next, true);
+        }
+        else if (Current)
+            CloseSegment(Current);
 
-        avformat_free_context(Context);
         avcodec_free_context(&AudioContext);
+        avcodec_parameters_free(&VideoPar);
+        avcodec_parameters_free(&AudioPar);
 
         av_packet_free(&Packet);
-        av_frame_free(&Frame);
+        av_packet_free(&VideoPacket);
 
         av_log_set_callback(nullptr);
     }
 
-    void SubmitVideoPacket(const uint8* data, uint size) override
+    void SubmitVideoPacket(const uint8* data, uint size, double time) override
     {
-        if (!VideoStream)
+        if (!Current)
         {
             InitVideo(data, size);
             InitAudio();
-            AVERR(avformat_write_header(Context, nullptr));
+            Current = OpenSegment(0);
+            FirstTime = time;
         }
 
+        // with VFR, the capture time says where the frame goes
+        int64 videoTime = Vfr ? (int64)llround((time - FirstTime) * VfrRate) : FrameNo;
+        if (FrameNo)
+            videoTime = Max(videoTime, VideoTime + 1);
+
+        // ... and the previous one lasts until then
+        if (VideoPending)
+            VideoPacket->duration = av_rescale_q(videoTime - VideoTime, VideoTb, Current->VideoStream->time_base);
+        FlushVideo();
+        VideoTime = videoTime;
+
+        bool keyframe = ParsePacket(NalType, data, size).IsKeyframe;
+        if (SegmentThread)
+            UpdateSegments(keyframe);
+
         AVRational tb = { .num = (int)Para.RateDen, .den = (int)Para.RateNum };
+        AVStream* stream = Current->VideoStream;
 
-        // set up packet
-        Packet->stream_index = VideoStream->index;
-        Packet->data = (uint8*)data;
-        Packet->size = size;
-        Packet->dts = Packet->pts = av_rescale_q(FrameNo, tb, VideoStream->time_base);
-        Packet->duration = av_rescale_q(1, tb, VideoStream->time_base);
+        // copy into pool memory (with the padding libav wants)
+        AVBufferRef* buf = VideoPool.Get(size + AV_INPUT_BUFFER_PADDING_SIZE);
+        ASSERT(buf);
+        memcpy(buf->data, data, size);
+        memset(buf->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        VideoBytesCopied += size;
 
-        // write packet
-        AVERR(av_interleaved_write_frame(Context, Packet));
-        av_packet_unref(Packet);
+        // set up packet
+        VideoPacket->buf = buf;
+        VideoPacket->data = buf->data;
+        VideoPacket->size = size;
+        VideoPacket->stream_index = stream->index;
+        VideoPacket->dts = VideoPacket->pts = av_rescale_q(VideoTime - Current->Start, VideoTb, stream->time_base);
+        VideoPacket->duration = av_rescale_q(1, tb, stream->time_base);
+        VideoPending = true;
+
+        if (keyframe)
+        {
+            VideoPacket->flags |= AV_PKT_FLAG_KEY;
+            Keyframes.Add(KeyframeEntry{ .FrameNo = (uint64)FrameNo, .Pts = VideoPacket->pts, .Size = size, .Segment = SegmentNo });
+        }
 
         FrameNo++;
     }
 
-    void SubmitAudio(const uint8* data, uint size) override
+    void WriteVideo() override
     {
-        if (!AudioContext) return;
-     
-        AVRational tb = { .num = 1, .den = (int)Para.Audio.SampleRate, };
-        uint samples = size / Para.Audio.BytesPerSample;       
-        int planar = av_sample_fmt_is_planar(AudioContext->sample_fmt);
-        uint bytesPerChannel = ResampleBufferSize * ResampleBytesPerSample;
-        uint rbsize = Para.Audio.Channels * bytesPerChannel;
-
-        while (samples)
-        {
-            // fill up resample buffer
-            uint avail =  ResampleBufferSize-ResampleFill;
+        if (AudioContext)
+            WriteAudio();
 
-            uint in = Min(samples, avail); // TODO: add sample rate conversion
+        // with VFR, the packet waits for the next one to know its duration
+        if (!Vfr)
+            FlushVideo();
+    }
 
-            uint rbpos = ResampleFill * ResampleBytesPerSample;
-            if (!planar)
-                rbpos *= Para.Audio.Channels;
+    void FlushVideo()
+    {
+        if (!VideoPending) return;
 
-            uint8* buffers[8];
-            for (int i = 0; i < 8; i++)
-                buffers[i] = ResampleBuffer + rbpos + i * bytesPerChannel;
+        // the packet is refcounted, so the muxer takes it over without a copy
+        AVERR(av_interleaved_write_frame(Current->Context, VideoPacket));
+        av_packet_unref(VideoPacket);
+        VideoPending = false;
+        VideoPackets++;
+    }
 
-            int samplesOut = swr_convert(Resample, buffers, avail, &data, in);
-            ResampleFill += in;
-            samples -= in;
-            data += in * Para.Audio.BytesPerSample;
+    void SubmitAudio(const uint8* data, uint size) override
+    {
+        if (!AudioContext) return;
 
-            // cut buffer into frames and send
-            uint frame = AudioContext->frame_size;
-            if (!frame) frame = ResampleFill;
-            uint written = 0;
-            while ((ResampleFill-written) >= frame)
-            {
-                // make frame
-                Frame->pts = av_rescale_q(AudioWritten + written, tb, AudioContext->time_base);
-                Frame->format = AudioContext->sample_fmt;
-                Frame->nb_samples = frame;
-                Frame->ch_layout = AudioContext->ch_layout;
-                AVERR(av_frame_get_buffer(Frame, 0));
-
-                // copy audio data
-                rbpos = written * ResampleBytesPerSample;
-                if (!planar)
-                    rbpos *= Para.Audio.Channels;
-                for (int i = 0; i < 8; i++) 
-                    if (Frame->data[i])
-                        memcpy(Frame->data[i], ResampleBuffer + rbpos + i * bytesPerChannel, Frame->linesize[0]);
-
-                // encode and send
-                AVERR(avcodec_send_frame(AudioContext, Frame));
-                WriteAudio();
-                av_frame_unref(Frame);
-
-                written += frame;
-            }
-            AudioWritten += written;
+        ConvertAudio(data, size / Para.Audio.BytesPerSample);
+    }
 
-            // move remainder of resample buffer back to start
-            if (written)
-            {
-                if (written < ResampleFill)
-                {
-                    if (planar)
-                    {
-                        for (uint i = 0; i < Para.Audio.Channels; i++)
-                        {
-                            uint8* buf = ResampleBuffer + i * bytesPerChannel;
-                            memcpy(buf, buf + written * ResampleBytesPerSample, ((size_t)ResampleFill - written) * ResampleBytesPerSample);
-                        }
-                    }
-                    else
-                    {
-                        uint bps = ResampleBytesPerSample * Para.Audio.Channels;
-                        memcpy(ResampleBuffer, ResampleBuffer + written * bps, ((size_t)ResampleFill - written) * bps);
-                    }
-                }
-                ResampleFill -= written;
-            }
-        }
+    OutputStats GetStats() const override
+    {
+        return OutputStats
+        {
+            .VideoPackets = VideoPackets,
+            .PoolRequests = VideoPool.GetRequests(),
+            .PoolHits = VideoPool.GetHits(),
+            .BytesCopied = VideoBytesCopied,
+            .AudioBytesCopied = AudioBytesCopied,
+            .Write = Current ? Current->File->GetStats() : AsyncFileWriter::Stats{},
+            .Segment = SegmentNo,
+            .Keyframes = Keyframes.GetCount(),
+            .LastKeyframe = Keyframes.GetLast(),
+        };
     }
 
+    void GetKeyframes(Array<KeyframeEntry>& out) const override { Keyframes.Get(out); }
+
 };
 
 IOutput* CreateOutputLibAV(const OutputPara& para) { return new Output_LibAV(para); }
\ No newline at end of file
@@ -0,0 +1,60 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#pragma once
+
+#include "types.h"
+
+extern "C"
+{
+#include <libavutil/buffer.h>
+}
+
+// Video packet memory in power of two size classes. Packets made from these are
+// refcounted, so the muxer can take them over instead of copying them again.
+class PacketPool
+{
+    static constexpr uint MinShift = 12;  // 4K
+    static constexpr uint NumClasses = 15; // ... 64M
+
+    AVBufferPool* Pools[NumClasses] = {};
+    uint64 Requests = 0;
+    uint64 Allocs = 0;
+
+    static AVBufferRef* Alloc(void* opaque, size_t size)
+    {
+        ((PacketPool*)opaque)->Allocs++;
+        return av_buffer_alloc(size);
+    }
+
+public:
+    ~PacketPool()
+    {
+        // buffers still in flight keep their pool alive until they come back
+        for (auto& pool : Pools)
+            av_buffer_pool_uninit(&pool);
+    }
+
+    AVBufferRef* Get(uint size)
+    {
+        Requests++;
+        uint cls = 0;
+        while (cls < NumClasses && (1u << (MinShift + cls)) < size)
+            cls++;
+
+        if (cls == NumClasses)
+        {
+            Allocs++;
+            return av_buffer_alloc(size);
+        }
+
+        if (!Pools[cls])
+            Pools[cls] = av_buffer_pool_init2((size_t)1 << (MinShift + cls), this, Alloc, nullptr);
+        return av_buffer_pool_get(Pools[cls]);
+    }
+
+    uint64 GetRequests() const { return Requests; }
+    uint64 GetHits() const { return Requests - Allocs; }
+};
@@ -0,0 +1,214 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include "replay.h"
+#include "screencapture.h"
+#include "packetpool.h"
+
+#include <string.h>
+
+ReplayBuffer::ReplayBuffer(const OutputPara& para, uint maxSeconds, uint64 maxBytes) : Para(para), MaxSeconds(maxSeconds), MaxBytes(maxBytes)
+{
+    Vfr = para.CConfig->VariableFrameRate;
+    Codec = para.CConfig->CodecCfg.Profile >= CodecProfile::HEVC_MAIN ? NalCodec::HEVC : NalCodec::H264;
+    MaxFrames = Max<uint64>((uint64)maxSeconds * para.RateNum / para.RateDen, 1);
+
+    // room for the time limit plus a GOP or two on top, for a start. VFR never
+    // has more frames than this. Longer GOPs (or none set) grow the ring later
+    uint64 gop = Max<uint64>(para.CConfig->CodecCfg.GopSize, 2ull * para.RateNum / para.RateDen);
+    Ring.SetSize(MaxFrames + 2 * gop);
+    Pool = new PacketPool;
+
+    SaveThread = new Thread(Bind(this, &ReplayBuffer::SaveThreadFunc));
+}
+
+ReplayBuffer::~ReplayBuffer()
+{
+    delete SaveThread;
+    Clear();
+    delete Pool;
+}
+
+ReplayBuffer::SaveJob::~SaveJob()
+{
+    for (SavedEntry& e : Entries)
+        av_buffer_unref(&e.Video);
+}
+
+void ReplayBuffer::AddVideo(const uint8* data, uint size, double time)
+{
+    bool key = ParsePacket(Codec, data, size).IsKeyframe;
+
+    // can't start without a keyframe
+    if (Head == Tail && !key)
+        return;
+
+    if (Tail - Head == Ring.Len())
+        GrowRing();
+
+    Entry& e = Ring[Tail % Ring.Len()];
+    e.Video = Pool->Get(size);
+    ASSERT(e.Video);
+    memcpy(e.Video->data, data, size);
+    e.VideoSize = size;
+    e.Audio.Clear();
+    e.Time = time;
+    if (key)
+        Keys += Tail;
+    Tail++;
+    Bytes += size;
+
+    Trim();
+}
+
+void ReplayBuffer::AddAudio(const uint8* data, uint size)
+{
+    // belongs to a frame that didn't make it in
+    if (Head == Tail)
+        return;
+
+    Ring[(Tail - 1) % Ring.Len()].Audio += ReadOnlySpan<uint8>(data, size);
+    Bytes += size;
+    Trim();
+}
+
+void ReplayBuffer::Save(const char* filename)
+{
+    if (Head == Tail)
+        return;
+
+    // more references to the same video buffers, and a copy of the audio as
+    // the newest entry can still get more
+    auto job = new SaveJob;
+    job->Filename = filename;
+    job->Entries.SetSize(Tail - Head);
+    for (uint64 i = Head; i < Tail; i++)
+    {
+        const Entry& e = Ring[i % Ring.Len()];
+        SavedEntry& se = job->Entries[i - Head];
+        se.Video = av_buffer_ref(e.Video);
+        se.VideoSize = e.VideoSize;
+        if (e.Audio.Len())
+            se.Audio = new Buffer(e.Audio.Ptr(), e.Audio.Len());
+        se.Time = e.Time;
+    }
+
+    if (!Jobs.Enqueue(job))
+    {
+        DPrintF("replay: too many saves pending, skipping %s\n", filename);
+        delete job;
+        return;
+    }
+    JobEvent.Fire();
+}
+
+double ReplayBuffer::GetSeconds() const
+{
+    return Head < Tail ? Length(Head) : 0;
+}
+
+// from frame `from` to the end of the newest one
+double ReplayBuffer::Length(uint64 from) const
+{
+    double frameTime = (double)Para.RateDen / Para.RateNum;
+    if (!Vfr)
+        return (Tail - from) * frameTime;
+    return Ring[(Tail - 1) % Ring.Len()].Time - Ring[from % Ring.Len()].Time + frameTime;
+}
+
+void ReplayBuffer::ClearEntry(Entry& e)
+{
+    Bytes -= e.VideoSize + e.Audio.Len();
+    av_buffer_unref(&e.Video);
+    e.VideoSize = 0;
+    e.Audio.Clear();
+}
+
+void ReplayBuffer::Clear()
+{
+    for (; Head < Tail; Head++)
+        ClearEntry(Ring[Head % Ring.Len()]);
+    Keys.Clear();
+    Bytes = 0;
+}
+
+// the GOPs are longer than the ring: twice the room, same absolute frame numbers
+void ReplayBuffer::GrowRing()
+{
+    Array<Entry> ring;
+    ring.SetSize(2 * Ring.Len());
+    for (uint64 i = Head; i < Tail; i++)
+    {
+        Entry& from = Ring[i % Ring.Len()];
+        Entry& to = ring[i % ring.Len()];
+        to.Video = from.Video;
+        to.VideoSize = from.VideoSize;
+        to.Audio = (Array<uint8>&&)from.Audio;
+        to.Time = from.Time;
+        from.Video = nullptr;
+    }
+    Ring = (Array<Entry>&&)ring;
+}
+
+void ReplayBuffer::Trim()
+{
+    // drop the oldest GOP while the rest still covers the time limit, or while we're too big
+    while (Keys.Len() >= 2 && (Length(Keys[1]) >= MaxSeconds || Bytes > MaxBytes))
+        DropGop();
+
+    // the newest GOP alone is over the size limit: start over at the next keyframe
+    if (Bytes > MaxBytes)
+        Clear();
+}
+
+void ReplayBuffer::DropGop()
+{
+    for (uint64 end = Keys[1]; Head < end; Head++)
+        ClearEntry(Ring[Head % Ring.Len()]);
+    Keys.PopHead();
+}
+
+void ReplayBuffer::SaveThreadFunc(Thread& thread)
+{
+    for (;;)
+    {
+        SaveJob* job;
+        if (!Jobs.Dequeue(job))
+        {
+            if (!thread.IsRunning())
+            {
+                if (Jobs.IsEmpty())
+                    break;
+                continue;
+            }
+            JobEvent.Wait(100);
+            continue;
+        }
+
+        // a single plain file, whatever the recording settings say
+        CaptureConfig cfg = *Para.CConfig;
+        cfg.Fragmented = false;
+        cfg.SegmentMinutes = 0;
+        cfg.SegmentMB = 0;
+        cfg.AudioThread = false;    // the audio comes in on this thread
+
+        // same sequence of calls the process thread does when recording to a file
+        OutputPara para = Para;
+        para.filename = job->Filename;
+        para.CConfig = &cfg;
+        IOutput* output = CreateOutputLibAV(para);
+        for (const SavedEntry& e : job->Entries)
+        {
+            output->SubmitVideoPacket(e.Video->data, e.VideoSize, e.Time);
+            output->WriteVideo();
+            if (e.Audio.IsValid())
+                output->SubmitAudio(e.Audio->Ptr(), (uint)e.Audio->Len());
+        }
+        delete output;
+
+        delete job;
+        Saves++;
+    }
+}
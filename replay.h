@@ -0,0 +1,96 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#pragma once
+
+#include "types.h"
+#include "system.h"
+#include "output.h"
+#include "annexb.h"
+
+class PacketPool;
+struct AVBufferRef;
+
+// In-memory ring of the last N seconds of encoded video plus the raw audio that
+// came with it, to save what just happened after the fact. It always starts with
+// a keyframe: old frames get dropped a whole GOP at a time, once the rest still
+// covers the time limit or the size limit is hit. The ring grows if the GOPs are
+// longer than it expected.
+//
+// Frames are refcounted buffers from a PacketPool, so Save() only takes a quick
+// snapshot (plus a copy of the audio, which is small next to the video) and a
+// background thread writes the file through a regular output.
+class ReplayBuffer
+{
+public:
+    ReplayBuffer(const OutputPara& para, uint maxSeconds, uint64 maxBytes);
+
+    // waits for saves still in progress
+    ~ReplayBuffer();
+
+    // one encoded video frame with its capture time, and the audio read after it
+    void AddVideo(const uint8* data, uint size, double time);
+    void AddAudio(const uint8* data, uint size);
+
+    // writes the current contents to a new file
+    void Save(const char* filename);
+
+    double GetSeconds() const;
+    uint64 GetBytes() const { return Bytes; }
+    uint GetSaves() const { return Saves; }
+
+private:
+    // audio grows in place, and the ring entries get reused so it keeps its memory
+    struct Entry
+    {
+        AVBufferRef* Video = nullptr;
+        uint VideoSize = 0;
+        Array<uint8> Audio;
+        double Time = 0;
+    };
+
+    struct SavedEntry
+    {
+        AVBufferRef* Video = nullptr;   // another reference to the ring's
+        uint VideoSize = 0;
+        RCPtr<Buffer> Audio;
+        double Time = 0;
+    };
+
+    struct SaveJob
+    {
+        String Filename;
+        Array<SavedEntry> Entries;
+
+        ~SaveJob();
+    };
+
+    OutputPara Para;
+    NalCodec Codec;
+    uint64 MaxFrames;
+    double MaxSeconds;
+    uint64 MaxBytes;
+    bool Vfr;
+    PacketPool* Pool = nullptr;
+
+    Array<Entry> Ring;
+    uint64 Head = 0;        // absolute frame numbers, entry at n % Ring.Len()
+    uint64 Tail = 0;
+    Array<uint64> Keys;     // keyframes in the ring, oldest first
+    uint64 Bytes = 0;
+
+    SpscQueue<SaveJob*, 16> Jobs;
+    ThreadEvent JobEvent;
+    Thread* SaveThread = nullptr;
+    std::atomic<uint> Saves = 0;
+
+    double Length(uint64 from) const;
+    void ClearEntry(Entry& e);
+    void Clear();
+    void GrowRing();
+    void Trim();
+    void DropGop();
+    void SaveThreadFunc(Thread& thread);
+};
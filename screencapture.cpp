@@ -10,9 +10,16 @@
 #include "graphics.h"
 
 #include "audiocapture.h"
+#include "audiometer.h"
+#include "framepacer.h"
 #include "colormath.h"
+#include "colorconvert_cpu.h"
 #include "encode.h"
+#include "histogram.h"
 #include "output.h"
+#include "replay.h"
+#include "tilehash.h"
+#include "tilemask.h"
 
 #include "ScreenCapture.h"
 
@@ -21,7 +28,10 @@
 class ScreenCapture : public IScreenCapture
 {
     CaptureConfig Config;
+    bool headless = false;      // no D3D: frames come in system memory and get converted on the CPU
 
+    IFrameSource* source = nullptr;
+    EncoderFactory createEncoder = nullptr;
     IEncode* encoder = nullptr;
     IAudioCapture* audioCapture = nullptr;
     AudioInfo audioInfo = {};
@@ -32,54 +42,130 @@ class ScreenCapture : public IScreenCapture
     bool isHdr = false;
 
     CaptureStats Stats = {};
+    StatsHistory history;
     double avSkew = 0;
     double fps = 0;
     double bitrate = 0;
+    std::atomic<bool> saveReplay = false;
+    std::atomic<uint64> audioBytesSent = 0;
+    AudioMeter* meter = nullptr;
+    double lastFrameTime = 0;   // capture thread: timestamp of the last frame or duplicate
+    double lastEncodeTime = 0;  // ... and of the last one that actually went to the encoder
+    std::atomic<double> captureCpu = 0; // CPU seconds of the capture thread (and converter) this recording
+
+    // per frame timestamps from the capture thread, one entry per encoded frame
+    // (duplicates included), so the process thread can match them to the packets
+    struct FrameStamps
+    {
+        int64 Acquire;
+        int64 Convert;
+        int64 Submit;
+    };
+    SpscQueue<FrameStamps, 1024> stamps;
+    LogHistogram latency[(int)CaptureStats::Stage::Count];
+
+    void PushStamps(int64 acquire, int64 convert)
+    {
+        // if this fails, nobody's reading packets anyway
+        stamps.Enqueue(FrameStamps{ .Acquire = acquire, .Convert = convert, .Submit = GetTicks() });
+    }
+
+    void ClearStamps()
+    {
+        FrameStamps st;
+        while (stamps.Dequeue(st)) {}
+    }
+
+    void RecordLatency(const FrameStamps& st, int64 packet, int64 mux, int64 done)
+    {
+        using Stage = CaptureStats::Stage;
+        const double toUs = 1000000.0 / (double)GetTicksPerSecond();
+        auto rec = [&](Stage stage, int64 from, int64 to) { latency[(int)stage].Record((uint64)(Max<int64>(to - from, 0) * toUs)); };
+
+        rec(Stage::Convert, st.Acquire, st.Convert);
+        rec(Stage::Submit, st.Convert, st.Submit);
+        rec(Stage::Encode, st.Submit, packet);
+        rec(Stage::Mux, packet, mux);
+        rec(Stage::Drain, packet, done);
+        rec(Stage::Total, st.Acquire, mux);
+    }
 
-    void CalcVU(const uint8 *ptr, uint size)
+    // runs wherever the audio gets read, so with AudioThread on it's off the video path
+    void UpdateMeter(const uint8* ptr, uint size)
     {
-        uint ch = audioInfo.Channels;
-        if (audioInfo.Format != AudioFormat::F32)
-            ch = 0;
+        if (!meter)
+            return;
 
-        size /= 4 * ch;
+        meter->Process(ptr, size);
 
+        uint ch = meter->GetChannels();
         for (uint i = 0; i < ch; i++)
         {
-            const float* data = ((float*)ptr) + i;
-            float cvu = Stats.VU[i];
-            for (uint s = 0; s < size; s++)
-            {
-                float v = fabsf(*data);
-                if (v > cvu)
-                    cvu = v;
-                else
-                    cvu *= 0.9999f;
-                data += ch;
-            }
-            Stats.VU[i] = cvu;
-            Stats.VUPeak[i] = Max(Stats.VUPeak[i], cvu);
+            float vu = Config.TruePeakMeter ? meter->GetTruePeak(i) : meter->GetPeak(i);
+            Stats.VU[i] = vu;
+            Stats.VURms[i] = meter->GetRms(i);
+            Stats.VUPeak[i] = Max(Stats.VUPeak[i], vu);
         }
 
-        for (int i = ch; i < 32; i++)
-            Stats.VU[i] = -1;        
+        for (uint i = ch; i < 32; i++)
+            Stats.VU[i] = -1;
     }
 
-    void ProcessThreadFunc(Thread& thread)
+    String MakeFilename(const char* suffix = "", const char* ext = nullptr)
     {
         static const char* const extensions[] = { "mp4", "mov", "mkv" };
 
         String prefix = Config.Directory + "\\" + Config.NamePrefix;
 
         auto systime = GetSystemTime();
-        auto filename = String::PrintF("%s_%04d-%02d-%02d_%02d.%02d.%02d_%dx%d_%.4gfps.%s",
+        return String::PrintF("%s_%04d-%02d-%02d_%02d.%02d.%02d_%dx%d_%.4gfps%s.%s",
             (const char*)prefix,
             systime.year, systime.month, systime.day, systime.hour, systime.minute, systime.second,
-            sizeX, sizeY, (double)rateNum / rateDen,
-            extensions[(int)Config.UseContainer]
+            sizeX, sizeY, (double)rateNum / rateDen, suffix,
+            ext ? ext : extensions[(int)Config.UseContainer]
         );
+    }
+
+    // reads and encodes audio as it comes in, so neither waits for video packets
+    void AudioThreadFunc(Thread& thread, IOutput* output)
+    {
+        // 10ms chunks
+        const uint audioSize = audioInfo.BytesPerSample * Max(audioInfo.SampleRate / 100, 1u);
+        uint8* audioData = new uint8[audioSize];
+
+        while (thread.IsRunning())
+        {
+            double audioTime = 0;
+            uint audio = audioCapture->Read(audioData, audioSize, audioTime);
+            if (!audio)
+            {
+                Thread::Sleep(2);
+                continue;
+            }
+
+            output->SubmitAudio(audioData, audio);
+            audioBytesSent += audio;
+            UpdateMeter(audioData, audio);
+        }
+
+        delete[] audioData;
+    }
+
+    void ProcessThreadFunc(Thread& thread)
+    {
+        auto filename = MakeFilename();
 
         audioInfo = audioCapture ? audioCapture->GetInfo() : AudioInfo{ .Format = AudioFormat::None };
+        if (audioInfo.Format != AudioFormat::None && audioInfo.Channels <= AudioMeter::MaxChannels)
+        {
+            meter = new AudioMeter(AudioMeter::Para
+            {
+                .Format = audioInfo.Format,
+                .Channels = audioInfo.Channels,
+                .SampleRate = audioInfo.SampleRate,
+                .TruePeak = Config.TruePeakMeter,
+            });
+        }
 
         OutputPara para =
         {
@@ -94,7 +180,13 @@ class ScreenCapture : public IScreenCapture
         };
 
         Stats = {};
-        Stats.Filename = filename;
+        const double threadCpuBase = GetThreadCpuTime();
+        const double processCpuBase = GetProcessCpuTime();
+        for (auto& hist : latency)
+            hist.Reset();
+        history.Clear();
+        if (!Config.ReplayMode)
+            Stats.Filename = filename;
         Stats.FPS = (double)rateNum / rateDen;
         Stats.SizeX = sizeX;
         Stats.SizeY = sizeY;
@@ -109,18 +201,29 @@ class ScreenCapture : public IScreenCapture
         }
         
         
-        IOutput* output = CreateOutputLibAV(para);
+        // in replay mode, nothing gets written until someone calls SaveReplay()
+        IOutput* output = nullptr;
+        ReplayBuffer* replay = nullptr;
+        if (Config.ReplayMode)
+        {
+            replay = new ReplayBuffer(para, Config.ReplaySeconds, (uint64)Config.ReplayMB << 20);
+            saveReplay = false;
+        }
+        else
+            output = CreateOutputLibAV(para);
 
         const uint audioSize = para.Audio.BytesPerSample * (para.Audio.SampleRate / 10);
         uint8* audioData = new uint8[audioSize];
+        Thread* audioThread = nullptr;
+        audioBytesSent = 0;
 
         bool firstVideo = true;
         bool firstAudio = true;
 
         double firstVideoTime = 0;
+        AudioRingStats ringBase = {};
         
         double vTimeSent = 0;
-        double aTimeSent = 0;
         bool scrlOn = true;
         if (Config.BlinkScrollLock)
             SetScrollLock(true);
@@ -136,31 +239,67 @@ class ScreenCapture : public IScreenCapture
             double videoTime;
             while (encoder->BeginGetPacket(data, size, 2, videoTime))
             {
-                output->SubmitVideoPacket(data, size);
-                encoder->EndGetPacket();
-                vTimeSent += (double)rateDen / rateNum;
+                int64 packetTicks = GetTicks();
+                if (replay)
+                {
+                    replay->AddVideo(data, size, videoTime);
+                    encoder->EndGetPacket();
+                }
+                else
+                {
+                    output->SubmitVideoPacket(data, size, videoTime);
+                    encoder->EndGetPacket();
+                    output->WriteVideo();
+                }
+                int64 muxTicks = GetTicks();
 
                 if (firstVideo)
                 {
                     firstVideoTime = videoTime;
                     firstVideo = false;
                     if (audioCapture)
+                    {
                         audioCapture->JumpToTime(firstVideoTime);
+                        ringBase = audioCapture->GetRingStats();
+
+                        // the replay buffer wants the audio right with its frames, and doesn't encode it anyway
+                        if (output && Config.AudioThread)
+                            audioThread = new Thread([this, output](Thread& t) { AudioThreadFunc(t, output); });
+                    }
                 }
 
+                // up to the end of this frame. With VFR that's a guess until the next one comes in
+                double frameTime = (double)rateDen / rateNum;
+                vTimeSent = Config.VariableFrameRate ? videoTime - firstVideoTime + frameTime : vTimeSent + frameTime;
+
                 if (audioCapture)
                 {
-                    double audioTime = 0;
-                    uint audio = audioCapture->Read(audioData, audioSize, audioTime);
-                    if (audio)
+                    if (!audioThread)
                     {
-                        output->SubmitAudio(audioData, audio);
-                        aTimeSent += (double)audio / ((double)para.Audio.BytesPerSample * para.Audio.SampleRate);
-                        CalcVU(audioData, audio);
+                        double audioTime = 0;
+                        uint audio = audioCapture->Read(audioData, audioSize, audioTime);
+                        if (audio)
+                        {
+                            if (replay)
+                                replay->AddAudio(audioData, audio);
+                            else
+                                output->SubmitAudio(audioData, audio);
+                            audioBytesSent += audio;
+                            UpdateMeter(audioData, audio);
+                        }
                     }
+                    double aTimeSent = (double)audioBytesSent / ((double)para.Audio.BytesPerSample * para.Audio.SampleRate);
                     avSkew += 0.03 * (aTimeSent - vTimeSent - avSkew);
+
+                    auto ring = audioCapture->GetRingStats();
+                    Stats.AudioOverruns = (uint)(ring.Overruns - ringBase.Overruns);
+                    Stats.AudioUnderruns = (uint)(ring.Underruns - ringBase.Underruns);
                 }
 
+                FrameStamps st;
+                if (stamps.Dequeue(st))
+                    RecordLatency(st, packetTicks, muxTicks, GetTicks());
+
                 if (Config.BlinkScrollLock)
                 {
                     bool blink = fmod(GetTime(), 1) < 0.5f;
@@ -176,18 +315,46 @@ class ScreenCapture : public IScreenCapture
 
                 double br = (8. * size * rateNum) / (1000. * rateDen);
                 bitrate += 0.03 * (br  - bitrate);
-                Stats.AvgBitrate = (8. * (double)totalBytes * rateNum) / (1000. * frameCount * rateDen);
+                Stats.AvgBitrate = (8. * (double)totalBytes) / (1000. * vTimeSent);
                 Stats.MaxBitrate = Max(Stats.MaxBitrate, bitrate);
-                Stats.Time = (double)frameCount * rateDen / rateNum;
-                Stats.Frames += CaptureStats::Frame{ .FPS = fps, .AVSkew = avSkew, .Bitrate = bitrate };
+                Stats.Time = vTimeSent;
+                Stats.FramesEncoded = frameCount;
+                Stats.CpuCapture = captureCpu;
+                Stats.CpuProcess = GetThreadCpuTime() - threadCpuBase;
+                Stats.CpuTotal = GetProcessCpuTime() - processCpuBase;
+                history.Add(StatsSample{ .FPS = fps, .AVSkew = avSkew, .Bitrate = bitrate }, Stats.Time);
+
+                if (replay)
+                {
+                    if (saveReplay.exchange(false))
+                        replay->Save(MakeFilename("_replay"));
+                    Stats.ReplaySeconds = replay->GetSeconds();
+                    Stats.ReplayBytes = replay->GetBytes();
+                    Stats.ReplaysSaved = replay->GetSaves();
+                }
+                else
+                {
+                    auto os = output->GetStats();
+                    Stats.PacketPoolHitRate = os.PoolRequests ? (double)os.PoolHits / os.PoolRequests : 0;
+                    Stats.BytesCopiedPerFrame = os.VideoPackets ? (double)os.BytesCopied / os.VideoPackets : 0;
+                    Stats.WriteQueue = os.Write.QueueDepth;
+                    Stats.WriteQueueMax = os.Write.MaxQueueDepth;
+                    Stats.WriteStalls = os.Write.Stalls;
+                    Stats.Segment = os.Segment;
+                    Stats.WriteRate = os.Write.WriteTime > 0 ? os.Write.BytesWritten / (os.Write.WriteTime * 1048576.) : 0;
+                }
             }        
         }
 
         if (Config.BlinkScrollLock && scrlOn)
             SetScrollLock(false);
 
+        // stop feeding the output before it flushes
+        delete audioThread;
         delete output;
+        delete replay;
         delete[] audioData;
+        Delete(meter);
     }
 
 
@@ -197,63 +364,207 @@ class ScreenCapture : public IScreenCapture
         uint pitch;           // bytes per line
         uint height;          // # of lines
         uint scale;           // upscale factor, only when UPSCALE is defined
-        uint _pad[1];
+        uint tiles;           // tile count, only when TILES is defined
         Mat44 colormatrix;    // convert to ST 2020 and normalize to 10000 nits
     };
 
+    void Duplicate(double time)
+    {
+        lastFrameTime = time;
+
+        // with VFR the previous frame just lasts longer. Still send one every
+        // now and then so the output keeps muxing the audio
+        if (Config.VariableFrameRate && time - lastEncodeTime < Config.VfrMaxGapMs / 1000.0)
+        {
+            AtomicInc(Stats.FramesHeld);
+            return;
+        }
+
+        int64 dupTicks = GetTicks();
+        encoder->DuplicateFrame(time);
+        PushStamps(dupTicks, dupTicks);
+        AtomicInc(Stats.FramesDuplicated);
+        lastEncodeTime = time;
+    }
+
+    void InsertDuplicates(uint count)
+    {
+        double frameTime = (double)rateDen / rateNum;
+        for (uint i = 0; i < count; i++)
+            Duplicate(lastFrameTime + frameTime);
+    }
+
+    // present times of the last recording, to replay them with FramePacerSim
+    void SavePacerTrace(Array<double>& presents)
+    {
+        if (!presents.Len())
+            return;
+
+        String path = MakeFilename("_pacer", "txt");
+        if (!FramePacerSim::Save(path, presents))
+            DPrintF("could not write %s\n", (const char*)path);
+        presents.Clear();
+    }
+
     void CaptureThreadFunc(Thread& thread)
     {
         bool first = true;
-        int duplicated = 0;
-        int over = 0;
-        double lastFrameTime = GetTime();
-        double ltf2 = lastFrameTime;
-        double frameDuration = 0;
+        FramePacer pacer;
+        Array<double> presents;     // for RecordPacerTrace
         uint upscale = 1;
-
-        double vInSkew = 0;
-        uint64 lastFrameCount = 0;
+        TileMask dirty;             // what changed since the last conversion
+        Array<uint> tiles;
+        RCPtr<StructuredBuffer<uint>> tileBuffer;   // the same for the tile shader
+        TileHasher hasher;          // for DetectStaticFrames
+        RCPtr<ReadbackTexture> readback;
+        RCPtr<Texture> held;        // with D3D, DetectStaticFrames converts from here, once the readback is done
+        double heldTime = 0;
+        int64 heldAcquire = 0;
+        bool heldEmit = false;      // the pacer wants it encoded
+        bool readbackPending = false;   // held hasn't been hashed yet
+        double cpuBase = 0;
 
         Mat44 yuvMatrix;
+        const Mat44 hdrMatrix = GetHdrColorMatrix().Transpose();
         RCPtr<GpuByteBuffer> outBuffer;
 
+        // headless: ColorConverterCPU does what the csc shader does, into system memory
+        ColorConverterCPU* cpuConverter = nullptr;
+        Array<uint8> cpuBuffer;
+
         uint scrSizeX = 0, scrSizeY = 0;
 
+        // the changed tiles from the last hasher.Update()
+        auto addHashed = [&]
+        {
+            hasher.GetChanged().ForEachRun([&](uint x0, uint x1, uint y)
+            {
+                const int ts = TileMask::TileSize;
+                dirty.AddRect(x0 * ts, y * ts, x1 * ts, (y + 1) * ts, upscale);
+            });
+        };
+
+        // converts what's dirty and sends it to the encoder, or repeats the last frame if nothing is
+        auto emitFrame = [&](const RCPtr<Texture>& frameTex, const uint8* pixels, uint pitch, double frameTime, int64 acquireTicks)
+        {
+            if (!dirty.GetCount())
+            {
+                // same picture as last time: repeat it instead of converting again
+                // (and with VFR, don't even encode it)
+                Duplicate(frameTime);
+                AtomicInc(Stats.FramesStatic);
+                return;
+            }
+
+            // the output buffer still has the last frame, so only the changed tiles need
+            // converting. Past half the screen a plain full pass is cheaper
+            double fraction = dirty.GetFraction();
+
+            if (headless)
+            {
+                if (fraction < 0.5)
+                    cpuConverter->ConvertTiles(pixels, pitch, pixfmt, cpuBuffer.Ptr(), dirty);
+                else
+                    cpuConverter->Convert(pixels, pitch, pixfmt, cpuBuffer.Ptr());
+            }
+            else
+            {
+                auto fi = GetFormatInfo(encoder->GetBufferFormat(), sizeX, sizeY);
+
+                // color space conversion
+                CBuffer<CbConvert> cb;
+                cb->yuvmatrix = yuvMatrix.Transpose();
+                cb->pitch = fi.pitch;
+                cb->height = sizeY;
+                cb->scale = upscale;
+                cb->colormatrix = hdrMatrix;
+
+                CBindings bind;
+                bind.res[0] = frameTex;
+                bind.uav[0] = outBuffer;
+                bind.cb[0] = &cb;
+
+                if (fraction < 0.5)
+                {
+                    uint count = dirty.GetTiles(tiles);
+                    if (count)
+                    {
+                        tiles.CopyTo(tileBuffer->Map());
+                        tileBuffer->Unmap();
+                        cb->tiles = count;
+                        bind.res[1] = tileBuffer;
+                        Dispatch(TileShader, bind, Min(count, 1024u), (count + 1023) / 1024, 1);
+                    }
+                }
+                else
+                    Dispatch(Shader, bind, (sizeX + 7) / 8, (sizeY + 7) / 8, 1);
+            }
+            dirty.Clear();
+            Stats.ConvertedTiles += 0.03 * (fraction - Stats.ConvertedTiles);
+            int64 convertTicks = GetTicks();
+
+            encoder->SubmitFrame(frameTime);
+            lastFrameTime = lastEncodeTime = frameTime;
+            PushStamps(acquireTicks, convertTicks);
+            AtomicInc(Stats.FramesCaptured);
+        };
+
+        // With D3D and DetectStaticFrames: hash the held frame once its readback is
+        // done, and convert it if the pacer wanted it. Before anything that comes after it
+        auto flushHeld = [&]
+        {
+            if (!readbackPending)
+                return;
+
+            uint pitch;
+            const uint8* pixels = readback->Map(pitch);
+            hasher.Update(pixels, pitch);
+            readback->Unmap();
+            readbackPending = false;
+
+            addHashed();
+            if (!Config.DirtyRects && dirty.GetCount())
+                dirty.SetAll();
+            if (heldEmit)
+                emitFrame(held, nullptr, 0, heldTime, heldAcquire);
+        };
+
         while (thread.IsRunning())
         {
             bool record = !Config.RecordOnlyFullscreen || IsFullscreen();
             Stats.Recording = record;
 
             CaptureInfo info;
-            if (CaptureFrame(2, info))
+            if (source->AcquireFrame(2, info))
             {
+                int64 acquireTicks = GetTicks();
                 double time = GetTime();
-                double deltaf = (time - ltf2) * (double)info.rateNum / info.rateDen;                
-
-                lastFrameTime = ltf2 = time;
 
                 if (!record)
                 {
+                    // the process thread still has to pick up the last packets
+                    if (encoder)
+                        encoder->Flush();
                     Delete(processThread);
                     Delete(encoder);
+                    ClearStamps();
                     scrSizeX = scrSizeY = 0;
-                    ReleaseFrame();
+                    source->ReleaseFrame();
                     for (int i = 0; i < 32; i++)
                         if (Stats.VU[i] > 0)
                             Stats.VU[i] = 0;
                     continue;
                 }
 
-                if (scrSizeX != info.sizeX || scrSizeY != info.sizeY || rateNum != info.rateNum || rateDen != info.rateDen || pixfmt != info.tex->para.format || isHdr != info.isHdr)
+                if (scrSizeX != info.sizeX || scrSizeY != info.sizeY || rateNum != info.rateNum || rateDen != info.rateDen || pixfmt != info.format || isHdr != info.isHdr)
                 {
                     // (re)init encoder and processing thread, starts new output file
                     scrSizeX = sizeX = info.sizeX;
                     scrSizeY = sizeY = info.sizeY;
                     rateNum = info.rateNum;
                     rateDen = info.rateDen;
-                    pixfmt = info.tex->para.format;
+                    pixfmt = info.format;
                     isHdr = info.isHdr;
-                    frameDuration = (double)info.rateDen / info.rateNum;
 
                     upscale = 1;
                     if (Config.Upscale)
@@ -269,135 +580,153 @@ class ScreenCapture : public IScreenCapture
 
                     Delete(processThread);
                     Delete(encoder);
+                    ClearStamps();
 
-                    encoder = CreateEncodeNVENC(Config, isHdr);
+                    encoder = createEncoder(Config, isHdr);
 
                     auto fmt = encoder->GetBufferFormat();
                     auto fi = GetFormatInfo(fmt, sizeX, sizeY);
-                    outBuffer = new GpuByteBuffer(fi.lines * fi.pitch, GpuBuffer::Usage::GpuOnly);
-                   
-                    auto source = LoadResource(IDR_COLORCONVERT, TEXTFILE);
-                    ShaderDefine defines[] =
-                    {
-                        "OUTFORMAT", String::PrintF("%d", (int)fmt),
-                        "UPSCALE", upscale > 1 ? "1":"0",
-                        "HDR", (isHdr && pixfmt == PixelFormat::RGBA16F) ? "1" : "0",
-                    };
-                 
-                    Shader = CompileShader(Shader::Type::Compute, source.Cast<char>(), "csc", "colorconvert.hlsl", defines);
-
-                    switch (fmt)
-                    {
-                    case IEncode::BufferFormat::BGRA8: 
-                        yuvMatrix = {}; 
-                        break;
-                    default:
-                        yuvMatrix = MakeRGB2YUV44(isHdr ? Rec2020 : Rec709, fi.ymin, fi.ymax, fi.uvmin, fi.uvmax);
-                    }
-                    yuvMatrix = yuvMatrix * Mat44::Scale(fi.amp);
-                    
-                    encoder->Init(sizeX, sizeY, rateNum, rateDen, outBuffer);
-                    first = true;
-                    duplicated = 0;
-                    over = 0;
-
-                    lastFrameCount = 0;
-                }
-                else
-                {
-                    int deltaFrames = (int)(info.frameCount - lastFrameCount);
-                    ASSERT(deltaFrames < 0x8000000000000000);
-                    lastFrameCount = info.frameCount;
+                    yuvMatrix = GetConvertMatrix(fmt, isHdr);
 
-                    // Encode frame
-                    if (first)
+                    if (headless)
                     {
-                        first = false;
-                        processThread = new Thread(Bind(this, &ScreenCapture::ProcessThreadFunc));
+                        Delete(cpuConverter);
+                        cpuConverter = new ColorConverterCPU(ColorConverterCPU::Para
+                        {
+                            .Format = fmt,
+                            .SizeX = sizeX,
+                            .SizeY = sizeY,
+                            .Upscale = upscale,
+                            .Hdr = isHdr && pixfmt == PixelFormat::RGBA16F,
+                            .YuvMatrix = yuvMatrix,
+                            .ColorMatrix = GetHdrColorMatrix(),
+                        });
+                        cpuBuffer.SetSize((size_t)fi.lines * fi.pitch);
                     }
                     else
                     {
-                        int dup = Max(1, deltaFrames) - 1 - duplicated;
+                        outBuffer = new GpuByteBuffer(fi.lines * fi.pitch, GpuBuffer::Usage::GpuOnly);
 
-                        if (dup < 0)
-                        {
-                            over -= dup;
-                            dup = 0;
-                        }
-                        else
+                        auto source = LoadResource(IDR_COLORCONVERT, TEXTFILE);
+                        ShaderDefine defines[] =
                         {
-                            int doover = Min(dup, over);
-                            dup -= doover;
-                            over -= doover;
-                        }
+                            "OUTFORMAT", String::PrintF("%d", (int)fmt),
+                            "UPSCALE", upscale > 1 ? "1":"0",
+                            "HDR", (isHdr && pixfmt == PixelFormat::RGBA16F) ? "1" : "0",
+                            "TILES", "0",
+                        };
+
+                        Shader = CompileShader(Shader::Type::Compute, source.Cast<char>(), "csc", "colorconvert.hlsl", defines);
+                        defines[3] = ShaderDefine{ "TILES", "1" };
+                        TileShader = CompileShader(Shader::Type::Compute, source.Cast<char>(), "csc", "colorconvert.hlsl", defines);
+                    }
 
-                        for (int i = 0; i < dup; i++)
+                    dirty.Init(sizeX, sizeY);
+                    tileBuffer.Clear();
+                    if (!headless)
+                        tileBuffer = new StructuredBuffer<uint>(dirty.GetTilesX() * dirty.GetTilesY(), GpuBuffer::Usage::Dynamic);
+                    readback.Clear();
+                    held.Clear();
+                    readbackPending = false;
+                    if (Config.DetectStaticFrames)
+                    {
+                        if (!headless)
                         {
-                            encoder->DuplicateFrame();
-                            AtomicInc(Stats.FramesDuplicated);
+                            // the first frame doesn't get converted, but the hashes
+                            // start from it
+                            readback = new ReadbackTexture();
+                            held = CreateTexture(info.tex->para, nullptr);
+                            held->CopyFrom(info.tex);
+                            readback->CopyFrom(info.tex);
+                            readbackPending = true;
+                            heldTime = info.time;
+                            heldAcquire = acquireTicks;
+                            heldEmit = false;   // like without it, this one only sets the start
                         }
+                        bool wide = pixfmt == PixelFormat::RGBA16F || pixfmt == PixelFormat::RGBA16 || pixfmt == PixelFormat::RGBA16I;
+                        hasher.Init(scrSizeX, scrSizeY, wide ? 8 : 4);
+                    }
 
-                        if (deltaFrames)
-                        {
-                            double curfps = (double)info.rateNum / ((double)info.rateDen * deltaFrames);
-                            if (!fps) fps = curfps;
-                            fps += 0.03 * (curfps - fps);
-                        }
+                    if (headless)
+                        encoder->Init(sizeX, sizeY, rateNum, rateDen, IEncode::Input{ .Cpu = cpuBuffer.Ptr() });
+                    else
+                        encoder->Init(sizeX, sizeY, rateNum, rateDen, IEncode::Input{ .Gpu = outBuffer });
+                    cpuBase = GetThreadCpuTime();
+                    captureCpu = 0;
+                    first = true;
+                    SavePacerTrace(presents);
+                    pacer = FramePacer(FramePacer::Para{ .RateNum = rateNum, .RateDen = rateDen });
+                }
+                else
+                {
+                    auto pace = pacer.OnFrame(info.time, time);
+                    if (Config.RecordPacerTrace)
+                        presents += info.time;
+
+                    // collect changes from dropped frames too, the output buffer hasn't seen them yet.
+                    // With DetectStaticFrames, whenever the source says anything changed, the hashes say what really did
+                    bool sourceChanged = info.allDirty || info.dirty.Len();
+                    if (held.IsValid())
+                    {
+                        // the one before this, if no timeout got to it yet
+                        flushHeld();
                     }
-                  
-                    if (deltaFrames)
+                    else if (Config.DetectStaticFrames && sourceChanged)
                     {
-                        constexpr auto hdrConvertMatrix = Mat44(Rec709.GetConvertTo(Rec2020) * Mat33::Scale(80.f / 10000.0f), Vec3(0)).Transpose();
-
-                        auto fi = GetFormatInfo(encoder->GetBufferFormat(), sizeX, sizeY);
+                        hasher.Update(info.pixels, info.pitch);
+                        addHashed();
+                    }
+                    else if (info.allDirty)
+                        dirty.SetAll();
+                    else
+                        for (const CaptureRect& r : info.dirty)
+                            dirty.AddRect(r.x0, r.y0, r.x1, r.y1, upscale);
 
-                        // color space conversion
-                        CBuffer<CbConvert> cb;
-                        cb->yuvmatrix = yuvMatrix.Transpose();
-                        cb->pitch = fi.pitch;
-                        cb->height = sizeY;
-                        cb->scale = upscale;
-                        cb->colormatrix = hdrConvertMatrix;
+                    if (!Config.DirtyRects && dirty.GetCount())
+                        dirty.SetAll();
 
-                        CBindings bind;
-                        bind.res[0] = info.tex;
-                        bind.uav[0] = outBuffer;
-                        bind.cb[0] = &cb;
+                    // Encode frame
+                    if (first)
+                    {
+                        first = false;
+                        processThread = new Thread(Bind(this, &ScreenCapture::ProcessThreadFunc));
+                    }
 
-                        Dispatch(Shader, bind, (sizeX + 7) / 8, (sizeY + 7) / 8, 1);
+                    InsertDuplicates(pace.Duplicates);
 
-                        encoder->SubmitFrame(info.time);
-                        AtomicInc(Stats.FramesCaptured);
+                    if (held.IsValid() && sourceChanged)
+                    {
+                        // on the GPU, mapping the copy right away would wait for it. So this
+                        // one gets hashed and converted with the next frame or the next
+                        // timeout, whichever comes first
+                        held->CopyFrom(info.tex);
+                        readback->CopyFrom(info.tex);
+                        readbackPending = true;
+                        heldTime = info.time;
+                        heldAcquire = acquireTicks;
+                        heldEmit = pace.Emit;
                     }
+                    else if (pace.Emit)
+                        emitFrame(held.IsValid() ? held : info.tex, info.pixels, info.pitch, info.time, acquireTicks);
                 }
-                ReleaseFrame();
-
-                // (it's that easy)
-                duplicated = 0;
+                source->ReleaseFrame();
+            }
+            else if (encoder && held.IsValid())
+            {
+                // nothing new: whatever's held goes out before any duplicates of it
+                flushHeld();
             }
 
             if (encoder && !first)
             {
-                // if more than a certain time has passed without a new image, assume a skipped frame
-                double time = GetTime();
-                while (time - lastFrameTime > 2.5 * frameDuration)
-                {
-                    if (over)
-                    {
-                        over--;
-                    }
-                    else
-                    {
-                        encoder->DuplicateFrame();
-                        AtomicInc(Stats.FramesDuplicated);
-                        duplicated++;
-                    }
-
-                    lastFrameTime += frameDuration;
-                    double curfps = (double)info.rateNum / ((double)info.rateDen * (duplicated + 1.0));
-                    fps += 0.03 * (curfps - fps);
-                }
+                InsertDuplicates(pacer.OnIdle(GetTime()));
             }
+
+            if (pacer.GetFps())
+                fps = pacer.GetFps();
+
+            if (encoder)
+                captureCpu = GetThreadCpuTime() - cpuBase + (cpuConverter ? cpuConverter->GetWorkerCpuTime() : 0);
         }
 
         if (encoder)
@@ -405,18 +734,25 @@ class ScreenCapture : public IScreenCapture
 
         delete processThread;
         delete encoder;
-       
+        delete cpuConverter;
+        SavePacerTrace(presents);
     }
 
 public:
 
+    RCPtr<Shader> TileShader;
     RCPtr<Shader> Shader;
 
-    ScreenCapture(const CaptureConfig& cfg) : Config(cfg)
+    ScreenCapture(const CaptureConfig& cfg, const Func<IFrameSource*()>& createSource, EncoderFactory encFactory, bool noD3D, IAudioCapture* audio = nullptr)
+        : Config(cfg), headless(noD3D), createEncoder(encFactory)
     {
-        InitD3D(Config.OutputIndex);
-       
-        if (Config.CaptureAudio)
+        if (!headless)
+            InitD3D(Config.OutputIndex);
+        source = createSource();
+
+        if (audio)
+            audioCapture = audio;
+        else if (Config.CaptureAudio)
             audioCapture = CreateAudioCaptureWASAPI(Config);
         captureThread = new Thread(Bind(this, &ScreenCapture::CaptureThreadFunc));
 
@@ -428,11 +764,39 @@ public:
     {
         delete captureThread;
         delete audioCapture;
-        ExitD3D();
+        delete source;
+        if (!headless)
+            ExitD3D();
     }
 
-    const CaptureStats &GetStats() override { return Stats; }
+    const CaptureStats &GetStats() override
+    {
+        // the percentiles walk all buckets, so only when someone wants to see them
+        for (int i = 0; i < (int)CaptureStats::Stage::Count; i++)
+        {
+            Stats.Latencies[i] = CaptureStats::Latency
+            {
+                .P50 = latency[i].GetPercentile(50) / 1000.f,
+                .P99 = latency[i].GetPercentile(99) / 1000.f,
+                .Max = latency[i].GetMax() / 1000.f,
+            };
+        }
+        return Stats;
+    }
+
+    uint GetHistory(StatsHistory::Level level, Span<StatsHistory::Bucket> out) override { return history.Get(level, out); }
+
+    void SaveReplay() override { saveReplay = true; }
 };
 
 
-IScreenCapture* CreateScreenCapture(const CaptureConfig& config) { return new ScreenCapture(config); }
\ No newline at end of file
+IScreenCapture* CreateScreenCapture(const CaptureConfig& config)
+{
+    EncoderFactory encoder = config.CodecCfg.UseEncoder == VideoEncoder::CPU ? CreateEncodeLibAV : CreateEncodeNVENC;
+    return new ScreenCapture(config, CreateFrameSourceDXGI, encoder, false);
+}
+
+IScreenCapture* CreateScreenCaptureHeadless(const CaptureConfig& config, IFrameSource* source, EncoderFactory createEncoder, IAudioCapture* audio)
+{
+    return new ScreenCapture(config, [source] { return source; }, createEncoder, true, audio);
+}
\ No newline at end of file
@@ -7,6 +7,7 @@
 
 #include "types.h"
 #include "json.h"
+#include "statshistory.h"
 
 enum class CodecProfile
 {
@@ -20,12 +21,14 @@ enum class CodecProfile
     HEVC_LOSSLESS,
 };
 
+enum class VideoEncoder { NVENC, CPU };
 enum class BitrateControl { CBR, CONSTQP, };
 enum class Container { Mp4, Mov, Mkv };
 enum class AudioCodec { PCM_S16, PCM_F32, MP3, AAC };
 enum class FrameConfig { I, IP, /* IBP, IBBP, */ };
 
 JSON_DEFINE_ENUM(CodecProfile, "h264_main", "h264_high", "h264_high_444", "hevc_main", "hevc_main10", "hevc_main_444", "hevc_main10_444", "hevc_lossless")
+JSON_DEFINE_ENUM(VideoEncoder, "nvenc", "cpu")
 JSON_DEFINE_ENUM(BitrateControl, "cbr", "constqp")
 JSON_DEFINE_ENUM(Container, "mp4", "mov", "mkv")
 JSON_DEFINE_ENUM(AudioCodec, "pcm_s16", "pcm_f32", "mp3", "aac")
@@ -33,6 +36,7 @@ JSON_DEFINE_ENUM(FrameConfig, "i", "ip" )
 
 struct VideoCodecConfig
 {
+    VideoEncoder UseEncoder = VideoEncoder::NVENC;
     CodecProfile Profile = CodecProfile::H264_MAIN;
 
     BitrateControl UseBitrateControl = BitrateControl::CONSTQP;
@@ -41,12 +45,19 @@ struct VideoCodecConfig
     FrameConfig FrameCfg = FrameConfig::IP;
     uint GopSize = 60; // 0: auto
 
+    // CPU encoder (libx264/libx265) only
+    String CpuPreset = "veryfast";
+    uint CpuThreads = 0; // 0: auto
+
     JSON_BEGIN();
+        JSON_ENUM(UseEncoder);
         JSON_ENUM(Profile);
         JSON_ENUM(UseBitrateControl);
         JSON_VALUE(BitrateParameter);
         JSON_ENUM(FrameCfg);
         JSON_VALUE(GopSize);
+        JSON_VALUE(CpuPreset);
+        JSON_VALUE(CpuThreads);
     JSON_END();
 };
 
@@ -57,6 +68,16 @@ struct CaptureConfig
     String NamePrefix = "capture";
     Container UseContainer = Container::Mov;
     bool BlinkScrollLock = true;
+    uint WriteBufferMB = 8;         // per write-behind buffer, there are 3
+    bool UnbufferedWrites = false;  // bypass the OS file cache
+    uint PreallocateMB = 0;         // disk space to reserve per file
+    bool Fragmented = false;        // crash safe, constant memory mp4/mov fragments or mkv clusters
+    uint FragmentMs = 2000;         // new fragment at the first keyframe after this
+    uint SegmentMinutes = 0;        // start a new file after this long (0: never)
+    uint SegmentMB = 0;             // ... or after this many MB
+    bool ReplayMode = false;        // only keep the last ReplaySeconds in memory, and save them on demand
+    uint ReplaySeconds = 60;
+    uint ReplayMB = 1024;           // memory limit for the replay buffer
 
     // video settings
     uint OutputIndex = 0; // 0: default
@@ -64,27 +85,55 @@ struct CaptureConfig
     uint UpscaleTo = 2160;
     VideoCodecConfig CodecCfg;
     bool RecordOnlyFullscreen = true;
+    bool VariableFrameRate = false; // timestamps from the capture, and no re-encoded duplicates for unchanged frames
+    uint VfrMaxGapMs = 1000;        // ... but still encode one after this long without a new frame
+    bool DirtyRects = true;         // only color convert what changed on screen
+    bool DetectStaticFrames = false; // hash every frame on the CPU to find unchanged ones and tiles (costs a readback)
 
     // audio settings
     bool CaptureAudio = true;
     uint AudioOutputIndex = 0; // 0: default
     AudioCodec UseAudioCodec = AudioCodec::PCM_S16;
     uint AudioBitrate = 320; // not for PCM
+    uint AudioBufferMs = 1000; // capture ring depth
+    uint AudioSampleRate = 0; // 0: same as the device
+    bool AudioThread = true; // read and encode audio on its own thread instead of with each video packet
+    bool TruePeakMeter = false; // VU meter shows 4x oversampled peaks (costs some CPU)
+    bool RecordPacerTrace = false; // write the present times of each recording to a text file, for FramePacerSim
 
     JSON_BEGIN()
         JSON_VALUE(Directory)
         JSON_VALUE(NamePrefix)
         JSON_ENUM(UseContainer)
         JSON_VALUE(BlinkScrollLock)
+        JSON_VALUE(WriteBufferMB)
+        JSON_VALUE(UnbufferedWrites)
+        JSON_VALUE(PreallocateMB)
+        JSON_VALUE(Fragmented)
+        JSON_VALUE(FragmentMs)
+        JSON_VALUE(SegmentMinutes)
+        JSON_VALUE(SegmentMB)
+        JSON_VALUE(ReplayMode)
+        JSON_VALUE(ReplaySeconds)
+        JSON_VALUE(ReplayMB)
         JSON_VALUE(OutputIndex)
         JSON_VALUE(Upscale)
         JSON_VALUE(UpscaleTo)
         JSON_VALUE(CodecCfg)
         JSON_VALUE(RecordOnlyFullscreen)
+        JSON_VALUE(VariableFrameRate)
+        JSON_VALUE(VfrMaxGapMs)
+        JSON_VALUE(DirtyRects)
+        JSON_VALUE(DetectStaticFrames)
         JSON_VALUE(CaptureAudio)
         JSON_VALUE(AudioOutputIndex)
         JSON_ENUM(UseAudioCodec)
         JSON_VALUE(AudioBitrate)
+        JSON_VALUE(AudioBufferMs)
+        JSON_VALUE(AudioSampleRate)
+        JSON_VALUE(AudioThread)
+        JSON_VALUE(TruePeakMeter)
+        JSON_VALUE(RecordPacerTrace)
     JSON_END();
 };
 
@@ -93,11 +142,16 @@ struct CaptureStats
 {
     enum class CaptureFormat { Unknown, P8, P10, P16, P16F };
 
-    struct Frame
+    // Convert: frame acquired -> color conversion dispatched
+    // Submit: -> encoder->SubmitFrame() returned
+    // Encode: -> packet ready
+    // Mux: -> packet written
+    // Drain: packet ready -> process thread is free for the next one (audio included, if it's not on its own thread)
+    enum class Stage { Convert, Submit, Encode, Mux, Drain, Total, Count };
+
+    struct Latency
     {
-        double FPS;
-        double AVSkew;
-        double Bitrate;
+        float P50, P99, Max; // in ms
     };
 
     bool Recording;
@@ -110,13 +164,42 @@ struct CaptureStats
     double FPS;
     double AvgBitrate;
     double MaxBitrate;
-    Array<Frame> Frames = Array<Frame>((size_t)40000);
 
     uint FramesCaptured;
-    uint FramesDuplicated;      
+    uint FramesDuplicated;      // repeats that went to the encoder
+    uint FramesHeld;            // VFR: repeats that didn't
+    uint FramesStatic;          // new frames identical to the last one, repeated instead of converted
+    uint FramesEncoded;         // packets out of the encoder
+    double ConvertedTiles;      // share of the image color converted per frame, smoothed
+
+    uint AudioOverruns;
+    uint AudioUnderruns;
+
+    double PacketPoolHitRate;
+    double BytesCopiedPerFrame;
+
+    uint WriteQueue;        // buffers waiting for the disk
+    uint WriteQueueMax;
+    uint WriteStalls;       // times muxing had to wait for the disk
+    double WriteRate;       // MB/s while writing
+    uint Segment;           // with segmenting on, the part number of Filename
+
+    double ReplaySeconds;   // replay mode: what's in the buffer
+    uint64 ReplayBytes;
+    uint ReplaysSaved;
+
+    Latency Latencies[(int)Stage::Count];
+
+    // CPU time used while recording, in seconds: capture thread (acquire, convert and
+    // submit, with the CPU converter's helper threads), process thread (packets, muxing,
+    // and audio if it's not on its own thread), and the whole process
+    double CpuCapture;
+    double CpuProcess;
+    double CpuTotal;
 
     float VU[32] = { -1.f };
     float VUPeak[32] = { -1.f };
+    float VURms[32] = {};
 
     String Filename;
 };
@@ -128,7 +211,25 @@ public:
     virtual ~IScreenCapture() {}
 
     virtual const CaptureStats &GetStats() = 0;
+
+    // per frame FPS/skew/bitrate history, see StatsHistory::Get()
+    virtual uint GetHistory(StatsHistory::Level level, Span<StatsHistory::Bucket> out) = 0;
+
+    // replay mode: write what's in the replay buffer to a new file
+    virtual void SaveReplay() = 0;
 };
 
+struct IEncode;
+class IFrameSource;
+class IAudioCapture;
+
+typedef IEncode* (*EncoderFactory)(const CaptureConfig& cfg, bool isHdr);
+
 // run a screen capture instance
-IScreenCapture* CreateScreenCapture(const CaptureConfig& config);
\ No newline at end of file
+IScreenCapture* CreateScreenCapture(const CaptureConfig& config);
+
+// run a capture instance without D3D, on a frame source that delivers system memory
+// frames (see CreateFrameSourceSynthetic()). Color conversion happens on the CPU, and
+// the encoder gets IEncode::Input::Cpu. audio replaces the configured device if
+// set (see CreateAudioCaptureSynthetic()). Takes ownership of source and audio
+IScreenCapture* CreateScreenCaptureHeadless(const CaptureConfig& config, IFrameSource* source, EncoderFactory createEncoder, IAudioCapture* audio = nullptr);
\ No newline at end of file
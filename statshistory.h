@@ -0,0 +1,158 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#pragma once
+
+#include "types.h"
+#include "system.h"
+
+#include <math.h>
+
+struct StatsSample
+{
+    double FPS;
+    double AVSkew;
+    double Bitrate;
+};
+
+// Fixed size history of the per frame stats: every single frame for the last
+// few thousand frames, and min/max/avg per second and per minute beyond that.
+// Adding never allocates, and queries only touch the points they return.
+class StatsHistory
+{
+public:
+    enum class Level { Frame, Second, Minute };
+
+    struct Bucket
+    {
+        StatsSample Min, Max, Avg;
+    };
+
+    static constexpr uint FrameCount = 8192;    // ~1 minute at 144 Hz
+    static constexpr uint SecondCount = 3600;   // 1 hour
+    static constexpr uint MinuteCount = 1440;   // 1 day
+
+    void Clear()
+    {
+        ScopeLock lock(Lock);
+        Frames.Written = Seconds.Written = Minutes.Written = 0;
+        CurSecond = {};
+        CurMinute = {};
+    }
+
+    // time is the position in the recording, in seconds
+    void Add(const StatsSample& sample, double time)
+    {
+        ScopeLock lock(Lock);
+        Frames.Push(sample);
+
+        int64 second = (int64)floor(time);
+        if (CurSecond.Count && CurSecond.Index != second)
+            FinishSecond();
+        CurSecond.Index = second;
+        CurSecond.Add({ sample, sample, sample }, 1);
+    }
+
+    // copies the newest entries of a level (as many as fit), oldest first.
+    // Returns the number of entries copied.
+    uint Get(Level level, Span<Bucket> out) const
+    {
+        ScopeLock lock(Lock);
+        switch (level)
+        {
+        case Level::Frame:
+        {
+            uint n = Frames.Count(out.Len());
+            for (uint i = 0; i < n; i++)
+            {
+                const StatsSample& s = Frames.Get(n, i);
+                out[i] = { s, s, s };
+            }
+            return n;
+        }
+        case Level::Second: return Seconds.CopyTo(out);
+        case Level::Minute: return Minutes.CopyTo(out);
+        }
+        return 0;
+    }
+
+private:
+
+    template<typename T, uint N> struct Ring
+    {
+        T Items[N];
+        uint64 Written = 0;
+
+        void Push(const T& v) { Items[Written++ % N] = v; }
+
+        uint Count(size_t max) const { return (uint)Min<uint64>(Min<uint64>(Written, N), max); }
+
+        // i-th of the newest n items
+        const T& Get(uint n, uint i) const { return Items[(Written - n + i) % N]; }
+
+        uint CopyTo(Span<T> out) const
+        {
+            uint n = Count(out.Len());
+            for (uint i = 0; i < n; i++)
+                out[i] = Get(n, i);
+            return n;
+        }
+    };
+
+    struct Accumulator
+    {
+        StatsSample Min = {}, Max = {}, Sum = {};
+        uint Count = 0;
+        int64 Index = 0;
+
+        void Add(const Bucket& b, uint count)
+        {
+            if (!Count)
+            {
+                Min = b.Min;
+                Max = b.Max;
+            }
+            else
+            {
+                Min = { ::Min(Min.FPS, b.Min.FPS), ::Min(Min.AVSkew, b.Min.AVSkew), ::Min(Min.Bitrate, b.Min.Bitrate) };
+                Max = { ::Max(Max.FPS, b.Max.FPS), ::Max(Max.AVSkew, b.Max.AVSkew), ::Max(Max.Bitrate, b.Max.Bitrate) };
+            }
+            Sum.FPS += b.Avg.FPS * count;
+            Sum.AVSkew += b.Avg.AVSkew * count;
+            Sum.Bitrate += b.Avg.Bitrate * count;
+            Count += count;
+        }
+
+        Bucket Get() const
+        {
+            double n = Count ? 1.0 / Count : 0;
+            return { Min, Max, { Sum.FPS * n, Sum.AVSkew * n, Sum.Bitrate * n } };
+        }
+    };
+
+    mutable ThreadLock Lock;
+    Ring<StatsSample, FrameCount> Frames;
+    Ring<Bucket, SecondCount> Seconds;
+    Ring<Bucket, MinuteCount> Minutes;
+    Accumulator CurSecond;
+    Accumulator CurMinute;
+
+    void FinishSecond()
+    {
+        Bucket b = CurSecond.Get();
+        Seconds.Push(b);
+
+        int64 minute = CurSecond.Index / 60;
+        if (CurMinute.Count && CurMinute.Index != minute)
+        {
+            Minutes.Push(CurMinute.Get());
+            CurMinute = {};
+        }
+        CurMinute.Index = minute;
+        CurMinute.Add(b, CurSecond.Count);
+
+        CurSecond = {};
+    }
+};
@@ -64,6 +64,13 @@ int64 GetTicks()
     return pc.QuadPart;
 }
 
+int64 GetTicksPerSecond()
+{
+    LARGE_INTEGER pf;
+    QueryPerformanceFrequency(&pf);
+    return pf.QuadPart;
+}
+
 double GetTime()
 {
     if (!perfFreq)
@@ -83,6 +90,27 @@ double GetTime()
     return (double)curTicks * invPerfFreq;
 }
 
+static double FileTimeToSeconds(const FILETIME& ft)
+{
+    return (double)(((uint64)ft.dwHighDateTime << 32) | ft.dwLowDateTime) * 1e-7;
+}
+
+double GetThreadCpuTime()
+{
+    FILETIME create, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &create, &exit, &kernel, &user))
+        return 0;
+    return FileTimeToSeconds(kernel) + FileTimeToSeconds(user);
+}
+
+double GetProcessCpuTime()
+{
+    FILETIME create, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &create, &exit, &kernel, &user))
+        return 0;
+    return FileTimeToSeconds(kernel) + FileTimeToSeconds(user);
+}
+
 SystemTime GetSystemTime()
 {
     SYSTEMTIME st = {};
@@ -272,6 +300,23 @@ struct FileStream : Stream
         /*uint64 read = */ Read(buf->Ptr(), size);
         return buf;
     }
+
+    bool Reserve(uint64 len) override
+    {
+        FILE_ALLOCATION_INFO info = {};
+        info.AllocationSize.QuadPart = len;
+        return !!SetFileInformationByHandle(hf, FileAllocationInfo, &info, sizeof(info));
+    }
+
+    bool SetLength(uint64 len) override
+    {
+        LARGE_INTEGER lis = {};
+        lis.QuadPart = len;
+        if (!SetFilePointerEx(hf, lis, nullptr, FILE_BEGIN) || !SetEndOfFile(hf))
+            return false;
+        size = len;
+        return true;
+    }
 };
 
 bool FileExists(const char* path)
@@ -279,6 +324,11 @@ bool FileExists(const char* path)
     return !!PathFileExists(path);
 }
 
+bool RemoveFile(const char* path)
+{
+    return !!DeleteFile(path);
+}
+
 Stream *OpenFile(const char* path, OpenFileMode mode)
 {
     HANDLE h = INVALID_HANDLE_VALUE;
@@ -303,6 +353,10 @@ Stream *OpenFile(const char* path, OpenFileMode mode)
         h = CreateFile(path, GENERIC_WRITE | GENERIC_READ, 0, NULL, OPEN_ALWAYS, 0, NULL);
         cw = true; cr = true;
         break;
+    case OpenFileMode::CreateUnbuffered:
+        h = CreateFile(path, GENERIC_WRITE | GENERIC_READ, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_FLAG_NO_BUFFERING, NULL);
+        cw = true; cr = true;
+        break;
     }
     if (h == INVALID_HANDLE_VALUE)
     {
@@ -470,6 +524,13 @@ void Thread::Sleep(int ms)
     ::Sleep(ms);
 }
 
+uint Thread::GetCPUCount()
+{
+    SYSTEM_INFO info = {};
+    GetSystemInfo(&info);
+    return Max<uint>(info.dwNumberOfProcessors, 1);
+}
+
 //----------------------------------------------------------------------------------------------
 //----------------------------------------------------------------------------------------------
 
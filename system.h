@@ -6,6 +6,8 @@
 #pragma once
 #include "types.h"
 
+#include <atomic>
+
 /*
 struct ScreenMode
 {
@@ -19,6 +21,7 @@ struct ScreenMode
 // -------------------------------------------------------------------------------
 
 int64 GetTicks(); // raw timer ticks
+int64 GetTicksPerSecond(); // timer frequency
 double GetTime(); // time since program start in seconds
 
 struct SystemTime {
@@ -34,6 +37,11 @@ struct SystemTime {
 
 SystemTime GetSystemTime(); // wall-clock time
 
+// CPU time used so far in seconds, by the calling thread or by the whole process.
+// On Windows this only advances in scheduler ticks, so average it over many frames
+double GetThreadCpuTime();
+double GetProcessCpuTime();
+
 // streams / files
 // -------------------------------------------------------------------------------
 
@@ -55,17 +63,58 @@ struct Stream
     virtual uint64 Pos() { return (uint64)Seek(0, From::Current); }
 
     virtual RCPtr<Buffer> Map() { return RCPtr<Buffer>(); }
+
+    // reserve disk space up front without changing the length
+    virtual bool Reserve(uint64) { return false; }
+    virtual bool SetLength(uint64) { return false; }
 };
 
+// formatted text into a stream, see FormatTo() in types.h. Collects up to 256
+// bytes on the stack first, so files don't get a write call for every field.
+// Returns the number of chars formatted
+CHECK_FORMAT(2, 3) inline size_t FormatTo(Stream& stream, FORMAT_STRING const char* format, ...)
+{
+    class StreamWriter : public FormatWriter
+    {
+    public:
+        Stream& S;
+        char Buf[256];
+        size_t Fill = 0;
+
+        StreamWriter(Stream& s) : S(s) {}
+        void Flush() { if (Fill) S.Write(Buf, Fill); Fill = 0; }
+        void Put(const char* str, size_t len) override
+        {
+            if (Fill + len > sizeof(Buf)) Flush();
+            if (len > sizeof(Buf)) { S.Write(str, len); return; }
+            memcpy(Buf + Fill, str, len);
+            Fill += len;
+        }
+    } writer(stream);
+
+    va_list args;
+    va_start(args, format);
+    size_t len = writer.Format(format, args);
+    va_end(args);
+    writer.Flush();
+    return len;
+}
+
 enum class OpenFileMode
 {
     Read,
     Create,
     Append,
     RandomAccess,
+    CreateUnbuffered, // read/write, bypasses the OS file cache. See FileBlockSize
 };
 
+// For unbuffered files, all positions, sizes and memory addresses of reads and
+// writes must be multiples of this
+static constexpr uint FileBlockSize = 4096;
+
 bool FileExists(const char* path);
+bool RemoveFile(const char* path);
 
 Stream* OpenFile(const char* path, OpenFileMode mode = OpenFileMode::Read);
 RCPtr<Buffer> LoadFile(const char* path);
@@ -79,12 +128,12 @@ ReadOnlySpan<uint8> LoadResource(int name, int type);
 // -------------------------------------------------------------------------------
 
 #if _DEBUG
-void DPrintF(const char* format, ...);
+CHECK_FORMAT(1, 2) void DPrintF(FORMAT_STRING const char* format, ...);
 #else
-inline void DPrintF(const char*, ...) {}
+CHECK_FORMAT(1, 2) inline void DPrintF(FORMAT_STRING const char*, ...) {}
 #endif
 [[ noreturn ]]
-void Fatal(const char* format, ...);
+CHECK_FORMAT(1, 2) void Fatal(FORMAT_STRING const char* format, ...);
 
 void DbgOpenLog(const char* filename);
 void DbgCloseLog();
@@ -151,6 +200,8 @@ public:
 
     static void Sleep(int ms);
 
+    static uint GetCPUCount(); // logical cores
+
 private:
     struct Priv;
     Priv* P = nullptr;
@@ -160,49 +211,187 @@ private:
 
 // -------------------------------------------------------------------------------
 
-// concurrent queue
+// lock free queues
+// SIZE must be a power of two. Both keep their read and write positions on separate
+// cache lines so producer and consumer don't fight over them.
+
+static constexpr size_t CacheLineSize = 64;
+
+// bounded multi producer/multi consumer queue (Vyukov style: every slot carries a
+// sequence number that tells producers and consumers whose turn it is)
 template <typename T, int SIZE> class Queue
 {
+    static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "Queue size must be a power of two");
+    static constexpr size_t MASK = SIZE - 1;
+
 public:
 
-    bool Enqueue(const T &value)
+    Queue()
     {
-        ScopeLock lock(Lock);
-        if (IsFull()) return false;
-        Buffer[(Write++) % SIZE] = value;
-        return true;
+        for (size_t i = 0; i < SIZE; i++)
+            Slots[i].Seq.store(i, std::memory_order_relaxed);
     }
 
-    bool Dequeue(T &value)
+    bool Enqueue(const T &value) { return EnqueueBatch({ &value, 1 }) == 1; }
+    bool Dequeue(T &value) { return DequeueBatch({ &value, 1 }) == 1; }
+
+    // enqueues as many values as there's room for, in order; returns the count
+    size_t EnqueueBatch(ReadOnlySpan<T> values)
+    {
+        size_t pos, n;
+        if (!(n = Claim(WritePos, values.Len(), 0, pos)))
+            return 0;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            Slot& slot = Slots[(pos + i) & MASK];
+            slot.Value = values[i];
+            slot.Seq.store(pos + i + 1, std::memory_order_release);
+        }
+        return n;
+    }
+
+    // dequeues up to values.Len() values, in order; returns the count
+    size_t DequeueBatch(Span<T> values)
     {
-        ScopeLock lock(Lock);
-        if (IsEmpty()) return false;
-        value = Buffer[(Read++) % SIZE];
-        if (Write >= SIZE && Read >= SIZE)
+        size_t pos, n;
+        if (!(n = Claim(ReadPos, values.Len(), 1, pos)))
+            return 0;
+
+        for (size_t i = 0; i < n; i++)
         {
-            Write -= SIZE;
-            Read -= SIZE;
+            Slot& slot = Slots[(pos + i) & MASK];
+            values[i] = slot.Value;
+            slot.Seq.store(pos + i + SIZE, std::memory_order_release);
         }
+        return n;
+    }
+
+    // only reliable if there's a single consumer
+    bool Peek(T& value)
+    {
+        size_t pos = ReadPos.load(std::memory_order_relaxed);
+        const Slot& slot = Slots[pos & MASK];
+        if (slot.Seq.load(std::memory_order_acquire) != pos + 1) return false;
+        value = slot.Value;
         return true;
     }
 
+    // snapshots, may be outdated by the time they return. The read position never
+    // passes the write position, so loading it first keeps the difference from wrapping
+    int  Len() const
+    {
+        size_t read = ReadPos.load(std::memory_order_acquire);
+        size_t write = WritePos.load(std::memory_order_acquire);
+        return (int)Clamp<int64>((int64)(write - read), 0, SIZE);
+    }
+    bool IsEmpty() const { return Len() == 0; }
+    bool IsFull() const { return Len() == SIZE; }
+
+private:
+
+    struct Slot
+    {
+        std::atomic<size_t> Seq;
+        T Value;
+    };
+
+    // reserve up to max consecutive slots whose sequence is pos+offset (free for
+    // writing with offset 0, filled with offset 1)
+    size_t Claim(std::atomic<size_t>& position, size_t max, size_t offset, size_t& pos)
+    {
+        pos = position.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            size_t n = 0;
+            while (n < max && n < SIZE && Slots[(pos + n) & MASK].Seq.load(std::memory_order_acquire) == pos + n + offset)
+                n++;
+            if (!n)
+            {
+                // either empty/full or someone else advanced the position in the meantime
+                size_t cur = position.load(std::memory_order_relaxed);
+                if (cur == pos) return 0;
+                pos = cur;
+                continue;
+            }
+            if (position.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed))
+                return n;
+        }
+    }
+
+    alignas(CacheLineSize) std::atomic<size_t> WritePos = 0;
+    alignas(CacheLineSize) std::atomic<size_t> ReadPos = 0;
+    alignas(CacheLineSize) Slot Slots[SIZE];
+};
+
+// bounded single producer/single consumer queue. Cheaper than Queue, but only
+// one thread may ever enqueue and one thread may ever dequeue.
+template <typename T, int SIZE> class SpscQueue
+{
+    static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "SpscQueue size must be a power of two");
+    static constexpr size_t MASK = SIZE - 1;
+
+public:
+
+    bool Enqueue(const T& value) { return EnqueueBatch({ &value, 1 }) == 1; }
+    bool Dequeue(T& value) { return DequeueBatch({ &value, 1 }) == 1; }
+
+    size_t EnqueueBatch(ReadOnlySpan<T> values)
+    {
+        size_t write = WritePos.load(std::memory_order_relaxed);
+        if (write - ReadCache + values.Len() > SIZE)
+            ReadCache = ReadPos.load(std::memory_order_acquire);
+
+        size_t n = Min<size_t>(values.Len(), SIZE - (write - ReadCache));
+        for (size_t i = 0; i < n; i++)
+            Buffer[(write + i) & MASK] = values[i];
+
+        WritePos.store(write + n, std::memory_order_release);
+        return n;
+    }
+
+    size_t DequeueBatch(Span<T> values)
+    {
+        size_t read = ReadPos.load(std::memory_order_relaxed);
+        if (WriteCache - read < values.Len())
+            WriteCache = WritePos.load(std::memory_order_acquire);
+
+        size_t n = Min<size_t>(values.Len(), WriteCache - read);
+        for (size_t i = 0; i < n; i++)
+            values[i] = Buffer[(read + i) & MASK];
+
+        ReadPos.store(read + n, std::memory_order_release);
+        return n;
+    }
+
+    // consumer side only
     bool Peek(T& value)
     {
-        ScopeLock lock(Lock);
-        if (IsEmpty()) return false;
-        value = Buffer[Read % SIZE];
+        size_t read = ReadPos.load(std::memory_order_relaxed);
+        if (read == WritePos.load(std::memory_order_acquire)) return false;
+        value = Buffer[read & MASK];
         return true;
     }
 
-    int  Len() { ScopeLock lock(Lock);  return (int)(Write - Read); }
-    bool IsEmpty() { ScopeLock lock(Lock); return Write == Read; }
-    bool IsFull() { ScopeLock lock(Lock); return Write - Read == SIZE; }
+    // snapshots, safe from any thread (same ordering as Queue::Len())
+    int  Len() const
+    {
+        size_t read = ReadPos.load(std::memory_order_acquire);
+        size_t write = WritePos.load(std::memory_order_acquire);
+        return (int)Clamp<int64>((int64)(write - read), 0, SIZE);
+    }
+    bool IsEmpty() const { return Len() == 0; }
+    bool IsFull() const { return Len() == SIZE; }
 
 private:
-    ThreadLock Lock;
-    uint Read = 0;
-    uint Write = 0;
-    T Buffer[SIZE];
+
+    // the Cache fields are private to the producer (ReadCache) and consumer (WriteCache)
+    // and save touching the other side's cache line most of the time
+    alignas(CacheLineSize) std::atomic<size_t> WritePos = 0;
+    size_t ReadCache = 0;
+    alignas(CacheLineSize) std::atomic<size_t> ReadPos = 0;
+    size_t WriteCache = 0;
+    alignas(CacheLineSize) T Buffer[SIZE];
 };
 
 // -------------------------------------------------------------------------------
@@ -0,0 +1,502 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+// POSIX implementation of the system layer, for running the headless parts
+// (synthetic source, pass-through encoding, muxing) outside of Windows.
+// The Windows build uses system.cpp.
+
+#ifndef _WIN32
+
+#include "system.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+//----------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------
+
+uint AtomicInc(uint& a) { return __atomic_add_fetch(&a, 1, __ATOMIC_SEQ_CST); }
+uint AtomicDec(uint& a) { return __atomic_sub_fetch(&a, 1, __ATOMIC_SEQ_CST); }
+
+//----------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------
+
+static int64 lastTicks = 0, curTicks = 0;
+
+int64 GetTicks()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+int64 GetTicksPerSecond()
+{
+    return 1000000000ll;
+}
+
+double GetTime()
+{
+    int64 ticks = GetTicks();
+    if (!lastTicks) lastTicks = ticks;
+    int64 delta = ticks - lastTicks;
+    lastTicks = ticks;
+    curTicks += delta;
+
+    return (double)curTicks * 1e-9;
+}
+
+double GetThreadCpuTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+double GetProcessCpuTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+SystemTime GetSystemTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    tm st = {};
+    gmtime_r(&ts.tv_sec, &st);
+
+    return SystemTime
+    {
+        .year = (uint)st.tm_year + 1900,
+        .month = (uint)st.tm_mon + 1,
+        .dayOfWeek = (uint)st.tm_wday,
+        .day = (uint)st.tm_mday,
+        .hour = (uint)st.tm_hour,
+        .minute = (uint)st.tm_min,
+        .second = (uint)st.tm_sec,
+        .milliseconds = (uint)(ts.tv_nsec / 1000000),
+    };
+}
+
+// debug output
+// -------------------------------------------------------------------------------
+
+static Stream* LogFile = nullptr;
+static ThreadLock LogLock;
+
+static constexpr int DbgSize = 4096;
+static thread_local char DbgBuffer[DbgSize];
+
+void DbgOpenLog(const char* filename)
+{
+    LogFile = OpenFile(filename, OpenFileMode::Create);
+}
+
+void DbgCloseLog()
+{
+    Delete(LogFile);
+}
+
+static void Dbg(const char* message)
+{
+    ScopeLock lock(LogLock);
+    fputs(message, stderr);
+    if (LogFile)
+    {
+        LogFile->Write(message, strlen(message));
+    }
+}
+
+#define PRINTF_INTERNAL() { \
+    va_list args; \
+    va_start(args, format); \
+    int len = vsnprintf(DbgBuffer, DbgSize, format, args); \
+    if (len < 0) len = 0; \
+    if (len >= DbgSize) len = DbgSize - 1; \
+    va_end(args); \
+    DbgBuffer[len] = 0; \
+}
+
+#ifdef _DEBUG
+void DPrintF(const char* format, ...)
+{
+    PRINTF_INTERNAL();
+    Dbg(DbgBuffer);
+}
+#endif
+
+[[noreturn]]
+void Fatal(const char* format, ...)
+{
+    PRINTF_INTERNAL();
+    Dbg("\n");
+    Dbg(DbgBuffer);
+    Dbg("\n");
+    DbgCloseLog();
+    _exit(1);
+}
+
+[[noreturn]]
+void OnAssert(const char* file, int line, const char* expr)
+{
+    Fatal("%s(%d): Assertion failed: %s\n", file, line, expr);
+}
+
+// streams
+// -------------------------------------------------------------------------------
+
+struct FileStream : Stream
+{
+    int fd;
+    bool canRead;
+    bool canWrite;
+
+    explicit FileStream(int f, bool cr, bool cw) : fd(f), canRead(cr), canWrite(cw) {}
+
+    ~FileStream() override
+    {
+        close(fd);
+    };
+
+    uint64 Read(void* ptr, uint64 len) override
+    {
+        ssize_t r = read(fd, ptr, (size_t)len);
+        return r > 0 ? (uint64)r : 0;
+    };
+
+    uint64 Write(const void* ptr, uint64 len) override
+    {
+        ssize_t w = write(fd, ptr, (size_t)len);
+        return w > 0 ? (uint64)w : 0;
+    };
+
+    bool CanRead() const override { return canRead; }
+    bool CanWrite() const override { return canWrite; }
+    bool CanSeek() const override { return true; }
+
+    uint64 Length() const override
+    {
+        struct stat st = {};
+        fstat(fd, &st);
+        return (uint64)st.st_size;
+    }
+
+    uint64 Seek(int64 pos, From from) override
+    {
+        static const int whence[] = { SEEK_SET, SEEK_CUR, SEEK_END };
+        off_t p = lseek(fd, (off_t)pos, whence[(int)from]);
+        return p >= 0 ? (uint64)p : 0;
+    }
+
+    RCPtr<Buffer> Map() override
+    {
+        uint64 size = Length();
+        RCPtr<Buffer> buf = (new Buffer(size));
+        /*uint64 read = */ Read(buf->Ptr(), size);
+        return buf;
+    }
+
+    bool Reserve(uint64 len) override
+    {
+#ifdef __linux__
+        return !fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)len);
+#else
+        return false;
+#endif
+    }
+
+    bool SetLength(uint64 len) override
+    {
+        return !ftruncate(fd, (off_t)len);
+    }
+};
+
+bool FileExists(const char* path)
+{
+    return !access(path, F_OK);
+}
+
+bool RemoveFile(const char* path)
+{
+    return !unlink(path);
+}
+
+Stream* OpenFile(const char* path, OpenFileMode mode)
+{
+    int fd = -1;
+    bool cr, cw;
+    switch (mode)
+    {
+    case OpenFileMode::Read:
+        fd = open(path, O_RDONLY);
+        cr = true; cw = false;
+        break;
+    case OpenFileMode::Append:
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        cw = true; cr = false;
+        break;
+    case OpenFileMode::Create:
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        cw = true; cr = false;
+        break;
+    case OpenFileMode::RandomAccess:
+        fd = open(path, O_RDWR | O_CREAT, 0644);
+        cw = true; cr = true;
+        break;
+    case OpenFileMode::CreateUnbuffered:
+#ifdef O_DIRECT
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+#else
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+#endif
+        cw = true; cr = true;
+        break;
+    }
+    if (fd < 0)
+    {
+        Fatal("could not open %s: %s\n", path, strerror(errno));
+    }
+    DPrintF("Opening %s\n", path);
+    return new FileStream(fd, cr, cw);
+}
+
+RCPtr<Buffer> LoadFile(const char* path)
+{
+    RCPtr<Buffer> buffer;
+    Stream* s = OpenFile(path);
+    if (s)
+    {
+        buffer = s->Map();
+        delete s;
+    }
+    return buffer;
+}
+
+String ReadFileUTF8(const char* path)
+{
+    Stream* str = OpenFile(path);
+    ASSERT(str);
+
+    size_t len = str->Length();
+    String ret;
+    char* ptr = ret.Make((int)len);
+
+    size_t offs = 0;
+    size_t read;
+    while (offs < len && (read = str->Read(ptr + offs, len - offs)))
+        offs += read;
+
+    ptr[offs] = 0;
+    delete str;
+    return ret;
+}
+
+void WriteFileUTF8(const String& text, const char* path)
+{
+    Stream* str = OpenFile(path, OpenFileMode::Create);
+    ASSERT(str);
+
+    size_t len = text.Length();
+    size_t offs = 0;
+    size_t written;
+    const char* ptr = text;
+    while (offs < len && (written = str->Write(ptr + offs, len - offs)))
+        offs += written;
+
+    delete str;
+}
+
+ReadOnlySpan<uint8> LoadResource(int name, int)
+{
+    Fatal("resource %d not available on this platform\n", name);
+}
+
+//----------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------
+
+ThreadLock::ThreadLock()
+{
+    // recursive, just like a critical section
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    P = new pthread_mutex_t;
+    pthread_mutex_init((pthread_mutex_t*)P, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+ThreadLock::~ThreadLock()
+{
+    pthread_mutex_destroy((pthread_mutex_t*)P);
+    delete (pthread_mutex_t*)P;
+}
+
+void ThreadLock::Lock()
+{
+    pthread_mutex_lock((pthread_mutex_t*)P);
+}
+
+void ThreadLock::Unlock()
+{
+    pthread_mutex_unlock((pthread_mutex_t*)P);
+}
+
+//----------------------------------------------------------------------------------------------
+
+struct PosixEvent
+{
+    pthread_mutex_t Mutex;
+    pthread_cond_t Cond;
+    bool AutoReset;
+    bool Signaled = false;
+};
+
+ThreadEvent::ThreadEvent(bool autoReset)
+{
+    auto ev = new PosixEvent;
+    pthread_mutex_init(&ev->Mutex, nullptr);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ev->Cond, &attr);
+    pthread_condattr_destroy(&attr);
+    ev->AutoReset = autoReset;
+    P = ev;
+}
+
+ThreadEvent::~ThreadEvent()
+{
+    auto ev = (PosixEvent*)P;
+    pthread_cond_destroy(&ev->Cond);
+    pthread_mutex_destroy(&ev->Mutex);
+    delete ev;
+}
+
+void ThreadEvent::Fire()
+{
+    auto ev = (PosixEvent*)P;
+    pthread_mutex_lock(&ev->Mutex);
+    ev->Signaled = true;
+    if (ev->AutoReset)
+        pthread_cond_signal(&ev->Cond);
+    else
+        pthread_cond_broadcast(&ev->Cond);
+    pthread_mutex_unlock(&ev->Mutex);
+}
+
+void ThreadEvent::Reset()
+{
+    auto ev = (PosixEvent*)P;
+    pthread_mutex_lock(&ev->Mutex);
+    ev->Signaled = false;
+    pthread_mutex_unlock(&ev->Mutex);
+}
+
+void ThreadEvent::Wait()
+{
+    auto ev = (PosixEvent*)P;
+    pthread_mutex_lock(&ev->Mutex);
+    while (!ev->Signaled)
+        pthread_cond_wait(&ev->Cond, &ev->Mutex);
+    if (ev->AutoReset)
+        ev->Signaled = false;
+    pthread_mutex_unlock(&ev->Mutex);
+}
+
+bool ThreadEvent::Wait(int timeoutMs)
+{
+    auto ev = (PosixEvent*)P;
+
+    timespec until;
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec += timeoutMs / 1000;
+    until.tv_nsec += (timeoutMs % 1000) * 1000000l;
+    if (until.tv_nsec >= 1000000000l)
+    {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000l;
+    }
+
+    pthread_mutex_lock(&ev->Mutex);
+    while (!ev->Signaled)
+        if (pthread_cond_timedwait(&ev->Cond, &ev->Mutex, &until) == ETIMEDOUT)
+            break;
+    bool signaled = ev->Signaled;
+    if (signaled && ev->AutoReset)
+        ev->Signaled = false;
+    pthread_mutex_unlock(&ev->Mutex);
+    return signaled;
+}
+
+void* ThreadEvent::GetRawEvent() const
+{
+    return P;
+}
+
+//----------------------------------------------------------------------------------------------
+
+struct Thread::Priv
+{
+    Priv() {}
+
+    ::Func<void(Thread&)> Func;
+    pthread_t Handle;
+
+    static void* Proxy(void* t)
+    {
+        auto thread = (Thread*)t;
+        thread->P->Func(*thread);
+        return nullptr;
+    }
+};
+
+Thread::Thread(Func<void(Thread&)> threadFunc)
+{
+    P = new Priv;
+    P->Func = threadFunc;
+    pthread_create(&P->Handle, nullptr, Priv::Proxy, this);
+}
+
+Thread::~Thread()
+{
+    Terminate();
+    pthread_join(P->Handle, nullptr);
+    delete P;
+}
+
+void Thread::Sleep(int ms)
+{
+    timespec ts = { ms / 1000, (ms % 1000) * 1000000l };
+    while (nanosleep(&ts, &ts) && errno == EINTR) {}
+}
+
+uint Thread::GetCPUCount()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (uint)n : 1;
+}
+
+//----------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------
+
+bool IsFullscreen()
+{
+    return false;
+}
+
+void SetScrollLock(bool)
+{
+}
+
+#endif // _WIN32
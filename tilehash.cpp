@@ -0,0 +1,134 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include "tilehash.h"
+
+#include <string.h>
+#include <emmintrin.h>
+
+// SSE2 is always there on x64, so no dispatching needed. More than that doesn't
+// help, the loop waits for memory already
+
+static constexpr uint TS = TileMask::TileSize;
+static constexpr uint64 Prime1 = 0x9E3779B185EBCA87ull;
+static constexpr uint64 Prime2 = 0xC2B2AE3D27D4EB4Full;
+static constexpr uint64 Prime4 = 0x85EBCA77C2B2AE63ull;
+
+// a different key for every row of a tile (64 bytes: 8 pixels of 8 bytes max),
+// so swapped rows don't hash the same. Straight out of splitmix64
+struct HashKeys { uint64 v[TS][8]; };
+
+static constexpr HashKeys MakeKeys()
+{
+    HashKeys keys = {};
+    uint64 x = 0;
+    for (uint r = 0; r < TS; r++)
+        for (uint i = 0; i < 8; i++)
+        {
+            uint64 z = (x += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            keys.v[r][i] = z ^ (z >> 31);
+        }
+    return keys;
+}
+
+static constexpr HashKeys Keys = MakeKeys();
+
+// XXH3's accumulate step: 32x32->64 multiply of data^key, plus the data itself
+// so nothing gets lost if a half of data^key is 0
+static inline __m128i Accumulate(__m128i acc, __m128i data, __m128i key)
+{
+    __m128i dk = _mm_xor_si128(data, key);
+    __m128i prod = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)));
+    __m128i swap = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+    return _mm_add_epi64(acc, _mm_add_epi64(prod, swap));
+}
+
+static inline uint64 Rotl(uint64 x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static uint64 Finalize(const uint64* lanes, uint n)
+{
+    uint64 h = n * Prime1;
+    for (uint i = 0; i < n; i++)
+    {
+        h ^= Rotl(lanes[i] * Prime2, 31) * Prime1;
+        h = Rotl(h, 27) * Prime1 + Prime4;
+    }
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ull;
+    return h ^ (h >> 32);
+}
+
+void TileHasher::Init(uint sizeX, uint sizeY, uint bytesPerPixel)
+{
+    ASSERT(bytesPerPixel == 4 || bytesPerPixel == 8);
+    SizeX = sizeX;
+    SizeY = sizeY;
+    RowBytes = TS * bytesPerPixel;
+    Changed.Init(sizeX, sizeY);
+    Hashes.SetSize(Changed.GetTilesX() * Changed.GetTilesY());
+    Valid = false;
+}
+
+// one tile, down its rows. The accumulators stay in registers, and the 8 row
+// streams are few enough for the prefetcher to keep up with
+template<uint Chunks> static uint64 HashTile(const uint8* src, uint pitch, uint rows)
+{
+    __m128i acc[Chunks];
+    for (uint c = 0; c < Chunks; c++)
+        acc[c] = _mm_setzero_si128();
+
+    for (uint r = 0; r < rows; r++, src += pitch)
+        for (uint c = 0; c < Chunks; c++)
+            acc[c] = Accumulate(acc[c], _mm_loadu_si128((const __m128i*)src + c), _mm_loadu_si128((const __m128i*)Keys.v[r] + c));
+
+    alignas(16) uint64 lanes[2 * Chunks];
+    for (uint c = 0; c < Chunks; c++)
+        _mm_store_si128((__m128i*)lanes + c, acc[c]);
+    return Finalize(lanes, 2 * Chunks);
+}
+
+uint TileHasher::Update(const uint8* src, uint pitch)
+{
+    const uint tilesX = Changed.GetTilesX();
+    const uint tilesY = Changed.GetTilesY();
+    const uint full = SizeX / TS;                       // tiles without a ragged edge
+    const uint rest = (SizeX % TS) * (RowBytes / TS);   // bytes in the last one if there is one
+    auto hashTile = RowBytes == 32 ? HashTile<2> : HashTile<4>;
+
+    Changed.Clear();
+    uint changed = 0;
+    auto check = [&](uint tx, uint ty, uint64 h)
+    {
+        uint64& old = Hashes[ty * tilesX + tx];
+        if (!Valid || h != old)
+        {
+            Changed.Set(tx, ty);
+            changed++;
+        }
+        old = h;
+    };
+
+    for (uint ty = 0; ty < tilesY; ty++)
+    {
+        const uint8* line = src + (size_t)ty * TS * pitch;
+        uint rows = Min(TS, SizeY - ty * TS);
+
+        for (uint tx = 0; tx < full; tx++)
+            check(tx, ty, hashTile(line + tx * RowBytes, pitch, rows));
+
+        if (rest)
+        {
+            uint8 tmp[TS][8 * TS] = {};
+            for (uint r = 0; r < rows; r++)
+                memcpy(tmp[r], line + (size_t)r * pitch + full * RowBytes, rest);
+            check(full, ty, hashTile(tmp[0], sizeof(tmp[0]), rows));
+        }
+    }
+
+    Valid = true;
+    return changed;
+}
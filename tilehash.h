@@ -0,0 +1,35 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#pragma once
+
+#include "types.h"
+#include "tilemask.h"
+
+// Hashes an image in 8x8 pixel tiles and compares them to the last image, to
+// find out what changed when the source doesn't say (or says "everything" for
+// frames that are actually the same). XXH3 style accumulation with SSE2, tile
+// by tile, which runs at a good part of what RAM can deliver (4K BGRA at 400+
+// fps on one core). Not a cryptographic hash, but 64 bits per tile is plenty.
+class TileHasher
+{
+public:
+    // size in pixels, 4 or 8 bytes per pixel. Everything counts as changed the first time
+    void Init(uint sizeX, uint sizeY, uint bytesPerPixel);
+
+    // hashes the image, returns the number of tiles that differ from the last one
+    uint Update(const uint8* src, uint pitch);
+
+    // the tiles that differed in the last Update(), in source pixels
+    const TileMask& GetChanged() const { return Changed; }
+
+private:
+    uint SizeX = 0;
+    uint SizeY = 0;
+    uint RowBytes = 0;      // per tile row: 8 pixels
+    Array<uint64> Hashes;
+    TileMask Changed;
+    bool Valid = false;
+};
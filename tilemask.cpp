@@ -0,0 +1,102 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#include "tilemask.h"
+
+#include <bit>
+#include <string.h>
+
+void TileMask::Init(uint sizeX, uint sizeY)
+{
+    TilesX = (sizeX + TileSize - 1) / TileSize;
+    TilesY = (sizeY + TileSize - 1) / TileSize;
+    Words = (TilesX + 63) / 64;
+    Bits.SetSize(Words * TilesY);
+    SetAll();
+}
+
+void TileMask::SetAll()
+{
+    if (!TilesX)
+        return;
+
+    // keep the bits past the end of each row clear, so GetCount() can just add up
+    uint64 last = (TilesX % 64) ? (1ull << (TilesX % 64)) - 1 : ~0ull;
+    for (uint y = 0; y < TilesY; y++)
+    {
+        uint64* row = Bits.Ptr() + y * Words;
+        memset(row, 0xff, (Words - 1) * sizeof(uint64));
+        row[Words - 1] = last;
+    }
+}
+
+void TileMask::Clear()
+{
+    memset(Bits.Ptr(), 0, Bits.Len() * sizeof(uint64));
+}
+
+void TileMask::AddRect(int x0, int y0, int x1, int y1, uint scale)
+{
+    x0 = Max(x0, 0) * scale;
+    y0 = Max(y0, 0) * scale;
+    x1 *= scale;
+    y1 *= scale;
+    if (x1 <= x0 || y1 <= y0)
+        return;
+
+    uint tx0 = x0 / TileSize, ty0 = y0 / TileSize;
+    uint tx1 = Min<uint>((x1 + TileSize - 1) / TileSize, TilesX);
+    uint ty1 = Min<uint>((y1 + TileSize - 1) / TileSize, TilesY);
+    if (tx0 >= tx1 || ty0 >= ty1)
+        return;
+
+    for (uint ty = ty0; ty < ty1; ty++)
+    {
+        uint64* row = Bits.Ptr() + ty * Words;
+        for (uint w = tx0 / 64; w <= (tx1 - 1) / 64; w++)
+        {
+            uint lo = Max(tx0, w * 64) - w * 64;
+            uint hi = Min(tx1, w * 64 + 64) - w * 64;
+            row[w] |= (hi == 64 ? ~0ull : (1ull << hi) - 1) & ~((1ull << lo) - 1);
+        }
+    }
+}
+
+uint TileMask::GetCount() const
+{
+    uint count = 0;
+    for (uint64 w : Bits)
+        count += std::popcount(w);
+    return count;
+}
+
+uint TileMask::GetTiles(Array<uint>& out) const
+{
+    out.Clear();
+    for (uint ty = 0; ty < TilesY; ty++)
+    {
+        const uint64* row = Bits.Ptr() + ty * Words;
+        for (uint w = 0; w < Words; w++)
+            for (uint64 bits = row[w]; bits; bits &= bits - 1)
+                out += (w * 64 + std::countr_zero(bits)) | (ty << 16);
+    }
+    return (uint)out.Len();
+}
+
+void TileMask::ForEachRun(const Func<void(uint x0, uint x1, uint y)>& f) const
+{
+    for (uint ty = 0; ty < TilesY; ty++)
+    {
+        uint tx = 0;
+        while (tx < TilesX)
+        {
+            while (tx < TilesX && !Get(tx, ty)) tx++;
+            uint start = tx;
+            while (tx < TilesX && Get(tx, ty)) tx++;
+            if (tx > start)
+                f(start, tx, ty);
+        }
+    }
+}
@@ -0,0 +1,47 @@
+//
+// Copyright (C) Tammo Hinrichs 2021. All rights reserved.
+// Licensed under the MIT License. See LICENSE.md file for full license information
+//
+
+#pragma once
+
+#include "types.h"
+
+// One bit per 8x8 pixel tile of an image, which is what the csc shader works on
+// per thread group. Tracks what has changed since the last conversion, so only
+// those tiles need doing again.
+class TileMask
+{
+public:
+    static constexpr uint TileSize = 8;
+
+    // size in pixels. Everything starts out dirty
+    void Init(uint sizeX, uint sizeY);
+
+    void SetAll();
+    void Clear();
+
+    // x1/y1 exclusive, clipped to the image. Coordinates get multiplied by scale
+    // first (for upscaling, the mask is in output pixels)
+    void AddRect(int x0, int y0, int x1, int y1, uint scale = 1);
+
+    bool Get(uint tx, uint ty) const { return (Bits[ty * Words + tx / 64] >> (tx % 64)) & 1; }
+    void Set(uint tx, uint ty) { Bits[ty * Words + tx / 64] |= 1ull << (tx % 64); }
+
+    uint GetTilesX() const { return TilesX; }
+    uint GetTilesY() const { return TilesY; }
+    uint GetCount() const;
+    double GetFraction() const { return TilesX && TilesY ? (double)GetCount() / (TilesX * TilesY) : 0; }
+
+    // all dirty tiles as x | (y << 16), row by row. Returns the count
+    uint GetTiles(Array<uint>& out) const;
+
+    // horizontal runs of dirty tiles, in tile coordinates (x1 exclusive)
+    void ForEachRun(const Func<void(uint x0, uint x1, uint y)>& f) const;
+
+private:
+    uint TilesX = 0;
+    uint TilesY = 0;
+    uint Words = 0;         // per row
+    Array<uint64> Bits;
+};
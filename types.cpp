@@ -8,9 +8,17 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <charconv>
 
+#ifdef _WIN32
 #include <windows.h>
 #include <stringapiset.h>
+#else
+#include <strings.h>
+#define _stricmp strcasecmp
+#define _strnicmp strncasecmp
+#define vsnprintf_s vsnprintf
+#endif
 
 Buffer::Buffer(const void* ptr, size_t size) : Span<uint8>(new uint8[size], size)
 {
@@ -20,10 +28,19 @@ Buffer::Buffer(const void* ptr, size_t size) : Span<uint8>(new uint8[size], size
 
 char *String::Make(size_t len)
 {
-    void* mem = new uint8[sizeof(Node) + len];
-    node = RCPtr<Node>(new (mem) Node);
-    node->len = len;    
+    Free();
+    if (len <= SmallCap)
+    {
+        smallLen = (uint8)len;
+        small[len] = 0;
+        return small;
+    }
+
+    void* mem = ::operator new(sizeof(Node) + len);
+    node = new (mem) Node;
+    node->len = len;
     node->str[len] = 0;
+    smallLen = LongTag;
     return node->str;
 }
 
@@ -35,6 +52,8 @@ void String::Make(const char* p, size_t len)
     memcpy(ptr, p, len);
 }
 
+#ifdef _WIN32
+
 void String::Make(const wchar_t* p, size_t len)
 {
     if (!p || !p[0]) return;
@@ -43,43 +62,78 @@ void String::Make(const wchar_t* p, size_t len)
     WideCharToMultiByte(CP_UTF8, WC_NO_BEST_FIT_CHARS, p, (int)len, ptr, bytes, NULL, NULL);
 }
 
+#else
+
+// wchar_t is UTF-32 everywhere else
+static size_t EncodeUTF8(const wchar_t* p, size_t len, char* out)
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < len && p[i]; i++)
+    {
+        uint c = (uint)p[i];
+        uint8 buf[4];
+        size_t n;
+        if (c < 0x80) { buf[0] = (uint8)c; n = 1; }
+        else if (c < 0x800) { buf[0] = (uint8)(0xc0 | (c >> 6)); buf[1] = (uint8)(0x80 | (c & 0x3f)); n = 2; }
+        else if (c < 0x10000) { buf[0] = (uint8)(0xe0 | (c >> 12)); buf[1] = (uint8)(0x80 | ((c >> 6) & 0x3f)); buf[2] = (uint8)(0x80 | (c & 0x3f)); n = 3; }
+        else { buf[0] = (uint8)(0xf0 | (c >> 18)); buf[1] = (uint8)(0x80 | ((c >> 12) & 0x3f)); buf[2] = (uint8)(0x80 | ((c >> 6) & 0x3f)); buf[3] = (uint8)(0x80 | (c & 0x3f)); n = 4; }
+        if (out) memcpy(out + bytes, buf, n);
+        bytes += n;
+    }
+    return bytes;
+}
+
+void String::Make(const wchar_t* p, size_t len)
+{
+    if (!p || !p[0]) return;
+    size_t bytes = EncodeUTF8(p, len, nullptr);
+    EncodeUTF8(p, len, Make(bytes));
+}
+
+#endif
+
 
 String String::Concat(const String &s1, const String &s2)
 {
     if (!s1) return s2;
     if (!s2) return s1;
-    auto& n1 = s1.node;
-    auto& n2 = s2.node;
-    size_t len = n1->len + n2->len;
+    size_t len1 = s1.Length(), len2 = s2.Length();
     String str;
-    char *ptr = str.Make(len);
-    memcpy(ptr, n1->str, n1->len);
-    memcpy(ptr + n1->len, n2->str, n2->len);
+    char *ptr = str.Make(len1 + len2);
+    memcpy(ptr, (const char*)s1, len1);
+    memcpy(ptr + len1, (const char*)s2, len2);
     return str;
 }
 
 String String::Repeat(char chr, int times)
 {
     String str;
-    str.Make(times);
-    memset(str.node->str, chr, times);
+    memset(str.Make(Max(times, 0)), chr, Max(times, 0));
     return str;
 }
 
 String String::PrintF(const char* format, ...)
 {
-    constexpr size_t size = 4096;
-    thread_local char buf[size];
-
-    va_list args;
+    // most results are short, so try the stack first and only format again if it didn't fit
+    char buf[256];
+    va_list args, args2;
     va_start(args, format);
-    int len = vsnprintf_s(buf, size, format, args);
-    if (len < 0) len = 0;
-    va_end(args);
-    buf[len] = 0;
+    va_copy(args2, args);
 
     String str;
-    str.Make(buf, len);
+    size_t len = VFormatTo(buf, format, args);
+    if (len < sizeof(buf))
+        str = ReadOnlySpan<char>(buf, len);
+    else
+    {
+        StringBuilder sb;
+        sb.Reserve(len);
+        VFormatTo(sb, format, args2);
+        str = sb.ToString();
+    }
+
+    va_end(args2);
+    va_end(args);
     return str;
 }
 
@@ -88,7 +142,13 @@ String String::Join(const ReadOnlySpan<String> &strings, const String &separator
     size_t count = strings.Len();
     if (!count) return String();
     if (count == 1) return strings[0];
+
+    size_t len = separator.Length() * (count - 1);
+    for (auto& s : strings)
+        len += s.Length();
+
     StringBuilder sb;
+    sb.Reserve(len);
     for (int i = 0; i < count; i++)
     {
         if (i) sb += separator;
@@ -124,148 +184,425 @@ int String::CompareLen(const String& s1, const char* s2, bool ignoreCase)
         return strncmp(s1, s2, s1.Length());
 }
 
+bool String::Equals(const String& s1, const String& s2, bool ignoreCase)
+{
+    size_t len = s1.Length();
+    if (len != s2.Length()) return false;
+    const char* p1 = s1, * p2 = s2;
+    if (p1 == p2) return true;
+    if (ignoreCase)
+        return !_strnicmp(p1, p2, len);
+
+    // both hashes there already (eg. map keys)? then they have the last word if they differ
+    if (s1.IsLong() && s2.IsLong())
+    {
+        uint h1 = s1.node->hash.load(std::memory_order_relaxed);
+        uint h2 = s2.node->hash.load(std::memory_order_relaxed);
+        if (h1 && h2 && h1 != h2) return false;
+    }
+    return !memcmp(p1, p2, len);
+}
+
+bool String::Equals(const String& s1, const char* s2, bool ignoreCase)
+{
+    if (!s2) s2 = "";
+    size_t len = s1.Length();
+    if (ignoreCase)
+        return !_strnicmp(s1, s2, len) && !s2[len];
+    else
+        return !strncmp(s1, s2, len) && !s2[len];
+}
+
+uint String::Hash(ReadOnlySpan<char> str)
+{
+    uint h = 2166136261u;
+    for (char c : str)
+        h = (h ^ (uint8)c) * 16777619u;
+    return h ? h : 1; // 0 means "not yet" in the node
+}
+
+uint String::Hash() const
+{
+    if (!IsLong())
+        return Hash(*this);
+    uint h = node->hash.load(std::memory_order_relaxed);
+    if (!h)
+        node->hash.store(h = Hash(*this), std::memory_order_relaxed);
+    return h;
+}
+
 String::WCharProxy String::ToWChar() const
 { 
     WCharProxy proxy;
-    if (!node) return proxy;
-    int len = MultiByteToWideChar(CP_UTF8, 0, node->str, (int)node->len, 0, 0);
+    size_t srcLen = Length();
+    if (!srcLen) return proxy;
+    const char* str = *this;
+#ifdef _WIN32
+    int len = MultiByteToWideChar(CP_UTF8, 0, str, (int)srcLen, 0, 0);
     proxy.ptr = new wchar_t[len + 1];
-    MultiByteToWideChar(CP_UTF8, 0, node->str, (int)node->len, proxy.ptr, len+1);
+    MultiByteToWideChar(CP_UTF8, 0, str, (int)srcLen, proxy.ptr, len+1);
     proxy.ptr[len] = 0;
+#else
+    const uint8* src = (const uint8*)str;
+    const uint8* end = src + srcLen;
+    wchar_t* dest = proxy.ptr = new wchar_t[srcLen + 1];
+    while (src < end)
+    {
+        uint c = *src++;
+        int extra = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0;
+        c &= extra ? 0x3f >> extra : 0x7f;
+        while (extra-- && src < end)
+            c = (c << 6) | (*src++ & 0x3f);
+        *dest++ = (wchar_t)c;
+    }
+    *dest = 0;
+#endif
     return proxy;
 }
 
 
-String StringBuilder::ToString() const
+void StringBuilder::Grow(size_t size)
 {
-    size_t len = 0;
-    for (auto &s : strings)
-        len += s.Length();
-
-    String out;
-    out.Make(len);
-    size_t offs = 0;
-    for (auto &s : strings)
+    size_t newCap = Max<size_t>(Max<size_t>(size, 2 * capacity), 256);
+    void* mem = ::operator new(sizeof(String::Node) + newCap);
+    String::Node* newNode = new (mem) String::Node;
+    if (node)
     {
-        len = s.Length();       
-        memcpy(out.node->str + offs, s.node->str, len);
-        offs += len;
+        memcpy(newNode->str, node->str, len);
+        node->Release();
     }
-    out.node->str[offs] = 0;
-    return out;
+    node = newNode;
+    capacity = newCap;
 }
 
-
-bool Scanner::If(const String& str)
+void StringBuilder::AppendIndent()
 {
-    Skip();
-    if (!String::CompareLen(str, ptr, true))
+    static const char spaces[] = "                                                                ";
+    firstInLine = false;
+    for (int left = indent; left > 0; )
     {
-        ptr += str.Length();
-        return true;
+        int n = Min(left, (int)sizeof(spaces) - 1);
+        AppendChars(spaces, n);
+        left -= n;
     }
-    return false;
 }
 
-bool Scanner::IfChar(char c)
+void StringBuilder::AppendInt(int64 value)
 {
-    Skip();
-    if (*ptr == c)
-    {
-        ptr++;
-        return true;
-    }
-    return false;
+    char buf[24];
+    auto res = std::to_chars(buf, buf + sizeof(buf), value);
+    AppendChars(buf, res.ptr - buf);
 }
 
-bool Scanner::Char(char c)
+void StringBuilder::AppendUInt(uint64 value)
 {
-    bool ret = IfChar(c);
-    if (!ret)
-        Error(String::PrintF("expected %c", c));
-    return ret;
+    char buf[24];
+    auto res = std::to_chars(buf, buf + sizeof(buf), value);
+    AppendChars(buf, res.ptr - buf);
 }
 
-int64 Scanner::Decimal(int* digits)
+void StringBuilder::AppendDouble(double value, int decimals)
 {
-    if (*ptr < '0' || *ptr > '9')
+    // %f of 1e308 is 309 digits
+    char buf[350];
+    auto res = decimals < 0 ? std::to_chars(buf, buf + sizeof(buf), value) : std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::fixed, decimals);
+    AppendChars(buf, res.ec == std::errc() ? res.ptr - buf : 0);
+}
+
+String StringBuilder::ToString()
+{
+    String out;
+    if (len <= String::SmallCap)
     {
-        Error("Number expected");
-        if (digits) *digits = 0;
-        return 0;
+        // fits into the String itself, keep the buffer
+        if (len) memcpy(out.Make(len), node->str, len);
     }
-    int64 ret = 0;
-    int dig = 0;
-    while (*ptr >= '0' && *ptr <= '9')
+    else
     {
-        if (ret || *ptr > '0') dig++;
-        ret = 10 * ret + ((int64)*ptr - '0');
-        ptr++;
+        node->len = len;
+        node->str[len] = 0;
+        out.node = node;
+        out.smallLen = String::LongTag;
+        node = nullptr;
+        capacity = 0;
     }
-    if (digits) *digits = dig;
-    return ret;
+    Clear();
+    return out;
 }
 
-void Scanner::Error(const String& err)
-{
-    errors += String::PrintF("Error (%d,%d): %s", ln + 1, ptr - line, (const char*)err);
-}
 
-String Scanner::QuotedString()
+size_t FormatWriter::Format(const char* format, va_list args)
 {
-    Skip();
-    if (!Char('\"')) return String();
+    static const char spaces[] = "                                ";
+    static const char zeros[] = "00000000000000000000000000000000";
+
+    size_t count = 0;
+    auto put = [&](const char* str, size_t len)
+    {
+        if (len) Put(str, len);
+        count += len;
+    };
+    auto pad = [&](const char* chars, int n)
+    {
+        for (; n > 0; n -= (int)sizeof(spaces) - 1)
+            put(chars, Min(n, (int)sizeof(spaces) - 1));
+    };
 
-    String ret;
-    bfill = 0;
-    while (*ptr && *ptr != '\"' && *ptr != '\n' && *ptr != '\r')
+    while (*format)
     {
-        if (*ptr == '\\')
+        const char* run = format;
+        while (*format && *format != '%') format++;
+        put(run, format - run);
+        if (!*format) break;
+
+        const char* spec = format++;
+
+        bool left = false, plus = false, space = false, alt = false, zero = false;
+        for (;; format++)
+        {
+            if (*format == '-') left = true;
+            else if (*format == '+') plus = true;
+            else if (*format == ' ') space = true;
+            else if (*format == '#') alt = true;
+            else if (*format == '0') zero = true;
+            else break;
+        }
+
+        int width = 0;
+        if (*format == '*')
+        {
+            width = va_arg(args, int);
+            if (width < 0) { left = true; width = -width; }
+            format++;
+        }
+        else while (*format >= '0' && *format <= '9')
+            width = 10 * width + (*format++ - '0');
+
+        int prec = -1;
+        if (*format == '.')
         {
-            ptr++;
-            switch (*ptr)
+            format++;
+            prec = 0;
+            if (*format == '*')
             {
-            case 0: ptr--; break;
-            case 'r': AddChar('\r', ret); break;
-            case 't': AddChar('\t', ret); break;
-            case 'n': AddChar('\n', ret); break;
-            case 'b': AddChar('\b', ret); break;
-            case 'f': AddChar('\f', ret); break;
-            case 'u': ASSERT0("IMPLEMENT ME");
-            case '\\': case '"': case '/': AddChar(*ptr, ret); break;
+                prec = Max(va_arg(args, int), -1);
+                format++;
             }
-            ptr++;
+            else while (*format >= '0' && *format <= '9')
+                prec = 10 * prec + (*format++ - '0');
         }
-        else
-            AddChar(*ptr++, ret);
-    }
-    if (!Char('\"')) return String();
 
-    buffer[bfill] = 0;
-    ret = ret + buffer;
-    return ret;
-}
+        // length modifiers, MSVC's I64/I32/I included
+        enum { Int, Char, Short, Long, LongLong, Size } size = Int;
+        bool wide = false;
+        for (;; format++)
+        {
+            if (*format == 'h') size = size == Short ? Char : Short;
+            else if (*format == 'l') { size = size == Long ? LongLong : Long; wide = true; }
+            else if (*format == 'z' || *format == 't' || *format == 'j') size = Size;
+            else if (*format == 'L') size = LongLong;
+            else if (*format == 'I' && format[1] == '6' && format[2] == '4') { size = LongLong; format += 2; }
+            else if (*format == 'I' && format[1] == '3' && format[2] == '2') { size = Int; format += 2; }
+            else if (*format == 'I') size = Size;
+            else break;
+        }
 
-void Scanner::Skip()
-{
-    while (*ptr && ((uint8)(*ptr) <= ' '))
-    {
-        if (*ptr == '\n')
+        char conv = *format;
+        if (conv) format++;
+
+        char buf[512];
+        const char* body = buf;
+        size_t bodyLen = 0;
+        const char* prefix = "";
+        int zeroExt = 0;        // zeros between prefix and body
+        String temp;
+
+        switch (conv)
+        {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'p':
+        {
+            uint64 value;
+            bool neg = false;
+            if (conv == 'p')
+            {
+                // MSVC style: all the digits, no 0x
+                value = (uint64)(size_t)va_arg(args, void*);
+                prec = 2 * sizeof(void*);
+                conv = 'X';
+            }
+            else if (conv == 'd' || conv == 'i')
+            {
+                int64 v;
+                switch (size)
+                {
+                case Char: v = (int8)va_arg(args, int); break;
+                case Short: v = (int16)va_arg(args, int); break;
+                case Long: v = va_arg(args, long); break;
+                case LongLong: v = va_arg(args, long long); break;
+                case Size: v = va_arg(args, ptrdiff_t); break;
+                default: v = va_arg(args, int); break;
+                }
+                neg = v < 0;
+                value = neg ? 0 - (uint64)v : (uint64)v;
+                prefix = neg ? "-" : plus ? "+" : space ? " " : "";
+            }
+            else
+            {
+                switch (size)
+                {
+                case Char: value = (uint8)va_arg(args, uint); break;
+                case Short: value = (uint16)va_arg(args, uint); break;
+                case Long: value = va_arg(args, unsigned long); break;
+                case LongLong: value = va_arg(args, unsigned long long); break;
+                case Size: value = va_arg(args, size_t); break;
+                default: value = va_arg(args, uint); break;
+                }
+            }
+
+            int base = (conv == 'x' || conv == 'X') ? 16 : conv == 'o' ? 8 : 10;
+            if (prec != 0 || value)
+                bodyLen = std::to_chars(buf, buf + 64, value, base).ptr - buf;
+            if (conv == 'X')
+                for (size_t i = 0; i < bodyLen; i++)
+                    if (buf[i] >= 'a') buf[i] -= 'a' - 'A';
+
+            if (alt && value && base == 16) prefix = conv == 'x' ? "0x" : "0X";
+            if (alt && base == 8 && (!bodyLen || buf[0] != '0') && (int)bodyLen >= prec) zeroExt = 1;
+
+            if (prec >= 0)
+                zeroExt = Max(zeroExt, prec - (int)bodyLen);
+            else if (zero && !left)
+                zeroExt = Max(zeroExt, width - (int)bodyLen - (int)strlen(prefix));
+            break;
+        }
+
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
         {
-            ln++;
-            line = ptr + 1;
+            double value = size == LongLong ? (double)va_arg(args, long double) : va_arg(args, double);
+            bool neg = signbit(value);
+            prefix = neg ? "-" : plus ? "+" : space ? " " : "";
+            value = fabs(value);
+
+            if (!isfinite(value))
+                bodyLen = strlen(strcpy(buf, isnan(value) ? "nan" : "inf"));
+            else
+            {
+                std::chars_format fmt = (conv == 'f' || conv == 'F') ? std::chars_format::fixed
+                    : (conv == 'e' || conv == 'E') ? std::chars_format::scientific
+                    : (conv == 'g' || conv == 'G') ? std::chars_format::general
+                    : std::chars_format::hex;
+                if (fmt == std::chars_format::hex)
+                {
+                    prefix = neg ? "-0x" : plus ? "+0x" : space ? " 0x" : "0x";
+                    if (prec < 0)
+                        bodyLen = std::to_chars(buf, buf + sizeof(buf), value, fmt).ptr - buf;
+                }
+                if (!bodyLen)
+                    bodyLen = std::to_chars(buf, buf + sizeof(buf), value, fmt, prec < 0 ? 6 : Min(prec, 100)).ptr - buf;
+                if (zero && !left)
+                    zeroExt = Max(0, width - (int)bodyLen - (int)strlen(prefix));
+            }
+
+            if (conv >= 'A' && conv <= 'Z')
+            {
+                for (size_t i = 0; i < bodyLen; i++)
+                    if (buf[i] >= 'a' && buf[i] <= 'z') buf[i] -= 'a' - 'A';
+                if (prefix[0] && prefix[strlen(prefix) - 1] == 'x')
+                    prefix = neg ? "-0X" : plus ? "+0X" : space ? " 0X" : "0X";
+            }
+            break;
+        }
+
+        case 'c':
+            buf[0] = (char)va_arg(args, int);
+            bodyLen = 1;
+            break;
+
+        case 's': case 'S':
+            if (wide || conv == 'S')
+            {
+                temp = va_arg(args, const wchar_t*);
+                body = temp;
+            }
+            else
+                body = va_arg(args, const char*);
+            if (!body) body = "(null)";
+            bodyLen = 0;
+            while ((prec < 0 || bodyLen < (size_t)prec) && body[bodyLen])
+                bodyLen++;
+            break;
+
+        case '%':
+            put("%", 1);
+            continue;
+
+        default:
+            // not a thing, print as is
+            put(spec, format - spec);
+            continue;
         }
-        ptr++;
+
+        int padding = width - (int)(strlen(prefix) + zeroExt + bodyLen);
+        if (!left) pad(spaces, padding);
+        put(prefix, strlen(prefix));
+        pad(zeros, zeroExt);
+        put(body, bodyLen);
+        if (left) pad(spaces, padding);
     }
+
+    return count;
 }
 
-void Scanner::AddChar(char c, String& out)
+class StringBuilderWriter : public FormatWriter
 {
-    buffer[bfill++] = c;
-    if (bfill == 1023)
+public:
+    StringBuilder& SB;
+    StringBuilderWriter(StringBuilder& sb) : SB(sb) {}
+    void Put(const char* str, size_t len) override { SB.AppendChars(str, len); }
+};
+
+class SpanWriter : public FormatWriter
+{
+public:
+    Span<char> Dest;
+    size_t Pos = 0;
+    SpanWriter(Span<char> dest) : Dest(dest) {}
+    void Put(const char* str, size_t len) override
     {
-        buffer[bfill] = 0;
-        out = out + buffer;
-        bfill = 0;
+        size_t n = Min(len, Dest.Len() ? Dest.Len() - 1 - Pos : 0);
+        if (n) memcpy(Dest.Ptr() + Pos, str, n);
+        Pos += n;
     }
+};
+
+size_t VFormatTo(StringBuilder& sb, const char* format, va_list args)
+{
+    StringBuilderWriter writer(sb);
+    return writer.Format(format, args);
+}
+
+size_t FormatTo(StringBuilder& sb, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t len = VFormatTo(sb, format, args);
+    va_end(args);
+    return len;
+}
+
+size_t VFormatTo(Span<char> dest, const char* format, va_list args)
+{
+    SpanWriter writer(dest);
+    size_t len = writer.Format(format, args);
+    if (dest.Len()) dest[writer.Pos] = 0;
+    return len;
+}
+
+size_t FormatTo(Span<char> dest, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t len = VFormatTo(dest, format, args);
+    va_end(args);
+    return len;
 }
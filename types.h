@@ -6,7 +6,11 @@
 #pragma once
 
 #include <math.h>
-#include <new.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdarg.h>
+#include <new>
+#include <atomic>
 
 // basic types
 // -------------------------------------------------------------------------------
@@ -29,6 +33,23 @@ void OnAssert(const char* file, int line, const char* expr);
 
 #define ASSERT0(s) { OnAssert(__FILE__, __LINE__, s); }
 
+// printf style format string checking for our own functions. GCC/Clang check
+// at compile time, MSVC only with /analyze. Argument indices start at 1, and
+// count "this" for non-static member functions
+#ifdef _MSC_VER
+#include <sal.h>
+#define FORMAT_STRING _Printf_format_string_
+#define CHECK_FORMAT(fmtArg, firstArg)
+#else
+#define FORMAT_STRING
+#define CHECK_FORMAT(fmtArg, firstArg) __attribute__((format(printf, fmtArg, firstArg)))
+#endif
+
+// MSVC's forced inlining (math3d.h uses it), for GCC/Clang
+#ifndef _MSC_VER
+#define __forceinline inline __attribute__((always_inline))
+#endif
+
 // basic math
 // -------------------------------------------------------------------------------
 
@@ -205,7 +226,7 @@ protected:
     void PrepareInsert(size_t at, size_t count)
     {
         ASSERT(at <= this->size);
-        ((TA*)this)->Grow(at + count);
+        ((TA*)this)->Grow(this->size + count);
         for (size_t i = this->size - at; i-- > 0;)
         {
             if (at + i + count >= this->size)
@@ -336,7 +357,7 @@ public:
 
     Array(const Array& a) { Grow(a.Len()); this->PushTail((Span<T>)a); }
 
-    Array(Array&& a) : TBase(a.mem, a.size, a.capacity)
+    Array(Array&& a) : TBase(a.mem, a.size), capacity(a.capacity)
     {
         a.size = a.capacity = 0;
         a.mem = nullptr;
@@ -377,7 +398,9 @@ public:
 
     Array& operator= (Array&& arr)
     {
+        if (&arr == this) return *this;
         this->Clear();
+        delete[](uint8*)this->mem;
         this->mem = arr.mem;
         this->size = arr.size;
         this->capacity = arr.capacity;
@@ -451,22 +474,26 @@ public:
     constexpr RCPtr(RCPtr&& p) : ptr(p.ptr) { p.ptr = nullptr; }
     constexpr RCPtr(T* p) { ptr = p; }
 
+#ifdef _WIN32
     // this works with COM or if your class implements it manually
     template <typename T2> RCPtr(const RCPtr<T2>& pp) : ptr(nullptr)
     {
         if (pp.IsValid()) pp->QueryInterface(__uuidof(T), (void**)&ptr);
     }
+#endif
 
     ~RCPtr() { Clear(); }
 
     RCPtr& operator = (const RCPtr& p) { Clear(); ptr = p.ptr; if (ptr) ptr->AddRef(); return *this; }
     RCPtr& operator = (RCPtr&& p) noexcept { Clear(); ptr = p.ptr; p.ptr = nullptr; return *this; }
+#ifdef _WIN32
     template <typename T2> RCPtr& operator =(const RCPtr<T2>& pp)
     {
         Clear();
         if (pp.IsValid()) pp->QueryInterface(__uuidof(T), (void**)&ptr);
         return *this;
     }
+#endif
 
     void Clear() { if (ptr) { ptr->Release(); ptr = 0; } }
     constexpr bool IsValid() const { return ptr != nullptr; }
@@ -578,52 +605,66 @@ public:
 // Strings
 // -------------------------------------------------------------------------------
 
-// very basic and very not optimized quasi-immutable string class
-// I just want a better interface than C style
-// let's totally rewrite this as soon as it becomes slow enough
+// quasi-immutable string class, because I want a better interface than C style.
+// Up to SmallCap chars live right inside the object, longer ones in a refcounted
+// node that copies share. So the pointer you get from a short string is only good
+// as long as that very String object lives and stays unchanged.
 class String
 {
 public:
+    static constexpr size_t SmallCap = 22;
+
     String() {};
     String(const char* p) { Make(p); }
     String(const wchar_t* p) { Make(p); }
-    String(const String& s) { node = s.node; }
-    String(String&& s) noexcept { node = static_cast<RCPtr<Node>&&>(s.node); }
+    String(const String& s) { Copy(s); }
+    String(String&& s) noexcept { Take(s); }
     String(ReadOnlySpan<char> str) { Make(str.Ptr(), str.Len()); }
     String(ReadOnlySpan<wchar_t> str) { Make(str.Ptr(), str.Len()); }
+    ~String() { Free(); }
 
-    static String PrintF(const char* format, ...);
+    CHECK_FORMAT(1, 2) static String PrintF(FORMAT_STRING const char* format, ...);
     static String Concat(const String& s1, const String& s2);
     static String Repeat(char chr, int count);
     static String Join(const ReadOnlySpan<String>& strings, const String& separator);
 
-    String& operator = (const char* p) { Make(p); return *this; }
-    String& operator = (const wchar_t* p) { Make(p); return *this; }
-    String& operator = (const String& s) { node = s.node; return *this; }
-    String& operator = (String&& s) noexcept { node = static_cast<RCPtr<Node>&&>(s.node); return *this; }
-    String& operator = (ReadOnlySpan<char> str) { Make(str.Ptr(), str.Len()); return *this; }
-    String& operator = (ReadOnlySpan<wchar_t> str) { Make(str.Ptr(), str.Len()); return *this; }
+    String& operator = (const char* p) { String t(p); Free(); Take(t); return *this; }
+    String& operator = (const wchar_t* p) { String t(p); Free(); Take(t); return *this; }
+    String& operator = (const String& s) { if (this != &s) { Free(); Copy(s); } return *this; }
+    String& operator = (String&& s) noexcept { if (this != &s) { Free(); Take(s); } return *this; }
+    String& operator = (ReadOnlySpan<char> str) { String t(str); Free(); Take(t); return *this; }
+    String& operator = (ReadOnlySpan<wchar_t> str) { String t(str); Free(); Take(t); return *this; }
 
-    size_t Length() const { return node.IsValid() ? node->len : 0; }
-    operator const char* () const { return node.IsValid() ? node->str : ""; }
+    size_t Length() const { return IsLong() ? node->len : smallLen; }
+    operator const char* () const { return IsLong() ? node->str : small; }
 
     static int Compare(const String& a, const String& b, bool ignoreCase = false);
     static int Compare(const String& a, const char* b, bool ignoreCase = false);
     static int CompareLen(const String& a, const char* b, bool ignoreCase = false);
     template<typename Ts> int Compare(const Ts& s, bool ignoreCase = false) const { return Compare(*this, s, ignoreCase); }
 
-    bool operator! () const { return !node; }
+    // cheaper than Compare() if all you want to know is "same or not": different
+    // lengths or hashes (if both are known already) bail out right away
+    static bool Equals(const String& a, const String& b, bool ignoreCase = false);
+    static bool Equals(const String& a, const char* b, bool ignoreCase = false);
+    template<typename Ts> bool Equals(const Ts& s, bool ignoreCase = false) const { return Equals(*this, s, ignoreCase); }
+
+    // FNV-1a, case sensitive. Long strings remember it
+    uint Hash() const;
+    static uint Hash(ReadOnlySpan<char> str);
+
+    bool operator! () const { return !Length(); }
     String operator + (const String& s) const { return Concat(*this, s); }
     String operator += (const String& s) { return *this = Concat(*this, s); }
 
     template<typename Ts> bool operator < (const Ts& s) const { return Compare(s) < 0; }
     template<typename Ts> bool operator <= (const Ts& s) const { return Compare(s) <= 0; }
-    template<typename Ts> bool operator == (const Ts& s) const { return Compare(s) == 0; }
+    template<typename Ts> bool operator == (const Ts& s) const { return Equals(s); }
     template<typename Ts> bool operator >= (const Ts& s) const { return Compare(s) >= 0; }
     template<typename Ts> bool operator > (const Ts& s) const { return Compare(s) > 0; }
-    template<typename Ts> bool operator != (const Ts& s) const { return Compare(s) != 0; }
+    template<typename Ts> bool operator != (const Ts& s) const { return !Equals(s); }
 
-    operator ReadOnlySpan<char>() const { return node.IsValid() ? ReadOnlySpan<char>(node->str, node->len) : ReadOnlySpan<char>(); }
+    operator ReadOnlySpan<char>() const { return ReadOnlySpan<char>((const char*)*this, Length()); }
 
     // wrapper to UTF-16 string
     // Beware object lifetimes (using ToWChar() as function argument is fine)
@@ -637,74 +678,141 @@ public:
         ~WCharProxy() { delete[] ptr; }
         WCharProxy(WCharProxy&& p) noexcept { ptr = p.ptr; p.ptr = nullptr; }
         operator const wchar_t* () const { return ptr ? ptr : L""; }
-    } ToWChar() const;
+    };
+    WCharProxy ToWChar() const;
 
     char* Make(size_t len); // HERE BE DRAGONS, you need to fill the string aftewards
 
 private:
     friend class StringBuilder;
 
-    struct Node : RCObj { size_t len = 0; char str[1] = {}; }; // variable size!
-    RCPtr<Node> node;
+    static constexpr uint8 LongTag = 0xff;
+
+    struct Node : RCObj // variable size, see Make()
+    {
+        size_t len = 0;
+        std::atomic<uint> hash = 0;     // 0: not known yet
+        char str[1] = {};
+
+        static void operator delete(void* p) { ::operator delete(p); }
+    };
+
+    // the length goes into the last byte so it all fits in 24
+    union
+    {
+        struct
+        {
+            char small[SmallCap + 1] = {};  // zero terminated
+            uint8 smallLen = 0;             // LongTag: it's in node
+        };
+        Node* node;
+    };
+
+    bool IsLong() const { return smallLen == LongTag; }
+
+    void Copy(const String& s)
+    {
+        memcpy((void*)this, (const void*)&s, sizeof(String));
+        if (IsLong()) node->AddRef();
+    }
+
+    void Take(String& s)
+    {
+        memcpy((void*)this, (const void*)&s, sizeof(String));
+        s.smallLen = 0;
+        s.small[0] = 0;
+    }
+
+    void Free()
+    {
+        if (IsLong()) node->Release();
+        smallLen = 0;
+        small[0] = 0;
+    }
 
     void Make(const char* p, size_t len = -1);
     void Make(const wchar_t* p, size_t len = -1);
 };
 
-// StringBuilder class, just append strings and get the result at the end
+// StringBuilder class, just append stuff and get the result at the end
+// Writes into one buffer that grows by doubling, which is a String node already,
+// so ToString() hands it over instead of copying
 // Supports optional pretty printing for human readable formats
 class StringBuilder
 {
 public:
+    StringBuilder() {}
+    StringBuilder(const StringBuilder&) = delete;
+    StringBuilder& operator = (const StringBuilder&) = delete;
+    ~StringBuilder() { if (node) node->Release(); }
+
+    void Clear() { len = 0; indent = 0; firstInLine = pretty; }
+    void Reserve(size_t size) { if (size > capacity) Grow(size); }
+    size_t Length() const { return len; }
+
+    void AppendChars(const char* str, size_t count)
+    {
+        if (firstInLine) AppendIndent();
+        if (len + count > capacity) Grow(len + count);
+        memcpy(node->str + len, str, count);
+        len += count;
+    }
 
-    void Clear() { strings.Clear(); }
+    void AppendChar(char c) { AppendChars(&c, 1); }
+    void AppendInt(int64 value);
+    void AppendUInt(uint64 value);
+    void AppendDouble(double value, int decimals = 6); // same as %f. decimals < 0: shortest that reads back the same
 
-    void Append(const String& str) { if (firstInLine) CheckIndent(); if (str.Length()) strings.PushTail(str); }
-    template<class ... args> void Append(const String& str, args ...a) { Append(str); Append(a...); }
+    void Append(const char* str) { if (str) AppendChars(str, strlen(str)); }
+    void Append(const String& str) { AppendChars(str, str.Length()); }
+    template<class T, class ... args> void Append(const T& str, const args& ...a) { Append(str); Append(a...); }
+    void operator += (const char* str) { Append(str); }
     void operator += (const String& str) { Append(str); }
 
-    String ToString() const;
+    // empties the builder
+    String ToString();
 
     // pretty printing
     void SetPrettyPrint(bool p) { pretty = p; indent = 0; firstInLine = p; }
-    void PrettySpace() { if (pretty) Append(" "); }
-    void PrettyNewline(int ind = 0) { if (pretty) { Append("\n"); indent = Max(0, indent + ind); firstInLine = true; } }
+    void PrettySpace() { if (pretty) AppendChar(' '); }
+    void PrettyNewline(int ind = 0) { if (pretty) { AppendChar('\n'); indent = Max(0, indent + ind); firstInLine = true; } }
 
 private:
-    Array<String> strings;
+    String::Node* node = nullptr;   // str has room for capacity chars plus the terminator
+    size_t len = 0;
+    size_t capacity = 0;
+
     bool pretty = false;
     int indent = 0;
     bool firstInLine = true;
 
-    void CheckIndent() { strings += String::Repeat(' ', indent); firstInLine = false; }
+    void Grow(size_t size);
+    void AppendIndent();
 };
 
-// Scans text and returns symbols, strings, or numbers
-// There's an error list you can use to relay errors back to the user
-class Scanner
+// Formatted output
+// -------------------------------------------------------------------------------
+
+// printf style formatting straight into a sink, without a temporary buffer and
+// without a length limit: every literal run and every converted value goes to
+// Put() as it comes. Numbers go through std::to_chars, so they come out like
+// printf's in the "C" locale. Not supported: %n, and the # flag for floats.
+// %S/%ls (wide strings) allocate for the UTF-8 conversion. %p is MSVC style
+// everywhere: all the digits, upper case, no 0x (0000000000001234, not 0x1234).
+class FormatWriter
 {
 public:
-    Scanner(const char* text) : ptr(text), line(text) {}
+    virtual void Put(const char* str, size_t len) = 0;
 
-    bool If(const String& str);
-    bool IfChar(char c);
-    bool Char(char c);
-    int64 Decimal(int* digits = nullptr);
-    String QuotedString();
-
-    bool operator!() const { return errors.Len() > 0; }
+    // returns the number of chars put
+    size_t Format(const char* format, va_list args);
+};
 
-    void Error(const String& err);
-    const Array<String>& Errors() const { return errors; }
+// append to a StringBuilder. Returns the number of chars appended
+CHECK_FORMAT(2, 3) size_t FormatTo(StringBuilder& sb, FORMAT_STRING const char* format, ...);
+size_t VFormatTo(StringBuilder& sb, const char* format, va_list args);
 
-private:
-    const char* ptr;
-    const char* line;
-    int ln = 0;
-    Array<String> errors;
-    char buffer[1024] = {};
-    int bfill = 0;
-
-    void Skip();
-    void AddChar(char c, String& out);
-};
+// into a fixed buffer, always zero terminated. Like snprintf, returns the length
+// the whole thing would have had, so >= dest.Len() means it got cut off
+CHECK_FORMAT(2, 3) size_t FormatTo(Span<char> dest, FORMAT_STRING const char* format, ...);
+size_t VFormatTo(Span<char> dest, const char* format, va_list args);